@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "../src/vdifparse_utils.h"
+#include "../vdifparse.h"
+
+#define MiB (1 << 20)
+#define READ_CHUNK_BYTES MiB
+#define DECODE_BLOCK_SAMPLES (1 << 16)
+#define HEADER_BATCH_FRAMES 4096
+
+typedef struct BenchConfig {
+    enum DataFormat format;
+    unsigned int bits;
+    unsigned long channels;
+    enum DataType type;
+    unsigned int payload_bytes;
+} BenchConfig;
+
+typedef struct BenchResult {
+    unsigned long long bytes;
+    unsigned long long samples;
+    double seconds;
+} BenchResult;
+
+static const char* label = "default";
+static unsigned long dataset_bytes = 16 * MiB;
+static const char* bench_dir = NULL;
+
+// MARK: synthetic data
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static inline uint64_t next_random() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static unsigned int header_bytes(BenchConfig config) {
+    return (config.format == CODIF) ? 64 : 32;
+}
+
+static void write_header(BenchConfig config, uint8_t* frame, unsigned long frame_number) {
+    unsigned long frames_per_second = 1000;
+    memset(frame, 0, header_bytes(config));
+    if (config.format == CODIF) {
+        CODIFHeader* header = (CODIFHeader*)frame;
+        header->frame_number = frame_number % frames_per_second;
+        header->seconds_from_epoch = 1000 + frame_number / frames_per_second;
+        header->reference_epoch = 4;
+        header->bits_per_sample = config.bits;
+        header->data_type = config.type;
+        header->sample_representation = (config.bits == 32) ? 2 : 0; // 32-bit samples are floats
+        header->codif_version_number = 1;
+        header->protocol_field = CODIF_VERSION;
+        header->station_id = 0x4142;
+        header->num_channels = config.channels;
+        unsigned long block_bits = config.channels * config.bits * (config.type + 1);
+        header->sample_block_length = (block_bits + 63) / 64;
+        header->data_array_length = config.payload_bytes / 8;
+        uint32_t synch_pattern = CODIF_SYNCH_PATTERN;
+        memcpy(&frame[sizeof(CODIFHeader)], &synch_pattern, sizeof(uint32_t));
+    } else {
+        VDIFHeader* header = (VDIFHeader*)frame;
+        header->seconds_from_epoch = 1000 + frame_number / frames_per_second;
+        header->frame_number = frame_number % frames_per_second;
+        header->reference_epoch = 40;
+        header->frame_length = (config.payload_bytes + header_bytes(config)) / 8;
+        header->log2_num_channels = __builtin_ctzl(config.channels);
+        header->station_id = 0x4142;
+        header->bits_per_sample = config.bits - 1;
+        header->data_type = config.type;
+    }
+}
+
+static uint8_t* make_dataset(BenchConfig config, unsigned long* num_bytes) {
+    unsigned long frame_bytes = header_bytes(config) + config.payload_bytes;
+    unsigned long num_frames = dataset_bytes / frame_bytes;
+    *num_bytes = num_frames * frame_bytes;
+    uint8_t* bytes = malloc(*num_bytes);
+    for (unsigned long i = 0; i < num_frames; i++) {
+        uint8_t* frame = &bytes[i * frame_bytes];
+        write_header(config, frame, i);
+        uint64_t* payload = (uint64_t*)&frame[header_bytes(config)];
+        for (unsigned long j = 0; j < config.payload_bytes / 8; j++) {
+            payload[j] = next_random();
+        }
+    }
+    return bytes;
+}
+
+// MARK: timing
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static DataStream* open_medium(const char* medium, const char* file_path, const uint8_t* bytes, unsigned long num_bytes) {
+    if (strcmp(medium, "memory") == 0) {
+        return open_memory(bytes, num_bytes);
+    }
+    DataStream* ds = open_file(file_path);
+    if (strcmp(medium, "hugepages") == 0) { set_huge_pages(ds, 1); }
+    if (strcmp(medium, "crc32c") == 0) { set_checksums(ds, 1); }
+    return ds;
+}
+
+static BenchResult bench_read(const char* medium, const char* file_path, const uint8_t* bytes, unsigned long num_bytes) {
+    BenchResult result = { 0 };
+    uint8_t* chunk = malloc(READ_CHUNK_BYTES);
+    double start = now_seconds();
+    FILE* file_handle = (strcmp(medium, "memory") == 0) ?
+        fmemopen((void*)bytes, num_bytes, "rb") : fopen(file_path, "rb");
+    size_t chunk_bytes;
+    while ((chunk_bytes = fread(chunk, 1, READ_CHUNK_BYTES, file_handle)) > 0) {
+        result.bytes += chunk_bytes;
+    }
+    fclose(file_handle);
+    result.seconds = now_seconds() - start;
+    free(chunk);
+    return result;
+}
+
+static BenchResult bench_scan(const char* medium, const char* file_path, const uint8_t* bytes, unsigned long num_bytes) {
+    BenchResult result = { 0 };
+    double start = now_seconds();
+    DataStream* ds = open_medium(medium, file_path, bytes, num_bytes);
+    const DataFrame* df;
+    uint64_t checksum = 0;
+    while (next_frame(ds, &df) == SUCCESS) {
+        checksum += get_unix_seconds(*df) + get_frame_number(*df) + get_thread_id(*df);
+        result.bytes += get_frame_length(*df);
+        result.samples += get_num_samples(*df) * get_num_channels(*df);
+        release_frame(ds, df);
+    }
+    close_stream(ds);
+    result.seconds = now_seconds() - start;
+    if (checksum == 0) { result.samples = 0; } // keep the loop honest
+    return result;
+}
+
+static BenchResult bench_headers(const char* medium, const char* file_path, const uint8_t* bytes, unsigned long num_bytes) {
+    BenchResult result = { 0 };
+    double start = now_seconds();
+    DataStream* ds = open_medium(medium, file_path, bytes, num_bytes);
+    HeaderBatch headers = init_header_batch(HEADER_BATCH_FRAMES);
+    uint64_t checksum = 0;
+    int status = SUCCESS;
+    while (status == SUCCESS) {
+        headers.num_headers = 0;
+        status = scan_headers(ds, &headers);
+        for (unsigned long i = 0; i < headers.num_headers; i++) {
+            checksum += headers.seconds_from_epoch[i] + headers.frame_number[i] + headers.thread_id[i];
+            result.bytes += headers.frame_length[i];
+        }
+    }
+    free_header_batch(&headers);
+    close_stream(ds);
+    result.seconds = now_seconds() - start;
+    if (checksum == 0) { result.bytes = 0; } // keep the loop honest
+    return result;
+}
+
+static BenchResult bench_quality(const char* medium, const char* file_path, const uint8_t* bytes, unsigned long num_bytes) {
+    BenchResult result = { 0 };
+    double start = now_seconds();
+    DataStream* ds = open_medium(medium, file_path, bytes, num_bytes);
+    QualityMap map = init_quality_map();
+    // the whole file is read, though only file streams can be scanned
+    if (scan_quality(ds, &map) == SUCCESS && map.num_seconds > 0) { result.bytes = num_bytes; }
+    free_quality_map(&map);
+    close_stream(ds);
+    result.seconds = now_seconds() - start;
+    return result;
+}
+
+static BenchResult bench_decode(const char* medium, const char* file_path, const uint8_t* bytes, unsigned long num_bytes) {
+    BenchResult result = { num_bytes };
+    double start = now_seconds();
+    DataStream* ds = open_medium(medium, file_path, bytes, num_bytes);
+    float** out = NULL;
+    DecodeMonitor statistics = { 0 };
+    int status = SUCCESS;
+    while (status == SUCCESS) {
+        status = decode_samples(ds, DECODE_BLOCK_SAMPLES, &out, &statistics);
+    }
+    result.seconds = now_seconds() - start;
+    for (unsigned long i = 0; i < statistics.decoded_channels; i++) {
+        result.samples += statistics.channels[i].num_decoded_samples;
+        free(out[i]);
+    }
+    free(out);
+    free(statistics.channels);
+    close_stream(ds);
+    return result;
+}
+
+// MARK: reporting
+
+static void report(BenchConfig config, const char* medium, const char* stage, BenchResult result) {
+    double seconds = (result.seconds > 0) ? result.seconds : 1e-9;
+    fprintf(stdout, "%s,%s,%s,%s,%u,%lu,%s,%u,%llu,%llu,%.6f,%.3f,%.3f\n", label,
+        string_for_data_format(config.format), medium, stage, config.bits, config.channels,
+        string_for_data_type(config.type), config.payload_bytes, result.bytes, result.samples,
+        result.seconds, result.bytes / seconds / 1e9, result.samples / seconds / 1e6);
+    fflush(stdout);
+}
+
+static void run_config(BenchConfig config) {
+    unsigned long num_bytes;
+    uint8_t* bytes = make_dataset(config, &num_bytes);
+    char file_path[512];
+    snprintf(file_path, sizeof(file_path), "%s/bench_synth_scan001_%s.%s", bench_dir,
+        label, (config.format == CODIF) ? "codif" : "vdif");
+    FILE* file_handle = fopen(file_path, "wb");
+    int has_file = (file_handle != NULL);
+    if (has_file) {
+        fwrite(bytes, 1, num_bytes, file_handle);
+        fclose(file_handle);
+    }
+    const char* media[2] = { "memory", "tmpfs" };
+    for (int i = 0; i < 2; i++) {
+        if (i == 1 && !has_file) { continue; }
+        report(config, media[i], "read", bench_read(media[i], file_path, bytes, num_bytes));
+        report(config, media[i], "scan", bench_scan(media[i], file_path, bytes, num_bytes));
+        report(config, media[i], "headers", bench_headers(media[i], file_path, bytes, num_bytes));
+        report(config, media[i], "quality", bench_quality(media[i], file_path, bytes, num_bytes));
+        report(config, media[i], "decode", bench_decode(media[i], file_path, bytes, num_bytes));
+    }
+    // the tmpfs file again, with frames and outputs in huge pages, and with
+    // frames checksummed as they are read
+    if (has_file) {
+        report(config, "hugepages", "decode", bench_decode("hugepages", file_path, bytes, num_bytes));
+        report(config, "crc32c", "scan", bench_scan("crc32c", file_path, bytes, num_bytes));
+    }
+    // and decoded straight from a gzip archive of the same file
+    char gzip_path[520];
+    snprintf(gzip_path, sizeof(gzip_path), "%s.gz", file_path);
+    gzFile gzip_handle = has_file ? gzopen(gzip_path, "wb1") : NULL;
+    if (gzip_handle != NULL) {
+        gzwrite(gzip_handle, bytes, num_bytes);
+        gzclose(gzip_handle);
+        report(config, "gzip", "decode", bench_decode("gzip", gzip_path, bytes, num_bytes));
+        remove(gzip_path);
+    }
+    if (has_file) { remove(file_path); }
+    free(bytes);
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-l label] [-m dataset MiB] [-d tmpfs directory]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) { usage(argv[0]); }
+        if (strcmp(argv[i], "-l") == 0) {
+            label = argv[++i];
+        } else if (strcmp(argv[i], "-m") == 0) {
+            dataset_bytes = strtoul(argv[++i], NULL, 10) * MiB;
+        } else if (strcmp(argv[i], "-d") == 0) {
+            bench_dir = argv[++i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (bench_dir == NULL) {
+        FILE* probe = fopen("/dev/shm/.vdifparse_bench", "wb");
+        bench_dir = (probe != NULL) ? "/dev/shm" : "/tmp";
+        if (probe != NULL) {
+            fclose(probe);
+            remove("/dev/shm/.vdifparse_bench");
+        }
+    }
+
+    const enum DataFormat formats[2] = { VDIF, CODIF };
+    const unsigned int bits[5] = { 1, 2, 4, 8, 16 };
+    const unsigned long channels[3] = { 1, 4, 16 };
+    const enum DataType types[2] = { RealData, ComplexData };
+    const unsigned int payload_bytes[2] = { 1024, 8192 };
+
+    fprintf(stdout, "label,format,medium,stage,bits,channels,data_type,payload_bytes,"
+        "bytes,samples,seconds,gbytes_per_s,msamples_per_s\n");
+    for (int f = 0; f < 2; f++) {
+        for (int b = 0; b < 5; b++) {
+            for (int c = 0; c < 3; c++) {
+                for (int t = 0; t < 2; t++) {
+                    for (int p = 0; p < 2; p++) {
+                        BenchConfig config = { formats[f], bits[b], channels[c], types[t], payload_bytes[p] };
+                        run_config(config);
+                    }
+                }
+            }
+        }
+    }
+    // and CODIF's float samples, which need copying rather than decoding
+    for (int c = 0; c < 3; c++) {
+        for (int t = 0; t < 2; t++) {
+            for (int p = 0; p < 2; p++) {
+                BenchConfig config = { CODIF, 32, channels[c], types[t], payload_bytes[p] };
+                run_config(config);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,164 @@
+// vdifparse_affinity.c - provides functions to pin threads to a set of CPUs
+// and to place buffers in the memory of those CPUs' NUMA nodes.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+
+#define _GNU_SOURCE // for cpu_set_t and pthread_setaffinity_np on Linux
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <dirent.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+#include "vdifparse_affinity.h"
+
+// memory policies, as in numaif.h, which is left out so as not to need libnuma
+#define MPOL_PREFERRED 1
+#define MPOL_INTERLEAVE 3
+#define MPOL_MF_MOVE (1 << 1)
+#define MAX_NODES 64
+
+// Threads started by the library for a stream are pinned as they start, so 
+// that the frames they allocate are first touched (and so placed) on their 
+// own node. Buffers allocated up front, before any thread has touched them, 
+// are bound to the node explicitly instead. Elsewhere than Linux the list is
+// still checked, but threads and buffers are left where the system puts them.
+
+#ifdef __linux__
+#define MAX_CPUS CPU_SETSIZE
+
+struct CpuAffinity {
+    cpu_set_t cpus;
+    unsigned long node_mask; // nodes of the CPUs, one bit each
+};
+#else
+#define MAX_CPUS 1024
+
+struct CpuAffinity {
+    unsigned int num_cpus;
+};
+#endif
+
+// MARK: parsing
+
+#ifdef __linux__
+static void clear_cpus(CpuAffinity* affinity) { CPU_ZERO(&affinity->cpus); }
+static void add_cpu(CpuAffinity* affinity, long cpu) { CPU_SET(cpu, &affinity->cpus); }
+static int count_cpus(const CpuAffinity* affinity) { return CPU_COUNT(&affinity->cpus); }
+
+static unsigned long get_node_mask(const cpu_set_t* cpus) {
+    unsigned long node_mask = 0;
+    char directory_path[64];
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, cpus)) { continue; }
+        // each CPU's directory links to its node, as node<N>
+        snprintf(directory_path, sizeof(directory_path), "/sys/devices/system/cpu/cpu%d", cpu);
+        DIR* directory = opendir(directory_path);
+        if (directory == NULL) { continue; }
+        struct dirent* entry;
+        while ((entry = readdir(directory)) != NULL) {
+            unsigned int node;
+            if (sscanf(entry->d_name, "node%u", &node) == 1 && node < MAX_NODES) {
+                node_mask |= 1UL << node;
+            }
+        }
+        closedir(directory);
+    }
+    return node_mask;
+}
+#else
+static void clear_cpus(CpuAffinity* affinity) { affinity->num_cpus = 0; }
+static void add_cpu(CpuAffinity* affinity, long cpu) { (void)cpu; affinity->num_cpus++; }
+static int count_cpus(const CpuAffinity* affinity) { return affinity->num_cpus; }
+#endif
+
+int init_affinity(const char* cpu_list, CpuAffinity** out) {
+    *out = NULL;
+    CpuAffinity* affinity = calloc(1, sizeof(CpuAffinity));
+    if (affinity == NULL) { return FAILED_MALLOC; }
+    clear_cpus(affinity);
+    long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    // a comma-separated list of CPUs and inclusive ranges of them
+    const char* cursor = cpu_list;
+    while (cursor != NULL && *cursor != '\0') {
+        char* end;
+        long first = strtol(cursor, &end, 10);
+        long last = first;
+        if (end == cursor) { break; }
+        if (*end == '-') {
+            cursor = end + 1;
+            last = strtol(cursor, &end, 10);
+            if (end == cursor) { break; }
+        }
+        if (first < 0 || last < first || last >= num_cpus || last >= MAX_CPUS) { break; }
+        for (long cpu = first; cpu <= last; cpu++) {
+            add_cpu(affinity, cpu);
+        }
+        cursor = (*end == ',') ? end + 1 : end;
+        if (*end != ',' && *end != '\0') { break; }
+    }
+    if (cursor == NULL || *cursor != '\0' || count_cpus(affinity) == 0) {
+        free(affinity);
+        return BAD_CPU_LIST;
+    }
+    #ifdef __linux__
+    affinity->node_mask = get_node_mask(&affinity->cpus);
+    #endif
+    *out = affinity;
+    return SUCCESS;
+}
+
+void free_affinity(CpuAffinity* affinity) {
+    free(affinity);
+}
+
+// MARK: placement
+
+int pin_thread(pthread_t thread, const CpuAffinity* affinity) {
+    if (affinity == NULL) { return SUCCESS; }
+    #ifdef __linux__
+    return (pthread_setaffinity_np(thread, sizeof(cpu_set_t), &affinity->cpus) == 0) ? SUCCESS : BAD_CPU_LIST;
+    #else
+    (void)thread;
+    return SUCCESS;
+    #endif
+}
+
+void bind_to_nodes(void* bytes, size_t num_bytes, const CpuAffinity* affinity) {
+    #ifdef __linux__
+    if (affinity == NULL || affinity->node_mask == 0) { return; }
+    // only whole pages can be bound, so leave any partial pages at either end
+    uintptr_t page_bytes = sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)bytes + page_bytes - 1) & ~(page_bytes - 1);
+    uintptr_t end = ((uintptr_t)bytes + num_bytes) & ~(page_bytes - 1);
+    if (end <= start) { return; }
+    // prefer a single node, or spread pages evenly over several
+    int is_single_node = (affinity->node_mask & (affinity->node_mask - 1)) == 0;
+    unsigned long node_mask = affinity->node_mask;
+    // any pages already touched elsewhere are moved; a failure only costs locality
+    syscall(SYS_mbind, start, end - start, is_single_node ? MPOL_PREFERRED : MPOL_INTERLEAVE, &node_mask,
+        MAX_NODES + 1, MPOL_MF_MOVE);
+    #else
+    (void)bytes;
+    (void)num_bytes;
+    (void)affinity;
+    #endif
+}
@@ -0,0 +1,32 @@
+// vdifparse_affinity.h - provides functions to pin threads to a set of CPUs
+// and to place buffers in the memory of those CPUs' NUMA nodes.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+#ifndef VDIFPARSE_AFFINITY_H
+#define VDIFPARSE_AFFINITY_H
+
+#include <pthread.h>
+
+#include "vdifparse_types.h"
+
+// a set of CPUs, as parsed from a list like "0-7,16-23", and their nodes
+typedef struct CpuAffinity CpuAffinity;
+
+int init_affinity(const char* cpu_list, CpuAffinity** affinity);
+void free_affinity(CpuAffinity* affinity);
+int pin_thread(pthread_t thread, const CpuAffinity* affinity);
+void bind_to_nodes(void* bytes, size_t num_bytes, const CpuAffinity* affinity);
+
+#endif // VDIFPARSE_AFFINITY_H
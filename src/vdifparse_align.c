@@ -0,0 +1,243 @@
+// vdifparse_align.c - provides functions to read several data streams in
+// lockstep from a common start time, each decoded ahead on its own thread.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <string.h>
+#include <pthread.h>
+
+#include "vdifparse_align.h"
+#include "vdifparse_affinity.h"
+#include "vdifparse_api.h"
+#include "vdifparse_stream.h"
+
+#define PREFETCH_BLOCKS 4
+
+// Each stream has a thread of its own that seeks to the common start and then
+// decodes blocks into a small ring of slots, so that a stream held up by a
+// slow disk only holds up the reader once its slots have all been used. The
+// reader hands out the next slot of every stream together, and gives them back
+// to their threads when it asks for the block after.
+
+typedef struct StreamPrefetch {
+    AlignedReader* reader;
+    DataStream* ds;
+    enum GapPolicy gap_policy; // the stream's own, given back when the reader is freed
+    pthread_t thread;
+    int is_started;
+    float** samples[PREFETCH_BLOCKS];
+    DecodeMonitor statistics[PREFETCH_BLOCKS];
+    int status[PREFETCH_BLOCKS];
+    unsigned long num_decoded_blocks;
+    unsigned long num_taken_blocks;
+} StreamPrefetch;
+
+struct AlignedReader {
+    StreamPrefetch* streams;
+    unsigned int num_streams;
+    unsigned long block_samples;
+    Timestamp start_time;
+    uint64_t samples_per_second;
+    unsigned long num_read_blocks;
+    int is_block_out; // the last block read is still in the reader's hands
+    int is_stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    // what each block read points to
+    float*** block_samples_out;
+    const DecodeMonitor** block_statistics;
+};
+
+// MARK: start time
+
+// finds when a stream's next sample is and how often they come, without
+// consuming anything from it
+static int peek_stream(DataStream* ds, Timestamp* time, uint64_t* samples_per_second) {
+    DataFrame* df;
+    int status = get_next_buffer_frame(ds, &df);
+    if (status != SUCCESS) { return status; }
+    ds->num_processed_frames--;
+    *samples_per_second = (uint64_t)get_frames_per_second(ds, *df) * get_num_samples(*df);
+    *time = get_sample_timestamp(ds, *df, ds->frame_cursor);
+    return (*samples_per_second == 0) ? UNKNOWN_DATA_RATE : SUCCESS;
+}
+
+// MARK: prefetch threads
+
+static void reset_monitor(DecodeMonitor* statistics) {
+    // keep the channel counters, which decoding would otherwise allocate anew
+    DecodeChannelMonitor* channels = statistics->channels;
+    unsigned long num_channels = statistics->decoded_channels;
+    if (channels != NULL) { memset(channels, 0, num_channels * sizeof(DecodeChannelMonitor)); }
+    *statistics = (DecodeMonitor){ num_channels, channels };
+}
+
+static void* prefetch_stream(void* arg) {
+    StreamPrefetch* stream = (StreamPrefetch*)arg;
+    AlignedReader* reader = stream->reader;
+    // pinned before decoding anything, so the frames it allocates are local
+    pin_thread(pthread_self(), stream->ds->affinity);
+    int status = seek_to_timestamp(stream->ds, reader->start_time);
+    while (1) {
+        pthread_mutex_lock(&reader->lock);
+        while (!reader->is_stopping && stream->num_decoded_blocks - stream->num_taken_blocks == PREFETCH_BLOCKS) {
+            pthread_cond_wait(&reader->changed, &reader->lock);
+        }
+        int is_stopping = reader->is_stopping;
+        unsigned int slot = stream->num_decoded_blocks % PREFETCH_BLOCKS;
+        pthread_mutex_unlock(&reader->lock);
+        if (is_stopping) { break; }
+
+        // the slot is free until it is published, so decode into it unlocked
+        if (status == SUCCESS) {
+            reset_monitor(&stream->statistics[slot]);
+            status = decode_samples(stream->ds, reader->block_samples, &stream->samples[slot], &stream->statistics[slot]);
+        }
+        pthread_mutex_lock(&reader->lock);
+        stream->status[slot] = status;
+        stream->num_decoded_blocks++;
+        pthread_cond_broadcast(&reader->changed);
+        pthread_mutex_unlock(&reader->lock);
+        // a short or failed block ends the stream, and so the lockstep
+        if (status != SUCCESS) { break; }
+    }
+    return NULL;
+}
+
+// MARK: reader lifecycle
+
+int init_aligned_reader(DataStream** streams, unsigned int num_streams, unsigned long block_samples,
+        AlignedReader** out) {
+    *out = NULL;
+    if (num_streams == 0 || block_samples == 0) { return FAILURE; }
+    // start from the latest of the streams' first samples, so all have data
+    Timestamp start_time = { 0 };
+    uint64_t samples_per_second = 0;
+    for (unsigned int i = 0; i < num_streams; i++) {
+        Timestamp stream_time;
+        uint64_t stream_rate;
+        int status = peek_stream(streams[i], &stream_time, &stream_rate);
+        if (status != SUCCESS) { return status; }
+        if (i > 0 && stream_rate != samples_per_second) { return MISMATCHED_SAMPLE_RATES; }
+        if (i == 0 || get_nanos_between(start_time, stream_time) > 0) { start_time = stream_time; }
+        samples_per_second = stream_rate;
+    }
+
+    AlignedReader* reader = calloc(1, sizeof(AlignedReader));
+    if (reader == NULL) { return FAILED_MALLOC; }
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_cond_init(&reader->changed, NULL);
+    reader->num_streams = num_streams;
+    reader->block_samples = block_samples;
+    reader->start_time = start_time;
+    reader->samples_per_second = samples_per_second;
+    reader->streams = calloc(num_streams, sizeof(StreamPrefetch));
+    reader->block_samples_out = calloc(num_streams, sizeof(float**));
+    reader->block_statistics = calloc(num_streams, sizeof(DecodeMonitor*));
+    if (reader->streams == NULL || reader->block_samples_out == NULL || reader->block_statistics == NULL) {
+        free_aligned_reader(reader);
+        return FAILED_MALLOC;
+    }
+    for (unsigned int i = 0; i < num_streams; i++) {
+        StreamPrefetch* stream = &reader->streams[i];
+        stream->reader = reader;
+        stream->ds = streams[i];
+        // lost frames must be filled in, or the stream would run ahead of the others
+        stream->gap_policy = streams[i]->gap_policy;
+        streams[i]->gap_policy = InsertInvalid;
+    }
+    for (unsigned int i = 0; i < num_streams; i++) {
+        StreamPrefetch* stream = &reader->streams[i];
+        if (pthread_create(&stream->thread, NULL, prefetch_stream, stream) != 0) {
+            free_aligned_reader(reader);
+            return FAILURE;
+        }
+        stream->is_started = 1;
+    }
+    *out = reader;
+    return SUCCESS;
+}
+
+int read_aligned_block(AlignedReader* reader, AlignedBlock* block) {
+    pthread_mutex_lock(&reader->lock);
+    // the block read last time is done with, so its slots can be refilled
+    if (reader->is_block_out) {
+        for (unsigned int i = 0; i < reader->num_streams; i++) {
+            reader->streams[i].num_taken_blocks++;
+        }
+        reader->is_block_out = 0;
+        pthread_cond_broadcast(&reader->changed);
+    }
+    int status = SUCCESS;
+    for (unsigned int i = 0; i < reader->num_streams; i++) {
+        StreamPrefetch* stream = &reader->streams[i];
+        while (stream->num_decoded_blocks == stream->num_taken_blocks) {
+            pthread_cond_wait(&reader->changed, &reader->lock);
+        }
+        unsigned int slot = stream->num_taken_blocks % PREFETCH_BLOCKS;
+        if (stream->status[slot] != SUCCESS && status == SUCCESS) { status = stream->status[slot]; }
+        reader->block_samples_out[i] = stream->samples[slot];
+        reader->block_statistics[i] = &stream->statistics[slot];
+    }
+    pthread_mutex_unlock(&reader->lock);
+    // once any stream runs out there is nothing left to read in lockstep
+    if (status != SUCCESS) { return status; }
+
+    uint64_t samples_ahead = (uint64_t)reader->num_read_blocks * reader->block_samples;
+    uint64_t nanoseconds = reader->start_time.nanoseconds
+        + (samples_ahead % reader->samples_per_second) * NANOS_PER_SECOND / reader->samples_per_second;
+    block->start_time.seconds = reader->start_time.seconds
+        + (int64_t)(samples_ahead / reader->samples_per_second + nanoseconds / NANOS_PER_SECOND);
+    block->start_time.nanoseconds = nanoseconds % NANOS_PER_SECOND;
+    block->num_streams = reader->num_streams;
+    block->num_samples = reader->block_samples;
+    block->samples = reader->block_samples_out;
+    block->statistics = reader->block_statistics;
+    reader->num_read_blocks++;
+    reader->is_block_out = 1;
+    return SUCCESS;
+}
+
+Timestamp get_reader_start(const AlignedReader* reader) {
+    return reader->start_time;
+}
+
+void free_aligned_reader(AlignedReader* reader) {
+    if (reader == NULL) { return; }
+    pthread_mutex_lock(&reader->lock);
+    reader->is_stopping = 1;
+    pthread_cond_broadcast(&reader->changed);
+    pthread_mutex_unlock(&reader->lock);
+    for (unsigned int i = 0; reader->streams != NULL && i < reader->num_streams; i++) {
+        StreamPrefetch* stream = &reader->streams[i];
+        if (stream->is_started) { pthread_join(stream->thread, NULL); }
+        for (unsigned int j = 0; j < PREFETCH_BLOCKS; j++) {
+            if (stream->samples[j] != NULL) {
+                for (unsigned long k = 0; k < stream->ds->num_selected_channels; k++) {
+                    free(stream->samples[j][k]);
+                }
+                free(stream->samples[j]);
+            }
+            free(stream->statistics[j].channels);
+        }
+        if (stream->ds != NULL) { stream->ds->gap_policy = stream->gap_policy; }
+    }
+    pthread_mutex_destroy(&reader->lock);
+    pthread_cond_destroy(&reader->changed);
+    free(reader->streams);
+    free(reader->block_samples_out);
+    free(reader->block_statistics);
+    free(reader);
+}
@@ -0,0 +1,28 @@
+// vdifparse_align.h - provides functions to read several data streams in
+// lockstep from a common start time, each decoded ahead on its own thread.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+#ifndef VDIFPARSE_ALIGN_H
+#define VDIFPARSE_ALIGN_H
+
+#include "vdifparse_types.h"
+
+int init_aligned_reader(DataStream** streams, unsigned int num_streams, unsigned long block_samples,
+    AlignedReader** reader);
+int read_aligned_block(AlignedReader* reader, AlignedBlock* block);
+Timestamp get_reader_start(const AlignedReader* reader);
+void free_aligned_reader(AlignedReader* reader);
+
+#endif // VDIFPARSE_ALIGN_H
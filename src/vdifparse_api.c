@@ -15,11 +15,34 @@
 // You should have received a copy of the GNU General Public License along with
 // this program. If not, see <http://www.gnu.org/licenses/>.
 
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
 #include "vdifparse_api.h"
+#include "vdifparse_affinity.h"
+#include "vdifparse_align.h"
+#include "vdifparse_batch.h"
+#include "vdifparse_capture.h"
+#include "vdifparse_checksum.h"
 #include "vdifparse_decode.h"
+#include "vdifparse_headers.h"
 #include "vdifparse_input.h"
+#include "vdifparse_memory.h"
+#include "vdifparse_metrics.h"
+#include "vdifparse_output.h"
+#include "vdifparse_quality.h"
+#include "vdifparse_sequence.h"
+#include "vdifparse_sink.h"
+#include "vdifparse_shm.h"
+#include "vdifparse_stream.h"
 #include "vdifparse_utils.h"
 
+// frames whose headers and payload patterns are gathered at a time when 
+// scanning for quality
+#define QUALITY_BATCH_FRAMES 65536
+
 // MARK: deal with error responses
 
 char* get_error_message(int error_code) {
@@ -34,6 +57,14 @@ char* get_error_message(int error_code) {
         case BAD_FORMAT_DESIGNATOR: return "Format designator did not follow ([a-zA-Z]+[_-])?\\d+-\\d+-\\d+(-\\d+)? expected format.";
         case BAD_FILE_NAME: return "File name did not follow expected <experiment>_<station>_<scan>[_<aux>...].<extension> format.";
         case FAILED_MALLOC: return "Could not allocate required memory.";
+        case FAILED_TO_OPEN_SOCKET: return "Could not open or bind network socket.";
+        case FRAMES_STILL_BORROWED: return "Frames handed out must all be released before more can be buffered.";
+        case UNKNOWN_DATA_RATE: return "Stream data rate is unknown, so times within a second cannot be found. Set a format designator.";
+        case MISMATCHED_SAMPLE_RATES: return "Streams to be read in lockstep must all have the same sample rate.";
+        case FAILED_TO_WRITE_FILE: return "Could not write to output file.";
+        case BAD_CPU_LIST: return "CPU list could not be parsed, or names CPUs that are not available.";
+        case RING_OVERRUN: return "Block was overwritten by the publisher before it was finished with.";
+        case MIXED_FORMATS: return "Files to be read as one stream must all be of the same format.";
         // TODO other types of errors...
         default: return "INVALID STATUS CODE";
     }
@@ -41,23 +72,123 @@ char* get_error_message(int error_code) {
 
 // MARK: initialise stream object
 
-DataStream open_file(const char* file_path) {
-    DataStream ds = init_stream(FileMode);
-    int status = peek_file(&ds, file_path);
+static DataStream* new_stream(enum InputMode mode) {
+    DataStream* ds = init_stream(mode);
+    if (ds == NULL) {
+        raise_exception("%s", get_error_message(FAILED_MALLOC));
+    }
+    return ds;
+}
+
+DataStream* open_file(const char* file_path) {
+    DataStream* ds = new_stream(FileMode);
+    int status = peek_file(ds, file_path);
     if (status != SUCCESS) {
-        raise_exception("file %s could not be opened.", file_path);
+        raise_exception("file %s could not be opened. %s", file_path, get_error_message(status));
     }
-    status = ingest_structured_filename(&ds, file_path);
+    status = ingest_structured_filename(ds, file_path);
     if (status != SUCCESS) {
         raise_warning("filename was not structured to specifications.");
     }
     return ds;
 }
 
+DataStream* open_files(const char** file_paths, unsigned int num_files) {
+    if (num_files == 0) {
+        raise_exception("no files were given to open.");
+    }
+    // take our own copies, ordered by scan then by first frame time
+    char** ordered_paths = malloc(num_files * sizeof(char*));
+    if (ordered_paths == NULL) {
+        raise_exception("%s", get_error_message(FAILED_MALLOC));
+    }
+    for (unsigned int i = 0; i < num_files; i++) {
+        ordered_paths[i] = strdup(file_paths[i]);
+    }
+    int status = order_files(ordered_paths, num_files);
+    if (status != SUCCESS) {
+        raise_exception("files could not be opened as one stream. %s", get_error_message(status));
+    }
+    DataStream* ds = open_file(ordered_paths[0]);
+    set_file_sequence(ds, ordered_paths, num_files);
+    return ds;
+}
+
+static int is_data_file(const char* file_name) {
+    const char* extension = strrchr(file_name, '.');
+    if (file_name[0] == '.' || extension == NULL) { return 0; }
+    // compressed files are named for what they hold, then how it was compressed
+    if (strcasecmp(extension, ".gz") == 0 || strcasecmp(extension, ".zst") == 0) {
+        const char* compression = extension;
+        for (extension = compression - 1; extension > file_name && *extension != '.'; extension--) {}
+        size_t length = compression - extension;
+        return (length == 5 && strncasecmp(extension, ".vdif", 5) == 0)
+            || (length == 6 && strncasecmp(extension, ".codif", 6) == 0);
+    }
+    return strcasecmp(extension, ".vdif") == 0 || strcasecmp(extension, ".codif") == 0;
+}
+
+DataStream* open_directory(const char* directory_path) {
+    DIR* directory = opendir(directory_path);
+    if (directory == NULL) {
+        raise_exception("directory %s could not be opened.", directory_path);
+    }
+    char** file_paths = NULL;
+    unsigned int num_files = 0;
+    struct dirent* entry;
+    while ((entry = readdir(directory)) != NULL) {
+        if (!is_data_file(entry->d_name)) { continue; }
+        char* file_path = malloc(strlen(directory_path) + strlen(entry->d_name) + 2);
+        sprintf(file_path, "%s/%s", directory_path, entry->d_name);
+        struct stat file_stat;
+        if (stat(file_path, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+            free(file_path);
+            continue;
+        }
+        file_paths = realloc(file_paths, (num_files + 1) * sizeof(char*));
+        file_paths[num_files] = file_path;
+        num_files++;
+    }
+    closedir(directory);
+    if (num_files == 0) {
+        raise_exception("directory %s contained no .vdif or .codif files (or compressed ones).", directory_path);
+    }
+    DataStream* ds = open_files((const char**)file_paths, num_files);
+    for (unsigned int i = 0; i < num_files; i++) {
+        free(file_paths[i]);
+    }
+    free(file_paths);
+    return ds;
+}
+
+DataStream* open_memory(const void* bytes, size_t num_bytes) {
+    DataStream* ds = new_stream(FileMode);
+    // reading from memory through a FILE* shares the whole file input path
+    FILE* file_handle = fmemopen((void*)bytes, num_bytes, "rb");
+    if (file_handle == NULL) {
+        raise_exception("memory buffer could not be opened. %s", get_error_message(FAILED_TO_OPEN_FILE));
+    }
+    int status = peek_file_handle(ds, file_handle);
+    if (status != SUCCESS) {
+        raise_exception("memory buffer could not be opened. %s", get_error_message(status));
+    }
+    return ds;
+}
 
-DataStream open_sink() {
+DataStream* open_sink() {
     // unfortunately nothing else can be known at this time
-    return init_stream(StreamMode);
+    return new_stream(StreamMode);
+}
+
+DataStream* open_udp(const char* address, unsigned int port, const CaptureOptions* options) {
+    DataStream* ds = new_stream(StreamMode);
+    // format is taken from the first frame to arrive
+    int status = open_capture(ds, address, port, (options != NULL) ? *options : init_capture_options());
+    if (status != SUCCESS) {
+        raise_exception("could not capture from %s:%u. %s", (address != NULL) ? address : "*", port,
+            get_error_message(status));
+    }
+    return ds;
 }
 
 // MARK: configure objects
@@ -70,56 +201,564 @@ int set_format_designator(DataStream* ds, const char* format_designator) {
     return status;
 }
 
+void set_gap_policy(DataStream* ds, enum GapPolicy policy) {
+    ds->gap_policy = policy;
+}
+
+void set_selected_channels(DataStream* ds, unsigned long num_channels) {
+    ds->num_selected_channels = num_channels;
+}
+
+int set_buffer_depth(DataStream* ds, unsigned int buffer_depth) {
+    // frames still waiting to be processed (or borrowed) would be lost
+    if (buffer_depth == 0 || ds->num_processed_frames < ds->num_buffered_frames 
+            || ds->is_frame_pending || ds->num_borrowed_frames > 0) {
+        return FAILURE;
+    }
+    if (ds->input.mode == StreamMode) {
+        release_packets(ds);
+        if (ds->input.stream->packet_pool != NULL) {
+            int status = resize_packet_pool(ds->input.stream, buffer_depth);
+            if (status != SUCCESS) { return status; }
+            bind_to_nodes(ds->input.stream->packet_pool, get_packet_pool_bytes(ds->input.stream), ds->affinity);
+        }
+    } else {
+        free_buffered_frames(ds);
+    }
+    DataFrame* frames = realloc(ds->frames, buffer_depth * sizeof(DataFrame));
+    if (frames == NULL) { return FAILED_MALLOC; }
+    ds->frames = frames;
+    ds->buffer_depth = buffer_depth;
+    return SUCCESS;
+}
+
+void set_metrics_dump(DataStream* ds, FILE* out, double interval_seconds) {
+    // metrics are printed from decode_samples, at most once per interval
+    ds->metrics_file = out;
+    ds->metrics_interval_nanos = (uint64_t)(interval_seconds * NANOS_PER_SECOND);
+    ds->last_metrics_nanos = get_monotonic_nanos();
+}
+
+int set_huge_pages(DataStream* ds, unsigned int use_huge_pages) {
+    // frames read from files are pooled in huge pages, which frames still 
+    // waiting to be processed (or borrowed) may be using
+    if (ds->num_processed_frames < ds->num_buffered_frames || ds->is_frame_pending || ds->num_borrowed_frames > 0) {
+        return FAILURE;
+    }
+    if (ds->input.mode == FileMode) {
+        free_buffered_frames(ds);
+        free_frame_pool(ds);
+    }
+    ds->use_huge_pages = use_huge_pages;
+    return SUCCESS;
+}
+
+int set_checksums(DataStream* ds, unsigned int use_checksums) {
+    // covers frames read from here on, so best set before the first is
+    if (ds->input.mode != FileMode && ds->input.stream->packet_pool == NULL) { return FAILURE; }
+    ds->use_checksums = use_checksums;
+    return SUCCESS;
+}
+
+int set_thread_affinity(DataStream* ds, const char* cpu_list) {
+    // a NULL list lets the stream's threads run anywhere again
+    CpuAffinity* affinity = NULL;
+    if (cpu_list != NULL) {
+        int status = init_affinity(cpu_list, &affinity);
+        if (status != SUCCESS) { return status; }
+    }
+    free_affinity(ds->affinity);
+    ds->affinity = affinity;
+    if (affinity == NULL) { return SUCCESS; }
+    // threads already running (and buffers already made) are moved over too
+    if (ds->input.mode == FileMode && ds->input.file->is_prefetching) {
+        pin_thread(ds->input.file->prefetch_thread, affinity);
+    } else if (ds->input.mode == StreamMode) {
+        bind_to_nodes(ds->input.stream->packet_pool, get_packet_pool_bytes(ds->input.stream), affinity);
+    }
+    return SUCCESS;
+}
+
+int pin_to_stream_cpus(const DataStream* ds) {
+    // for threads of the caller's own that decode the stream
+    return pin_thread(pthread_self(), ds->affinity);
+}
+
 // MARK: process data
 
-int init_decode_output(DataStream ds, unsigned long num_samples, float*** out, DecodeMonitor* statistics) {
-    float** new_out = malloc(ds.num_selected_channels * sizeof(float*));
+int init_decode_output(const DataStream* ds, unsigned long num_samples, float*** out) {
+    // complex samples are output as interleaved (I, Q) pairs
+    unsigned long num_values = num_samples * ((ds->data_type == ComplexData) ? 2 : 1);
+    float** new_out = malloc(ds->num_selected_channels * sizeof(float*));
     if (new_out == NULL) { return FAILED_MALLOC; }
-    for (long i = 0; i < ds.num_selected_channels; i++) {
-        new_out[i] = malloc(num_samples * sizeof(float));
+    for (long i = 0; i < ds->num_selected_channels; i++) {
+        // still freed with free(), so only ever transparent huge pages
+        new_out[i] = ds->use_huge_pages ? alloc_transparent_huge(num_values * sizeof(float)) :
+            malloc(num_values * sizeof(float));
         if (new_out[i] == NULL) { return FAILED_MALLOC; }
     }
     *out = new_out;
-    *statistics = init_monitor(ds.num_selected_channels);
     return SUCCESS;
 }
 
+// checks a newly fetched frame against its thread's sequence, noting any 
+// frames lost before it (unless it was already checked on an earlier call)
+static void check_frame_sequence(DataStream* ds, const DataFrame* df, DecodeMonitor* statistics) {
+    if (ds->is_frame_pending) {
+        ds->is_frame_pending = 0;
+        return;
+    }
+    ds->num_gap_frames = track_frame_sequence(ds, df, statistics);
+}
+
+// puts the frame just fetched back, to be fetched (but not checked) again 
+// on the next call
+static void hold_frame(DataStream* ds) {
+    ds->num_processed_frames--;
+    ds->is_frame_pending = 1;
+}
+
 int decode_samples(DataStream* ds, unsigned long num_samples, float*** out, DecodeMonitor* statistics) {
     // if samples to decode is 0, we have already succeeded
     if (num_samples < 1) { return SUCCESS; }
-    int status;
+    int status = SUCCESS;
+    // statistics are optional, but decoding needs somewhere to put them
+    DecodeMonitor local_statistics = { 0 };
+    if (statistics == NULL) { statistics = &local_statistics; }
+    unsigned long long discarded_bytes = ds->num_discarded_bytes;
+    unsigned long resyncs = ds->num_resyncs;
+    // a live stream only knows its channel layout once its first frame arrives
+    DataFrame* next_frame = NULL;
+    int has_frame = (get_next_buffer_frame(ds, &next_frame) == SUCCESS);
     // if output buffers are not set up yet, do that
     // and if that fails, return with the error arising from the attempt
-    if (*out == NULL || *out[0] == NULL || statistics == NULL) {
-        status = init_decode_output(*ds, num_samples, out, statistics);
+    if (*out == NULL) {
+        status = init_decode_output(ds, num_samples, out);
         if (status != SUCCESS) { return status; }
     }
+    if (statistics->channels == NULL) {
+        *statistics = init_monitor(ds->num_selected_channels);
+    }
     // otherwise we actually have to do work
     unsigned long decoded_samples = 0;
-    DataFrame* next_frame = malloc(sizeof(DataFrame));
-    int has_frame = (get_next_buffer_frame(ds, &next_frame) == SUCCESS);
+    if (has_frame) { check_frame_sequence(ds, next_frame, statistics); }
     while (has_frame && decoded_samples < num_samples) {
-        status = decode_frame(*ds, next_frame, num_samples - decoded_samples, out, statistics);
-        // TODO remove above
-        // status = decode_frame(*ds, next_frame, num_samples - decoded_samples, &out[decoded_samples], valid_samples);
-        if (status < SUCCESS) { return status; }
+        // lost frames are stood in for by the one shared invalid frame
+        int is_gap = (ds->num_gap_frames > 0);
+        const DataFrame* df = (is_gap) ? &ds->gap_frame : next_frame;
+        METRIC_START(decode_start);
+        status = decode_frame(ds, df, num_samples - decoded_samples, *out, decoded_samples, statistics);
+        METRIC_STOP(ds, decode_nanos, decode_start);
+        if (status < SUCCESS) { break; }
         decoded_samples += status; // otherwise response = samples decoded
-        has_frame = get_next_buffer_frame(ds, &next_frame); // get next_frame
+        ds->frame_cursor += status;
+        if (ds->frame_cursor < get_num_samples(*df)) {
+            // stopped mid-frame, so carry on from the cursor next time
+            hold_frame(ds);
+            break;
+        }
+        ds->frame_cursor = 0;
+        if (is_gap) {
+            ds->num_gap_frames--;
+            statistics->num_inserted_frames++;
+            // the frame after the gap is still to come
+            if (decoded_samples >= num_samples) { hold_frame(ds); }
+            continue;
+        }
+        METRIC_ADD(ds, num_decoded_frames, 1);
+        if (decoded_samples >= num_samples) { break; }
+        has_frame = (get_next_buffer_frame(ds, &next_frame) == SUCCESS); // get next_frame
+        if (has_frame) { check_frame_sequence(ds, next_frame, statistics); }
+    }
+    // bytes skipped while resynchronising are attributed to this decode
+    statistics->num_discarded_bytes += ds->num_discarded_bytes - discarded_bytes;
+    statistics->num_resyncs += ds->num_resyncs - resyncs;
+    statistics->metrics = ds->metrics;
+    free(local_statistics.channels);
+    if (ds->metrics_file != NULL) {
+        uint64_t now = get_monotonic_nanos();
+        if (now - ds->last_metrics_nanos >= ds->metrics_interval_nanos) {
+            print_metrics(ds->metrics, ds->metrics_file);
+            ds->last_metrics_nanos = now;
+        }
+    }
+    if (status < SUCCESS) { return status; }
+    if (decoded_samples < num_samples) {
+        return (ds->input.mode == FileMode) ? REACHED_END_OF_FILE : REACHED_END_OF_BUFFER;
+    }
+    return SUCCESS;
+}
+
+int next_frame(DataStream* ds, const DataFrame** frame) {
+    // the frames handed out live in the buffer, so it can't be refilled under them
+    if (ds->num_processed_frames >= ds->num_buffered_frames && ds->num_borrowed_frames > 0) {
+        *frame = NULL;
+        return FRAMES_STILL_BORROWED;
+    }
+    // a frame part-way through decoding is handed out whole
+    ds->frame_cursor = 0;
+    ds->is_frame_pending = 0;
+    DataFrame* df;
+    int status = get_next_buffer_frame(ds, &df);
+    *frame = df;
+    if (status == SUCCESS) { ds->num_borrowed_frames++; }
+    return status;
+}
+
+int release_frame(DataStream* ds, const DataFrame* frame) {
+    if (frame < ds->frames || frame >= &ds->frames[ds->num_buffered_frames] || ds->num_borrowed_frames == 0) {
+        return FAILURE;
     }
-    // TODO replace for StreamMode
-    if (decoded_samples < num_samples) { return REACHED_END_OF_FILE; }
+    ds->num_borrowed_frames--;
     return SUCCESS;
 }
 
-void close(DataStream* ds) {
+int for_each_frame(DataStream* ds, FrameCallback on_frame, void* context) {
+    const DataFrame* df;
+    int status;
+    while ((status = next_frame(ds, &df)) == SUCCESS) {
+        int callback_status = on_frame(context, df);
+        release_frame(ds, df);
+        if (callback_status != SUCCESS) { return callback_status; }
+    }
+    // running out of frames is the normal way to finish
+    return (status == REACHED_END_OF_FILE || status == REACHED_END_OF_BUFFER) ? SUCCESS : status;
+}
+
+int scan_headers(DataStream* ds, HeaderBatch* headers) {
+    if (ds->input.mode != FileMode || ds->signature.frame_length == 0) { return FAILURE; }
+    // headers are read from wherever the stream has got to, so any frames 
+    // buffered and not yet processed would be skipped over
+    if (ds->num_borrowed_frames > 0) { return FRAMES_STILL_BORROWED; }
+    if (ds->num_processed_frames < ds->num_buffered_frames || ds->is_frame_pending) { return FAILURE; }
+    return buffer_headers(ds, headers, NULL);
+}
+
+int scan_quality(DataStream* ds, QualityMap* map) {
+    // reads the rest of the stream (as scan_headers does), flagging frames that
+    // are invalid, missing, or have all-zero or constant payloads, by second
+    if (ds->input.mode != FileMode || ds->signature.frame_length == 0) { return FAILURE; }
+    if (ds->num_borrowed_frames > 0) { return FRAMES_STILL_BORROWED; }
+    if (ds->num_processed_frames < ds->num_buffered_frames || ds->is_frame_pending) { return FAILURE; }
+    HeaderBatch headers = init_header_batch(QUALITY_BATCH_FRAMES);
+    uint8_t* patterns = malloc(QUALITY_BATCH_FRAMES);
+    int status = (headers.capacity > 0 && patterns != NULL) ? SUCCESS : FAILED_MALLOC;
+    while (status == SUCCESS) {
+        headers.num_headers = 0;
+        status = buffer_headers(ds, &headers, patterns);
+        int map_status = add_quality_frames(ds, map, &headers, patterns);
+        if (map_status != SUCCESS) { status = map_status; }
+    }
+    free_header_batch(&headers);
+    free(patterns);
+    return (status == REACHED_END_OF_FILE) ? SUCCESS : status;
+}
+
+int decode_headers(enum DataFormat format, const void* bytes, unsigned long frame_length, 
+        unsigned long num_frames, HeaderBatch* headers) {
+    unsigned long header_length = (format == CODIF) ? sizeof(CODIFHeader) + CODIF_METADATA_BYTES :
+        (format == VDIF_LEGACY) ? sizeof(VDIFHeader) : sizeof(VDIFHeader) + VDIF_EXTENDED_DATA_BYTES;
+    if (format < VDIF || format > CODIF || frame_length < header_length) { return UNKNOWN_FORMAT; }
+    unsigned long first = headers->num_headers;
+    unsigned long num_decoded = unpack_headers(format, bytes, frame_length, num_frames, headers);
+    for (unsigned long i = 0; i < num_decoded; i++) {
+        headers->offsets[first + i] = i * frame_length;
+        headers->file_index[first + i] = 0;
+    }
+    return (num_decoded == num_frames) ? SUCCESS : REACHED_END_OF_BUFFER;
+}
+
+int seek_to_timestamp(DataStream* ds, Timestamp start) {
+    // frames are skipped by fetching them, so none can be out on loan
+    if (ds->num_borrowed_frames > 0) { return FRAMES_STILL_BORROWED; }
+    if (ds->data_rate == 0) { return UNKNOWN_DATA_RATE; }
+    // once everything buffered is used up, most of a file can be jumped over
+    if (ds->input.mode == FileMode && ds->signature.frame_length > 0 && !ds->is_frame_pending
+            && ds->num_processed_frames >= ds->num_buffered_frames) {
+        jump_to_time(ds, start);
+    }
+    // then walk frames to the one holding the start, and the sample within it
+    unsigned long long first_sample = ds->frame_cursor;
+    DataFrame* df;
+    int status;
+    while ((status = get_next_buffer_frame(ds, &df)) == SUCCESS) {
+        long long frames_per_second = get_frames_per_second(ds, *df);
+        unsigned long long frame_samples = get_num_samples(*df);
+        int64_t nanos_ahead = get_nanos_between(get_frame_timestamp(ds, *df), start);
+        unsigned long long sample = 0;
+        if (nanos_ahead >= (int64_t)NANOS_PER_SECOND) { first_sample = 0; continue; }
+        if (nanos_ahead > 0) {
+            // split into whole frames and the rest, so that nothing overflows
+            long long frames_scaled = nanos_ahead * frames_per_second;
+            if (frames_scaled >= (long long)NANOS_PER_SECOND) { first_sample = 0; continue; }
+            sample = (frames_scaled * frame_samples + NANOS_PER_SECOND - 1) / NANOS_PER_SECOND;
+        }
+        if (sample >= frame_samples) { first_sample = 0; continue; }
+        // put the frame back to be decoded from there, as the start of its
+        // thread's sequence, so that the frames skipped aren't counted as lost
+        ds->frame_cursor = (sample > first_sample) ? sample : first_sample;
+        ds->num_processed_frames--;
+        ds->is_frame_pending = 0;
+        ds->num_gap_frames = 0;
+        ds->num_sequences = 0;
+        return SUCCESS;
+    }
+    ds->frame_cursor = 0;
+    ds->is_frame_pending = 0;
+    return status;
+}
+
+int align_streams(DataStream** streams, unsigned int num_streams, unsigned long block_samples, 
+        AlignedReader** reader) {
+    return init_aligned_reader(streams, num_streams, block_samples, reader);
+}
+
+int read_aligned(AlignedReader* reader, AlignedBlock* block) {
+    return read_aligned_block(reader, block);
+}
+
+int decode_streams(DataStream** streams, StreamSink* sinks, unsigned int num_streams, 
+        unsigned long block_samples, unsigned int num_threads) {
+    // a thread count of 0 means one per available processor
+    return run_batch(streams, sinks, num_streams, block_samples, num_threads);
+}
+
+// MARK: inspect stream
+
+enum DataFormat get_stream_format(const DataStream* ds) { return ds->format; }
+enum GapPolicy get_gap_policy(const DataStream* ds) { return ds->gap_policy; }
+unsigned int get_stream_data_rate(const DataStream* ds) { return ds->data_rate; }
+unsigned int get_stream_num_channels(const DataStream* ds) { return ds->num_channels; }
+unsigned int get_stream_bits_per_sample(const DataStream* ds) { return ds->bits_per_sample; }
+enum DataType get_stream_data_type(const DataStream* ds) { return ds->data_type; }
+unsigned int get_stream_num_threads(const DataStream* ds) { return ds->num_threads; }
+unsigned int get_stream_header_length(const DataStream* ds) { return ds->signature.header_length; }
+unsigned long get_selected_channels(const DataStream* ds) { return ds->num_selected_channels; }
+unsigned int get_buffer_depth(const DataStream* ds) { return ds->buffer_depth; }
+unsigned long long get_discarded_bytes(const DataStream* ds) { return ds->num_discarded_bytes; }
+
+unsigned int get_capture_port(const DataStream* ds) {
+    return (ds->input.mode == StreamMode) ? ds->input.stream->port : 0;
+}
+
+const DataFrame* get_buffered_frame(const DataStream* ds, unsigned int index) {
+    return (index < ds->num_buffered_frames) ? &ds->frames[index] : NULL;
+}
+
+StreamMetrics get_stream_metrics(const DataStream* ds) {
+    return ds->metrics;
+}
+
+unsigned int get_file_checksums(const DataStream* ds, const StreamChecksum** checksums) {
+    // one per file read from so far, in the order they were first read
+    *checksums = ds->file_checksums;
+    return ds->num_file_checksums;
+}
+
+unsigned int get_thread_checksums(const DataStream* ds, const StreamChecksum** checksums) {
+    // one per thread, in the order each was first seen
+    *checksums = ds->thread_checksums;
+    return ds->num_thread_checksums;
+}
+
+uint32_t get_crc32c(uint32_t crc, const void* bytes, size_t num_bytes) {
+    // start from 0, and pass each result back in to carry on over more bytes
+    return update_crc32c(crc, bytes, num_bytes);
+}
+
+Timestamp get_aligned_start(const AlignedReader* reader) {
+    return get_reader_start(reader);
+}
+
+// MARK: write data
+
+DataOutput open_output(const char* file_path, enum DataFormat format) {
+    DataOutput dout = init_output(format);
+    dout.file_handle = fopen(file_path, "wb");
+    if (dout.file_handle == NULL) {
+        raise_exception("file %s could not be opened for writing.", file_path);
+    }
+    return dout;
+}
+
+int set_output_format_designator(DataOutput* dout, const char* format_designator) {
+    // parse as if for an input stream, then keep the relevant parts
+    DataStream parsed = { .format = dout->format };
+    int status = set_format_designator(&parsed, format_designator);
+    if (status != SUCCESS) { return status; }
+    if (parsed.num_threads > 1) {
+        raise_warning("output of multiple threads is not supported, writing a single thread.");
+    }
+    dout->data_rate = parsed.data_rate;
+    dout->num_channels = parsed.num_channels;
+    dout->bits_per_sample = parsed.bits_per_sample;
+    return SUCCESS;
+}
+
+int set_output_start_time(DataOutput* dout, Timestamp start_time) {
+    if (dout->num_written_frames > 0 || dout->num_staged_values > 0) { return FAILURE; }
+    dout->reference_epoch = get_epoch_for_time(dout->format, start_time.seconds);
+    dout->seconds_from_epoch = start_time.seconds - get_epoch_seconds(dout->format, dout->reference_epoch);
+    unsigned long long frames_per_second = (dout->data_rate == 0) ? 0 :
+        (unsigned long long)dout->data_rate * 1000000 / 8 / dout->payload_bytes;
+    dout->frame_number = frames_per_second * start_time.nanoseconds / NANOS_PER_SECOND;
+    return SUCCESS;
+}
+
+void set_output_checksum(DataOutput* dout, unsigned int use_checksum) {
+    // covers frames written from here on
+    dout->use_checksum = use_checksum;
+}
+
+uint32_t get_output_checksum(const DataOutput* dout) {
+    // of the frames written so far, which includes any padded out by close_output
+    return dout->checksum;
+}
+
+int write_samples(DataOutput* dout, float** samples, unsigned long num_samples) {
+    // check the frame layout is one we can actually produce
+    unsigned int bits = dout->bits_per_sample;
+    if (bits != 1 && bits != 2 && bits != 4 && bits != 8) { return BAD_FORMAT_DESIGNATOR; }
+    if (dout->num_channels == 0 || (dout->format != CODIF && (dout->num_channels & (dout->num_channels - 1)) != 0)) {
+        return BAD_FORMAT_DESIGNATOR;
+    }
+    unsigned long frame_samples = get_output_frame_samples(dout);
+    unsigned long sample_bits = bits * dout->num_channels * ((dout->data_type == ComplexData) ? 2 : 1);
+    if (dout->payload_bytes % 8 != 0 || frame_samples == 0 || (frame_samples * sample_bits) != dout->payload_bytes * 8) {
+        return BAD_FORMAT_DESIGNATOR;
+    }
+    // and that CODIF frames are made of whole sample blocks
+    unsigned long block_words = get_output_block_words(dout);
+    if (dout->format == CODIF && (block_words > 0xffff || (dout->payload_bytes / 8) % block_words != 0)) {
+        return BAD_FORMAT_DESIGNATOR;
+    }
+    return stage_samples(dout, samples, num_samples);
+}
+
+int close_output(DataOutput* dout) {
+    int status = flush_output(dout, 1);
+    fclose(dout->file_handle);
+    free(dout->staging);
+    free(dout->buffer);
+    dout->staging = NULL;
+    dout->buffer = NULL;
+    return status;
+}
+
+SampleWriter* open_sample_writer(const char* file_path, const SinkOptions* options) {
+    // a NULL path (or "-") writes to stdout
+    SampleWriter* writer;
+    int status = init_sample_writer(file_path, (options != NULL) ? *options : init_sink_options(), &writer);
+    if (status != SUCCESS) {
+        raise_exception("could not write samples to %s. %s", (file_path != NULL) ? file_path : "stdout",
+            get_error_message(status));
+    }
+    return writer;
+}
+
+int write_sample_block(SampleWriter* writer, float** samples, unsigned long num_channels, unsigned long num_samples) {
+    // returns once the samples are copied, or at once if dropped (see SinkOptions)
+    return append_samples(writer, samples, num_channels, num_samples);
+}
+
+StreamSink get_sample_sink(SampleWriter* writer) {
+    // for decode_streams, with one writer per stream
+    return (StreamSink){ append_stream_block, writer };
+}
+
+SinkMetrics get_sink_metrics(SampleWriter* writer) {
+    return get_writer_metrics(writer);
+}
+
+int close_sample_writer(SampleWriter* writer) {
+    // waits for everything appended to be written, and reports any failure
+    return free_sample_writer(writer);
+}
+
+// MARK: share data
+
+SharedRing* create_shared_ring(const char* name, unsigned int num_slots, unsigned long num_channels, 
+        unsigned long block_samples, enum DataType data_type) {
+    // replaces any ring of the same name, though its readers keep what they have
+    SharedRing* ring;
+    unsigned int values_per_sample = (data_type == ComplexData) ? 2 : 1;
+    int status = init_publisher(name, num_slots, num_channels, block_samples, values_per_sample, &ring);
+    if (status != SUCCESS) {
+        raise_exception("could not create shared ring %s. %s", name, get_error_message(status));
+    }
+    return ring;
+}
+
+int publish_ring_block(SharedRing* ring, float** samples, unsigned long num_samples) {
+    // never waits for readers; ones that fall a whole ring behind lose blocks
+    return publish_samples(ring, samples, num_samples);
+}
+
+int claim_ring_block(SharedRing* ring, float*** samples) {
+    // for decoding straight into the ring, as with decode_samples(ds, n, samples, ...)
+    return claim_slot(ring, samples);
+}
+
+int commit_ring_block(SharedRing* ring, unsigned long num_samples) {
+    return commit_slot(ring, num_samples);
+}
+
+StreamSink get_ring_sink(SharedRing* ring) {
+    // for decode_streams, with one ring per stream
+    return (StreamSink){ publish_stream_block, ring };
+}
+
+SharedRing* attach_shared_ring(const char* name) {
+    SharedRing* ring;
+    int status = init_subscriber(name, &ring);
+    if (status != SUCCESS) {
+        raise_exception("could not attach to shared ring %s. %s", name, get_error_message(status));
+    }
+    return ring;
+}
+
+int read_ring_block(SharedRing* ring, RingBlock* block, unsigned int timeout_millis) {
+    // block->samples point into the ring itself, and stay valid until overwritten
+    return read_ring(ring, block, timeout_millis);
+}
+
+int release_ring_block(SharedRing* ring, const RingBlock* block) {
+    // RING_OVERRUN if the block was overwritten while in use, so what was read from it is suspect
+    return check_ring_block(ring, block);
+}
+
+void close_shared_ring(SharedRing* ring) {
+    free_shared_ring(ring);
+}
+
+// MARK: cleanup
+
+void close_stream(DataStream* ds) {
     // free DataStreamInput structs and fields
     switch (ds->input.mode) {
-        case FileMode: fclose(ds->input.file->file_handle);
+        case FileMode: close_files(ds->input.file);
             free(ds->input.file);
             break;
         case StreamMode: 
+            // captured frames borrow their data from the packet pool
+            release_packets(ds);
+            close_capture(ds->input.stream);
             free(ds->input.stream);
             break;
     }
-    // TODO free DataFrame structs and fields
-}
\ No newline at end of file
+    // free DataFrame structs and fields
+    free_buffered_frames(ds);
+    free_frame_pool(ds);
+    free_sequences(ds);
+    free_checksums(ds);
+    free(ds->frames);
+    free(ds->resync_chunk);
+    free_affinity(ds->affinity);
+    free(ds);
+}
+
+void close_aligned(AlignedReader* reader) {
+    // stops the reads ahead, but leaves the streams open with their gap
+    // policies as they were
+    free_aligned_reader(reader);
+}
@@ -27,22 +27,95 @@ char* get_error_message(int error_code);
 
 // MARK: initialise stream object
 
-DataStream open_file(const char* file_path);
-DataStream open_sink();
+DataStream* open_file(const char* file_path);
+DataStream* open_files(const char** file_paths, unsigned int num_files);
+DataStream* open_directory(const char* directory_path);
+DataStream* open_memory(const void* bytes, size_t num_bytes);
+DataStream* open_sink();
+DataStream* open_udp(const char* address, unsigned int port, const CaptureOptions* options);
 
 // MARK: configure objects
 
 int set_format_designator(DataStream* ds, const char* format_designator);
 
-static inline void set_gap_policy(DataStream* ds, enum GapPolicy policy) { ds->gap_policy = policy; }
+void set_gap_policy(DataStream* ds, enum GapPolicy policy);
+void set_selected_channels(DataStream* ds, unsigned long num_channels);
+int set_buffer_depth(DataStream* ds, unsigned int buffer_depth);
+void set_metrics_dump(DataStream* ds, FILE* out, double interval_seconds);
+int set_huge_pages(DataStream* ds, unsigned int use_huge_pages);
+int set_thread_affinity(DataStream* ds, const char* cpu_list);
+int set_checksums(DataStream* ds, unsigned int use_checksums);
+int pin_to_stream_cpus(const DataStream* ds);
 
 // MARK: process data
 
+int next_frame(DataStream* ds, const DataFrame** frame);
+int release_frame(DataStream* ds, const DataFrame* frame);
+int for_each_frame(DataStream* ds, FrameCallback on_frame, void* context);
+int scan_headers(DataStream* ds, HeaderBatch* headers);
+int scan_quality(DataStream* ds, QualityMap* map);
+int decode_headers(enum DataFormat format, const void* bytes, unsigned long frame_length, 
+    unsigned long num_frames, HeaderBatch* headers);
 int decode_samples(DataStream* ds, unsigned long num_samples, float*** out, DecodeMonitor* statistics);
+int seek_to_timestamp(DataStream* ds, Timestamp start);
+int decode_streams(DataStream** streams, StreamSink* sinks, unsigned int num_streams, 
+    unsigned long block_samples, unsigned int num_threads);
+int align_streams(DataStream** streams, unsigned int num_streams, unsigned long block_samples, 
+    AlignedReader** reader);
+int read_aligned(AlignedReader* reader, AlignedBlock* block);
 
+// MARK: inspect stream
+
+enum DataFormat get_stream_format(const DataStream* ds);
+enum GapPolicy get_gap_policy(const DataStream* ds);
+unsigned int get_stream_data_rate(const DataStream* ds);
+unsigned int get_stream_num_channels(const DataStream* ds);
+unsigned int get_stream_bits_per_sample(const DataStream* ds);
+enum DataType get_stream_data_type(const DataStream* ds);
+unsigned int get_stream_num_threads(const DataStream* ds);
+unsigned int get_stream_header_length(const DataStream* ds);
+unsigned long get_selected_channels(const DataStream* ds);
+unsigned int get_buffer_depth(const DataStream* ds);
+unsigned long long get_discarded_bytes(const DataStream* ds);
+unsigned int get_capture_port(const DataStream* ds);
+const DataFrame* get_buffered_frame(const DataStream* ds, unsigned int index);
+StreamMetrics get_stream_metrics(const DataStream* ds);
+unsigned int get_file_checksums(const DataStream* ds, const StreamChecksum** checksums);
+unsigned int get_thread_checksums(const DataStream* ds, const StreamChecksum** checksums);
+uint32_t get_crc32c(uint32_t crc, const void* bytes, size_t num_bytes);
+Timestamp get_aligned_start(const AlignedReader* reader);
+
+// MARK: write data
+
+DataOutput open_output(const char* file_path, enum DataFormat format);
+int set_output_format_designator(DataOutput* dout, const char* format_designator);
+int set_output_start_time(DataOutput* dout, Timestamp start_time);
+void set_output_checksum(DataOutput* dout, unsigned int use_checksum);
+uint32_t get_output_checksum(const DataOutput* dout);
+int write_samples(DataOutput* dout, float** samples, unsigned long num_samples);
+int close_output(DataOutput* dout);
+SampleWriter* open_sample_writer(const char* file_path, const SinkOptions* options);
+int write_sample_block(SampleWriter* writer, float** samples, unsigned long num_channels, unsigned long num_samples);
+StreamSink get_sample_sink(SampleWriter* writer);
+SinkMetrics get_sink_metrics(SampleWriter* writer);
+int close_sample_writer(SampleWriter* writer);
+
+// MARK: share data
+
+SharedRing* create_shared_ring(const char* name, unsigned int num_slots, unsigned long num_channels, 
+    unsigned long block_samples, enum DataType data_type);
+int publish_ring_block(SharedRing* ring, float** samples, unsigned long num_samples);
+int claim_ring_block(SharedRing* ring, float*** samples);
+int commit_ring_block(SharedRing* ring, unsigned long num_samples);
+StreamSink get_ring_sink(SharedRing* ring);
+SharedRing* attach_shared_ring(const char* name);
+int read_ring_block(SharedRing* ring, RingBlock* block, unsigned int timeout_millis);
+int release_ring_block(SharedRing* ring, const RingBlock* block);
+void close_shared_ring(SharedRing* ring);
 
 // MARK: cleanup
 
-void close(DataStream* ds);
+void close_stream(DataStream* ds);
+void close_aligned(AlignedReader* reader);
 
 #endif // VDIFPARSE_API_H
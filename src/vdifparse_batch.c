@@ -0,0 +1,281 @@
+// vdifparse_batch.c - provides a thread pool to decode blocks of samples from 
+// many data streams concurrently.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <pthread.h>
+
+#include "vdifparse_batch.h"
+#include "vdifparse_affinity.h"
+#include "vdifparse_api.h"
+#include "vdifparse_stream.h"
+#include "vdifparse_utils.h"
+
+#define NO_TASK -1
+
+// Each stream has at most one task (decode its next block) in existence at a
+// time, so a stream's blocks are always decoded and delivered in order, and 
+// the pool balances whole streams across workers rather than splitting any 
+// one of them: a single slow stream is decoded no faster than on one thread. 
+// A worker takes tasks from the front of its own queue and pushes each 
+// follow-up task onto the back, so the streams dealt to it take turns a 
+// block at a time, and none is left unread (a live one overflowing its 
+// socket buffer) while another runs to its end. A worker with an empty queue
+// takes the oldest task from the front of another's. With more streams than
+// workers, a stream still waits for a block of each other stream in its 
+// worker's queue between its own.
+
+typedef struct WorkerQueue {
+    pthread_mutex_t lock;
+    int* tasks; // ring of stream indices
+    unsigned int capacity;
+    unsigned int head;
+    unsigned int num_tasks;
+} WorkerQueue;
+
+typedef struct BatchState {
+    DataStream** streams;
+    StreamSink* sinks;
+    unsigned long block_samples;
+    float*** outputs;
+    DecodeMonitor* monitors;
+
+    unsigned int num_workers;
+    WorkerQueue* queues;
+
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    unsigned int num_queued_tasks;
+    unsigned int num_remaining_streams;
+    int status;
+} BatchState;
+
+typedef struct BatchWorker {
+    BatchState* state;
+    unsigned int index;
+    int is_own_thread; // so that it may be pinned
+    const CpuAffinity* affinity; // where it is pinned, NULL if anywhere
+} BatchWorker;
+
+// MARK: task queues
+
+static void push_task(BatchState* state, unsigned int worker, int task) {
+    WorkerQueue* queue = &state->queues[worker];
+    pthread_mutex_lock(&queue->lock);
+    queue->tasks[(queue->head + queue->num_tasks) % queue->capacity] = task;
+    queue->num_tasks++;
+    pthread_mutex_unlock(&queue->lock);
+
+    pthread_mutex_lock(&state->idle_lock);
+    state->num_queued_tasks++;
+    pthread_cond_signal(&state->idle_cond);
+    pthread_mutex_unlock(&state->idle_lock);
+}
+
+static int take_task(BatchState* state, unsigned int worker) {
+    WorkerQueue* queue = &state->queues[worker];
+    int task = NO_TASK;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->num_tasks > 0) {
+        task = queue->tasks[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->num_tasks--;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    if (task != NO_TASK) {
+        pthread_mutex_lock(&state->idle_lock);
+        state->num_queued_tasks--;
+        pthread_mutex_unlock(&state->idle_lock);
+    }
+    return task;
+}
+
+static int find_task(BatchState* state, unsigned int worker) {
+    int task = take_task(state, worker);
+    // otherwise try to take the oldest task from each other worker in turn
+    for (unsigned int i = 1; task == NO_TASK && i < state->num_workers; i++) {
+        task = take_task(state, (worker + i) % state->num_workers);
+    }
+    return task;
+}
+
+// MARK: workers
+
+static void finish_stream(BatchState* state, int status) {
+    pthread_mutex_lock(&state->idle_lock);
+    if (status < SUCCESS && state->status == SUCCESS) {
+        state->status = status;
+    }
+    state->num_remaining_streams--;
+    if (state->num_remaining_streams == 0) {
+        pthread_cond_broadcast(&state->idle_cond);
+    }
+    pthread_mutex_unlock(&state->idle_lock);
+}
+
+// decodes the next block of a stream and hands it to the stream's sink,
+// returning whether the stream has more to decode
+static int run_task(BatchState* state, int task) {
+    DataStream* ds = state->streams[task];
+    DecodeMonitor* statistics = &state->monitors[task];
+    unsigned long decoded_before = (statistics->channels != NULL) ? statistics->channels[0].num_decoded_samples : 0;
+    int status = decode_samples(ds, state->block_samples, &state->outputs[task], statistics);
+    // a live stream with nothing more to read (within its receive timeout) 
+    // has ended as far as the batch is concerned, as a file has at its end
+    int is_end = (status == REACHED_END_OF_FILE || status == REACHED_END_OF_BUFFER);
+    if (status < SUCCESS && !is_end) {
+        finish_stream(state, status);
+        return 0;
+    }
+    unsigned long num_samples = (statistics->channels != NULL) ?
+        statistics->channels[0].num_decoded_samples - decoded_before : 0;
+    if (num_samples > 0) {
+        StreamSink* sink = &state->sinks[task];
+        int sink_status = sink->write_block(sink->context, state->outputs[task], num_samples, statistics);
+        if (sink_status < SUCCESS) {
+            finish_stream(state, sink_status);
+            return 0;
+        }
+    }
+    if (is_end || num_samples == 0) {
+        finish_stream(state, SUCCESS);
+        return 0;
+    }
+    return 1;
+}
+
+// moves a worker to where the stream it is about to decode is pinned, if it
+// is; a stream that may run anywhere is decoded wherever the worker already 
+// is. the calling thread, if it has to do the work itself, is left alone
+static void place_worker(BatchWorker* worker, const DataStream* ds) {
+    if (!worker->is_own_thread || ds->affinity == NULL || ds->affinity == worker->affinity) { return; }
+    if (pin_thread(pthread_self(), ds->affinity) == SUCCESS) {
+        worker->affinity = ds->affinity;
+    }
+}
+
+static void* run_worker(void* arg) {
+    BatchWorker* worker = (BatchWorker*)arg;
+    BatchState* state = worker->state;
+    while (1) {
+        int task = find_task(state, worker->index);
+        if (task != NO_TASK) {
+            place_worker(worker, state->streams[task]);
+            if (run_task(state, task)) {
+                push_task(state, worker->index, task);
+            }
+            continue;
+        }
+        // nothing to do here or elsewhere: sleep until a task is queued or all is done
+        pthread_mutex_lock(&state->idle_lock);
+        while (state->num_queued_tasks == 0 && state->num_remaining_streams > 0) {
+            pthread_cond_wait(&state->idle_cond, &state->idle_lock);
+        }
+        int is_done = (state->num_remaining_streams == 0);
+        pthread_mutex_unlock(&state->idle_lock);
+        if (is_done) { break; }
+    }
+    return NULL;
+}
+
+static void* start_worker(void* arg) {
+    BatchWorker* worker = (BatchWorker*)arg;
+    worker->is_own_thread = 1;
+    return run_worker(worker);
+}
+
+// MARK: batch lifecycle
+
+static void free_batch(BatchState* state, unsigned int num_streams, pthread_t* threads, BatchWorker* workers) {
+    for (unsigned int i = 0; state->outputs != NULL && i < num_streams; i++) {
+        if (state->outputs[i] != NULL) {
+            for (unsigned long j = 0; j < state->streams[i]->num_selected_channels; j++) {
+                free(state->outputs[i][j]);
+            }
+            free(state->outputs[i]);
+        }
+    }
+    for (unsigned int i = 0; state->monitors != NULL && i < num_streams; i++) {
+        free(state->monitors[i].channels);
+    }
+    for (unsigned int i = 0; state->queues != NULL && i < state->num_workers; i++) {
+        free(state->queues[i].tasks);
+    }
+    free(state->outputs);
+    free(state->monitors);
+    free(state->queues);
+    free(threads);
+    free(workers);
+}
+
+int run_batch(DataStream** streams, StreamSink* sinks, unsigned int num_streams,
+        unsigned long block_samples, unsigned int num_threads) {
+    if (num_streams == 0) { return SUCCESS; }
+    if (num_threads == 0) { num_threads = get_num_processors(); }
+    if (num_threads > num_streams) { num_threads = num_streams; }
+
+    BatchState state = { streams, sinks, block_samples };
+    state.outputs = calloc(num_streams, sizeof(float**));
+    state.monitors = calloc(num_streams, sizeof(DecodeMonitor));
+    state.queues = calloc(num_threads, sizeof(WorkerQueue));
+    pthread_t* threads = calloc(num_threads, sizeof(pthread_t));
+    BatchWorker* workers = calloc(num_threads, sizeof(BatchWorker));
+    state.num_workers = (state.queues != NULL) ? num_threads : 0;
+    int is_allocated = (state.outputs != NULL && state.monitors != NULL && state.queues != NULL
+        && threads != NULL && workers != NULL);
+    for (unsigned int i = 0; is_allocated && i < num_threads; i++) {
+        state.queues[i].capacity = num_streams;
+        state.queues[i].tasks = malloc(num_streams * sizeof(int));
+        is_allocated = (state.queues[i].tasks != NULL);
+    }
+    if (!is_allocated) {
+        free_batch(&state, num_streams, threads, workers);
+        return FAILED_MALLOC;
+    }
+    state.num_remaining_streams = num_streams;
+    pthread_mutex_init(&state.idle_lock, NULL);
+    pthread_cond_init(&state.idle_cond, NULL);
+    for (unsigned int i = 0; i < num_threads; i++) {
+        pthread_mutex_init(&state.queues[i].lock, NULL);
+    }
+    // deal streams out round-robin, then let idle workers even out the load
+    for (unsigned int i = 0; i < num_streams; i++) {
+        push_task(&state, i % num_threads, i);
+    }
+
+    unsigned int num_started = 0;
+    for (unsigned int i = 0; i < num_threads; i++) {
+        workers[i].state = &state;
+        workers[i].index = i;
+        if (pthread_create(&threads[i], NULL, start_worker, &workers[i]) != 0) { break; }
+        num_started++;
+    }
+    if (num_started == 0) {
+        // no threads available, so do all of the work on this one
+        run_worker(&workers[0]);
+    }
+    for (unsigned int i = 0; i < num_started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (unsigned int i = 0; i < num_threads; i++) {
+        pthread_mutex_destroy(&state.queues[i].lock);
+    }
+    pthread_mutex_destroy(&state.idle_lock);
+    pthread_cond_destroy(&state.idle_cond);
+    int status = state.status;
+    free_batch(&state, num_streams, threads, workers);
+    return status;
+}
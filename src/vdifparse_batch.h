@@ -0,0 +1,25 @@
+// vdifparse_batch.h - provides a thread pool to decode blocks of samples from 
+// many data streams concurrently.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later 
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT 
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+#ifndef VDIFPARSE_BATCH_H
+#define VDIFPARSE_BATCH_H
+
+#include "vdifparse_types.h"
+
+int run_batch(DataStream** streams, StreamSink* sinks, unsigned int num_streams, 
+    unsigned long block_samples, unsigned int num_threads);
+
+#endif // VDIFPARSE_BATCH_H
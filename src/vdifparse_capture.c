@@ -0,0 +1,310 @@
+// vdifparse_capture.c - provides functions to receive VDIF or CODIF frames
+// sent one per UDP datagram, in batches, as the input of a StreamMode stream.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+
+#define _GNU_SOURCE // for recvmmsg on Linux
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "vdifparse_capture.h"
+#include "vdifparse_checksum.h"
+#include "vdifparse_input.h"
+#include "vdifparse_metrics.h"
+#include "vdifparse_sequence.h"
+#include "vdifparse_stream.h"
+#include "vdifparse_utils.h"
+
+#define PACKET_ALIGNMENT 64
+#define CONTROL_BYTES CMSG_SPACE(sizeof(uint32_t))
+
+// Each datagram is received straight into its own slot of a preallocated
+// pool, and the frames buffered from a batch point into those slots rather
+// than owning a copy of their data. Slots are only reused by the next batch,
+// which is not received until every frame of this one has been processed.
+
+#ifdef __linux__
+typedef struct mmsghdr PacketMessage;
+#else
+// recvmmsg is Linux only, elsewhere each message is received by recvmsg
+typedef struct PacketMessage {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+} PacketMessage;
+#endif
+
+typedef struct PacketBatch {
+    PacketMessage* messages;
+    struct iovec* vectors;
+    uint8_t* control;
+} PacketBatch;
+
+// MARK: socket setup
+
+static void set_receive_buffer(int socket_fd, int num_bytes) {
+    #ifdef __linux__
+    // forcing past rmem_max needs CAP_NET_ADMIN, so fall back to asking nicely
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_RCVBUFFORCE, &num_bytes, sizeof(int)) != 0) {
+        setsockopt(socket_fd, SOL_SOCKET, SO_RCVBUF, &num_bytes, sizeof(int));
+    }
+    #else
+    setsockopt(socket_fd, SOL_SOCKET, SO_RCVBUF, &num_bytes, sizeof(int));
+    #endif
+    int actual_bytes = 0;
+    socklen_t length = sizeof(int);
+    getsockopt(socket_fd, SOL_SOCKET, SO_RCVBUF, &actual_bytes, &length);
+    // the kernel reports double the requested size, to allow for its bookkeeping
+    if (actual_bytes < num_bytes) {
+        raise_warning("socket receive buffer limited to %d bytes, raise net.core.rmem_max to avoid drops.", actual_bytes / 2);
+    }
+}
+
+static int open_socket(DataStreamInput_Stream* input, const char* address) {
+    struct sockaddr_in socket_address = { .sin_family = AF_INET, .sin_port = htons(input->port) };
+    socket_address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (address != NULL && inet_pton(AF_INET, address, &socket_address.sin_addr) != 1) {
+        return FAILED_TO_OPEN_SOCKET;
+    }
+    input->socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (input->socket_fd < 0) { return FAILED_TO_OPEN_SOCKET; }
+
+    int enable = 1;
+    setsockopt(input->socket_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int));
+    #ifdef __linux__
+    // have the kernel tell us how many packets it dropped for want of space
+    setsockopt(input->socket_fd, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(int));
+    #endif
+    if (input->options.receive_buffer_bytes > 0) {
+        set_receive_buffer(input->socket_fd, input->options.receive_buffer_bytes);
+    }
+    #ifdef SO_BUSY_POLL
+    if (input->options.busy_poll_micros > 0) {
+        setsockopt(input->socket_fd, SOL_SOCKET, SO_BUSY_POLL, &input->options.busy_poll_micros, sizeof(int));
+    }
+    #endif
+    struct timeval timeout = { input->options.receive_timeout_millis / 1000,
+        (input->options.receive_timeout_millis % 1000) * 1000 };
+    setsockopt(input->socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    if (bind(input->socket_fd, (struct sockaddr*)&socket_address, sizeof(socket_address)) != 0) {
+        return FAILED_TO_OPEN_SOCKET;
+    }
+    if (IN_MULTICAST(ntohl(socket_address.sin_addr.s_addr))) {
+        struct ip_mreq membership = { socket_address.sin_addr, { htonl(INADDR_ANY) } };
+        if (setsockopt(input->socket_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0) {
+            return FAILED_TO_OPEN_SOCKET;
+        }
+    }
+    // if asked for any port, find out which one we were given
+    socklen_t length = sizeof(socket_address);
+    getsockname(input->socket_fd, (struct sockaddr*)&socket_address, &length);
+    input->port = ntohs(socket_address.sin_port);
+    return SUCCESS;
+}
+
+static unsigned int get_slot_bytes(const DataStreamInput_Stream* input) {
+    unsigned int num_bytes = input->options.max_packet_bytes;
+    return (num_bytes + PACKET_ALIGNMENT - 1) / PACKET_ALIGNMENT * PACKET_ALIGNMENT;
+}
+
+size_t get_packet_pool_bytes(const DataStreamInput_Stream* input) {
+    return (input->packet_pool != NULL) ? (size_t)get_slot_bytes(input) * input->buffer_depth : 0;
+}
+
+static void free_packet_pool(DataStreamInput_Stream* input) {
+    PacketBatch* batch = input->packet_batch;
+    if (batch != NULL) {
+        free(batch->messages);
+        free(batch->vectors);
+        free(batch->control);
+        free(batch);
+    }
+    free(input->packet_pool);
+    input->packet_batch = NULL;
+    input->packet_pool = NULL;
+}
+
+static int init_packet_pool(DataStreamInput_Stream* input) {
+    unsigned int slot_bytes = get_slot_bytes(input);
+    if (posix_memalign((void**)&input->packet_pool, PACKET_ALIGNMENT, (size_t)slot_bytes * input->buffer_depth) != 0) {
+        input->packet_pool = NULL;
+        return FAILED_MALLOC;
+    }
+    PacketBatch* batch = calloc(1, sizeof(PacketBatch));
+    if (batch == NULL) { return FAILED_MALLOC; }
+    input->packet_batch = batch;
+    batch->messages = calloc(input->buffer_depth, sizeof(PacketMessage));
+    batch->vectors = calloc(input->buffer_depth, sizeof(struct iovec));
+    batch->control = calloc(input->buffer_depth, CONTROL_BYTES);
+    if (batch->messages == NULL || batch->vectors == NULL || batch->control == NULL) { return FAILED_MALLOC; }
+    for (unsigned int i = 0; i < input->buffer_depth; i++) {
+        batch->vectors[i].iov_base = &input->packet_pool[(size_t)i * slot_bytes];
+        batch->vectors[i].iov_len = input->options.max_packet_bytes;
+        batch->messages[i].msg_hdr.msg_iov = &batch->vectors[i];
+        batch->messages[i].msg_hdr.msg_iovlen = 1;
+        batch->messages[i].msg_hdr.msg_control = &batch->control[i * CONTROL_BYTES];
+    }
+    return SUCCESS;
+}
+
+int open_capture(DataStream* ds, const char* address, unsigned int port, CaptureOptions options) {
+    DataStreamInput_Stream* input = ds->input.stream;
+    input->options = options;
+    input->port = port;
+    input->buffer_depth = ds->buffer_depth;
+    int status = init_packet_pool(input);
+    if (status != SUCCESS) { return status; }
+    return open_socket(input, address);
+}
+
+int resize_packet_pool(DataStreamInput_Stream* input, unsigned int buffer_depth) {
+    // the socket stays open, only the slots and their message headers change
+    free_packet_pool(input);
+    input->buffer_depth = buffer_depth;
+    return init_packet_pool(input);
+}
+
+// MARK: packet input
+
+static void update_dropped_packets(DataStreamInput_Stream* input, struct msghdr* message) {
+    #ifdef __linux__
+    for (struct cmsghdr* control = CMSG_FIRSTHDR(message); control != NULL; control = CMSG_NXTHDR(message, control)) {
+        if (control->cmsg_level == SOL_SOCKET && control->cmsg_type == SO_RXQ_OVFL) {
+            uint32_t num_dropped;
+            memcpy(&num_dropped, CMSG_DATA(control), sizeof(uint32_t));
+            input->num_dropped_packets = num_dropped;
+        }
+    }
+    #else
+    // other kernels don't report drops, so num_dropped_packets stays 0
+    (void)input;
+    (void)message;
+    #endif
+}
+
+// waits for the first packet, then takes whatever else has already arrived
+static int receive_packets(int socket_fd, PacketMessage* messages, unsigned int num_messages) {
+    #ifdef __linux__
+    return recvmmsg(socket_fd, messages, num_messages, MSG_WAITFORONE, NULL);
+    #else
+    int num_packets = 0;
+    for (unsigned int i = 0; i < num_messages; i++) {
+        ssize_t num_bytes = recvmsg(socket_fd, &messages[i].msg_hdr, (i == 0) ? 0 : MSG_DONTWAIT);
+        if (num_bytes < 0) { return (i == 0) ? -1 : num_packets; }
+        messages[i].msg_len = (unsigned int)num_bytes;
+        num_packets++;
+    }
+    return num_packets;
+    #endif
+}
+
+// checks a datagram holds exactly one frame of this stream, taking the
+// stream's format from the first one that arrives
+static int is_frame_packet(DataStream* ds, const uint8_t* frame, unsigned int num_bytes) {
+    if (num_bytes < ds->signature.header_length || num_bytes < 16) { return 0; }
+    if (ds->signature.frame_length == 0) {
+        if (identify_frame(ds, frame) != SUCCESS) { return 0; }
+        if (ds->signature.frame_length != num_bytes) {
+            ds->signature.frame_length = 0; // try again with the next packet
+            return 0;
+        }
+    }
+    return num_bytes == ds->signature.frame_length && is_plausible_header(ds, frame);
+}
+
+int buffer_packets(DataStream* ds, unsigned int num_frames) {
+    DataStreamInput_Stream* input = ds->input.stream;
+    PacketBatch* batch = input->packet_batch;
+    // everything buffered last time has been processed, so the slots are free
+    release_packets(ds);
+    if (num_frames > input->buffer_depth) { num_frames = input->buffer_depth; }
+
+    while (ds->num_buffered_frames == 0) {
+        for (unsigned int i = 0; i < num_frames; i++) {
+            batch->messages[i].msg_hdr.msg_controllen = CONTROL_BYTES;
+        }
+        int num_packets = receive_packets(input->socket_fd, batch->messages, num_frames);
+        if (num_packets < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) { return REACHED_END_OF_BUFFER; }
+            return FAILURE;
+        }
+        input->num_received_packets += num_packets;
+        for (int i = 0; i < num_packets; i++) {
+            PacketMessage* message = &batch->messages[i];
+            update_dropped_packets(input, &message->msg_hdr);
+            METRIC_ADD(ds, num_bytes_read, message->msg_len);
+            uint8_t* frame = (uint8_t*)batch->vectors[i].iov_base + input->options.packet_offset;
+            unsigned int num_bytes = (message->msg_len > input->options.packet_offset) ?
+                message->msg_len - input->options.packet_offset : 0;
+            if ((message->msg_hdr.msg_flags & MSG_TRUNC) || !is_frame_packet(ds, frame, num_bytes)) {
+                input->num_rejected_packets++;
+                ds->num_discarded_bytes += message->msg_len;
+                continue;
+            }
+            DataFrame df = frame_from_header(ds, frame);
+            // the payload follows the header in the packet
+            const uint8_t* payload = &frame[ds->signature.header_length];
+            unsigned int is_kept = should_buffer_frame(ds, df);
+            if (ds->use_checksums) { checksum_frame(ds, &df, payload, 0, is_kept); }
+            if (!is_kept) {
+                skip_frame(ds, &df);
+                free_frame(df);
+                METRIC_ADD(ds, num_skipped_frames, 1);
+                continue;
+            }
+            // the frame's data stays where it was received
+            uint32_t* data = (uint32_t*)payload;
+            if (ds->format == CODIF) {
+                df.codif->data = data;
+            } else {
+                df.vdif->data = data;
+            }
+            take_skipped_frames(ds, &df);
+            ds->frames[ds->num_buffered_frames] = df;
+            ds->num_buffered_frames++;
+            METRIC_ADD(ds, num_buffered_frames, 1);
+        }
+    }
+    return SUCCESS;
+}
+
+void release_packets(DataStream* ds) {
+    // frames only borrow their data from the packet pool, so don't free it
+    for (unsigned int i = 0; i < ds->num_buffered_frames; i++) {
+        DataFrame df = ds->frames[i];
+        if (df.format == CODIF) {
+            df.codif->data = NULL;
+        } else {
+            df.vdif->data = NULL;
+        }
+        free_frame(df);
+    }
+    ds->num_buffered_frames = 0;
+    ds->num_processed_frames = 0;
+}
+
+// MARK: cleanup
+
+void close_capture(DataStreamInput_Stream* input) {
+    if (input->socket_fd >= 0) {
+        close(input->socket_fd);
+        input->socket_fd = -1;
+    }
+    free_packet_pool(input);
+}
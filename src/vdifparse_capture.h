@@ -0,0 +1,30 @@
+// vdifparse_capture.h - provides functions to receive VDIF or CODIF frames
+// sent one per UDP datagram, in batches, as the input of a StreamMode stream.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VDIFPARSE_CAPTURE_H
+#define VDIFPARSE_CAPTURE_H
+
+#include "vdifparse_types.h"
+
+int open_capture(DataStream* ds, const char* address, unsigned int port, CaptureOptions options);
+int buffer_packets(DataStream* ds, unsigned int num_frames);
+void release_packets(DataStream* ds);
+int resize_packet_pool(DataStreamInput_Stream* input, unsigned int buffer_depth);
+size_t get_packet_pool_bytes(const DataStreamInput_Stream* input);
+void close_capture(DataStreamInput_Stream* input);
+
+#endif // VDIFPARSE_CAPTURE_H
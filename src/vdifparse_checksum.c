@@ -0,0 +1,262 @@
+// vdifparse_checksum.c - provides CRC32C (Castagnoli) checksums of frames as
+// they are read or written, per file and per thread.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define HAS_CRC32_INSTRUCTION 1
+#endif
+
+#include "vdifparse_checksum.h"
+#include "vdifparse_stream.h"
+
+// CRC32C's polynomial, bit-reversed as the checksum is computed low bit first
+#define CRC32C_POLYNOMIAL 0x82f63b78
+
+// long buffers are checksummed as three lanes at once of this many bytes, to
+// hide the latency of the CRC32 instruction
+#define LANE_BYTES 256
+
+// Each frame is checksummed once, from a zero state, and that checksum is
+// then folded into both its file's and its thread's by shifting theirs on by
+// the frame's length, rather than making a second pass over the bytes. The
+// shift is a multiplication by a constant, so is looked up a byte at a time
+// in tables made once per frame length. The states here are the raw shift
+// register, which get_crc32c inverts going in and out as the standard CRC32C
+// does.
+
+static uint32_t crc_tables[8][256];
+static uint32_t power_table[32]; // x^(2^k) modulo the polynomial
+static uint32_t lane_shift_table[4][256]; // shifts a state on past one lane
+static int has_crc32_instruction = 0;
+static pthread_once_t crc_tables_once = PTHREAD_ONCE_INIT;
+
+// MARK: polynomial arithmetic
+
+// multiplies two polynomials modulo the CRC polynomial, as zlib does to
+// combine CRCs
+static uint32_t multiply_mod_polynomial(uint32_t a, uint32_t b) {
+    uint32_t m = (uint32_t)1 << 31;
+    uint32_t product = 0;
+    while (m != 0) {
+        if (a & m) {
+            product ^= b;
+            if ((a & (m - 1)) == 0) { break; }
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32C_POLYNOMIAL : b >> 1;
+    }
+    return product;
+}
+
+// x^(8 * num_bytes) modulo the polynomial, by which a state is multiplied to
+// move it on past that many bytes
+static uint32_t get_shift(unsigned long long num_bytes) {
+    uint32_t shift = (uint32_t)1 << 31; // x^0
+    unsigned int k = 3; // from bits to bytes
+    while (num_bytes != 0) {
+        if (num_bytes & 1) { shift = multiply_mod_polynomial(power_table[k & 31], shift); }
+        num_bytes >>= 1;
+        k++;
+    }
+    return shift;
+}
+
+static void init_crc_tables() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; k++) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+        }
+        crc_tables[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int j = 1; j < 8; j++) {
+            crc_tables[j][i] = (crc_tables[j - 1][i] >> 8) ^ crc_tables[0][crc_tables[j - 1][i] & 0xff];
+        }
+    }
+    power_table[0] = (uint32_t)1 << 30; // x^1
+    for (int k = 1; k < 32; k++) {
+        power_table[k] = multiply_mod_polynomial(power_table[k - 1], power_table[k - 1]);
+    }
+    uint32_t lane_shift = get_shift(LANE_BYTES);
+    for (uint32_t i = 0; i < 4; i++) {
+        for (uint32_t value = 0; value < 256; value++) {
+            lane_shift_table[i][value] = multiply_mod_polynomial(value << (8 * i), lane_shift);
+        }
+    }
+#ifdef HAS_CRC32_INSTRUCTION
+    has_crc32_instruction = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+// MARK: checksumming bytes
+
+static inline uint32_t shift_past_lane(uint32_t state) {
+    return lane_shift_table[0][state & 0xff] ^ lane_shift_table[1][(state >> 8) & 0xff]
+        ^ lane_shift_table[2][(state >> 16) & 0xff] ^ lane_shift_table[3][state >> 24];
+}
+
+#ifdef HAS_CRC32_INSTRUCTION
+// the CRC32 instruction of SSE4.2 is CRC32C, 8 bytes at a time
+__attribute__((target("sse4.2")))
+static uint32_t update_with_instruction(uint32_t state, const uint8_t* bytes, size_t num_bytes) {
+    uint64_t wide_state = state;
+    // each instruction waits on the last, so run three independent lanes 
+    // side by side, then fold the later two in after the first
+    for (; num_bytes >= 3 * LANE_BYTES; num_bytes -= 3 * LANE_BYTES, bytes += 3 * LANE_BYTES) {
+        uint64_t lane_states[2] = { 0, 0 };
+        for (unsigned int i = 0; i < LANE_BYTES; i += 8) {
+            uint64_t words[3];
+            memcpy(&words[0], &bytes[i], sizeof(uint64_t));
+            memcpy(&words[1], &bytes[LANE_BYTES + i], sizeof(uint64_t));
+            memcpy(&words[2], &bytes[2 * LANE_BYTES + i], sizeof(uint64_t));
+            wide_state = _mm_crc32_u64(wide_state, words[0]);
+            lane_states[0] = _mm_crc32_u64(lane_states[0], words[1]);
+            lane_states[1] = _mm_crc32_u64(lane_states[1], words[2]);
+        }
+        state = shift_past_lane((uint32_t)wide_state) ^ (uint32_t)lane_states[0];
+        wide_state = shift_past_lane(state) ^ (uint32_t)lane_states[1];
+    }
+    for (; num_bytes >= 8; num_bytes -= 8, bytes += 8) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(uint64_t));
+        wide_state = _mm_crc32_u64(wide_state, word);
+    }
+    state = (uint32_t)wide_state;
+    for (; num_bytes > 0; num_bytes--, bytes++) {
+        state = _mm_crc32_u8(state, *bytes);
+    }
+    return state;
+}
+#endif
+
+// looks up 8 bytes at a time, one table per byte position
+static uint32_t update_with_tables(uint32_t state, const uint8_t* bytes, size_t num_bytes) {
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; num_bytes >= 8; num_bytes -= 8, bytes += 8) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(uint64_t));
+        word ^= state;
+        state = crc_tables[7][word & 0xff] ^ crc_tables[6][(word >> 8) & 0xff]
+            ^ crc_tables[5][(word >> 16) & 0xff] ^ crc_tables[4][(word >> 24) & 0xff]
+            ^ crc_tables[3][(word >> 32) & 0xff] ^ crc_tables[2][(word >> 40) & 0xff]
+            ^ crc_tables[1][(word >> 48) & 0xff] ^ crc_tables[0][word >> 56];
+    }
+#endif
+    for (; num_bytes > 0; num_bytes--, bytes++) {
+        state = (state >> 8) ^ crc_tables[0][(state ^ *bytes) & 0xff];
+    }
+    return state;
+}
+
+static uint32_t update_state(uint32_t state, const void* bytes, size_t num_bytes) {
+    pthread_once(&crc_tables_once, init_crc_tables);
+#ifdef HAS_CRC32_INSTRUCTION
+    if (has_crc32_instruction) { return update_with_instruction(state, bytes, num_bytes); }
+#endif
+    return update_with_tables(state, bytes, num_bytes);
+}
+
+uint32_t update_crc32c(uint32_t crc, const void* bytes, size_t num_bytes) {
+    // chains like zlib's crc32, starting from 0
+    return ~update_state(~crc, bytes, num_bytes);
+}
+
+// MARK: checksumming frames
+
+static StreamChecksum* get_checksum(StreamChecksum** checksums, unsigned int* num_checksums, unsigned int id) {
+    for (unsigned int i = 0; i < *num_checksums; i++) {
+        if ((*checksums)[i].id == id) { return &(*checksums)[i]; }
+    }
+    StreamChecksum* grown = realloc(*checksums, (*num_checksums + 1) * sizeof(StreamChecksum));
+    if (grown == NULL) { return NULL; }
+    *checksums = grown;
+    StreamChecksum* checksum = &grown[(*num_checksums)++];
+    *checksum = (StreamChecksum){ .id = id };
+    return checksum;
+}
+
+// tabulates the shift past one frame, for each value of each byte of a state
+static int init_shift_table(DataStream* ds, unsigned long frame_bytes) {
+    if (ds->checksum_shift_table == NULL) {
+        ds->checksum_shift_table = malloc(4 * 256 * sizeof(uint32_t));
+        if (ds->checksum_shift_table == NULL) { return FAILED_MALLOC; }
+    }
+    uint32_t shift = get_shift(frame_bytes);
+    for (uint32_t i = 0; i < 4; i++) {
+        for (uint32_t value = 0; value < 256; value++) {
+            ds->checksum_shift_table[i * 256 + value] = multiply_mod_polynomial(value << (8 * i), shift);
+        }
+    }
+    ds->checksum_shift_bytes = frame_bytes;
+    return SUCCESS;
+}
+
+static void fold_frame(StreamChecksum* checksum, uint32_t frame_state, const uint32_t* shift_table,
+        unsigned long frame_bytes) {
+    // the frame's own state was taken from zero, so it just adds on
+    uint32_t state = ~checksum->crc32c;
+    state = shift_table[state & 0xff] ^ shift_table[256 + ((state >> 8) & 0xff)]
+        ^ shift_table[512 + ((state >> 16) & 0xff)] ^ shift_table[768 + (state >> 24)];
+    checksum->crc32c = ~(state ^ frame_state);
+    checksum->num_bytes += frame_bytes;
+    checksum->num_frames++;
+}
+
+void checksum_frame(DataStream* ds, const DataFrame* df, const uint8_t* payload, unsigned int file_index,
+        unsigned int is_kept) {
+    // the header as it was read, then the payload
+    uint32_t state;
+    unsigned long header_bytes;
+    if (df->format == CODIF) {
+        state = update_state(0, df->codif->header, sizeof(CODIFHeader));
+        state = update_state(state, df->codif->metadata->none, CODIF_METADATA_BYTES);
+        header_bytes = sizeof(CODIFHeader) + CODIF_METADATA_BYTES;
+    } else {
+        state = update_state(0, df->vdif->header, sizeof(VDIFHeader));
+        header_bytes = sizeof(VDIFHeader);
+        if (df->vdif->extended_data != NULL) {
+            state = update_state(state, df->vdif->extended_data->none, VDIF_EXTENDED_DATA_BYTES);
+            header_bytes += VDIF_EXTENDED_DATA_BYTES;
+        }
+    }
+    unsigned long data_length = get_data_length(*df);
+    state = update_state(state, payload, data_length);
+    unsigned long frame_bytes = header_bytes + data_length;
+    // frames are all one length, as a rule
+    if (frame_bytes != ds->checksum_shift_bytes && init_shift_table(ds, frame_bytes) != SUCCESS) { return; }
+    StreamChecksum* checksum = get_checksum(&ds->file_checksums, &ds->num_file_checksums, file_index);
+    if (checksum != NULL) { fold_frame(checksum, state, ds->checksum_shift_table, frame_bytes); }
+    // frames that are skipped count towards their file, but not their thread
+    if (!is_kept) { return; }
+    checksum = get_checksum(&ds->thread_checksums, &ds->num_thread_checksums, get_thread_id(*df));
+    if (checksum != NULL) { fold_frame(checksum, state, ds->checksum_shift_table, frame_bytes); }
+}
+
+void free_checksums(DataStream* ds) {
+    free(ds->file_checksums);
+    free(ds->thread_checksums);
+    free(ds->checksum_shift_table);
+    ds->checksum_shift_table = NULL;
+    ds->checksum_shift_bytes = 0;
+    ds->file_checksums = NULL;
+    ds->thread_checksums = NULL;
+    ds->num_file_checksums = 0;
+    ds->num_thread_checksums = 0;
+}
@@ -0,0 +1,27 @@
+// vdifparse_checksum.h - provides CRC32C (Castagnoli) checksums of frames as
+// they are read or written, per file and per thread.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+#ifndef VDIFPARSE_CHECKSUM_H
+#define VDIFPARSE_CHECKSUM_H
+
+#include "vdifparse_types.h"
+
+uint32_t update_crc32c(uint32_t crc, const void* bytes, size_t num_bytes);
+void checksum_frame(DataStream* ds, const DataFrame* df, const uint8_t* payload, unsigned int file_index,
+    unsigned int is_kept);
+void free_checksums(DataStream* ds);
+
+#endif // VDIFPARSE_CHECKSUM_H
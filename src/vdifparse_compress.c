@@ -0,0 +1,597 @@
+// vdifparse_compress.c - provides transparent reading of gzip (and, if built
+// with ZSTD=1, zstd) compressed files, decompressed on background threads.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+
+#define _GNU_SOURCE // for fopencookie on Linux
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifdef VDIFPARSE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "vdifparse_compress.h"
+#include "vdifparse_utils.h"
+
+#define CHUNK_BYTES (1 << 22)
+#define NUM_SLOTS 8
+#define MAX_WORKERS 4
+#define READ_BYTES (1 << 20)
+#define MAX_BLOCK_BYTES (1 << 26)
+#define BGZF_HEADER_BYTES 18
+#define ZSTD_HEADER_BYTES 18
+
+// A compressed file is read through a FILE* of its own, so that everything
+// downstream of fopen works on it unchanged. A producer thread reads the
+// compressed bytes and fills a ring of chunks in order: runs of independent
+// blocks whose decompressed sizes are known up front (BGZF gzip members, zstd
+// frames with a content size) are packed into a chunk for one of a few worker
+// threads to decompress, so that those files decompress in parallel; anything
+// else is decompressed as a stream by the producer itself. The reader copies
+// out of the chunks in order, and keeps the chunk before the one it is in, so
+// that the short backward seeks of resynchronisation stay in memory. Seeking
+// back any further starts decompression again from the top.
+
+enum Compression { NoCompression, GzipCompression, ZstdCompression };
+enum SlotState { SLOT_FREE, SLOT_PACKED, SLOT_DECOMPRESSING, SLOT_READY };
+
+typedef struct Chunk {
+    enum SlotState state;
+    int status;
+    long long start; // offset of its first byte in the decompressed file
+    uint8_t* bytes;
+    size_t num_bytes;
+    size_t capacity;
+    // independent blocks waiting for a worker, if packed
+    uint8_t* compressed;
+    size_t num_compressed_bytes;
+    size_t compressed_capacity;
+} Chunk;
+
+typedef struct CompressedFile {
+    FILE* file_handle;
+    enum Compression compression;
+
+    // compressed bytes read ahead by the producer
+    uint8_t* input;
+    size_t input_capacity;
+    size_t input_start;
+    size_t input_end;
+    int is_input_done;
+    // state of a block being decompressed as a stream
+    z_stream inflater;
+    #ifdef VDIFPARSE_ZSTD
+    ZSTD_DCtx* zstd_context;
+    #endif
+    int is_mid_stream;
+    long long next_start;
+
+    Chunk chunks[NUM_SLOTS]; // chunk k lives in slot k % NUM_SLOTS
+    unsigned long num_filled_chunks;
+    unsigned long num_released_chunks;
+    int is_finished; // no more chunks will be filled
+    int is_stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    pthread_t producer;
+    int is_producing;
+    pthread_t workers[MAX_WORKERS];
+    unsigned int num_workers;
+
+    // where the reader is
+    unsigned long current_chunk;
+    long long current_start;
+    long long position;
+} CompressedFile;
+
+// MARK: compressed input
+
+static enum Compression compression_for_magic(const uint8_t* magic, size_t num_bytes) {
+    if (num_bytes >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) { return GzipCompression; }
+    if (num_bytes >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+        return ZstdCompression;
+    }
+    return NoCompression;
+}
+
+// makes sure at least num_bytes of compressed input are buffered, unless the
+// file ends first, and returns how many are
+static size_t fill_input(CompressedFile* cf, size_t num_bytes) {
+    size_t num_available = cf->input_end - cf->input_start;
+    if (num_available >= num_bytes || cf->is_input_done) { return num_available; }
+    memmove(cf->input, &cf->input[cf->input_start], num_available);
+    cf->input_start = 0;
+    cf->input_end = num_available;
+    if (num_bytes > cf->input_capacity) {
+        uint8_t* input = realloc(cf->input, num_bytes);
+        if (input == NULL) { return num_available; }
+        cf->input = input;
+        cf->input_capacity = num_bytes;
+    }
+    while (cf->input_end < num_bytes) {
+        size_t num_read = fread(&cf->input[cf->input_end], 1, cf->input_capacity - cf->input_end, cf->file_handle);
+        if (num_read == 0) {
+            cf->is_input_done = 1;
+            break;
+        }
+        cf->input_end += num_read;
+    }
+    return cf->input_end - cf->input_start;
+}
+
+static inline uint32_t load_le_word(const uint8_t* bytes) {
+    return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+// returns the compressed length of the block at the front of the input, if it
+// can be decompressed on its own to a size known now, or 0 if not
+static size_t find_block(CompressedFile* cf, size_t* content_bytes) {
+    if (cf->compression == GzipCompression) {
+        // a BGZF member gives its length in a 'BC' extra field, and its
+        // decompressed length in its last four bytes, as every gzip member does
+        if (fill_input(cf, BGZF_HEADER_BYTES) < BGZF_HEADER_BYTES) { return 0; }
+        const uint8_t* head = &cf->input[cf->input_start];
+        if (head[0] != 0x1f || head[1] != 0x8b || !(head[3] & 0x04) || head[12] != 'B' || head[13] != 'C') { return 0; }
+        size_t block_bytes = ((size_t)head[16] | ((size_t)head[17] << 8)) + 1;
+        if (fill_input(cf, block_bytes) < block_bytes) { return 0; }
+        *content_bytes = load_le_word(&cf->input[cf->input_start + block_bytes - 4]);
+        return block_bytes;
+    }
+    #ifdef VDIFPARSE_ZSTD
+    if (cf->compression == ZstdCompression) {
+        size_t num_available = fill_input(cf, ZSTD_HEADER_BYTES);
+        unsigned long long frame_content = ZSTD_getFrameContentSize(&cf->input[cf->input_start], num_available);
+        if (frame_content == ZSTD_CONTENTSIZE_UNKNOWN || frame_content == ZSTD_CONTENTSIZE_ERROR
+                || frame_content > MAX_BLOCK_BYTES) {
+            return 0;
+        }
+        num_available = fill_input(cf, ZSTD_compressBound(frame_content) + ZSTD_HEADER_BYTES);
+        size_t block_bytes = ZSTD_findFrameCompressedSize(&cf->input[cf->input_start], num_available);
+        if (ZSTD_isError(block_bytes)) { return 0; }
+        *content_bytes = frame_content;
+        return block_bytes;
+    }
+    #endif
+    return 0;
+}
+
+// MARK: decompression
+
+static int reserve_bytes(uint8_t** bytes, size_t* capacity, size_t num_bytes) {
+    if (num_bytes <= *capacity) { return SUCCESS; }
+    uint8_t* grown = realloc(*bytes, num_bytes);
+    if (grown == NULL) { return FAILED_MALLOC; }
+    *bytes = grown;
+    *capacity = num_bytes;
+    return SUCCESS;
+}
+
+// decompresses the independent blocks packed into a chunk, on a worker
+static int decompress_blocks(enum Compression compression, Chunk* chunk) {
+    size_t num_bytes = 0;
+    if (compression == GzipCompression) {
+        z_stream inflater = { 0 };
+        if (inflateInit2(&inflater, 16 + MAX_WBITS) != Z_OK) { return FAILED_MALLOC; }
+        inflater.next_in = chunk->compressed;
+        inflater.avail_in = chunk->num_compressed_bytes;
+        inflater.next_out = chunk->bytes;
+        inflater.avail_out = chunk->num_bytes;
+        int result = Z_STREAM_END;
+        while (inflater.avail_in > 0 && result == Z_STREAM_END) {
+            result = inflate(&inflater, Z_FINISH);
+            if (result == Z_STREAM_END) { inflateReset(&inflater); }
+        }
+        num_bytes = chunk->num_bytes - inflater.avail_out;
+        inflateEnd(&inflater);
+        if (result != Z_STREAM_END) { return FAILURE; }
+    }
+    #ifdef VDIFPARSE_ZSTD
+    if (compression == ZstdCompression) {
+        num_bytes = ZSTD_decompress(chunk->bytes, chunk->num_bytes, chunk->compressed, chunk->num_compressed_bytes);
+        if (ZSTD_isError(num_bytes)) { return FAILURE; }
+    }
+    #endif
+    // the sizes given up front decided where every later chunk starts
+    return (num_bytes == chunk->num_bytes) ? SUCCESS : FAILURE;
+}
+
+// decompresses some of a block as a stream, noting whether it came to the end
+static int decompress_stream(CompressedFile* cf, uint8_t* out, size_t out_bytes, size_t* num_consumed,
+        size_t* num_made, int* is_block_end) {
+    const uint8_t* in = &cf->input[cf->input_start];
+    size_t in_bytes = cf->input_end - cf->input_start;
+    *is_block_end = 0;
+    if (cf->compression == GzipCompression) {
+        cf->inflater.next_in = (uint8_t*)in;
+        cf->inflater.avail_in = in_bytes;
+        cf->inflater.next_out = out;
+        cf->inflater.avail_out = out_bytes;
+        int result = inflate(&cf->inflater, Z_NO_FLUSH);
+        *num_consumed = in_bytes - cf->inflater.avail_in;
+        *num_made = out_bytes - cf->inflater.avail_out;
+        if (result == Z_STREAM_END) {
+            inflateReset(&cf->inflater);
+            *is_block_end = 1;
+        } else if (result != Z_OK && result != Z_BUF_ERROR) {
+            return FAILURE;
+        }
+        return SUCCESS;
+    }
+    #ifdef VDIFPARSE_ZSTD
+    ZSTD_inBuffer in_buffer = { in, in_bytes, 0 };
+    ZSTD_outBuffer out_buffer = { out, out_bytes, 0 };
+    size_t result = ZSTD_decompressStream(cf->zstd_context, &out_buffer, &in_buffer);
+    if (ZSTD_isError(result)) { return FAILURE; }
+    *num_consumed = in_buffer.pos;
+    *num_made = out_buffer.pos;
+    *is_block_end = (result == 0);
+    return SUCCESS;
+    #else
+    return FAILURE;
+    #endif
+}
+
+// decompresses the input straight into a chunk, until the chunk is full or
+// a block ends that is followed by ones which can be packed instead
+static int stream_into_chunk(CompressedFile* cf, Chunk* chunk) {
+    if (reserve_bytes(&chunk->bytes, &chunk->capacity, CHUNK_BYTES) != SUCCESS) { return FAILED_MALLOC; }
+    size_t num_bytes = 0;
+    while (num_bytes < CHUNK_BYTES) {
+        size_t num_available = fill_input(cf, 1);
+        if (num_available == 0) { break; }
+        size_t num_consumed, num_made;
+        int is_block_end;
+        int status = decompress_stream(cf, &chunk->bytes[num_bytes], CHUNK_BYTES - num_bytes,
+            &num_consumed, &num_made, &is_block_end);
+        if (status != SUCCESS) { return status; }
+        cf->input_start += num_consumed;
+        num_bytes += num_made;
+        cf->is_mid_stream = !is_block_end;
+        if (is_block_end) {
+            size_t content_bytes;
+            if (find_block(cf, &content_bytes) > 0) { break; }
+        } else if (num_consumed == 0 && num_made == 0
+                && fill_input(cf, num_available + 1) == num_available) {
+            // a block cut short by the end of the file
+            raise_warning("compressed file ended part-way through a block.");
+            cf->is_input_done = 1;
+            cf->input_start = cf->input_end;
+            break;
+        }
+    }
+    chunk->num_bytes = num_bytes;
+    return (num_bytes == 0) ? REACHED_END_OF_FILE : SUCCESS;
+}
+
+// fills the next chunk with packed blocks for a worker, or failing that by
+// decompressing a stream
+static int fill_chunk(CompressedFile* cf, Chunk* chunk) {
+    chunk->start = cf->next_start;
+    chunk->status = SUCCESS;
+    chunk->num_bytes = 0;
+    chunk->num_compressed_bytes = 0;
+    size_t content_bytes;
+    size_t block_bytes;
+    while (!cf->is_mid_stream && chunk->num_bytes < CHUNK_BYTES
+            && (block_bytes = find_block(cf, &content_bytes)) > 0) {
+        if (chunk->num_bytes > 0 && chunk->num_bytes + content_bytes > MAX_BLOCK_BYTES) { break; }
+        if (reserve_bytes(&chunk->compressed, &chunk->compressed_capacity,
+                chunk->num_compressed_bytes + block_bytes) != SUCCESS) {
+            return FAILED_MALLOC;
+        }
+        memcpy(&chunk->compressed[chunk->num_compressed_bytes], &cf->input[cf->input_start], block_bytes);
+        chunk->num_compressed_bytes += block_bytes;
+        chunk->num_bytes += content_bytes;
+        cf->input_start += block_bytes;
+    }
+    int status;
+    if (chunk->num_compressed_bytes > 0) {
+        status = reserve_bytes(&chunk->bytes, &chunk->capacity, chunk->num_bytes);
+    } else {
+        status = stream_into_chunk(cf, chunk);
+    }
+    cf->next_start += chunk->num_bytes;
+    return status;
+}
+
+// MARK: threads
+
+// fills chunk k and hands it on, returning whether there may be more after it
+static int produce_chunk(CompressedFile* cf, unsigned long k) {
+    Chunk* chunk = &cf->chunks[k % NUM_SLOTS];
+    int status = fill_chunk(cf, chunk);
+    pthread_mutex_lock(&cf->lock);
+    if (status != REACHED_END_OF_FILE) {
+        chunk->status = status;
+        chunk->state = (status == SUCCESS && chunk->num_compressed_bytes > 0) ? SLOT_PACKED : SLOT_READY;
+        cf->num_filled_chunks = k + 1;
+    }
+    if (status != SUCCESS) { cf->is_finished = 1; }
+    pthread_cond_broadcast(&cf->changed);
+    pthread_mutex_unlock(&cf->lock);
+    return status == SUCCESS;
+}
+
+static void* produce_chunks(void* arg) {
+    CompressedFile* cf = (CompressedFile*)arg;
+    for (unsigned long k = 0; ; k++) {
+        pthread_mutex_lock(&cf->lock);
+        while (!cf->is_stopping && k - cf->num_released_chunks >= NUM_SLOTS) {
+            pthread_cond_wait(&cf->changed, &cf->lock);
+        }
+        int is_stopping = cf->is_stopping;
+        pthread_mutex_unlock(&cf->lock);
+        if (is_stopping || !produce_chunk(cf, k)) { break; }
+    }
+    return NULL;
+}
+
+static void* decompress_chunks(void* arg) {
+    CompressedFile* cf = (CompressedFile*)arg;
+    pthread_mutex_lock(&cf->lock);
+    while (!cf->is_stopping) {
+        // take the earliest packed chunk, which the reader will want first
+        Chunk* chunk = NULL;
+        for (unsigned long k = cf->num_released_chunks; chunk == NULL && k < cf->num_filled_chunks; k++) {
+            if (cf->chunks[k % NUM_SLOTS].state == SLOT_PACKED) { chunk = &cf->chunks[k % NUM_SLOTS]; }
+        }
+        if (chunk == NULL) {
+            if (cf->is_finished) { break; }
+            pthread_cond_wait(&cf->changed, &cf->lock);
+            continue;
+        }
+        chunk->state = SLOT_DECOMPRESSING;
+        pthread_mutex_unlock(&cf->lock);
+        int status = decompress_blocks(cf->compression, chunk);
+        pthread_mutex_lock(&cf->lock);
+        chunk->status = status;
+        chunk->state = SLOT_READY;
+        pthread_cond_broadcast(&cf->changed);
+    }
+    pthread_mutex_unlock(&cf->lock);
+    return NULL;
+}
+
+static void start_threads(CompressedFile* cf) {
+    // without threads, the reader fills and decompresses chunks as it needs them
+    cf->is_producing = (pthread_create(&cf->producer, NULL, produce_chunks, cf) == 0);
+    cf->num_workers = 0;
+    unsigned int num_workers = get_num_processors();
+    if (num_workers > MAX_WORKERS) { num_workers = MAX_WORKERS; }
+    for (unsigned int i = 0; cf->is_producing && i < num_workers; i++) {
+        if (pthread_create(&cf->workers[cf->num_workers], NULL, decompress_chunks, cf) == 0) { cf->num_workers++; }
+    }
+}
+
+static void stop_threads(CompressedFile* cf) {
+    pthread_mutex_lock(&cf->lock);
+    cf->is_stopping = 1;
+    pthread_cond_broadcast(&cf->changed);
+    pthread_mutex_unlock(&cf->lock);
+    if (cf->is_producing) { pthread_join(cf->producer, NULL); }
+    cf->is_producing = 0;
+    for (unsigned int i = 0; i < cf->num_workers; i++) {
+        pthread_join(cf->workers[i], NULL);
+    }
+    cf->num_workers = 0;
+}
+
+static void restart_decompression(CompressedFile* cf) {
+    stop_threads(cf);
+    fseek(cf->file_handle, 0, SEEK_SET);
+    cf->input_start = cf->input_end = 0;
+    cf->is_input_done = 0;
+    inflateReset(&cf->inflater);
+    #ifdef VDIFPARSE_ZSTD
+    ZSTD_DCtx_reset(cf->zstd_context, ZSTD_reset_session_only);
+    #endif
+    cf->is_mid_stream = 0;
+    cf->next_start = 0;
+    for (unsigned int i = 0; i < NUM_SLOTS; i++) {
+        cf->chunks[i].state = SLOT_FREE;
+    }
+    cf->num_filled_chunks = cf->num_released_chunks = 0;
+    cf->is_finished = cf->is_stopping = 0;
+    cf->current_chunk = 0;
+    cf->current_start = 0;
+    cf->position = 0;
+    start_threads(cf);
+}
+
+// MARK: reading
+
+// waits for chunk k to be decompressed, if there is to be one, doing the 
+// work itself if there are no threads to do it
+static int wait_for_chunk(CompressedFile* cf, unsigned long k, Chunk** chunk) {
+    *chunk = &cf->chunks[k % NUM_SLOTS];
+    pthread_mutex_lock(&cf->lock);
+    while (!(k < cf->num_filled_chunks && (*chunk)->state == SLOT_READY)
+            && !(cf->is_finished && k >= cf->num_filled_chunks)) {
+        if (!cf->is_producing && k >= cf->num_filled_chunks) {
+            pthread_mutex_unlock(&cf->lock);
+            produce_chunk(cf, cf->num_filled_chunks);
+            pthread_mutex_lock(&cf->lock);
+        } else if (cf->num_workers == 0 && (*chunk)->state == SLOT_PACKED) {
+            (*chunk)->state = SLOT_DECOMPRESSING;
+            pthread_mutex_unlock(&cf->lock);
+            int status = decompress_blocks(cf->compression, *chunk);
+            pthread_mutex_lock(&cf->lock);
+            (*chunk)->status = status;
+            (*chunk)->state = SLOT_READY;
+        } else {
+            pthread_cond_wait(&cf->changed, &cf->lock);
+        }
+    }
+    int status = (k < cf->num_filled_chunks) ? (*chunk)->status : REACHED_END_OF_FILE;
+    pthread_mutex_unlock(&cf->lock);
+    return status;
+}
+
+static void move_to_next_chunk(CompressedFile* cf, const Chunk* chunk) {
+    cf->current_chunk++;
+    cf->current_start += chunk->num_bytes;
+    // keep the chunk just finished, for short seeks back into it
+    if (cf->current_chunk > cf->num_released_chunks + 1) {
+        pthread_mutex_lock(&cf->lock);
+        cf->num_released_chunks = cf->current_chunk - 1;
+        pthread_cond_broadcast(&cf->changed);
+        pthread_mutex_unlock(&cf->lock);
+    }
+}
+
+static ssize_t read_decompressed(void* cookie, char* buffer, size_t size) {
+    CompressedFile* cf = (CompressedFile*)cookie;
+    size_t num_read = 0;
+    while (num_read < size) {
+        Chunk* chunk;
+        int status = wait_for_chunk(cf, cf->current_chunk, &chunk);
+        if (status == REACHED_END_OF_FILE) { break; }
+        if (status != SUCCESS) { return (num_read > 0) ? (ssize_t)num_read : -1; }
+        long long offset = cf->position - cf->current_start;
+        if (offset >= (long long)chunk->num_bytes) {
+            move_to_next_chunk(cf, chunk);
+            continue;
+        }
+        size_t num_bytes = chunk->num_bytes - offset;
+        if (num_bytes > size - num_read) { num_bytes = size - num_read; }
+        memcpy(&buffer[num_read], &chunk->bytes[offset], num_bytes);
+        num_read += num_bytes;
+        cf->position += num_bytes;
+    }
+    return num_read;
+}
+
+static long long seek_decompressed(CompressedFile* cf, long long offset, int whence) {
+    // the decompressed length isn't known without decompressing it all
+    if (whence == SEEK_END) { return -1; }
+    long long target = (whence == SEEK_SET) ? offset : cf->position + offset;
+    if (target < 0) { return -1; }
+    // step back through the chunks still held, or failing that start over;
+    // seeking forward is left to the next read
+    while (target < cf->current_start && cf->current_chunk > cf->num_released_chunks) {
+        cf->current_chunk--;
+        cf->current_start = cf->chunks[cf->current_chunk % NUM_SLOTS].start;
+    }
+    if (target < cf->current_start) { restart_decompression(cf); }
+    cf->position = target;
+    return target;
+}
+
+static int close_decompressed(void* cookie) {
+    CompressedFile* cf = (CompressedFile*)cookie;
+    stop_threads(cf);
+    pthread_mutex_destroy(&cf->lock);
+    pthread_cond_destroy(&cf->changed);
+    for (unsigned int i = 0; i < NUM_SLOTS; i++) {
+        free(cf->chunks[i].bytes);
+        free(cf->chunks[i].compressed);
+    }
+    inflateEnd(&cf->inflater);
+    #ifdef VDIFPARSE_ZSTD
+    ZSTD_freeDCtx(cf->zstd_context);
+    #endif
+    free(cf->input);
+    int status = fclose(cf->file_handle);
+    free(cf);
+    return status;
+}
+
+// fopencookie is glibc's, the BSDs and macOS have funopen instead
+#ifdef __linux__
+static int seek_cookie(void* cookie, off64_t* offset, int whence) {
+    long long target = seek_decompressed((CompressedFile*)cookie, *offset, whence);
+    if (target < 0) { return -1; }
+    *offset = target;
+    return 0;
+}
+
+static FILE* open_cookie(CompressedFile* cf) {
+    cookie_io_functions_t functions = { read_decompressed, NULL, seek_cookie, close_decompressed };
+    return fopencookie(cf, "rb", functions);
+}
+#else
+static int read_cookie(void* cookie, char* buffer, int size) {
+    return (int)read_decompressed(cookie, buffer, (size_t)size);
+}
+
+static fpos_t seek_cookie(void* cookie, fpos_t offset, int whence) {
+    return (fpos_t)seek_decompressed((CompressedFile*)cookie, (long long)offset, whence);
+}
+
+static FILE* open_cookie(CompressedFile* cf) {
+    return funopen(cf, read_cookie, NULL, seek_cookie, close_decompressed);
+}
+#endif
+
+// MARK: opening
+
+static FILE* open_decompressed(FILE* file_handle, enum Compression compression) {
+    CompressedFile* cf = calloc(1, sizeof(CompressedFile));
+    if (cf == NULL) { return NULL; }
+    cf->file_handle = file_handle;
+    cf->compression = compression;
+    cf->input = malloc(READ_BYTES);
+    cf->input_capacity = READ_BYTES;
+    int is_ready = (cf->input != NULL && inflateInit2(&cf->inflater, 16 + MAX_WBITS) == Z_OK);
+    #ifdef VDIFPARSE_ZSTD
+    cf->zstd_context = ZSTD_createDCtx();
+    is_ready = is_ready && cf->zstd_context != NULL;
+    #endif
+    if (!is_ready) {
+        inflateEnd(&cf->inflater);
+        #ifdef VDIFPARSE_ZSTD
+        ZSTD_freeDCtx(cf->zstd_context);
+        #endif
+        free(cf->input);
+        free(cf);
+        return NULL;
+    }
+    pthread_mutex_init(&cf->lock, NULL);
+    pthread_cond_init(&cf->changed, NULL);
+    FILE* decompressed = open_cookie(cf);
+    if (decompressed == NULL) {
+        inflateEnd(&cf->inflater);
+        #ifdef VDIFPARSE_ZSTD
+        ZSTD_freeDCtx(cf->zstd_context);
+        #endif
+        free(cf->input);
+        free(cf);
+        return NULL;
+    }
+    start_threads(cf);
+    return decompressed;
+}
+
+FILE* open_input_file(const char* file_path) {
+    FILE* file_handle = fopen(file_path, "rb");
+    if (file_handle == NULL) { return NULL; }
+    uint8_t magic[4];
+    size_t num_bytes = fread(magic, 1, sizeof(magic), file_handle);
+    fseek(file_handle, 0, SEEK_SET);
+    enum Compression compression = compression_for_magic(magic, num_bytes);
+    if (compression == NoCompression) { return file_handle; }
+    #ifndef VDIFPARSE_ZSTD
+    if (compression == ZstdCompression) {
+        raise_warning("%s is zstd compressed, but vdifparse was built without zstd (build with ZSTD=1).", file_path);
+        fclose(file_handle);
+        return NULL;
+    }
+    #endif
+    FILE* decompressed = open_decompressed(file_handle, compression);
+    if (decompressed == NULL) { fclose(file_handle); }
+    return decompressed;
+}
@@ -0,0 +1,26 @@
+// vdifparse_compress.h - provides transparent reading of gzip (and, if built
+// with ZSTD=1, zstd) compressed files, decompressed on background threads.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+#ifndef VDIFPARSE_COMPRESS_H
+#define VDIFPARSE_COMPRESS_H
+
+#include <stdio.h>
+
+#include "vdifparse_types.h"
+
+FILE* open_input_file(const char* file_path);
+
+#endif // VDIFPARSE_COMPRESS_H
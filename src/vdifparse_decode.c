@@ -15,14 +15,22 @@
 // You should have received a copy of the GNU General Public License along with
 // this program. If not, see <http://www.gnu.org/licenses/>.
 
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "vdifparse_decode.h"
 #include "vdifparse_lookup.h"
+#include "vdifparse_stream.h"
 
 #define REP_OFFSET 0
 #define REP_2sCOMP 1
 #define REP_FLOAT 2
 #define REP_INVALID 3
 
+#define WIDE_SCRATCH_FIELDS 1024
+
 static DecodeChannelMonitor init_channel_monitor() {
     DecodeChannelMonitor channel_monitor = { 0 };
     return channel_monitor;
@@ -37,48 +45,332 @@ DecodeMonitor init_monitor(unsigned long num_channels) {
     return monitor;
 }
 
-int decode_frame(DataStream ds, const DataFrame* df, unsigned long num_samples, float*** out, DecodeMonitor* statistics) {
-    unsigned long decoded_samples = 0;
+static inline const uint8_t* get_payload(const DataFrame* df) {
+    return (df->format == CODIF) ? (const uint8_t*)df->codif->data : (const uint8_t*)df->vdif->data;
+}
+
+// the shape of one frame's samples, shared by every block it is made of
+typedef struct SampleLayout {
+    unsigned int num_components;
+    unsigned long num_channels;
+    unsigned long num_output_channels;
+    unsigned long long block_samples;
+    unsigned long block_bytes;
+    // fields are packed in groups that never straddle a word, so that where 
+    // the groups don't fill a word exactly its top bits are padding
+    unsigned long group_fields;
+    unsigned long groups_per_word;
+    unsigned long word_bits;
+    // channels flagged invalid by a multiplexed (EDV 0x04) frame
+    uint64_t invalid_channels;
+} SampleLayout;
+
+static inline int is_channel_invalid(const SampleLayout* layout, unsigned long channel) {
+    return channel < 64 && ((layout->invalid_channels >> channel) & 0b1);
+}
+
+// two's complement codes become offset binary by flipping the top bit of 
+// each field, which then index the same lookup tables
+static uint8_t get_sign_mask(int encoding, unsigned int num_bits) {
+    if (encoding != REP_2sCOMP) { return 0; }
+    switch (num_bits) {
+        case 1: return 0xff;
+        case 2: return 0xaa;
+        case 4: return 0x88;
+        default: return 0x80;
+    }
+}
+
+// MARK: block decoders
+
+// decodes samples [first_sample, last_sample) of a block of packed fields, 
+// one byte's worth of fields at a time
+static void decode_packed_block(const SampleLayout* layout, const uint8_t* block, float** lookup,
+        unsigned int num_bits, uint8_t sign_mask, unsigned long long first_sample, 
+        unsigned long long last_sample, float** out, unsigned long long out_sample) {
+    unsigned int num_components = layout->num_components;
+    unsigned long num_channels = layout->num_channels;
+    unsigned int fields_per_byte = 8 / num_bits;
+    unsigned long long first_field = first_sample * num_channels * num_components;
+    unsigned long long last_field = last_sample * num_channels * num_components;
+    unsigned long long field = first_field - (first_field % fields_per_byte);
+    unsigned long channel = (field / num_components) % num_channels;
+    unsigned int component = field % num_components;
+    unsigned long long position = out_sample * num_components - first_sample * num_components 
+        + (field / (num_channels * num_components)) * num_components;
+    for (unsigned long long byte = field / fields_per_byte; field < last_field; byte++) {
+        const float* values = lookup[block[byte] ^ sign_mask];
+        for (unsigned int j = 0; j < fields_per_byte; j++, field++) {
+            if (field >= first_field && field < last_field && channel < layout->num_output_channels) {
+                out[channel][position + component] = values[j];
+            }
+            if (++component == num_components) {
+                component = 0;
+                if (++channel == num_channels) {
+                    channel = 0;
+                    position += num_components;
+                }
+            }
+        }
+    }
+}
+
+// samples already stored as floats only need pulling out per channel, which 
+// for a single channel is one straight copy
+static void copy_float_block(const SampleLayout* layout, const uint8_t* block, unsigned long long first_sample,
+        unsigned long long last_sample, float** out, unsigned long long out_sample) {
+    unsigned int num_components = layout->num_components;
+    unsigned long sample_values = layout->num_channels * num_components;
+    unsigned long long num_samples = last_sample - first_sample;
+    size_t value_bytes = num_components * sizeof(float);
+    if (layout->num_channels == 1 && layout->num_output_channels == 1) {
+        memcpy(&out[0][out_sample * num_components], &block[first_sample * value_bytes], num_samples * value_bytes);
+        return;
+    }
+    for (unsigned long channel = 0; channel < layout->num_output_channels; channel++) {
+        if (is_channel_invalid(layout, channel)) { continue; }
+        float* values = &out[channel][out_sample * num_components];
+        const uint8_t* source = &block[(first_sample * sample_values + channel * num_components) * sizeof(float)];
+        for (unsigned long long i = 0; i < num_samples; i++) {
+            memcpy(&values[i * num_components], &source[i * sample_values * sizeof(float)], value_bytes);
+        }
+    }
+}
+
+// wider fields are converted straight from their integer codes, 8 or 4 at a 
+// time where SSE2 is available, with offset binary codes made signed by 
+// flipping their top bit
+static void convert_wide_fields(const uint8_t* bytes, unsigned long num_fields, unsigned int num_bits, 
+        int encoding, float* out) {
+    unsigned long i = 0;
+    if (num_bits == 16) {
+        uint16_t flip = (encoding == REP_OFFSET) ? 0x8000 : 0;
+#ifdef __SSE2__
+        __m128i flips = _mm_set1_epi16((short)flip);
+        for (; i + 8 <= num_fields; i += 8) {
+            __m128i codes = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&bytes[2 * i]), flips);
+            // each code lands in the top half of a 32-bit lane, then is shifted down signed
+            __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(codes, codes), 16);
+            __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(codes, codes), 16);
+            _mm_storeu_ps(&out[i], _mm_cvtepi32_ps(low));
+            _mm_storeu_ps(&out[i + 4], _mm_cvtepi32_ps(high));
+        }
+#endif
+        for (; i < num_fields; i++) {
+            uint16_t code;
+            memcpy(&code, &bytes[2 * i], sizeof(uint16_t));
+            out[i] = (float)(int16_t)(code ^ flip);
+        }
+    } else {
+        uint32_t flip = (encoding == REP_OFFSET) ? 0x80000000 : 0;
+#ifdef __SSE2__
+        __m128i flips = _mm_set1_epi32((int)flip);
+        for (; i + 4 <= num_fields; i += 4) {
+            __m128i codes = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&bytes[4 * i]), flips);
+            _mm_storeu_ps(&out[i], _mm_cvtepi32_ps(codes));
+        }
+#endif
+        for (; i < num_fields; i++) {
+            uint32_t code;
+            memcpy(&code, &bytes[4 * i], sizeof(uint32_t));
+            out[i] = (float)(int32_t)(code ^ flip);
+        }
+    }
+}
+
+// decodes a block of 16 or 32-bit fields, a run of whole samples at a time 
+// before handing each selected channel its share
+static void decode_wide_block(const SampleLayout* layout, const uint8_t* block, unsigned int num_bits, 
+        int encoding, unsigned long long first_sample, unsigned long long last_sample, 
+        float** out, unsigned long long out_sample) {
+    unsigned int num_components = layout->num_components;
+    unsigned long sample_fields = layout->num_channels * num_components;
+    unsigned int field_bytes = num_bits / 8;
+    if (layout->num_channels == 1 && layout->num_output_channels == 1) {
+        convert_wide_fields(&block[first_sample * sample_fields * field_bytes], (last_sample - first_sample) * sample_fields,
+            num_bits, encoding, &out[0][out_sample * num_components]);
+        return;
+    }
+    float scratch[WIDE_SCRATCH_FIELDS];
+    unsigned long chunk_samples = WIDE_SCRATCH_FIELDS / sample_fields;
+    if (chunk_samples == 0) {
+        // too many channels to stage even one sample, so go channel by channel
+        for (unsigned long long i = first_sample; i < last_sample; i++) {
+            for (unsigned long channel = 0; channel < layout->num_output_channels; channel++) {
+                if (is_channel_invalid(layout, channel)) { continue; }
+                convert_wide_fields(&block[(i * sample_fields + channel * num_components) * field_bytes], num_components,
+                    num_bits, encoding, &out[channel][(out_sample + i - first_sample) * num_components]);
+            }
+        }
+        return;
+    }
+    for (unsigned long long i = first_sample; i < last_sample; i += chunk_samples) {
+        unsigned long num_samples = (last_sample - i < chunk_samples) ? last_sample - i : chunk_samples;
+        convert_wide_fields(&block[i * sample_fields * field_bytes], num_samples * sample_fields, num_bits, encoding, scratch);
+        for (unsigned long channel = 0; channel < layout->num_output_channels; channel++) {
+            if (is_channel_invalid(layout, channel)) { continue; }
+            float* values = &out[channel][(out_sample + i - first_sample) * num_components];
+            for (unsigned long j = 0; j < num_samples; j++) {
+                memcpy(&values[j * num_components], &scratch[j * sample_fields + channel * num_components], 
+                    num_components * sizeof(float));
+            }
+        }
+    }
+}
+
+static inline uint32_t extract_field(const uint8_t* block, unsigned long long bit, unsigned int num_bits) {
+    // only read the bytes the field touches, so as not to run off the block
+    unsigned int num_bytes = ((bit & 7) + num_bits + 7) / 8;
+    const uint8_t* bytes = &block[bit >> 3];
+    uint64_t window = 0;
+    for (unsigned int i = 0; i < num_bytes; i++) {
+        window |= (uint64_t)bytes[i] << (8 * i);
+    }
+    return (window >> (bit & 7)) & ((1ULL << num_bits) - 1);
+}
+
+// decodes fields of widths that don't pack evenly into bytes, pulling each 
+// out of the bitstream by its word, group and position in the group
+static void decode_unaligned_block(const SampleLayout* layout, const uint8_t* block, unsigned int num_bits, 
+        int encoding, unsigned long long first_sample, unsigned long long last_sample, 
+        float** out, unsigned long long out_sample) {
+    unsigned int num_components = layout->num_components;
+    unsigned long sample_fields = layout->num_channels * num_components;
+    int64_t sign = 1LL << (num_bits - 1);
+    uint32_t flip = (encoding == REP_2sCOMP) ? (uint32_t)sign : 0;
+    for (unsigned long long i = first_sample; i < last_sample; i++) {
+        unsigned long long position = (out_sample + i - first_sample) * num_components;
+        for (unsigned long channel = 0; channel < layout->num_output_channels; channel++) {
+            if (is_channel_invalid(layout, channel)) { continue; }
+            for (unsigned int component = 0; component < num_components; component++) {
+                unsigned long long field = i * sample_fields + channel * num_components + component;
+                unsigned long long group = field / layout->group_fields;
+                unsigned long long bit = (group / layout->groups_per_word) * layout->word_bits
+                    + ((group % layout->groups_per_word) * layout->group_fields + field % layout->group_fields) * num_bits;
+                uint32_t code = extract_field(block, bit, num_bits);
+                out[channel][position + component] = (float)((int64_t)(code ^ flip) - sign);
+            }
+        }
+    }
+}
+
+// MARK: frame decoding
+
+int decode_frame(const DataStream* ds, const DataFrame* df, unsigned long num_samples, float** out, 
+        unsigned long out_offset, DecodeMonitor* statistics) {
     int encoding = REP_OFFSET;
     if (df->format == CODIF) {
         encoding = df->codif->header->sample_representation;
     }
-    
-    unsigned long long first_sample = 0; 
-    // TODO scrub for cursor if mid-frame
+    if (encoding >= REP_INVALID) { return FAILURE; }
+
+    // pick up where the last call left off, if that was mid-frame
+    unsigned long long first_sample = ds->frame_cursor;
     unsigned long long frame_samples = get_num_samples(*df);
-    // TODO what to do if not encoded? e.g. CODIF float type?
-    float** lookup = get_lookup_table(get_bits_per_sample(*df), get_data_type(*df));
-    // TODO wth do you do if a sample size if over 1 byte?
-
-    // iterate over frame samples
-
-    for (int i = first_sample; i < get_num_samples(*df); i++) {
-        // TODO remove
-        unsigned long word = df->vdif->data[i / 8];
-        float* byte = lookup[word & 0xff];
-        (*out)[0][decoded_samples] = byte[0];
-        (*out)[1][decoded_samples] = byte[1];
-        decoded_samples++;
-        (*out)[0][decoded_samples] = byte[2];
-        (*out)[1][decoded_samples] = byte[3];
-        decoded_samples++;
-        byte = lookup[(word >> 8) & 0xff];
-        (*out)[0][decoded_samples] = byte[0];
-        (*out)[1][decoded_samples] = byte[1];
-        decoded_samples++;
-        (*out)[0][decoded_samples] = byte[2];
-        (*out)[1][decoded_samples] = byte[3];
-        decoded_samples++;
-        if (decoded_samples >= num_samples) {
-            break;
+    unsigned int num_bits = get_bits_per_sample(*df);
+    if (num_bits == 0 || num_bits > 32) { return FAILURE; }
+    float** lookup = NULL;
+    if (encoding == REP_FLOAT) {
+        if (num_bits != 8 * sizeof(float)) { return FAILURE; }
+    } else if (8 % num_bits == 0) {
+        // narrow samples are quantised to a few levels, so are looked up
+        lookup = get_lookup_table(num_bits, RealData);
+        if (lookup == NULL) { return FAILURE; }
+    }
+
+    // complex samples are just pairs of real components (I then Q), so each 
+    // channel's output gets them interleaved
+    SampleLayout layout = { (get_data_type(*df) == ComplexData) ? 2 : 1 };
+    layout.num_channels = get_num_channels(*df);
+    layout.num_output_channels = (ds->num_selected_channels < layout.num_channels) ? 
+        ds->num_selected_channels : layout.num_channels;
+    layout.block_samples = get_block_samples(*df);
+    layout.block_bytes = get_sample_block_bytes(*df);
+    layout.invalid_channels = get_invalid_channel_mask(*df);
+    if (layout.block_samples == 0) { return FAILURE; }
+    unsigned long long sample_bits = (unsigned long long)num_bits * layout.num_components * layout.num_channels;
+    if (layout.block_samples * sample_bits == layout.block_bytes * 8ULL) {
+        // blocks without padding run on into each other, so decode them as one
+        layout.block_samples = frame_samples;
+        layout.block_bytes = get_data_length(*df);
+    }
+    if (df->format == CODIF) {
+        // a block's samples are packed end to end, so it is all one word
+        layout.group_fields = layout.num_channels * layout.num_components;
+        layout.groups_per_word = layout.block_samples;
+        layout.word_bits = layout.block_bytes * 8;
+    } else {
+        // VDIF packs whole samples into 32-bit words if they fit, otherwise 
+        // each channel's sample (both components, if complex), otherwise 
+        // each component alone
+        unsigned long long unit_bits = num_bits * layout.num_components;
+        if (sample_bits <= 32) {
+            layout.group_fields = layout.num_channels * layout.num_components;
+            layout.groups_per_word = 32 / sample_bits;
+        } else if (unit_bits <= 32) {
+            layout.group_fields = layout.num_components;
+            layout.groups_per_word = 32 / unit_bits;
+        } else {
+            layout.group_fields = 1;
+            layout.groups_per_word = 1;
+        }
+        layout.word_bits = 32;
+    }
+    unsigned int num_components = layout.num_components;
+    unsigned long num_output_channels = layout.num_output_channels;
+    unsigned long long last_sample = (frame_samples - first_sample < num_samples) ? frame_samples : first_sample + num_samples;
+
+    if (is_frame_invalid(*df)) {
+        // data of an invalid (or inserted) frame is meaningless, so give zeros
+        unsigned long long first_position = out_offset * num_components;
+        unsigned long long num_values = (last_sample - first_sample) * num_components;
+        for (unsigned long i = 0; i < num_output_channels; i++) {
+            memset(&out[i][first_position], 0, num_values * sizeof(float));
+            statistics->channels[i].num_decoded_samples += last_sample - first_sample;
+            statistics->channels[i].num_invalid_samples += last_sample - first_sample;
+            statistics->channels[i].num_invalid_frames += (last_sample == frame_samples);
+        }
+        return last_sample - first_sample;
+    }
+
+    // samples never straddle blocks, but blocks may end in padding (CODIF), 
+    // so go block by block; a VDIF frame is a single block
+    const uint8_t* payload = get_payload(df);
+    uint8_t sign_mask = get_sign_mask(encoding, num_bits);
+    unsigned long long out_sample = out_offset;
+    for (unsigned long long block = first_sample / layout.block_samples; 
+            block * layout.block_samples < last_sample; block++) {
+        unsigned long long block_start = block * layout.block_samples;
+        unsigned long long block_first = (first_sample > block_start) ? first_sample - block_start : 0;
+        unsigned long long block_last = (last_sample - block_start < layout.block_samples) ? 
+            last_sample - block_start : layout.block_samples;
+        const uint8_t* block_bytes = &payload[block * layout.block_bytes];
+        if (encoding == REP_FLOAT) {
+            copy_float_block(&layout, block_bytes, block_first, block_last, out, out_sample);
+        } else if (lookup != NULL) {
+            decode_packed_block(&layout, block_bytes, lookup, num_bits, sign_mask, block_first, block_last, out, out_sample);
+        } else if (num_bits == 16 || num_bits == 32) {
+            decode_wide_block(&layout, block_bytes, num_bits, encoding, block_first, block_last, out, out_sample);
+        } else {
+            decode_unaligned_block(&layout, block_bytes, num_bits, encoding, block_first, block_last, out, out_sample);
+        }
+        out_sample += block_last - block_first;
+    }
+    unsigned long decoded_samples = last_sample - first_sample;
+    for (unsigned long i = 0; i < num_output_channels; i++) {
+        statistics->channels[i].num_decoded_samples += decoded_samples;
+        if (is_channel_invalid(&layout, i)) {
+            // an invalid channel's data is as meaningless as an invalid frame's, 
+            // so blank whatever the interleaved kernels wrote there
+            memset(&out[i][out_offset * num_components], 0, decoded_samples * num_components * sizeof(float));
+            statistics->channels[i].num_invalid_samples += decoded_samples;
+            statistics->channels[i].num_invalid_frames += (last_sample == frame_samples);
+        } else {
+            statistics->channels[i].num_decoded_frames += (last_sample == frame_samples);
         }
     }
-    // TODO remove
-    statistics->channels[0].num_decoded_samples += decoded_samples;
-    statistics->channels[1].num_decoded_samples += decoded_samples;
 
     // TODO some sort of "incorporate partial result" function (for thread safety) here
 
     return decoded_samples;
-}
\ No newline at end of file
+}
@@ -20,6 +20,7 @@
 #include "vdifparse_types.h"
 
 DecodeMonitor init_monitor(unsigned long num_channels);
-int decode_frame(DataStream ds, const DataFrame* df, unsigned long num_samples, float*** out, DecodeMonitor* statistics);
+int decode_frame(const DataStream* ds, const DataFrame* df, unsigned long num_samples, float** out, 
+    unsigned long out_offset, DecodeMonitor* statistics);
 
 #endif // VDIFPARSE_DECODE_H
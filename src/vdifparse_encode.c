@@ -0,0 +1,146 @@
+// vdifparse_encode.c - provides functions to quantise (real or complex) float
+// arrays to the offset binary-encoded sample representations of frame data.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "vdifparse_encode.h"
+#include "vdifparse_lookup.h"
+
+// thresholds sit halfway between the levels in vdifparse_lookup.c, so that
+// encoding a decoded value always gives back the same code
+#define TWO_BIT_THRESHOLD ((1.0 + M5A_2BIT_HIGH) / 2.0)
+
+// MARK: scalar quantisers
+
+static inline uint8_t quantise_1bit(float value) {
+    return value >= 0.0f;
+}
+
+static inline uint8_t quantise_2bit(float value) {
+    return (value >= -TWO_BIT_THRESHOLD) + (value >= 0.0f) + (value >= TWO_BIT_THRESHOLD);
+}
+
+static inline uint8_t quantise_scaled(float value, float scale, float offset, long max_code) {
+    long code = lrintf(value * scale + offset);
+    return (code < 0) ? 0 : ((code > max_code) ? max_code : code);
+}
+
+static inline uint8_t quantise(float value, unsigned int num_bits) {
+    switch (num_bits) {
+        case 1: return quantise_1bit(value);
+        case 2: return quantise_2bit(value);
+        case 4: return quantise_scaled(value, FOUR_BIT_1_SIGMA, 8.0f, 15);
+        default: return quantise_scaled(value, EIGHT_BIT_1_SIGMA, 128.0f, 255);
+    }
+}
+
+static void encode_scalar(const float* values, unsigned long num_values, unsigned int num_bits, uint8_t* out) {
+    unsigned int fields_per_byte = 8 / num_bits;
+    for (unsigned long i = 0; i < num_values; i += fields_per_byte) {
+        uint8_t byte = 0;
+        for (unsigned int j = 0; j < fields_per_byte; j++) {
+            byte |= quantise(values[i + j], num_bits) << (num_bits * j);
+        }
+        *out++ = byte;
+    }
+}
+
+// MARK: vector quantisers
+
+#ifdef __SSE2__
+// 16 codes (each < 256, one per 32-bit lane across 4 vectors) to 16 bytes
+static inline __m128i narrow_codes(__m128i a, __m128i b, __m128i c, __m128i d) {
+    return _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+}
+
+static inline __m128i scaled_codes(const float* values, float scale, float offset) {
+    __m128 scales = _mm_set1_ps(scale);
+    __m128 offsets = _mm_set1_ps(offset);
+    __m128i codes[4];
+    for (int i = 0; i < 4; i++) {
+        __m128 scaled = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&values[4 * i]), scales), offsets);
+        codes[i] = _mm_cvtps_epi32(scaled);
+    }
+    // saturating packs clamp to [0, 255] on the way down
+    return narrow_codes(codes[0], codes[1], codes[2], codes[3]);
+}
+
+// quantises 16 values, returning the number of bytes written
+static inline int encode_block(const float* values, unsigned int num_bits, uint8_t* out) {
+    __m128i zero = _mm_setzero_si128();
+    switch (num_bits) {
+        case 1: {
+            unsigned int bits = 0;
+            for (int i = 0; i < 4; i++) {
+                __m128 is_positive = _mm_cmpge_ps(_mm_loadu_ps(&values[4 * i]), _mm_setzero_ps());
+                bits |= _mm_movemask_ps(is_positive) << (4 * i);
+            }
+            out[0] = bits & 0xff;
+            out[1] = bits >> 8;
+            return 2;
+        }
+        case 2: {
+            __m128 low = _mm_set1_ps(-TWO_BIT_THRESHOLD);
+            __m128 high = _mm_set1_ps(TWO_BIT_THRESHOLD);
+            __m128i codes[4];
+            for (int i = 0; i < 4; i++) {
+                __m128 v = _mm_loadu_ps(&values[4 * i]);
+                // each true comparison is -1, so subtracting them counts thresholds passed
+                __m128i count = _mm_sub_epi32(zero, _mm_castps_si128(_mm_cmpge_ps(v, low)));
+                count = _mm_sub_epi32(count, _mm_castps_si128(_mm_cmpge_ps(v, _mm_setzero_ps())));
+                codes[i] = _mm_sub_epi32(count, _mm_castps_si128(_mm_cmpge_ps(v, high)));
+            }
+            // 4 codes per 32-bit lane become 1 byte: c0 | c1 << 2 | c2 << 4 | c3 << 6
+            __m128i lanes = narrow_codes(codes[0], codes[1], codes[2], codes[3]);
+            __m128i packed = _mm_or_si128(_mm_or_si128(lanes, _mm_srli_epi32(lanes, 6)),
+                _mm_or_si128(_mm_srli_epi32(lanes, 12), _mm_srli_epi32(lanes, 18)));
+            packed = _mm_and_si128(packed, _mm_set1_epi32(0xff));
+            packed = _mm_packus_epi16(_mm_packs_epi32(packed, zero), zero);
+            uint32_t bytes = _mm_cvtsi128_si32(packed);
+            for (int i = 0; i < 4; i++) {
+                out[i] = (bytes >> (8 * i)) & 0xff;
+            }
+            return 4;
+        }
+        case 4: {
+            __m128i codes = _mm_min_epu8(scaled_codes(values, FOUR_BIT_1_SIGMA, 8.0f), _mm_set1_epi8(15));
+            // 2 codes per 16-bit lane become 1 byte: c0 | c1 << 4
+            __m128i packed = _mm_and_si128(_mm_or_si128(codes, _mm_srli_epi16(codes, 4)), _mm_set1_epi16(0xff));
+            _mm_storel_epi64((__m128i*)out, _mm_packus_epi16(packed, zero));
+            return 8;
+        }
+        default:
+            _mm_storeu_si128((__m128i*)out, scaled_codes(values, EIGHT_BIT_1_SIGMA, 128.0f));
+            return 16;
+    }
+}
+#endif
+
+int encode_values(const float* values, unsigned long num_values, unsigned int num_bits, uint8_t* out) {
+    if (num_bits != 1 && num_bits != 2 && num_bits != 4 && num_bits != 8) { return FAILURE; }
+    unsigned long i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= num_values; i += 16) {
+        out += encode_block(&values[i], num_bits, out);
+    }
+#endif
+    encode_scalar(&values[i], num_values - i, num_bits, out);
+    return SUCCESS;
+}
@@ -0,0 +1,24 @@
+// vdifparse_encode.h - provides functions to quantise (real or complex) float
+// arrays to the offset binary-encoded sample representations of frame data.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later 
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT 
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+#ifndef VDIFPARSE_ENCODE_H
+#define VDIFPARSE_ENCODE_H
+
+#include "vdifparse_types.h"
+
+int encode_values(const float* values, unsigned long num_values, unsigned int num_bits, uint8_t* out);
+
+#endif // VDIFPARSE_ENCODE_H
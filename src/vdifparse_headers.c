@@ -0,0 +1,165 @@
+// vdifparse_headers.c - provides functions to decode the headers of many
+// frames at once, into one array per header field.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "vdifparse_headers.h"
+
+// Fields are taken from the header words with explicit shifts and masks,
+// rather than through the VDIFHeader and CODIFHeader bitfields, whose layout
+// is up to the compiler. Both formats store their words little-endian.
+
+#define CODIF_HEADER_BYTES (sizeof(CODIFHeader) + CODIF_METADATA_BYTES)
+
+static inline uint32_t load_le_word(const uint8_t* bytes) {
+    uint32_t word;
+    memcpy(&word, bytes, sizeof(uint32_t));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap32(word);
+#endif
+    return word;
+}
+
+// MARK: one header at a time
+
+static void unpack_vdif_header(const uint8_t* bytes, HeaderBatch* hb, unsigned long i) {
+    uint32_t word0 = load_le_word(&bytes[0]);
+    uint32_t word1 = load_le_word(&bytes[4]);
+    uint32_t word2 = load_le_word(&bytes[8]);
+    uint32_t word3 = load_le_word(&bytes[12]);
+    hb->seconds_from_epoch[i] = word0 & 0x3fffffff;
+    hb->invalid[i] = word0 >> 31;
+    hb->frame_number[i] = word1 & 0xffffff;
+    hb->reference_epoch[i] = (word1 >> 24) & 0x3f;
+    hb->frame_length[i] = (word2 & 0xffffff) * 8;
+    hb->station_id[i] = word3 & 0xffff;
+    hb->thread_id[i] = (word3 >> 16) & 0x3ff;
+}
+
+static void unpack_codif_header(const uint8_t* bytes, HeaderBatch* hb, unsigned long i) {
+    uint32_t word2 = load_le_word(&bytes[8]);
+    hb->frame_number[i] = load_le_word(&bytes[0]);
+    hb->seconds_from_epoch[i] = load_le_word(&bytes[4]);
+    hb->reference_epoch[i] = word2 & 0xff;
+    hb->invalid[i] = (word2 >> 17) & 0b1;
+    hb->thread_id[i] = load_le_word(&bytes[16]) & 0xffff;
+    hb->station_id[i] = load_le_word(&bytes[20]) >> 16;
+    hb->frame_length[i] = load_le_word(&bytes[28]) * 8 + CODIF_HEADER_BYTES;
+}
+
+// MARK: four headers at a time
+
+#ifdef __SSE2__
+// loads the same four words from each of four headers, then transposes them
+// so that each vector holds one word of all four headers
+static inline void load_header_words(const uint8_t* bytes, unsigned long stride, unsigned int offset, __m128i words[4]) {
+    __m128i row0 = _mm_loadu_si128((const __m128i*)&bytes[offset]);
+    __m128i row1 = _mm_loadu_si128((const __m128i*)&bytes[stride + offset]);
+    __m128i row2 = _mm_loadu_si128((const __m128i*)&bytes[2 * stride + offset]);
+    __m128i row3 = _mm_loadu_si128((const __m128i*)&bytes[3 * stride + offset]);
+    __m128i low01 = _mm_unpacklo_epi32(row0, row1);
+    __m128i low23 = _mm_unpacklo_epi32(row2, row3);
+    __m128i high01 = _mm_unpackhi_epi32(row0, row1);
+    __m128i high23 = _mm_unpackhi_epi32(row2, row3);
+    words[0] = _mm_unpacklo_epi64(low01, low23);
+    words[1] = _mm_unpackhi_epi64(low01, low23);
+    words[2] = _mm_unpacklo_epi64(high01, high23);
+    words[3] = _mm_unpackhi_epi64(high01, high23);
+}
+
+static inline __m128i mask_words(__m128i words, unsigned int shift, uint32_t mask) {
+    return _mm_and_si128(_mm_srli_epi32(words, shift), _mm_set1_epi32((int)mask));
+}
+
+static inline void store_words(uint32_t* out, __m128i words) {
+    _mm_storeu_si128((__m128i*)out, words);
+}
+
+static inline void store_half_words(uint16_t* out, __m128i words) {
+    // SSE2 only packs with signed saturation, so shift into the signed range first
+    __m128i packed = _mm_packs_epi32(_mm_sub_epi32(words, _mm_set1_epi32(0x8000)), _mm_setzero_si128());
+    _mm_storel_epi64((__m128i*)out, _mm_add_epi16(packed, _mm_set1_epi16((short)0x8000)));
+}
+
+static inline void store_bytes(uint8_t* out, __m128i words) {
+    __m128i packed = _mm_packs_epi32(words, _mm_setzero_si128());
+    uint32_t four_bytes = (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(packed, _mm_setzero_si128()));
+    memcpy(out, &four_bytes, sizeof(uint32_t));
+}
+
+static void unpack_vdif_headers_x4(const uint8_t* bytes, unsigned long stride, HeaderBatch* hb, unsigned long i) {
+    __m128i words[4];
+    load_header_words(bytes, stride, 0, words);
+    store_words(&hb->seconds_from_epoch[i], mask_words(words[0], 0, 0x3fffffff));
+    store_bytes(&hb->invalid[i], _mm_srli_epi32(words[0], 31));
+    store_words(&hb->frame_number[i], mask_words(words[1], 0, 0xffffff));
+    store_bytes(&hb->reference_epoch[i], mask_words(words[1], 24, 0x3f));
+    store_words(&hb->frame_length[i], _mm_slli_epi32(mask_words(words[2], 0, 0xffffff), 3));
+    store_half_words(&hb->station_id[i], mask_words(words[3], 0, 0xffff));
+    store_half_words(&hb->thread_id[i], mask_words(words[3], 16, 0x3ff));
+}
+
+static void unpack_codif_headers_x4(const uint8_t* bytes, unsigned long stride, HeaderBatch* hb, unsigned long i) {
+    __m128i words[4];
+    load_header_words(bytes, stride, 0, words);
+    store_words(&hb->frame_number[i], words[0]);
+    store_words(&hb->seconds_from_epoch[i], words[1]);
+    store_bytes(&hb->reference_epoch[i], mask_words(words[2], 0, 0xff));
+    store_bytes(&hb->invalid[i], mask_words(words[2], 17, 0b1));
+    load_header_words(bytes, stride, 16, words);
+    store_half_words(&hb->thread_id[i], mask_words(words[0], 0, 0xffff));
+    store_half_words(&hb->station_id[i], _mm_srli_epi32(words[1], 16));
+    store_words(&hb->frame_length[i], _mm_add_epi32(_mm_slli_epi32(words[3], 3),
+        _mm_set1_epi32(CODIF_HEADER_BYTES)));
+}
+#endif
+
+// MARK: batch decode
+
+// decodes the headers of frames laid out every stride bytes, appending them
+// to the batch for as long as it has room; offsets and file indices are left
+// for the caller, which knows where the bytes came from
+unsigned long unpack_headers(enum DataFormat format, const uint8_t* bytes, unsigned long stride,
+        unsigned long num_frames, HeaderBatch* hb) {
+    if (num_frames > hb->capacity - hb->num_headers) {
+        num_frames = hb->capacity - hb->num_headers;
+    }
+    unsigned long first = hb->num_headers;
+    unsigned long i = 0;
+#ifdef __SSE2__
+    for (; i + 4 <= num_frames; i += 4) {
+        if (format == CODIF) {
+            unpack_codif_headers_x4(&bytes[i * stride], stride, hb, first + i);
+        } else {
+            unpack_vdif_headers_x4(&bytes[i * stride], stride, hb, first + i);
+        }
+    }
+#endif
+    for (; i < num_frames; i++) {
+        if (format == CODIF) {
+            unpack_codif_header(&bytes[i * stride], hb, first + i);
+        } else {
+            unpack_vdif_header(&bytes[i * stride], hb, first + i);
+        }
+    }
+    hb->format = format;
+    hb->num_headers += num_frames;
+    return num_frames;
+}
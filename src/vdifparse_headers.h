@@ -0,0 +1,25 @@
+// vdifparse_headers.h - provides functions to decode the headers of many
+// frames at once, into one array per header field.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+#ifndef VDIFPARSE_HEADERS_H
+#define VDIFPARSE_HEADERS_H
+
+#include "vdifparse_types.h"
+
+unsigned long unpack_headers(enum DataFormat format, const uint8_t* bytes, unsigned long stride,
+    unsigned long num_frames, HeaderBatch* hb);
+
+#endif // VDIFPARSE_HEADERS_H
@@ -16,41 +16,264 @@
 // this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <ctype.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "vdifparse_input.h"
+#include "vdifparse_affinity.h"
+#include "vdifparse_checksum.h"
+#include "vdifparse_compress.h"
+#include "vdifparse_headers.h"
+#include "vdifparse_quality.h"
+#include "vdifparse_memory.h"
+#include "vdifparse_sequence.h"
+#include "vdifparse_metrics.h"
+#include "vdifparse_stream.h"
 #include "vdifparse_utils.h"
 
-static enum DataFormat peek_format(const uint8_t* bytes) {
-    // TODO scrub for synch fields first? or assume good?
-    uint8_t legacy_mode = (bytes[0] >> 1) & 0b1;
-    uint8_t version = bytes[4] & 0b111;
+#define MAX_HEADER_BYTES 64
+#define RESYNC_CHUNK_BYTES (1 << 20)
+#define ORDER_PEEK_BYTES (1 << 16)
+#define PREFETCH_BYTES (1 << 22)
+#define SCAN_CHUNK_BYTES (1 << 22)
+
+// MARK: header plausibility
+
+static inline uint32_t load_word(const uint8_t* bytes) {
+    uint32_t word;
+    memcpy(&word, bytes, sizeof(uint32_t));
+    return word;
+}
+
+static inline uint16_t load_half_word(const uint8_t* bytes) {
+    uint16_t half_word;
+    memcpy(&half_word, bytes, sizeof(uint16_t));
+    return half_word;
+}
+
+static unsigned int header_length_for_format(enum DataFormat format) {
+    switch (format) {
+        case VDIF_LEGACY: return 16;
+        case VDIF: return 32;
+        case CODIF: return 64;
+    }
+    return 0;
+}
+
+// the top 3 bits of word 2 are the VDIF version, which CODIF sets to all 1s
+static int infer_format(const uint8_t* bytes, enum DataFormat* format) {
+    uint8_t version = bytes[11] >> 5;
+    uint8_t legacy_mode = (bytes[3] >> 6) & 0b1;
     if (version == 0 || version == 1) {
-        return (legacy_mode) ? VDIF_LEGACY : VDIF;
-    } else if (version == 7) {
-        return CODIF;
+        *format = (legacy_mode) ? VDIF_LEGACY : VDIF;
+    } else if (version == CODIF_VERSION) {
+        *format = CODIF;
     } else {
-        raise_exception("file format could not be inferred.");
-        return VDIF; // to silence the compiler
+        return UNRECOGNISED_VERSION;
+    }
+    return SUCCESS;
+}
+
+static unsigned int frame_length_for_header(enum DataFormat format, const uint8_t* bytes) {
+    if (format == CODIF) {
+        return load_word(&bytes[28]) * 8 + header_length_for_format(format);
+    }
+    return (load_word(&bytes[8]) & 0xffffff) * 8;
+}
+
+static FrameSignature signature_for_header(enum DataFormat format, const uint8_t* bytes) {
+    FrameSignature sig = { header_length_for_format(format) };
+    sig.frame_length = frame_length_for_header(format, bytes);
+    if (format == CODIF) {
+        sig.key_offset = 28; // data array length
+        sig.reference_epoch = bytes[8];
+        sig.station_id = load_half_word(&bytes[22]);
+        sig.synch_offset = 40;
+        if (load_word(&bytes[40]) == CODIF_SYNCH_PATTERN) {
+            sig.synch_pattern = CODIF_SYNCH_PATTERN;
+        }
+    } else {
+        sig.key_offset = 8; // frame length, channels and version
+        sig.reference_epoch = bytes[7] & 0x3f;
+        sig.station_id = load_half_word(&bytes[12]);
+        sig.synch_offset = 20;
+        uint8_t edv = bytes[19];
+        if (format == VDIF && (edv == NICT || edv == NRAO || edv == Multiplex) 
+                && load_word(&bytes[20]) == VDIF_SYNCH_PATTERN) {
+            sig.synch_pattern = VDIF_SYNCH_PATTERN;
+        }
     }
+    sig.key_word = load_word(&bytes[sig.key_offset]);
+    return sig;
+}
+
+int is_plausible_header(const DataStream* ds, const uint8_t* bytes) {
+    const FrameSignature* sig = &ds->signature;
+    if (load_word(&bytes[sig->key_offset]) != sig->key_word) { return 0; }
+    if (sig->synch_pattern && load_word(&bytes[sig->synch_offset]) != sig->synch_pattern) { return 0; }
+    if (ds->format == CODIF) {
+        return (bytes[11] >> 5) == CODIF_VERSION && bytes[8] == sig->reference_epoch
+            && load_half_word(&bytes[22]) == sig->station_id;
+    }
+    uint8_t legacy_mode = (bytes[3] >> 6) & 0b1;
+    return legacy_mode == (ds->format == VDIF_LEGACY) && (bytes[7] & 0x3f) == sig->reference_epoch
+        && load_half_word(&bytes[12]) == sig->station_id;
+}
+
+// find the first header start in [start, end) whose signature key word 
+// matches, comparing 16 byte offsets at a time where SSE2 is available
+static long find_key_word(const uint8_t* bytes, long start, long end, const FrameSignature* sig) {
+    const uint8_t* keys = bytes + sig->key_offset;
+    long i = start;
+#ifdef __SSE2__
+    __m128i target = _mm_set1_epi32((int)sig->key_word);
+    // each unaligned load compares 4 words, so 4 staggered loads cover 16 offsets
+    for (; i + 16 + 3 <= end; i += 16) {
+        unsigned int matches = 0;
+        for (int j = 0; j < 4; j++) {
+            __m128i words = _mm_loadu_si128((const __m128i*)(keys + i + j));
+            unsigned int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(words, target)));
+            for (int k = 0; k < 4; k++) {
+                matches |= ((mask >> k) & 0b1) << (4 * k + j);
+            }
+        }
+        if (matches) {
+            return i + __builtin_ctz(matches);
+        }
+    }
+#endif
+    for (; i < end; i++) {
+        if (load_word(keys + i) == sig->key_word) { return i; }
+    }
+    return -1;
+}
+
+// MARK: resynchronisation
+
+static int resync_file(DataStream* ds, long bad_offset) {
+    FILE* file_handle = get_file_handle(ds->input);
+    const FrameSignature* sig = &ds->signature;
+    // a damaged file may need many resyncs, so the chunk is kept for the next
+    if (ds->resync_chunk == NULL) {
+        ds->resync_chunk = malloc(RESYNC_CHUNK_BYTES);
+        if (ds->resync_chunk == NULL) { return FAILED_MALLOC; }
+    }
+    uint8_t* chunk = ds->resync_chunk;
+    long chunk_start = bad_offset + 1;
+    int status = REACHED_END_OF_FILE;
+    while (1) {
+        fseek(file_handle, chunk_start, SEEK_SET);
+        long num_bytes = (long)fread(chunk, 1, RESYNC_CHUNK_BYTES, file_handle);
+        METRIC_ADD(ds, num_bytes_read, num_bytes);
+        // candidate headers must lie wholly within the chunk
+        long end = num_bytes - (long)sig->header_length + 1;
+        long position = (end > 0) ? find_key_word(chunk, 0, end, sig) : -1;
+        while (position >= 0) {
+            long next_header = position + sig->frame_length;
+            if (is_plausible_header(ds, &chunk[position]) && (next_header + sig->header_length > num_bytes
+                    || is_plausible_header(ds, &chunk[next_header]))) {
+                break;
+            }
+            position = find_key_word(chunk, position + 1, end, sig);
+        }
+        if (position >= 0) {
+            ds->num_discarded_bytes += (chunk_start + position) - bad_offset;
+            ds->num_resyncs++;
+            fseek(file_handle, chunk_start + position, SEEK_SET);
+            status = SUCCESS;
+            break;
+        }
+        if (num_bytes < RESYNC_CHUNK_BYTES) {
+            ds->num_discarded_bytes += (chunk_start + num_bytes) - bad_offset;
+            break;
+        }
+        // overlap chunks so that a header straddling the boundary is not missed
+        chunk_start += end;
+    }
+    return status;
+}
+
+// MARK: file input
+
+// takes the format, frame signature and channel layout of the stream from
+// its first frame header
+static void identify_stream(DataStream* ds, enum DataFormat format, const uint8_t* bytes) {
+    ds->format = format;
+    ds->signature = signature_for_header(format, bytes);
+    // until told otherwise, decode every channel of the first frame
+    unsigned long num_channels;
+    if (format == CODIF) {
+        num_channels = load_half_word(&bytes[24]);
+        ds->data_type = (enum DataType)((bytes[10] >> 2) & 0b1);
+    } else {
+        num_channels = 1UL << (bytes[11] & 0x1f);
+        ds->data_type = (enum DataType)(bytes[15] >> 7);
+    }
+    if (ds->num_selected_channels == 0) {
+        ds->num_selected_channels = num_channels;
+    }
+}
+
+// returns offset of first frame header whose length is consistent with the 
+// header following it, or -1 if no such frame could be found
+static long find_first_frame(const uint8_t* bytes, long num_bytes, enum DataFormat* format) {
+    for (long i = 0; i + MAX_HEADER_BYTES <= num_bytes; i++) {
+        if (infer_format(&bytes[i], format) != SUCCESS) { continue; }
+        unsigned int header_length = header_length_for_format(*format);
+        unsigned long frame_length = frame_length_for_header(*format, &bytes[i]);
+        if (frame_length <= header_length) { continue; }
+        FrameSignature sig = signature_for_header(*format, &bytes[i]);
+        long next_header = i + frame_length;
+        if (next_header + MAX_HEADER_BYTES > num_bytes) {
+            // can't check consistency, so only trust a frame at the very start
+            if (i == 0) { return i; }
+            continue;
+        }
+        if (load_word(&bytes[next_header + sig.key_offset]) == sig.key_word) { return i; }
+    }
+    return -1;
+}
+
+int identify_frame(DataStream* ds, const uint8_t* bytes) {
+    enum DataFormat format;
+    if (infer_format(bytes, &format) != SUCCESS) { return UNKNOWN_FORMAT; }
+    identify_stream(ds, format, bytes);
+    return SUCCESS;
 }
 
 int peek_file(DataStream* ds, const char* file_path) {
-    // open file in binary mode
-    FILE* file_handle = fopen(file_path, "rb");
-    file_handle = fopen(file_path, "rb");
+    // open file in binary mode, decompressing it on the way if need be
+    FILE* file_handle = open_input_file(file_path);
     if (file_handle == NULL) { // check it actually opened
         return FAILED_TO_OPEN_FILE;
     }
+    return peek_file_handle(ds, file_handle);
+}
 
-    // get a bit of the file
-    uint8_t head[5];
-    fread(head, 5, 1, file_handle);
-    fseek(file_handle, 0, SEEK_SET);
+int peek_file_handle(DataStream* ds, FILE* file_handle) {
     ds->input.file->file_handle = file_handle;
 
-    // see which format it is
-    ds->format = peek_format(head);
-    // TODO nicer error handling of this
+    // get a bit of the file, enough to check a few frames are consistent
+    uint8_t* head = malloc(RESYNC_CHUNK_BYTES);
+    if (head == NULL) { return FAILED_MALLOC; }
+    long num_bytes = (long)fread(head, 1, RESYNC_CHUNK_BYTES, file_handle);
+
+    // see which format it is, skipping any leading garbage
+    enum DataFormat format;
+    long first_frame = find_first_frame(head, num_bytes, &format);
+    if (first_frame < 0) {
+        free(head);
+        return FILE_HEADER_INVALID;
+    }
+    identify_stream(ds, format, &head[first_frame]);
+    ds->num_discarded_bytes += first_frame;
+    fseek(file_handle, first_frame, SEEK_SET);
+    free(head);
 
     #ifdef __DEBUG__
         fprintf(stdout, "File format inferred to be: %s\n", string_for_data_format(ds->format));
@@ -59,18 +282,228 @@ int peek_file(DataStream* ds, const char* file_path) {
     return SUCCESS;
 }
 
-static DataFrame peek_frame(DataStream ds) {
-    DataFrame df = init_frame(ds.format);
-    if (ds.format == CODIF) {
-        fread((uint8_t*)df.codif->header, sizeof(CODIFHeader), 1, get_file_handle(ds.input));
+// MARK: multi-file input
+
+typedef struct FileOrder {
+    char* file_path;
+    char* scan_name;
+    enum DataFormat format; // 0 if no frame was found
+    uint8_t reference_epoch;
+    uint32_t seconds_from_epoch;
+    uint32_t frame_number;
+} FileOrder;
+
+// returns a copy of the scan name, which the caller frees
+static char* get_scan_name(const char* file_path) {
+    char* path = strdup(file_path); // duplicate const
+    char** args;
+    int num_args = split_string(basename(path), "_", &args);
+    // same rule as ingest_structured_filename: <experiment>_<station>_<scan>_...
+    char* scan_name = strdup((num_args < 4) ? "" : args[2]);
+    free_split_string(args, num_args);
+    free(path);
+    return scan_name;
+}
+
+static FileOrder get_file_order(char* file_path) {
+    FileOrder order = { file_path, get_scan_name(file_path) };
+    FILE* file_handle = open_input_file(file_path);
+    if (file_handle == NULL) { return order; }
+    uint8_t* head = malloc(ORDER_PEEK_BYTES);
+    long num_bytes = (long)fread(head, 1, ORDER_PEEK_BYTES, file_handle);
+    fclose(file_handle);
+    enum DataFormat format;
+    long first_frame = find_first_frame(head, num_bytes, &format);
+    if (first_frame >= 0) {
+        const uint8_t* bytes = &head[first_frame];
+        order.format = format;
+        if (format == CODIF) {
+            order.frame_number = load_word(&bytes[0]);
+            order.seconds_from_epoch = load_word(&bytes[4]);
+            order.reference_epoch = bytes[8];
+        } else {
+            order.seconds_from_epoch = load_word(&bytes[0]) & 0x3fffffff;
+            order.frame_number = load_word(&bytes[4]) & 0xffffff;
+            order.reference_epoch = bytes[7] & 0x3f;
+        }
+    }
+    free(head);
+    return order;
+}
+
+// compares strings with any runs of digits ordered by numeric value, so that
+// e.g. scan9 sorts before scan10
+static int compare_natural(const char* a, const char* b) {
+    while (*a != TERM_CHAR && *b != TERM_CHAR) {
+        if (isdigit(*a) && isdigit(*b)) {
+            char* a_end;
+            char* b_end;
+            unsigned long long a_value = strtoull(a, &a_end, 10);
+            unsigned long long b_value = strtoull(b, &b_end, 10);
+            if (a_value != b_value) { return (a_value < b_value) ? -1 : 1; }
+            a = a_end;
+            b = b_end;
+        } else {
+            if (*a != *b) { return (*a < *b) ? -1 : 1; }
+            a++;
+            b++;
+        }
+    }
+    return (*a == *b) ? 0 : ((*a == TERM_CHAR) ? -1 : 1);
+}
+
+static int compare_file_order(const void* a, const void* b) {
+    const FileOrder* x = a;
+    const FileOrder* y = b;
+    int scan_order = compare_natural(x->scan_name, y->scan_name);
+    if (scan_order != 0) { return scan_order; }
+    if (x->reference_epoch != y->reference_epoch) { return (x->reference_epoch < y->reference_epoch) ? -1 : 1; }
+    if (x->seconds_from_epoch != y->seconds_from_epoch) { return (x->seconds_from_epoch < y->seconds_from_epoch) ? -1 : 1; }
+    if (x->frame_number != y->frame_number) { return (x->frame_number < y->frame_number) ? -1 : 1; }
+    return strcmp(x->file_path, y->file_path);
+}
+
+int order_files(char** file_paths, unsigned int num_files) {
+    FileOrder* orders = malloc(num_files * sizeof(FileOrder));
+    if (orders == NULL) { return FAILED_MALLOC; }
+    enum DataFormat format = 0;
+    int status = SUCCESS;
+    for (unsigned int i = 0; i < num_files; i++) {
+        orders[i] = get_file_order(file_paths[i]);
+        // a file of another format would be discarded as garbage when reached
+        if (orders[i].format != 0 && format != 0 && orders[i].format != format) { status = MIXED_FORMATS; }
+        if (orders[i].format != 0) { format = orders[i].format; }
+    }
+    qsort(orders, num_files, sizeof(FileOrder), compare_file_order);
+    for (unsigned int i = 0; i < num_files; i++) {
+        file_paths[i] = orders[i].file_path;
+        free(orders[i].scan_name);
+    }
+    free(orders);
+    return status;
+}
+
+static void* prefetch_file(void* arg) {
+    DataStreamInput_File* input = (DataStreamInput_File*)arg;
+    FILE* file_handle = open_input_file(input->file_paths[input->current_file + 1]);
+    if (file_handle != NULL) {
+        // ask for the whole file to be read ahead (compressed files are 
+        // decompressed ahead anyway), and pull in the first frames ourselves 
+        // so they are resident when we switch over
+        #ifdef POSIX_FADV_WILLNEED
+        if (fileno(file_handle) >= 0) {
+            posix_fadvise(fileno(file_handle), 0, 0, POSIX_FADV_WILLNEED);
+        }
+        #endif
+        uint8_t* head = malloc(PREFETCH_BYTES);
+        if (head != NULL) {
+            fread(head, 1, PREFETCH_BYTES, file_handle);
+            free(head);
+        }
+        fseek(file_handle, 0, SEEK_SET);
+    }
+    input->next_file_handle = file_handle;
+    return NULL;
+}
+
+static void start_prefetch(DataStreamInput_File* input) {
+    if (input->current_file + 1 >= input->num_files) { return; }
+    input->next_file_handle = NULL;
+    input->is_prefetching = (pthread_create(&input->prefetch_thread, NULL, prefetch_file, input) == 0);
+}
+
+static void finish_prefetch(DataStreamInput_File* input) {
+    if (input->is_prefetching) {
+        pthread_join(input->prefetch_thread, NULL);
+        input->is_prefetching = 0;
+    }
+}
+
+int set_file_sequence(DataStream* ds, char** file_paths, unsigned int num_files) {
+    DataStreamInput_File* input = ds->input.file;
+    input->file_paths = file_paths;
+    input->num_files = num_files;
+    input->current_file = 0;
+    start_prefetch(input);
+    return SUCCESS;
+}
+
+int advance_file(DataStream* ds) {
+    DataStreamInput_File* input = ds->input.file;
+    while (input->current_file + 1 < input->num_files) {
+        finish_prefetch(input);
+        if (input->next_file_handle == NULL && !input->is_prefetching) {
+            // prefetch thread could not be started, so open it here instead
+            prefetch_file(input);
+        }
+        fclose(input->file_handle);
+        input->current_file++;
+        input->file_handle = input->next_file_handle;
+        input->next_file_handle = NULL;
+        if (input->file_handle != NULL) {
+            start_prefetch(input);
+            return SUCCESS;
+        }
+        raise_warning("file %s could not be opened, skipping.", input->file_paths[input->current_file]);
+        // keep a valid handle so that the next fclose is harmless
+        input->file_handle = fopen("/dev/null", "rb");
+    }
+    return REACHED_END_OF_FILE;
+}
+
+void close_files(DataStreamInput_File* input) {
+    finish_prefetch(input);
+    if (input->next_file_handle != NULL) { fclose(input->next_file_handle); }
+    if (input->file_handle != NULL) { fclose(input->file_handle); }
+    for (unsigned int i = 0; i < input->num_files; i++) {
+        free(input->file_paths[i]);
+    }
+    free(input->file_paths);
+}
+
+// reads the next plausible frame header, resynchronising past any bytes that
+// don't look like one
+static int peek_frame(DataStream* ds, DataFrame* out) {
+    FILE* file_handle = get_file_handle(ds->input);
+    unsigned int header_length = ds->signature.header_length;
+    uint8_t head[MAX_HEADER_BYTES];
+    while (1) {
+        long offset = ftell(file_handle);
+        size_t num_bytes = fread(head, 1, header_length, file_handle);
+        METRIC_ADD(ds, num_bytes_read, num_bytes);
+        if (num_bytes < header_length) {
+            ds->num_discarded_bytes += num_bytes;
+            // carry on into the next file of the stream, if any
+            if (advance_file(ds) != SUCCESS) { return REACHED_END_OF_FILE; }
+            file_handle = get_file_handle(ds->input);
+            continue;
+        }
+        if (is_plausible_header(ds, head)) { break; }
+        int status = resync_file(ds, offset);
+        if (status == REACHED_END_OF_FILE && advance_file(ds) == SUCCESS) {
+            file_handle = get_file_handle(ds->input);
+            continue;
+        }
+        if (status != SUCCESS) { return status; }
+    }
+    *out = frame_from_header(ds, head);
+    return SUCCESS;
+}
+
+DataFrame frame_from_header(DataStream* ds, const uint8_t* head) {
+    METRIC_START(alloc_start);
+    DataFrame df = init_frame(ds->format);
+    METRIC_STOP(ds, alloc_nanos, alloc_start);
+    if (ds->format == CODIF) {
+        memcpy(df.codif->header, head, sizeof(CODIFHeader));
         // now metadata
-        fread((uint8_t*)df.codif->metadata->none, CODIF_METADATA_BYTES, 1, get_file_handle(ds.input)); 
+        memcpy(df.codif->metadata->none, &head[sizeof(CODIFHeader)], CODIF_METADATA_BYTES);
         df.codif->metadata->version = df.codif->metadata->none->metadata_version;
     } else {
-        fread((uint8_t*)df.vdif->header, sizeof(VDIFHeader), 1, get_file_handle(ds.input));
+        memcpy(df.vdif->header, head, sizeof(VDIFHeader));
         // now extended data, if any
-        if (ds.format == VDIF) {
-            fread((uint8_t*)df.vdif->extended_data->none, VDIF_EXTENDED_DATA_BYTES, 1, get_file_handle(ds.input));
+        if (ds->format == VDIF) {
+            memcpy(df.vdif->extended_data->none, &head[sizeof(VDIFHeader)], VDIF_EXTENDED_DATA_BYTES);
             df.vdif->extended_data->version = df.vdif->extended_data->none->extended_data_version;
         } else {
             df.vdif->extended_data = NULL;
@@ -79,28 +512,237 @@ static DataFrame peek_frame(DataStream ds) {
     return df;
 }
 
-int buffer_frames(DataStream* ds, unsigned int num_frames) {
+// MARK: frame pool
+
+static int is_pooled(const DataStream* ds, const void* data) {
+    return ds->frame_pool != NULL && (const uint8_t*)data >= ds->frame_pool
+        && (const uint8_t*)data < &ds->frame_pool[ds->frame_pool_bytes];
+}
+
+void free_buffered_frames(DataStream* ds) {
+    // frames only borrow their data from the pool, so don't free that
+    for (unsigned int i = 0; i < ds->num_buffered_frames; i++) {
+        DataFrame df = ds->frames[i];
+        if (is_pooled(ds, get_frame_payload(df))) {
+            if (df.format == CODIF) {
+                df.codif->data = NULL;
+            } else {
+                df.vdif->data = NULL;
+            }
+        }
+        free_frame(df);
+    }
     ds->num_buffered_frames = 0;
     ds->num_processed_frames = 0;
+    ds->num_pooled_bytes = 0;
+}
+
+void free_frame_pool(DataStream* ds) {
+    unmap_huge_pages(ds->frame_pool, ds->frame_pool_bytes);
+    ds->frame_pool = NULL;
+    ds->frame_pool_bytes = 0;
+    ds->num_pooled_bytes = 0;
+}
+
+// sizes the pool for a buffer of frames, mapping it afresh if it has grown
+static void prepare_frame_pool(DataStream* ds, unsigned int num_frames) {
+    size_t pool_bytes = (size_t)num_frames * (ds->signature.frame_length - ds->signature.header_length);
+    if (!ds->use_huge_pages || pool_bytes == 0 || pool_bytes <= ds->frame_pool_bytes) { return; }
+    free_frame_pool(ds);
+    int is_explicit;
+    ds->frame_pool = map_huge_pages(pool_bytes, &ds->frame_pool_bytes, &is_explicit);
+    if (ds->frame_pool == NULL) {
+        // frames are allocated one by one instead
+        ds->frame_pool_bytes = 0;
+        return;
+    }
+    // before anything touches it, so that it is placed with the stream's threads
+    bind_to_nodes(ds->frame_pool, ds->frame_pool_bytes, ds->affinity);
+    if (!is_explicit) {
+        raise_warning("too few huge pages are reserved for a %zu byte frame pool, so asking for transparent ones.",
+            pool_bytes);
+    }
+}
+
+static uint32_t* alloc_frame_data(DataStream* ds, uint32_t frame_length) {
+    // payloads are kept 8-byte aligned, as every frame format's are whole words
+    size_t pooled_length = (frame_length + 7) & ~(size_t)7;
+    if (ds->frame_pool != NULL && ds->num_pooled_bytes + pooled_length <= ds->frame_pool_bytes) {
+        uint32_t* data = (uint32_t*)&ds->frame_pool[ds->num_pooled_bytes];
+        ds->num_pooled_bytes += pooled_length;
+        return data;
+    }
+    return malloc(frame_length);
+}
+
+// MARK: buffering
+
+int buffer_frames(DataStream* ds, unsigned int num_frames) {
+    // everything buffered last time has been processed, so let it go
+    free_buffered_frames(ds);
+    prepare_frame_pool(ds, num_frames);
+    FILE* file_handle;
     uint32_t frame_length;
-    while (ds->num_buffered_frames < num_frames && !feof(get_file_handle(ds->input))) {
-        DataFrame df = peek_frame(*ds);
+    while (ds->num_buffered_frames < num_frames) {
+        DataFrame df;
+        if (peek_frame(ds, &df) != SUCCESS) { break; }
+        // may have moved on to the next file of the stream
+        file_handle = get_file_handle(ds->input);
         frame_length = get_data_length(df);
-        if (should_buffer_frame(*ds, df)) {
+        if (should_buffer_frame(ds, df)) {
+            METRIC_START(alloc_start);
+            uint32_t* data = alloc_frame_data(ds, frame_length);
+            METRIC_STOP(ds, alloc_nanos, alloc_start);
+            size_t num_bytes = fread(data, 1, frame_length, file_handle);
+            METRIC_ADD(ds, num_bytes_read, num_bytes);
+            if (num_bytes < frame_length) {
+                // frame was truncated by the end of the file
+                ds->num_discarded_bytes += ds->signature.header_length + num_bytes;
+                METRIC_ADD(ds, num_skipped_frames, 1);
+                if (!is_pooled(ds, data)) { free(data); }
+                free_frame(df);
+                continue;
+            }
+            if (ds->use_checksums) {
+                checksum_frame(ds, &df, (const uint8_t*)data, ds->input.file->current_file, 1);
+            }
             if (ds->format == CODIF) {
-                df.codif->data = malloc(frame_length);
-                fread(df.codif->data, frame_length, 1, get_file_handle(ds->input));
+                df.codif->data = data;
             } else {
-                df.vdif->data = malloc(frame_length);
-                fread(df.vdif->data, frame_length, 1, get_file_handle(ds->input));
+                df.vdif->data = data;
             }
+            take_skipped_frames(ds, &df);
             ds->frames[ds->num_buffered_frames] = df;
             ds->num_buffered_frames++;
+            METRIC_ADD(ds, num_buffered_frames, 1);
+        } else if (ds->use_checksums) {
+            skip_frame(ds, &df);
+            // still read, so that the file's checksum covers every frame
+            uint8_t* data = malloc(frame_length);
+            size_t num_bytes = (data != NULL) ? fread(data, 1, frame_length, file_handle) : 0;
+            METRIC_ADD(ds, num_bytes_read, num_bytes);
+            if (num_bytes == frame_length) {
+                checksum_frame(ds, &df, data, ds->input.file->current_file, 0);
+            }
+            METRIC_ADD(ds, num_skipped_frames, 1);
+            free(data);
+            free_frame(df);
         } else {
+            skip_frame(ds, &df);
             // skip over this frame in the file
-            fseek(get_file_handle(ds->input), frame_length, SEEK_CUR);
+            fseek(file_handle, frame_length, SEEK_CUR);
+            METRIC_ADD(ds, num_skipped_frames, 1);
+            free_frame(df);
         }
     }
     return (ds->num_buffered_frames == num_frames) ? SUCCESS : REACHED_END_OF_FILE;
 }
 
+// MARK: header scanning
+
+// reads whole chunks of frames and decodes only their headers, stopping at
+// the first that doesn't look like one to resynchronise from there; given
+// somewhere to put them, the pattern of each frame's payload is noted too,
+// while it is still in cache
+int buffer_headers(DataStream* ds, HeaderBatch* hb, uint8_t* patterns) {
+    unsigned long frame_length = ds->signature.frame_length;
+    unsigned long chunk_frames = SCAN_CHUNK_BYTES / frame_length;
+    if (chunk_frames == 0) { chunk_frames = 1; }
+    uint8_t* chunk = malloc(chunk_frames * frame_length);
+    if (chunk == NULL) { return FAILED_MALLOC; }
+    int status = SUCCESS;
+    while (hb->num_headers < hb->capacity) {
+        FILE* file_handle = get_file_handle(ds->input);
+        long chunk_offset = ftell(file_handle);
+        unsigned long num_frames = hb->capacity - hb->num_headers;
+        if (num_frames > chunk_frames) { num_frames = chunk_frames; }
+        size_t num_bytes = fread(chunk, 1, num_frames * frame_length, file_handle);
+        METRIC_ADD(ds, num_bytes_read, num_bytes);
+        unsigned long num_whole_frames = num_bytes / frame_length;
+        unsigned long num_plausible = 0;
+        while (num_plausible < num_whole_frames && is_plausible_header(ds, &chunk[num_plausible * frame_length])) {
+            num_plausible++;
+        }
+        unsigned long first = hb->num_headers;
+        unpack_headers(ds->format, chunk, frame_length, num_plausible, hb);
+        unsigned int header_length = ds->signature.header_length;
+        for (unsigned long i = 0; i < num_plausible; i++) {
+            hb->offsets[first + i] = chunk_offset + i * frame_length;
+            hb->file_index[first + i] = ds->input.file->current_file;
+            if (patterns != NULL) {
+                patterns[first + i] = classify_payload(&chunk[i * frame_length + header_length],
+                    frame_length - header_length);
+            }
+        }
+        if (num_plausible < num_whole_frames) {
+            status = resync_file(ds, chunk_offset + num_plausible * frame_length);
+        } else if (num_whole_frames < num_frames) {
+            // any frame cut short by the end of the file can't be used
+            ds->num_discarded_bytes += num_bytes - num_whole_frames * frame_length;
+            status = REACHED_END_OF_FILE;
+        } else {
+            continue;
+        }
+        if (status == REACHED_END_OF_FILE && advance_file(ds) == SUCCESS) {
+            status = SUCCESS;
+        }
+        if (status != SUCCESS) { break; }
+    }
+    free(chunk);
+    return (hb->num_headers == hb->capacity) ? SUCCESS : status;
+}
+
+// MARK: seeking
+
+// reads the header at an offset of the current file, if it is plausibly one 
+// of this stream's
+static int read_header_at(DataStream* ds, long offset, DataFrame* out) {
+    FILE* file_handle = get_file_handle(ds->input);
+    unsigned int header_length = ds->signature.header_length;
+    uint8_t head[MAX_HEADER_BYTES];
+    if (fseek(file_handle, offset, SEEK_SET) != 0) { return FAILURE; }
+    if (fread(head, 1, header_length, file_handle) < header_length) { return REACHED_END_OF_FILE; }
+    if (!is_plausible_header(ds, head)) { return FAILURE; }
+    *out = frame_from_header(ds, head);
+    return SUCCESS;
+}
+
+// jumps the file straight to a frame a little before the given time, on the 
+// assumption that the frames in between are an unbroken run; if the header 
+// landed on doesn't bear that out, the file is left where it was, to be 
+// walked frame by frame instead
+int jump_to_time(DataStream* ds, Timestamp start) {
+    FILE* file_handle = get_file_handle(ds->input);
+    long origin = ftell(file_handle);
+    DataFrame df;
+    if (read_header_at(ds, origin, &df) != SUCCESS) {
+        fseek(file_handle, origin, SEEK_SET);
+        return FAILURE;
+    }
+    long long frames_per_second = get_frames_per_second(ds, df);
+    int64_t nanos_ahead = get_nanos_between(get_frame_timestamp(ds, df), start);
+    free_frame(df);
+    long long frames_ahead = 0;
+    if (nanos_ahead > 0) {
+        frames_ahead = (nanos_ahead / (int64_t)NANOS_PER_SECOND) * frames_per_second 
+            + (nanos_ahead % (int64_t)NANOS_PER_SECOND) * frames_per_second / (int64_t)NANOS_PER_SECOND;
+    }
+    // the frames of all threads are interleaved, so land a frame of each early
+    unsigned int num_threads = (ds->num_threads > 0) ? ds->num_threads : 1;
+    frames_ahead = (frames_ahead - 1) * num_threads;
+    if (frames_ahead <= 0) {
+        fseek(file_handle, origin, SEEK_SET);
+        return SUCCESS;
+    }
+    long target = origin + frames_ahead * (long)ds->signature.frame_length;
+    if (read_header_at(ds, target, &df) == SUCCESS) {
+        int is_before_start = (get_nanos_between(get_frame_timestamp(ds, df), start) >= 0);
+        free_frame(df);
+        if (is_before_start) {
+            fseek(file_handle, target, SEEK_SET);
+            return SUCCESS;
+        }
+    }
+    fseek(file_handle, origin, SEEK_SET);
+    return FAILURE;
+}
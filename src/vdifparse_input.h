@@ -21,8 +21,22 @@
 
 #include "vdifparse_types.h"
 
+int is_plausible_header(const DataStream* ds, const uint8_t* bytes);
+int identify_frame(DataStream* ds, const uint8_t* bytes);
+DataFrame frame_from_header(DataStream* ds, const uint8_t* head);
+
 int peek_file(DataStream* ds, const char* file_path);
+int peek_file_handle(DataStream* ds, FILE* file_handle);
+
+int order_files(char** file_paths, unsigned int num_files);
+int set_file_sequence(DataStream* ds, char** file_paths, unsigned int num_files);
+int advance_file(DataStream* ds);
+void close_files(DataStreamInput_File* input);
 
 int buffer_frames(DataStream* ds, unsigned int num_frames);
+void free_buffered_frames(DataStream* ds);
+void free_frame_pool(DataStream* ds);
+int buffer_headers(DataStream* ds, HeaderBatch* hb, uint8_t* patterns);
+int jump_to_time(DataStream* ds, Timestamp start);
 
 #endif // VDIFPARSE_INPUT_H
@@ -17,6 +17,7 @@
 
 #include <stdlib.h>
 #include <complex.h>
+#include <pthread.h>
 
 #include "vdifparse_lookup.h"
 
@@ -25,6 +26,8 @@
 // but trying to singleton in a non-OO language would be worse
 // so forgive me this one evil
 LookupHolder lookup_holder = { NULL };
+// (which may be lazily filled from several decoding threads at once)
+static pthread_mutex_t lookup_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static inline float luts_2level(char key) { 
     return (key) ? 1.0 : -1.0;
@@ -36,8 +39,8 @@ static inline float luts_4level(char key) {
 static inline float luts_16level(char key) {
     return ((float)key - 8.0) / FOUR_BIT_1_SIGMA;
 }
-static inline float luts_high(key) {
-    return ((float)key - 128.0) / 3.3;
+static inline float luts_high(int key) {
+    return ((float)key - 128.0) / EIGHT_BIT_1_SIGMA;
 }
 
 static float** make_lookup_table_real(char num_bits) {
@@ -96,65 +99,44 @@ static float** make_lookup_table_complex(char num_bits) {
     return new_luts;
 }
 
-static float** get_luts(LookupHolder* lookup, char num_bits, enum DataType type) {
+static float** _Atomic* get_luts_slot(LookupHolder* lookup, char num_bits, enum DataType type) {
     if (type == RealData) {
         switch (num_bits) {
-            case 1: return lookup->luts1bit;
-            case 2: return lookup->luts2bit;
-            case 4: return lookup->luts4bit;
-            case 8: return lookup->luts8bit;
+            case 1: return &lookup->luts1bit;
+            case 2: return &lookup->luts2bit;
+            case 4: return &lookup->luts4bit;
+            case 8: return &lookup->luts8bit;
             default: break;
         }
     }
     if (type == ComplexData) {
         switch (num_bits) {
-            case 1: return lookup->luts1bit_complex;
-            case 2: return lookup->luts2bit_complex;
-            case 4: return lookup->luts4bit_complex;
+            case 1: return &lookup->luts1bit_complex;
+            case 2: return &lookup->luts2bit_complex;
+            case 4: return &lookup->luts4bit_complex;
             default: break;
         }
     }
-    return (float**)NULL;
-}
-
-static void set_luts(LookupHolder* lookup, char num_bits, enum DataType type, float*** luts) {
-    if (type == RealData) {
-        switch (num_bits) {
-            case 1: lookup->luts1bit = *luts;
-                return;
-            case 2: lookup->luts2bit = *luts;
-                return;
-            case 4: lookup->luts4bit = *luts;
-                return;
-            case 8: lookup->luts8bit = *luts;
-                return;
-            default: return;
-        }
-    }
-    if (type == ComplexData) {
-        switch (num_bits) {
-            case 1: lookup->luts1bit_complex = *luts;
-                return;
-            case 2: lookup->luts2bit_complex = *luts;
-                return;
-            case 4: lookup->luts4bit_complex = *luts;
-                return;
-            default: return;
-        }
-    }
+    return NULL;
 }
 
 float** get_lookup_table(char num_bits, enum DataType type) {
-    LookupHolder* lookup = &lookup_holder;
-    float** luts = get_luts(lookup, num_bits, type);
+    float** _Atomic* slot = get_luts_slot(&lookup_holder, num_bits, type);
+    if (slot == NULL) { return (float**)NULL; }
+    // once built, a table is read on every frame, so only take the lock to build it
+    float** luts = atomic_load_explicit(slot, memory_order_acquire);
     if (luts != NULL) { return luts; }
-    float** new_luts;
-    switch (type) {
-        case RealData: new_luts = make_lookup_table_real(num_bits);
-            break;
-        case ComplexData: new_luts = make_lookup_table_complex(num_bits);
-            break;
+    pthread_mutex_lock(&lookup_lock);
+    luts = atomic_load_explicit(slot, memory_order_relaxed);
+    if (luts == NULL) {
+        switch (type) {
+            case RealData: luts = make_lookup_table_real(num_bits);
+                break;
+            case ComplexData: luts = make_lookup_table_complex(num_bits);
+                break;
+        }
+        atomic_store_explicit(slot, luts, memory_order_release);
     }
-    set_luts(lookup, num_bits, type, &new_luts);
-    return get_luts(lookup, num_bits, type);
-}
\ No newline at end of file
+    pthread_mutex_unlock(&lookup_lock);
+    return luts;
+}
@@ -19,18 +19,22 @@
 
 #define M5A_2BIT_HIGH 3.3359
 #define FOUR_BIT_1_SIGMA 2.95
+#define EIGHT_BIT_1_SIGMA 3.3
 // #define BB_2BIT_HIGH 3.316505 // from baseband.py
 
+#include <stdatomic.h>
+
 #include "vdifparse_types.h"
 
+// each table is published whole, once, so it can be read without a lock
 typedef struct LookupHolder {
-    float** luts1bit;
-    float** luts2bit;
-    float** luts4bit;
-    float** luts8bit;
-    float** luts1bit_complex;
-    float** luts2bit_complex;
-    float** luts4bit_complex;
+    float** _Atomic luts1bit;
+    float** _Atomic luts2bit;
+    float** _Atomic luts4bit;
+    float** _Atomic luts8bit;
+    float** _Atomic luts1bit_complex;
+    float** _Atomic luts2bit_complex;
+    float** _Atomic luts4bit_complex;
 } LookupHolder;
 
 float** get_lookup_table(char num_bits, enum DataType type);
@@ -0,0 +1,74 @@
+// vdifparse_memory.c - provides functions to allocate large buffers from huge
+// pages, to cut the TLB misses of walking through them.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+
+#define _GNU_SOURCE // for MAP_HUGETLB and MADV_HUGEPAGE on Linux
+
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "vdifparse_memory.h"
+
+// Buffers the library keeps to itself (such as a stream's frame pool) are
+// mapped from the explicitly reserved huge pages if there are enough, and 
+// otherwise from ordinary pages the kernel is asked to back with transparent 
+// huge pages. Buffers handed to the caller must stay freeable with free(), 
+// so can only be aligned to huge pages and given the same advice. Elsewhere
+// than Linux both kinds are just aligned to huge pages with posix_memalign.
+
+static size_t round_to_huge_pages(size_t num_bytes) {
+    return (num_bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+}
+
+void* map_huge_pages(size_t num_bytes, size_t* mapped_bytes, int* is_explicit) {
+    size_t length = round_to_huge_pages(num_bytes);
+    #ifdef __linux__
+    void* bytes = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    *is_explicit = (bytes != MAP_FAILED);
+    if (bytes == MAP_FAILED) {
+        // none (or too few) reserved in /proc/sys/vm/nr_hugepages
+        bytes = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (bytes == MAP_FAILED) { return NULL; }
+        madvise(bytes, length, MADV_HUGEPAGE);
+    }
+    #else
+    void* bytes;
+    *is_explicit = 0;
+    if (posix_memalign(&bytes, HUGE_PAGE_BYTES, length) != 0) { return NULL; }
+    #endif
+    *mapped_bytes = length;
+    return bytes;
+}
+
+void unmap_huge_pages(void* bytes, size_t mapped_bytes) {
+    #ifdef __linux__
+    if (bytes != NULL) { munmap(bytes, mapped_bytes); }
+    #else
+    (void)mapped_bytes;
+    free(bytes);
+    #endif
+}
+
+void* alloc_transparent_huge(size_t num_bytes) {
+    void* bytes;
+    if (num_bytes < HUGE_PAGE_BYTES) { return malloc(num_bytes); }
+    if (posix_memalign(&bytes, HUGE_PAGE_BYTES, num_bytes) != 0) { return NULL; }
+    #ifdef __linux__
+    // whole huge pages only, since the end of the allocation may share one
+    madvise(bytes, num_bytes / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES, MADV_HUGEPAGE);
+    #endif
+    return bytes;
+}
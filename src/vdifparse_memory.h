@@ -0,0 +1,28 @@
+// vdifparse_memory.h - provides functions to allocate large buffers from huge
+// pages, to cut the TLB misses of walking through them.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+#ifndef VDIFPARSE_MEMORY_H
+#define VDIFPARSE_MEMORY_H
+
+#include <stddef.h>
+
+#define HUGE_PAGE_BYTES (2UL << 20)
+
+void* map_huge_pages(size_t num_bytes, size_t* mapped_bytes, int* is_explicit);
+void unmap_huge_pages(void* bytes, size_t mapped_bytes);
+void* alloc_transparent_huge(size_t num_bytes);
+
+#endif // VDIFPARSE_MEMORY_H
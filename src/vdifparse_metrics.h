@@ -0,0 +1,41 @@
+// vdifparse_metrics.h - provides macros to count and time the stages of the
+// frame buffering and decoding hot path, compiled away with VDIFPARSE_NO_METRICS.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VDIFPARSE_METRICS_H
+#define VDIFPARSE_METRICS_H
+
+#include <stdint.h>
+#include <time.h>
+
+// the monotonic clock is read through the vDSO, so costs tens of nanoseconds
+static inline uint64_t get_monotonic_nanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#ifndef VDIFPARSE_NO_METRICS
+#define METRIC_ADD(ds, field, value) ((ds)->metrics.field += (value))
+#define METRIC_START(timer) uint64_t timer = get_monotonic_nanos()
+#define METRIC_STOP(ds, field, timer) ((ds)->metrics.field += get_monotonic_nanos() - (timer))
+#else
+#define METRIC_ADD(ds, field, value) ((void)0)
+#define METRIC_START(timer) ((void)0)
+#define METRIC_STOP(ds, field, timer) ((void)0)
+#endif
+
+#endif // VDIFPARSE_METRICS_H
@@ -0,0 +1,191 @@
+// vdifparse_output.c - provides functions to build VDIF and CODIF frames from
+// samples and write them out to file in large batches.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <string.h>
+
+#include "vdifparse_output.h"
+#include "vdifparse_checksum.h"
+#include "vdifparse_encode.h"
+
+#define DEFAULT_PAYLOAD_BYTES 8000
+#define OUTPUT_BUFFER_BYTES (1 << 23)
+
+DataOutput init_output(enum DataFormat format) {
+    DataOutput dout = { .format = format };
+    dout.num_channels = 1;
+    dout.bits_per_sample = 2;
+    dout.data_type = RealData;
+    dout.payload_bytes = DEFAULT_PAYLOAD_BYTES;
+    // unless told otherwise, data starts now
+    int64_t now = (int64_t)time(NULL);
+    dout.reference_epoch = get_epoch_for_time(format, now);
+    dout.seconds_from_epoch = now - get_epoch_seconds(format, dout.reference_epoch);
+    return dout;
+}
+
+unsigned int get_output_header_length(const DataOutput* dout) {
+    switch (dout->format) {
+        case VDIF_LEGACY: return 16;
+        case VDIF: return 32;
+        case CODIF: return 64;
+    }
+    return 0;
+}
+
+unsigned long get_output_frame_samples(const DataOutput* dout) {
+    unsigned long sample_bits = dout->bits_per_sample * dout->num_channels * ((dout->data_type == ComplexData) ? 2 : 1);
+    return (sample_bits == 0) ? 0 : ((unsigned long)dout->payload_bytes * 8) / sample_bits;
+}
+
+// samples are written without padding, so a sample block is the fewest 64-bit 
+// words that hold a whole number of samples
+unsigned long get_output_block_words(const DataOutput* dout) {
+    unsigned long sample_bits = dout->bits_per_sample * dout->num_channels * ((dout->data_type == ComplexData) ? 2 : 1);
+    if (sample_bits == 0) { return 0; }
+    unsigned int common_bits = (__builtin_ctzl(sample_bits) < 6) ? __builtin_ctzl(sample_bits) : 6;
+    return sample_bits >> common_bits;
+}
+
+static unsigned long get_output_frames_per_second(const DataOutput* dout) {
+    if (dout->data_rate == 0) { return 0; } // frame numbers never wrap
+    return (unsigned long)((unsigned long long)dout->data_rate * 1000000 / 8 / dout->payload_bytes);
+}
+
+// MARK: frame construction
+
+static void write_header(const DataOutput* dout, uint8_t* bytes, unsigned int is_invalid) {
+    unsigned int header_length = get_output_header_length(dout);
+    memset(bytes, 0, header_length);
+    if (dout->format == CODIF) {
+        CODIFHeader header = { 0 };
+        header.frame_number = dout->frame_number;
+        header.seconds_from_epoch = dout->seconds_from_epoch;
+        header.reference_epoch = dout->reference_epoch;
+        header.bits_per_sample = dout->bits_per_sample;
+        header.invalid_flag = is_invalid;
+        header.data_type = dout->data_type;
+        header.protocol_field = CODIF_VERSION; // top bits of word 2 mark this as CODIF
+        header.codif_version_number = 1;
+        header.alignment_period = 1;
+        header.thread_id = dout->thread_id;
+        header.station_id = dout->station_id;
+        header.num_channels = dout->num_channels;
+        header.sample_block_length = get_output_block_words(dout);
+        header.data_array_length = dout->payload_bytes / 8;
+        memcpy(bytes, &header, sizeof(CODIFHeader));
+        uint32_t synch_pattern = CODIF_SYNCH_PATTERN;
+        memcpy(&bytes[sizeof(CODIFHeader)], &synch_pattern, sizeof(uint32_t));
+    } else {
+        VDIFHeader header = { 0 };
+        header.seconds_from_epoch = dout->seconds_from_epoch;
+        header.legacy_mode = (dout->format == VDIF_LEGACY);
+        header.invalid_flag = is_invalid;
+        header.frame_number = dout->frame_number;
+        header.reference_epoch = dout->reference_epoch;
+        header.frame_length = (header_length + dout->payload_bytes) / 8;
+        header.log2_num_channels = __builtin_ctzl(dout->num_channels);
+        header.station_id = dout->station_id;
+        header.thread_id = dout->thread_id;
+        header.bits_per_sample = dout->bits_per_sample - 1;
+        header.data_type = dout->data_type;
+        memcpy(bytes, &header, sizeof(VDIFHeader));
+    }
+}
+
+static int write_buffer(DataOutput* dout) {
+    if (dout->num_buffered_bytes == 0) { return SUCCESS; }
+    size_t num_bytes = fwrite(dout->buffer, 1, dout->num_buffered_bytes, dout->file_handle);
+    int status = (num_bytes == dout->num_buffered_bytes) ? SUCCESS : FAILURE;
+    dout->num_buffered_bytes = 0;
+    return status;
+}
+
+static int emit_frame(DataOutput* dout, unsigned int is_invalid) {
+    unsigned long frame_bytes = get_output_header_length(dout) + dout->payload_bytes;
+    if (dout->num_buffered_bytes + frame_bytes > dout->buffer_bytes) {
+        int status = write_buffer(dout);
+        if (status != SUCCESS) { return status; }
+    }
+    uint8_t* frame = &dout->buffer[dout->num_buffered_bytes];
+    write_header(dout, frame, is_invalid);
+    int status = encode_values(dout->staging, dout->num_staged_values, dout->bits_per_sample,
+        &frame[get_output_header_length(dout)]);
+    if (status != SUCCESS) { return status; }
+    // while the frame is still in cache
+    if (dout->use_checksum) { dout->checksum = update_crc32c(dout->checksum, frame, frame_bytes); }
+    dout->num_buffered_bytes += frame_bytes;
+    dout->num_staged_values = 0;
+    dout->num_written_frames++;
+
+    // move on to the next frame's time
+    unsigned long frames_per_second = get_output_frames_per_second(dout);
+    dout->frame_number++;
+    if (frames_per_second > 0 && dout->frame_number >= frames_per_second) {
+        dout->frame_number = 0;
+        dout->seconds_from_epoch++;
+    }
+    return SUCCESS;
+}
+
+static int init_output_buffers(DataOutput* dout) {
+    unsigned long frame_bytes = get_output_header_length(dout) + dout->payload_bytes;
+    unsigned long frames_per_buffer = OUTPUT_BUFFER_BYTES / frame_bytes;
+    if (frames_per_buffer == 0) { frames_per_buffer = 1; }
+    dout->buffer_bytes = frames_per_buffer * frame_bytes;
+    dout->buffer = malloc(dout->buffer_bytes);
+    dout->staging = malloc(dout->payload_bytes * 8 / dout->bits_per_sample * sizeof(float));
+    if (dout->buffer == NULL || dout->staging == NULL) { return FAILED_MALLOC; }
+    return SUCCESS;
+}
+
+// MARK: sample input
+
+int stage_samples(DataOutput* dout, float** samples, unsigned long num_samples) {
+    if (dout->staging == NULL) {
+        int status = init_output_buffers(dout);
+        if (status != SUCCESS) { return status; }
+    }
+    unsigned int num_components = (dout->data_type == ComplexData) ? 2 : 1;
+    unsigned long frame_values = get_output_frame_samples(dout) * dout->num_channels * num_components;
+    // interleave channels (and I/Q components) into stream order
+    for (unsigned long i = 0; i < num_samples; i++) {
+        for (unsigned long channel = 0; channel < dout->num_channels; channel++) {
+            for (unsigned int component = 0; component < num_components; component++) {
+                dout->staging[dout->num_staged_values++] = samples[channel][i * num_components + component];
+            }
+        }
+        if (dout->num_staged_values == frame_values) {
+            int status = emit_frame(dout, 0);
+            if (status != SUCCESS) { return status; }
+        }
+    }
+    return SUCCESS;
+}
+
+int flush_output(DataOutput* dout, unsigned int pad_frame) {
+    if (pad_frame && dout->num_staged_values > 0) {
+        // a partial frame is padded out, and flagged so readers skip it
+        unsigned long frame_values = dout->payload_bytes * 8 / dout->bits_per_sample;
+        memset(&dout->staging[dout->num_staged_values], 0, (frame_values - dout->num_staged_values) * sizeof(float));
+        dout->num_staged_values = frame_values;
+        int status = emit_frame(dout, 1);
+        if (status != SUCCESS) { return status; }
+    }
+    int status = write_buffer(dout);
+    if (status == SUCCESS) { fflush(dout->file_handle); }
+    return status;
+}
@@ -0,0 +1,29 @@
+// vdifparse_output.h - provides functions to build VDIF and CODIF frames from
+// samples and write them out to file in large batches.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later 
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT 
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more 
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+#ifndef VDIFPARSE_OUTPUT_H
+#define VDIFPARSE_OUTPUT_H
+
+#include "vdifparse_types.h"
+
+DataOutput init_output(enum DataFormat format);
+unsigned int get_output_header_length(const DataOutput* dout);
+unsigned long get_output_frame_samples(const DataOutput* dout);
+unsigned long get_output_block_words(const DataOutput* dout);
+int stage_samples(DataOutput* dout, float** samples, unsigned long num_samples);
+int flush_output(DataOutput* dout, unsigned int pad_frame);
+
+#endif // VDIFPARSE_OUTPUT_H
@@ -0,0 +1,175 @@
+// vdifparse_quality.c - provides a pre-scan of frames for data quality,
+// building a map of which seconds of a stream are fit to process.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "vdifparse_quality.h"
+#include "vdifparse_sequence.h"
+#include "vdifparse_stream.h"
+
+// payloads are checked this many bytes at a time, so that one that varies is
+// given up on early without a branch per word
+#define PATTERN_RUN_BYTES 256
+
+// MARK: payload patterns
+
+// ORs together the difference of each 64-bit word from the pattern, so the
+// result is zero only if every word matched
+static uint64_t diff_words(const uint8_t* bytes, size_t num_bytes, uint64_t pattern) {
+    uint64_t diff = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128i patterns = _mm_set1_epi64x((long long)pattern);
+    __m128i diffs = _mm_setzero_si128();
+    for (; i + 16 <= num_bytes; i += 16) {
+        diffs = _mm_or_si128(diffs, _mm_xor_si128(_mm_loadu_si128((const __m128i*)&bytes[i]), patterns));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, diffs);
+    diff = lanes[0] | lanes[1];
+#endif
+    for (; i + 8 <= num_bytes; i += 8) {
+        uint64_t word;
+        memcpy(&word, &bytes[i], sizeof(uint64_t));
+        diff |= word ^ pattern;
+    }
+    return diff;
+}
+
+enum PayloadPattern classify_payload(const uint8_t* bytes, size_t num_bytes) {
+    // every format's payload is whole 64-bit words
+    if (num_bytes < 8) { return PayloadVaried; }
+    uint64_t pattern;
+    memcpy(&pattern, bytes, sizeof(uint64_t));
+    for (size_t i = 0; i < num_bytes; i += PATTERN_RUN_BYTES) {
+        size_t run_bytes = (num_bytes - i < PATTERN_RUN_BYTES) ? num_bytes - i : PATTERN_RUN_BYTES;
+        if (diff_words(&bytes[i], run_bytes, pattern) != 0) { return PayloadVaried; }
+    }
+    return (pattern == 0) ? PayloadZero : PayloadConstant;
+}
+
+// MARK: map building
+
+static SecondQuality* get_second(QualityMap* map, int64_t seconds) {
+    // frames come mostly in order, so look back from the latest second
+    unsigned long i = map->num_seconds;
+    while (i > 0 && map->seconds[i - 1].seconds > seconds) { i--; }
+    if (i > 0 && map->seconds[i - 1].seconds == seconds) { return &map->seconds[i - 1]; }
+    if (map->num_seconds == map->capacity) {
+        unsigned long capacity = (map->capacity > 0) ? map->capacity * 2 : 64;
+        SecondQuality* grown = realloc(map->seconds, capacity * sizeof(SecondQuality));
+        if (grown == NULL) { return NULL; }
+        map->seconds = grown;
+        map->capacity = capacity;
+    }
+    memmove(&map->seconds[i + 1], &map->seconds[i], (map->num_seconds - i) * sizeof(SecondQuality));
+    map->seconds[i] = (SecondQuality){ .seconds = seconds };
+    map->num_seconds++;
+    return &map->seconds[i];
+}
+
+static ThreadSequence* get_sequence(QualityMap* map, unsigned int thread_id, int* is_new) {
+    *is_new = 0;
+    for (unsigned int i = 0; i < map->num_sequences; i++) {
+        if (map->sequences[i].thread_id == thread_id) { return &map->sequences[i]; }
+    }
+    ThreadSequence* sequences = realloc(map->sequences, (map->num_sequences + 1) * sizeof(ThreadSequence));
+    if (sequences == NULL) { return NULL; }
+    map->sequences = sequences;
+    *is_new = 1;
+    ThreadSequence* sequence = &map->sequences[map->num_sequences++];
+    sequence->thread_id = thread_id;
+    return sequence;
+}
+
+// counts the frames missing between two positions of a thread against the
+// seconds they should have fallen in
+static int add_missing_frames(QualityMap* map, long long last_position, long long position,
+        unsigned long long frames_per_second) {
+    long long first_missing = last_position + 1;
+    while (first_missing < position) {
+        int64_t seconds = first_missing / (long long)frames_per_second;
+        long long end_of_second = (seconds + 1) * (long long)frames_per_second;
+        long long last_missing = (position < end_of_second) ? position : end_of_second;
+        SecondQuality* second = get_second(map, seconds);
+        if (second == NULL) { return FAILED_MALLOC; }
+        second->num_missing_frames += last_missing - first_missing;
+        first_missing = last_missing;
+    }
+    return SUCCESS;
+}
+
+// follows a thread's frame numbers on to this frame, as track_frame_sequence
+// does while decoding
+static int track_continuity(const DataStream* ds, QualityMap* map, unsigned int thread_id, int64_t seconds,
+        unsigned long frame_number, unsigned long data_length) {
+    if (frame_number > map->max_frame_number) { map->max_frame_number = frame_number; }
+    int is_new;
+    ThreadSequence* sequence = get_sequence(map, thread_id, &is_new);
+    if (sequence == NULL) { return FAILED_MALLOC; }
+    if (is_new) {
+        sequence->seconds = seconds;
+        sequence->frame_number = frame_number;
+        return SUCCESS;
+    }
+    // without a data rate, frames lost from the end of a second can only be
+    // seen once the stream has shown how high frame numbers go
+    unsigned long long frames_per_second = get_stream_frames_per_second(ds, data_length);
+    if (frames_per_second == 0) { frames_per_second = map->max_frame_number + 1; }
+    long long position = (long long)seconds * frames_per_second + frame_number;
+    long long last_position = (long long)sequence->seconds * frames_per_second + sequence->frame_number;
+    if (position <= last_position) {
+        map->num_out_of_order_frames++;
+        return SUCCESS;
+    }
+    sequence->seconds = seconds;
+    sequence->frame_number = frame_number;
+    if (position - last_position - 1 > (long long)frames_per_second * MAX_GAP_SECONDS) { return SUCCESS; }
+    return add_missing_frames(map, last_position, position, frames_per_second);
+}
+
+int add_quality_frames(const DataStream* ds, QualityMap* map, const HeaderBatch* hb, const uint8_t* patterns) {
+    int64_t epoch_seconds = 0;
+    unsigned int reference_epoch = 0x100; // matches none, so the first is looked up
+    for (unsigned long i = 0; i < hb->num_headers; i++) {
+        if (hb->reference_epoch[i] != reference_epoch) {
+            reference_epoch = hb->reference_epoch[i];
+            epoch_seconds = get_epoch_seconds(hb->format, reference_epoch);
+        }
+        int64_t seconds = epoch_seconds + hb->seconds_from_epoch[i];
+        unsigned long data_length = hb->frame_length[i] - ds->signature.header_length;
+        int status = track_continuity(ds, map, hb->thread_id[i], seconds, hb->frame_number[i], data_length);
+        if (status != SUCCESS) { return status; }
+        SecondQuality* second = get_second(map, seconds);
+        if (second == NULL) { return FAILED_MALLOC; }
+        second->num_frames++;
+        second->num_invalid_frames += hb->invalid[i];
+        second->num_zero_frames += (patterns[i] == PayloadZero);
+        second->num_constant_frames += (patterns[i] == PayloadConstant);
+        second->num_valid_frames += (!hb->invalid[i] && patterns[i] == PayloadVaried);
+    }
+    // missing frames may have been counted against any second so far
+    for (unsigned long i = 0; i < map->num_seconds; i++) {
+        SecondQuality* second = &map->seconds[i];
+        unsigned long num_expected = second->num_frames + second->num_missing_frames;
+        second->valid_fraction = (num_expected > 0) ? (float)second->num_valid_frames / num_expected : 0;
+    }
+    return SUCCESS;
+}
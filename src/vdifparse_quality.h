@@ -0,0 +1,25 @@
+// vdifparse_quality.h - provides a pre-scan of frames for data quality,
+// building a map of which seconds of a stream are fit to process.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+#ifndef VDIFPARSE_QUALITY_H
+#define VDIFPARSE_QUALITY_H
+
+#include "vdifparse_types.h"
+
+enum PayloadPattern classify_payload(const uint8_t* bytes, size_t num_bytes);
+int add_quality_frames(const DataStream* ds, QualityMap* map, const HeaderBatch* hb, const uint8_t* patterns);
+
+#endif // VDIFPARSE_QUALITY_H
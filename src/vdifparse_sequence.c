@@ -0,0 +1,162 @@
+// vdifparse_sequence.c - provides functions to follow the frame sequence of 
+// each thread of a stream, and to stand in for frames lost from it.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <string.h>
+
+#include "vdifparse_sequence.h"
+#include "vdifparse_stream.h"
+
+// MARK: gap frame
+
+static void free_gap_frame(DataStream* ds) {
+    if (ds->gap_frame.format != 0) {
+        free_frame(ds->gap_frame);
+        ds->gap_frame.format = 0;
+    }
+}
+
+// builds the stream's one invalid frame, shaped like the frames around it, 
+// with a zeroed payload that every inserted frame shares. the new frame is
+// built before the old one is freed, and if that fails the stream is left 
+// with no gap frame rather than one of the wrong length
+static int init_gap_frame(DataStream* ds, const DataFrame* df) {
+    unsigned int data_length = get_data_length(*df);
+    if (ds->gap_frame.format != 0 && get_data_length(ds->gap_frame) == data_length) { return SUCCESS; }
+    DataFrame gap_frame = init_frame(df->format);
+    uint32_t* data = calloc(1, data_length);
+    if (data == NULL) {
+        free_frame(gap_frame);
+        free_gap_frame(ds);
+        return FAILED_MALLOC;
+    }
+    if (df->format == CODIF) {
+        memcpy(gap_frame.codif->header, df->codif->header, sizeof(CODIFHeader));
+        gap_frame.codif->header->invalid_flag = 1;
+        gap_frame.codif->data = data;
+    } else {
+        memcpy(gap_frame.vdif->header, df->vdif->header, sizeof(VDIFHeader));
+        gap_frame.vdif->header->invalid_flag = 1;
+        gap_frame.vdif->data = data;
+    }
+    free_gap_frame(ds);
+    ds->gap_frame = gap_frame;
+    return SUCCESS;
+}
+
+// MARK: skipped frames
+
+static SkippedFrames* get_skipped_frames(DataStream* ds, unsigned int thread_id) {
+    for (unsigned int i = 0; i < ds->num_skipped_threads; i++) {
+        if (ds->skipped_frames[i].thread_id == thread_id) { return &ds->skipped_frames[i]; }
+    }
+    return NULL;
+}
+
+// notes an invalid frame left unbuffered, so that the gap it leaves in its 
+// thread's sequence isn't taken for loss
+void skip_frame(DataStream* ds, const DataFrame* df) {
+    unsigned int thread_id = get_thread_id(*df);
+    SkippedFrames* skipped = get_skipped_frames(ds, thread_id);
+    if (skipped == NULL) {
+        SkippedFrames* grown = realloc(ds->skipped_frames, (ds->num_skipped_threads + 1) * sizeof(SkippedFrames));
+        if (grown == NULL) { return; }
+        ds->skipped_frames = grown;
+        skipped = &ds->skipped_frames[ds->num_skipped_threads++];
+        *skipped = (SkippedFrames){ thread_id, 0 };
+    }
+    skipped->num_frames++;
+}
+
+// hands a frame about to be buffered the count of its thread's frames 
+// skipped since the last one was buffered (as frames are buffered ahead of 
+// being decoded, a count kept on the stream would run ahead of the decoder)
+void take_skipped_frames(DataStream* ds, DataFrame* df) {
+    SkippedFrames* skipped = get_skipped_frames(ds, get_thread_id(*df));
+    df->num_skipped_before = (skipped != NULL) ? skipped->num_frames : 0;
+    if (skipped != NULL) { skipped->num_frames = 0; }
+}
+
+// MARK: sequence tracking
+
+static ThreadSequence* get_sequence(DataStream* ds, unsigned int thread_id) {
+    for (unsigned int i = 0; i < ds->num_sequences; i++) {
+        if (ds->sequences[i].thread_id == thread_id) { return &ds->sequences[i]; }
+    }
+    return NULL;
+}
+
+static ThreadSequence* add_sequence(DataStream* ds, unsigned int thread_id) {
+    // only grows when a thread is first seen
+    ThreadSequence* sequences = realloc(ds->sequences, (ds->num_sequences + 1) * sizeof(ThreadSequence));
+    if (sequences == NULL) { return NULL; }
+    ds->sequences = sequences;
+    ThreadSequence* sequence = &ds->sequences[ds->num_sequences++];
+    sequence->thread_id = thread_id;
+    return sequence;
+}
+
+// returns the number of frames of this frame's thread that were lost since 
+// the last one seen, and that should be filled under the gap policy
+unsigned long track_frame_sequence(DataStream* ds, const DataFrame* df, DecodeMonitor* statistics) {
+    unsigned int thread_id = get_thread_id(*df);
+    int64_t seconds = get_unix_seconds(*df);
+    unsigned long frame_number = get_frame_number(*df);
+    if (frame_number > ds->max_frame_number) { ds->max_frame_number = frame_number; }
+    statistics->num_skipped_frames += df->num_skipped_before;
+
+    ThreadSequence* sequence = get_sequence(ds, thread_id);
+    if (sequence == NULL) {
+        // nothing to compare the first frame of a thread against
+        sequence = add_sequence(ds, thread_id);
+        if (sequence == NULL) { return 0; }
+        sequence->seconds = seconds;
+        sequence->frame_number = frame_number;
+        return 0;
+    }
+    // without a data rate, frames lost from the end of a second can only be 
+    // seen once the stream has shown how high frame numbers go
+    unsigned long long frames_per_second = get_frames_per_second(ds, *df);
+    if (frames_per_second == 0) { frames_per_second = ds->max_frame_number + 1; }
+    long long position = (long long)seconds * frames_per_second + frame_number;
+    long long last_position = (long long)sequence->seconds * frames_per_second + sequence->frame_number;
+    if (position <= last_position) {
+        statistics->num_out_of_order_frames++;
+        return 0;
+    }
+    sequence->seconds = seconds;
+    sequence->frame_number = frame_number;
+    unsigned long long num_missing = position - last_position - 1;
+    // frames skipped for being invalid were seen, so weren't lost
+    num_missing -= (df->num_skipped_before < num_missing) ? df->num_skipped_before : num_missing;
+    if (num_missing == 0) { return 0; }
+    statistics->num_lost_frames += num_missing;
+    if (ds->gap_policy != InsertInvalid || num_missing > frames_per_second * MAX_GAP_SECONDS) { return 0; }
+    if (init_gap_frame(ds, df) != SUCCESS) { return 0; }
+    return num_missing;
+}
+
+// MARK: cleanup
+
+void free_sequences(DataStream* ds) {
+    free(ds->sequences);
+    ds->sequences = NULL;
+    ds->num_sequences = 0;
+    free(ds->skipped_frames);
+    ds->skipped_frames = NULL;
+    ds->num_skipped_threads = 0;
+    free_gap_frame(ds);
+}
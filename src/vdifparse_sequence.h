@@ -0,0 +1,32 @@
+// vdifparse_sequence.h - provides functions to follow the frame sequence of 
+// each thread of a stream, and to stand in for frames lost from it.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VDIFPARSE_SEQUENCE_H
+#define VDIFPARSE_SEQUENCE_H
+
+#include "vdifparse_types.h"
+
+// a longer gap is taken to be a restart of the stream rather than loss, so
+// is not filled while decoding, nor mapped as missing in a quality report
+#define MAX_GAP_SECONDS 10
+
+void skip_frame(DataStream* ds, const DataFrame* df);
+void take_skipped_frames(DataStream* ds, DataFrame* df);
+unsigned long track_frame_sequence(DataStream* ds, const DataFrame* df, DecodeMonitor* statistics);
+void free_sequences(DataStream* ds);
+
+#endif // VDIFPARSE_SEQUENCE_H
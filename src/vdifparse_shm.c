@@ -0,0 +1,403 @@
+// vdifparse_shm.c - provides a ring of decoded blocks in POSIX shared memory,
+// published by one process and read without copying by any number of others.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+
+#define _GNU_SOURCE // for syscall on Linux
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "vdifparse_shm.h"
+
+#define RING_MAGIC 0x56445052 // "VDPR"
+#define RING_VERSION 1
+#define MAX_RING_READERS 64
+#define SLOT_HEADER_BYTES 64
+#define SLOT_ALIGNMENT 4096
+#define POLL_NANOS 100000 // how often readers look for a block without futexes
+
+// The publisher never looks at its readers. Each slot carries the sequence
+// number of the block in it, made odd while the block is being written, so a
+// reader can tell whether a block it was handed (or is still using) has been
+// overwritten since, much as with a seqlock. A reader that falls more than a
+// ring behind skips to the oldest block still intact and counts the rest as
+// lost. Readers keep their cursors in the shared header too, where a monitor
+// can see how far behind each one is. Off Linux, where there is no futex to
+// sleep on, a reader that has caught up polls for the next block instead.
+
+typedef struct RingReader {
+    _Atomic int32_t pid; // 0 if the slot is free
+    _Atomic uint64_t cursor; // the next block it will read
+    _Atomic uint64_t num_lost_blocks;
+} RingReader;
+
+typedef struct RingHeader {
+    _Atomic uint32_t magic; // set last, once the ring is ready to attach to
+    uint32_t version;
+    uint32_t num_slots;
+    uint32_t values_per_sample;
+    uint64_t num_channels;
+    uint64_t block_samples;
+    uint64_t slot_bytes;
+    uint64_t data_offset;
+    _Atomic uint64_t num_published;
+    _Atomic uint32_t is_closed;
+    _Atomic uint32_t wake_word; // bumped on every publish, for readers to futex-wait on
+    _Atomic uint32_t num_waiters;
+    RingReader readers[MAX_RING_READERS];
+} RingHeader;
+
+typedef struct SlotHeader {
+    _Atomic uint64_t state; // 2s + 1 while block s is written, 2s + 2 once it has been
+    uint64_t num_samples;
+} SlotHeader;
+
+struct SharedRing {
+    char* name;
+    int is_publisher;
+    RingHeader* header;
+    size_t mapped_bytes;
+    int reader_index;
+    int is_claimed; // by the publisher, between claim and commit
+    float** samples; // channel pointers into the slot last handed out
+};
+
+// MARK: layout
+
+static size_t round_up(size_t num_bytes, size_t alignment) {
+    return (num_bytes + alignment - 1) / alignment * alignment;
+}
+
+static SlotHeader* get_slot(const RingHeader* header, uint64_t sequence) {
+    uint64_t index = sequence % header->num_slots;
+    return (SlotHeader*)((uint8_t*)header + header->data_offset + index * header->slot_bytes);
+}
+
+static void point_at_slot(SharedRing* ring, SlotHeader* slot) {
+    const RingHeader* header = ring->header;
+    float* data = (float*)((uint8_t*)slot + SLOT_HEADER_BYTES);
+    for (uint64_t c = 0; c < header->num_channels; c++) {
+        ring->samples[c] = &data[c * header->block_samples * header->values_per_sample];
+    }
+}
+
+static char* get_object_name(const char* name) {
+    // shared memory objects are named like absolute paths
+    size_t length = strlen(name);
+    char* object_name = malloc(length + 2);
+    if (object_name == NULL) { return NULL; }
+    snprintf(object_name, length + 2, "%s%s", (name[0] == '/') ? "" : "/", name);
+    return object_name;
+}
+
+#ifdef __linux__
+static void wait_on_word(_Atomic uint32_t* word, uint32_t value, const struct timespec* timeout) {
+    // not FUTEX_PRIVATE_FLAG, since the word is shared between processes
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAIT, value, timeout, NULL, 0);
+}
+
+static void wake_waiters(_Atomic uint32_t* word) {
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+#else
+static void wait_on_word(_Atomic uint32_t* word, uint32_t value, const struct timespec* timeout) {
+    long long nanos_left = timeout->tv_sec * 1000000000LL + timeout->tv_nsec;
+    while (nanos_left > 0 && atomic_load_explicit(word, memory_order_acquire) == value) {
+        long long nanos = (nanos_left < POLL_NANOS) ? nanos_left : POLL_NANOS;
+        struct timespec pause = { 0, nanos };
+        nanosleep(&pause, NULL);
+        nanos_left -= nanos;
+    }
+}
+
+static void wake_waiters(_Atomic uint32_t* word) {
+    (void)word; // readers see the word change as they poll
+}
+#endif
+
+// MARK: publishing
+
+int init_publisher(const char* name, unsigned int num_slots, unsigned long num_channels,
+        unsigned long block_samples, unsigned int values_per_sample, SharedRing** out) {
+    *out = NULL;
+    if (num_slots < 2 || num_channels == 0 || block_samples == 0 || values_per_sample == 0) { return FAILURE; }
+    SharedRing* ring = calloc(1, sizeof(SharedRing));
+    if (ring == NULL) { return FAILED_MALLOC; }
+    ring->is_publisher = 1;
+    ring->name = get_object_name(name);
+    ring->samples = calloc(num_channels, sizeof(float*));
+    if (ring->name == NULL || ring->samples == NULL) {
+        free_shared_ring(ring);
+        return FAILED_MALLOC;
+    }
+    // readers still attached to a ring left by an earlier publisher keep it
+    // until they detach, rather than have it truncated under them
+    shm_unlink(ring->name);
+    int fd = shm_open(ring->name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        free_shared_ring(ring);
+        return FAILED_TO_OPEN_FILE;
+    }
+    size_t data_offset = round_up(sizeof(RingHeader), SLOT_ALIGNMENT);
+    size_t slot_bytes = round_up(SLOT_HEADER_BYTES + num_channels * block_samples * values_per_sample * sizeof(float),
+        SLOT_ALIGNMENT);
+    ring->mapped_bytes = data_offset + num_slots * slot_bytes;
+    void* bytes = MAP_FAILED;
+    if (ftruncate(fd, ring->mapped_bytes) == 0) {
+        bytes = mmap(NULL, ring->mapped_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (bytes == MAP_FAILED) {
+        shm_unlink(ring->name);
+        ring->is_publisher = 0;
+        free_shared_ring(ring);
+        return FAILED_MALLOC;
+    }
+    // the object starts zeroed, so only the layout needs filling in
+    RingHeader* header = (RingHeader*)bytes;
+    header->version = RING_VERSION;
+    header->num_slots = num_slots;
+    header->values_per_sample = values_per_sample;
+    header->num_channels = num_channels;
+    header->block_samples = block_samples;
+    header->slot_bytes = slot_bytes;
+    header->data_offset = data_offset;
+    atomic_store_explicit(&header->magic, RING_MAGIC, memory_order_release);
+    ring->header = header;
+    *out = ring;
+    return SUCCESS;
+}
+
+// hands out the next slot to be written into directly (such as by decode_samples)
+int claim_slot(SharedRing* ring, float*** samples) {
+    if (!ring->is_publisher) { return FAILURE; }
+    RingHeader* header = ring->header;
+    uint64_t sequence = atomic_load_explicit(&header->num_published, memory_order_relaxed);
+    SlotHeader* slot = get_slot(header, sequence);
+    // mark the block in the slot as overwritten before any of it is
+    atomic_store_explicit(&slot->state, 2 * sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    point_at_slot(ring, slot);
+    ring->is_claimed = 1;
+    *samples = ring->samples;
+    return SUCCESS;
+}
+
+int commit_slot(SharedRing* ring, unsigned long num_samples) {
+    if (!ring->is_claimed) { return FAILURE; }
+    RingHeader* header = ring->header;
+    uint64_t sequence = atomic_load_explicit(&header->num_published, memory_order_relaxed);
+    SlotHeader* slot = get_slot(header, sequence);
+    slot->num_samples = (num_samples < header->block_samples) ? num_samples : header->block_samples;
+    atomic_store_explicit(&slot->state, 2 * sequence + 2, memory_order_release);
+    atomic_store_explicit(&header->num_published, sequence + 1, memory_order_release);
+    ring->is_claimed = 0;
+    // readers only sleep when they have caught up, so usually no one needs waking
+    atomic_fetch_add_explicit(&header->wake_word, 1, memory_order_release);
+    if (atomic_load_explicit(&header->num_waiters, memory_order_acquire) > 0) {
+        wake_waiters(&header->wake_word);
+    }
+    return SUCCESS;
+}
+
+int publish_samples(SharedRing* ring, float** samples, unsigned long num_samples) {
+    const RingHeader* header = ring->header;
+    unsigned long values_per_sample = header->values_per_sample;
+    // blocks longer than a slot are spread over several
+    for (unsigned long first = 0; first < num_samples; first += header->block_samples) {
+        unsigned long slot_samples = num_samples - first;
+        if (slot_samples > header->block_samples) { slot_samples = header->block_samples; }
+        float** slot_channels;
+        int status = claim_slot(ring, &slot_channels);
+        if (status != SUCCESS) { return status; }
+        for (uint64_t c = 0; c < header->num_channels; c++) {
+            memcpy(slot_channels[c], &samples[c][first * values_per_sample],
+                slot_samples * values_per_sample * sizeof(float));
+        }
+        commit_slot(ring, slot_samples);
+    }
+    return SUCCESS;
+}
+
+int publish_stream_block(void* context, float** samples, unsigned long num_samples, const DecodeMonitor* statistics) {
+    SharedRing* ring = (SharedRing*)context;
+    if (statistics->decoded_channels < ring->header->num_channels) { return FAILURE; }
+    return publish_samples(ring, samples, num_samples);
+}
+
+// MARK: reading
+
+int init_subscriber(const char* name, SharedRing** out) {
+    *out = NULL;
+    SharedRing* ring = calloc(1, sizeof(SharedRing));
+    if (ring == NULL) { return FAILED_MALLOC; }
+    ring->reader_index = -1;
+    ring->name = get_object_name(name);
+    if (ring->name == NULL) {
+        free_shared_ring(ring);
+        return FAILED_MALLOC;
+    }
+    // cursors are written back to the header, so the mapping is writable
+    int fd = shm_open(ring->name, O_RDWR, 0);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(RingHeader)) {
+        if (fd >= 0) { close(fd); }
+        free_shared_ring(ring);
+        return FAILED_TO_OPEN_FILE;
+    }
+    ring->mapped_bytes = info.st_size;
+    void* bytes = mmap(NULL, ring->mapped_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (bytes == MAP_FAILED) {
+        ring->mapped_bytes = 0;
+        free_shared_ring(ring);
+        return FAILED_MALLOC;
+    }
+    RingHeader* header = (RingHeader*)bytes;
+    ring->header = header;
+    if (atomic_load_explicit(&header->magic, memory_order_acquire) != RING_MAGIC || header->version != RING_VERSION
+            || header->data_offset + header->num_slots * header->slot_bytes > ring->mapped_bytes) {
+        free_shared_ring(ring);
+        return FILE_HEADER_INVALID;
+    }
+    ring->samples = calloc(header->num_channels, sizeof(float*));
+    if (ring->samples == NULL) {
+        free_shared_ring(ring);
+        return FAILED_MALLOC;
+    }
+    // take a free reader slot, or one left behind by a reader that has exited
+    for (int i = 0; i < MAX_RING_READERS && ring->reader_index < 0; i++) {
+        int32_t pid = atomic_load(&header->readers[i].pid);
+        if (pid != 0 && (kill(pid, 0) == 0 || errno != ESRCH)) { continue; }
+        if (atomic_compare_exchange_strong(&header->readers[i].pid, &pid, getpid())) {
+            ring->reader_index = i;
+        }
+    }
+    if (ring->reader_index < 0) {
+        free_shared_ring(ring);
+        return FAILURE;
+    }
+    // from the next block published on
+    RingReader* reader = &header->readers[ring->reader_index];
+    atomic_store(&reader->cursor, atomic_load_explicit(&header->num_published, memory_order_acquire));
+    atomic_store(&reader->num_lost_blocks, 0);
+    *out = ring;
+    return SUCCESS;
+}
+
+// waits until a block past the cursor is published, the ring is closed, or time runs out
+static int wait_for_block(RingHeader* header, uint64_t cursor, unsigned int timeout_millis) {
+    struct timespec now, deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_millis / 1000;
+    deadline.tv_nsec += (long)(timeout_millis % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    while (cursor >= atomic_load_explicit(&header->num_published, memory_order_acquire)) {
+        if (atomic_load_explicit(&header->is_closed, memory_order_acquire)) { return REACHED_END_OF_FILE; }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long nanos_left = (deadline.tv_sec - now.tv_sec) * 1000000000LL + (deadline.tv_nsec - now.tv_nsec);
+        if (nanos_left <= 0) { return REACHED_END_OF_BUFFER; }
+        struct timespec timeout = { nanos_left / 1000000000LL, nanos_left % 1000000000LL };
+        uint32_t word = atomic_load_explicit(&header->wake_word, memory_order_acquire);
+        atomic_fetch_add_explicit(&header->num_waiters, 1, memory_order_acq_rel);
+        // checked again now we are counted, or a publish in between would be missed
+        if (cursor >= atomic_load_explicit(&header->num_published, memory_order_acquire)
+                && !atomic_load_explicit(&header->is_closed, memory_order_acquire)) {
+            wait_on_word(&header->wake_word, word, &timeout);
+        }
+        atomic_fetch_sub_explicit(&header->num_waiters, 1, memory_order_acq_rel);
+    }
+    return SUCCESS;
+}
+
+int read_ring(SharedRing* ring, RingBlock* block, unsigned int timeout_millis) {
+    if (ring->is_publisher) { return FAILURE; }
+    RingHeader* header = ring->header;
+    RingReader* reader = &header->readers[ring->reader_index];
+    uint64_t cursor = atomic_load_explicit(&reader->cursor, memory_order_relaxed);
+    unsigned long num_lost = 0;
+    while (1) {
+        int status = wait_for_block(header, cursor, timeout_millis);
+        if (status != SUCCESS) { return status; }
+        // anything more than a ring behind has been overwritten already
+        uint64_t num_published = atomic_load_explicit(&header->num_published, memory_order_acquire);
+        if (num_published - cursor > header->num_slots) {
+            num_lost += num_published - header->num_slots - cursor;
+            cursor = num_published - header->num_slots;
+        }
+        // and the oldest may be being overwritten now
+        SlotHeader* slot = get_slot(header, cursor);
+        if (atomic_load_explicit(&slot->state, memory_order_acquire) == 2 * cursor + 2) {
+            block->sequence = cursor;
+            block->num_samples = slot->num_samples;
+            break;
+        }
+        num_lost++;
+        cursor++;
+    }
+    point_at_slot(ring, get_slot(header, cursor));
+    block->num_channels = header->num_channels;
+    block->samples = ring->samples;
+    block->num_lost_blocks = num_lost;
+    atomic_store_explicit(&reader->cursor, cursor + 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&reader->num_lost_blocks, num_lost, memory_order_relaxed);
+    return SUCCESS;
+}
+
+int check_ring_block(const SharedRing* ring, const RingBlock* block) {
+    // whatever was read from the block must be read before the slot is checked
+    atomic_thread_fence(memory_order_acquire);
+    SlotHeader* slot = get_slot(ring->header, block->sequence);
+    uint64_t state = atomic_load_explicit(&slot->state, memory_order_relaxed);
+    return (state == 2 * block->sequence + 2) ? SUCCESS : RING_OVERRUN;
+}
+
+// MARK: cleanup
+
+void free_shared_ring(SharedRing* ring) {
+    if (ring == NULL) { return; }
+    RingHeader* header = ring->header;
+    if (header != NULL && ring->is_publisher) {
+        // readers drain what is left, then see the end
+        atomic_store_explicit(&header->is_closed, 1, memory_order_release);
+        atomic_fetch_add_explicit(&header->wake_word, 1, memory_order_release);
+        wake_waiters(&header->wake_word);
+        shm_unlink(ring->name);
+    } else if (header != NULL && ring->reader_index >= 0) {
+        atomic_store(&header->readers[ring->reader_index].pid, 0);
+    }
+    if (header != NULL) { munmap(header, ring->mapped_bytes); }
+    free(ring->samples);
+    free(ring->name);
+    free(ring);
+}
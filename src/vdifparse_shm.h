@@ -0,0 +1,33 @@
+// vdifparse_shm.h - provides a ring of decoded blocks in POSIX shared memory,
+// published by one process and read without copying by any number of others.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+#ifndef VDIFPARSE_SHM_H
+#define VDIFPARSE_SHM_H
+
+#include "vdifparse_types.h"
+
+int init_publisher(const char* name, unsigned int num_slots, unsigned long num_channels, 
+    unsigned long block_samples, unsigned int values_per_sample, SharedRing** ring);
+int claim_slot(SharedRing* ring, float*** samples);
+int commit_slot(SharedRing* ring, unsigned long num_samples);
+int publish_samples(SharedRing* ring, float** samples, unsigned long num_samples);
+int publish_stream_block(void* context, float** samples, unsigned long num_samples, const DecodeMonitor* statistics);
+int init_subscriber(const char* name, SharedRing** ring);
+int read_ring(SharedRing* ring, RingBlock* block, unsigned int timeout_millis);
+int check_ring_block(const SharedRing* ring, const RingBlock* block);
+void free_shared_ring(SharedRing* ring);
+
+#endif // VDIFPARSE_SHM_H
@@ -0,0 +1,403 @@
+// vdifparse_sink.c - provides a writer for decoded samples that batches them
+// into large writes on a thread of its own, rotating output files by size or
+// by time.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+
+#define _GNU_SOURCE // for O_DIRECT
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "vdifparse_sink.h"
+#include "vdifparse_affinity.h"
+#include "vdifparse_metrics.h"
+#include "vdifparse_utils.h"
+
+#define DIRECT_IO_ALIGNMENT 4096
+#ifndef O_DIRECT
+#define O_DIRECT 0 // not on macOS and others, where writes go through the page cache
+#endif
+
+// Samples are interleaved into rows as they are appended, straight into the
+// buffer the caller is filling, and whole buffers are handed to the writer
+// thread through a ring. Full buffers are a whole number of pages, so writes
+// stay aligned for direct I/O until the last (short) buffer of each file,
+// which is written with the page cache. A buffer may end early where a file
+// is rotated, so that each file holds whole rows.
+
+typedef struct SinkBuffer {
+    uint8_t* bytes;
+    size_t num_bytes;
+    int ends_file; // the file is closed once this buffer is written
+} SinkBuffer;
+
+struct SampleWriter {
+    SinkOptions options;
+    char* file_path; // NULL for stdout
+    int is_rotating;
+    unsigned long long rotate_samples;
+
+    // filled by the caller
+    float* row; // for the row that straddles two buffers
+    size_t row_capacity;
+    unsigned long long file_bytes;
+    unsigned long long file_samples;
+
+    // drained by the writer thread
+    int fd;
+    int is_direct;
+    unsigned int file_index;
+    pthread_t thread;
+    int is_started;
+    CpuAffinity* affinity;
+
+    SinkBuffer* buffers;
+    unsigned long num_filled_buffers;
+    unsigned long num_written_buffers;
+    int is_closing;
+    int status; // the first write to fail, reported to the caller
+    SinkMetrics metrics;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+// MARK: writer thread
+
+static int write_all(int fd, const uint8_t* bytes, size_t num_bytes) {
+    while (num_bytes > 0) {
+        ssize_t num_written = write(fd, bytes, num_bytes);
+        if (num_written < 0) {
+            if (errno == EINTR) { continue; }
+            return FAILED_TO_WRITE_FILE;
+        }
+        bytes += num_written;
+        num_bytes -= num_written;
+    }
+    return SUCCESS;
+}
+
+static int open_next_file(SampleWriter* writer) {
+    // rotated files are numbered before the extension, as in out_0003.f32
+    char file_path[4096];
+    if (writer->is_rotating) {
+        const char* name = strrchr(writer->file_path, '/');
+        const char* extension = strrchr((name != NULL) ? name : writer->file_path, '.');
+        int stem_length = (extension != NULL) ? (int)(extension - writer->file_path) : (int)strlen(writer->file_path);
+        snprintf(file_path, sizeof(file_path), "%.*s_%04u%s", stem_length, writer->file_path, writer->file_index,
+            (extension != NULL) ? extension : "");
+    } else {
+        snprintf(file_path, sizeof(file_path), "%s", writer->file_path);
+    }
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    writer->is_direct = writer->options.use_direct_io && O_DIRECT != 0;
+    writer->fd = open(file_path, flags | (writer->is_direct ? O_DIRECT : 0), 0644);
+    if (writer->fd < 0 && writer->is_direct && errno == EINVAL) {
+        // e.g. tmpfs, which has no direct I/O
+        raise_warning("direct I/O is not supported for %s, so writing through the page cache.", file_path);
+        writer->options.use_direct_io = 0;
+        writer->is_direct = 0;
+        writer->fd = open(file_path, flags, 0644);
+    }
+    if (writer->fd < 0) { return FAILED_TO_OPEN_FILE; }
+    writer->file_index++;
+    return SUCCESS;
+}
+
+static int write_buffer(SampleWriter* writer, const SinkBuffer* buffer, SinkMetrics* written) {
+    if (writer->fd < 0 && buffer->num_bytes > 0) {
+        int status = open_next_file(writer);
+        if (status != SUCCESS) { return status; }
+        written->num_files++;
+    }
+    uint64_t start = get_monotonic_nanos();
+    size_t aligned_bytes = buffer->num_bytes;
+    if (writer->is_direct) {
+        aligned_bytes -= buffer->num_bytes % DIRECT_IO_ALIGNMENT;
+    }
+    int status = write_all(writer->fd, buffer->bytes, aligned_bytes);
+    if (status == SUCCESS && aligned_bytes < buffer->num_bytes) {
+        // a short tail cannot be written directly, so finish the file without
+        fcntl(writer->fd, F_SETFL, fcntl(writer->fd, F_GETFL) & ~O_DIRECT);
+        writer->is_direct = 0;
+        status = write_all(writer->fd, &buffer->bytes[aligned_bytes], buffer->num_bytes - aligned_bytes);
+    }
+    written->write_nanos += get_monotonic_nanos() - start;
+    if (status != SUCCESS) { return status; }
+    written->num_written_bytes += buffer->num_bytes;
+    if (buffer->ends_file && writer->fd >= 0 && writer->file_path != NULL) {
+        if (close(writer->fd) != 0) { status = FAILED_TO_WRITE_FILE; }
+        writer->fd = -1;
+    }
+    return status;
+}
+
+static void* write_buffers(void* arg) {
+    SampleWriter* writer = (SampleWriter*)arg;
+    pin_thread(pthread_self(), writer->affinity);
+    while (1) {
+        pthread_mutex_lock(&writer->lock);
+        while (writer->num_written_buffers == writer->num_filled_buffers && !writer->is_closing) {
+            pthread_cond_wait(&writer->changed, &writer->lock);
+        }
+        if (writer->num_written_buffers == writer->num_filled_buffers) {
+            pthread_mutex_unlock(&writer->lock);
+            break;
+        }
+        SinkBuffer* buffer = &writer->buffers[writer->num_written_buffers % writer->options.num_buffers];
+        int status = writer->status;
+        pthread_mutex_unlock(&writer->lock);
+
+        // after a failure, buffers are still taken (and dropped), so the caller never waits forever
+        SinkMetrics written = { 0 };
+        if (status == SUCCESS) { status = write_buffer(writer, buffer, &written); }
+
+        pthread_mutex_lock(&writer->lock);
+        if (writer->status == SUCCESS) { writer->status = status; }
+        writer->metrics.num_written_bytes += written.num_written_bytes;
+        writer->metrics.num_files += written.num_files;
+        writer->metrics.write_nanos += written.write_nanos;
+        writer->num_written_buffers++;
+        pthread_cond_broadcast(&writer->changed);
+        pthread_mutex_unlock(&writer->lock);
+    }
+    return NULL;
+}
+
+// MARK: filling buffers
+
+static SinkBuffer* get_current_buffer(SampleWriter* writer) {
+    return &writer->buffers[writer->num_filled_buffers % writer->options.num_buffers];
+}
+
+// hands the current buffer to the writer thread, then waits for the next to be free
+static int publish_buffer(SampleWriter* writer, int ends_file) {
+    get_current_buffer(writer)->ends_file = ends_file;
+    pthread_mutex_lock(&writer->lock);
+    writer->num_filled_buffers++;
+    pthread_cond_broadcast(&writer->changed);
+    if (writer->num_filled_buffers - writer->num_written_buffers == writer->options.num_buffers) {
+        writer->metrics.num_writer_stalls++;
+        while (writer->num_filled_buffers - writer->num_written_buffers == writer->options.num_buffers) {
+            pthread_cond_wait(&writer->changed, &writer->lock);
+        }
+    }
+    int status = writer->status;
+    pthread_mutex_unlock(&writer->lock);
+    SinkBuffer* next = get_current_buffer(writer);
+    next->num_bytes = 0;
+    next->ends_file = 0;
+    return status;
+}
+
+static void interleave_rows(float* out, float** samples, unsigned long num_channels, unsigned int values_per_sample,
+        unsigned long first_sample, unsigned long num_samples) {
+    unsigned long row_values = num_channels * values_per_sample;
+    for (unsigned long c = 0; c < num_channels; c++) {
+        const float* in = &samples[c][first_sample * values_per_sample];
+        float* column = &out[c * values_per_sample];
+        if (values_per_sample == 1) {
+            for (unsigned long i = 0; i < num_samples; i++) {
+                column[i * row_values] = in[i];
+            }
+        } else {
+            for (unsigned long i = 0; i < num_samples; i++) {
+                for (unsigned int v = 0; v < values_per_sample; v++) {
+                    column[i * row_values + v] = in[i * values_per_sample + v];
+                }
+            }
+        }
+    }
+}
+
+// how many rows can go in the current file before it must be rotated
+static unsigned long long get_rows_left_in_file(const SampleWriter* writer, size_t row_bytes) {
+    unsigned long long num_rows = ~0ULL;
+    if (writer->options.rotate_bytes > 0) {
+        unsigned long long rotate_rows = writer->options.rotate_bytes / row_bytes;
+        if (rotate_rows == 0) { rotate_rows = 1; } // a file holds at least one row
+        num_rows = (rotate_rows > writer->file_samples) ? rotate_rows - writer->file_samples : 0;
+    }
+    if (writer->rotate_samples > 0) {
+        unsigned long long time_rows = (writer->rotate_samples > writer->file_samples) ?
+            writer->rotate_samples - writer->file_samples : 0;
+        if (time_rows < num_rows) { num_rows = time_rows; }
+    }
+    return num_rows;
+}
+
+int append_samples(SampleWriter* writer, float** samples, unsigned long num_channels, unsigned long num_samples) {
+    unsigned int values_per_sample = writer->options.values_per_sample;
+    size_t row_bytes = num_channels * values_per_sample * sizeof(float);
+    size_t buffer_bytes = writer->options.buffer_bytes;
+    if (row_bytes == 0) { return SUCCESS; }
+    if (row_bytes > writer->row_capacity) {
+        float* row = realloc(writer->row, row_bytes);
+        if (row == NULL) { return FAILED_MALLOC; }
+        writer->row = row;
+        writer->row_capacity = row_bytes;
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    int status = writer->status;
+    if (status == SUCCESS && writer->options.drop_when_full) {
+        // the block must fit in the space left in the buffers not yet queued
+        unsigned long num_queued = writer->num_filled_buffers - writer->num_written_buffers;
+        size_t free_bytes = buffer_bytes - get_current_buffer(writer)->num_bytes
+            + (writer->options.num_buffers - 1 - num_queued) * buffer_bytes;
+        if (num_samples * row_bytes > free_bytes) {
+            writer->metrics.num_dropped_blocks++;
+            num_samples = 0;
+        }
+    }
+    pthread_mutex_unlock(&writer->lock);
+    if (status != SUCCESS) { return status; }
+
+    unsigned long sample = 0;
+    while (sample < num_samples && status == SUCCESS) {
+        unsigned long long rows_left = writer->is_rotating ? get_rows_left_in_file(writer, row_bytes) : ~0ULL;
+        if (rows_left == 0) {
+            status = publish_buffer(writer, 1);
+            writer->file_bytes = 0;
+            writer->file_samples = 0;
+            continue;
+        }
+        SinkBuffer* buffer = get_current_buffer(writer);
+        size_t space = buffer_bytes - buffer->num_bytes;
+        unsigned long long num_rows = space / row_bytes;
+        if (num_rows > num_samples - sample) { num_rows = num_samples - sample; }
+        if (num_rows > rows_left) { num_rows = rows_left; }
+        if (num_rows > 0) {
+            interleave_rows((float*)&buffer->bytes[buffer->num_bytes], samples, num_channels, values_per_sample,
+                sample, num_rows);
+            buffer->num_bytes += num_rows * row_bytes;
+        } else {
+            // split the row across the end of this buffer and the start of the next
+            num_rows = 1;
+            interleave_rows(writer->row, samples, num_channels, values_per_sample, sample, 1);
+            memcpy(&buffer->bytes[buffer->num_bytes], writer->row, space);
+            buffer->num_bytes = buffer_bytes;
+            status = publish_buffer(writer, 0);
+            buffer = get_current_buffer(writer);
+            memcpy(buffer->bytes, (uint8_t*)writer->row + space, row_bytes - space);
+            buffer->num_bytes = row_bytes - space;
+        }
+        sample += num_rows;
+        writer->file_samples += num_rows;
+        writer->file_bytes += num_rows * row_bytes;
+        if (buffer->num_bytes == buffer_bytes && status == SUCCESS) { status = publish_buffer(writer, 0); }
+    }
+    return status;
+}
+
+int append_stream_block(void* context, float** samples, unsigned long num_samples, const DecodeMonitor* statistics) {
+    return append_samples((SampleWriter*)context, samples, statistics->decoded_channels, num_samples);
+}
+
+// MARK: writer lifecycle
+
+int init_sample_writer(const char* file_path, SinkOptions options, SampleWriter** out) {
+    *out = NULL;
+    if (options.num_buffers < 2) { options.num_buffers = 2; }
+    if (options.values_per_sample == 0) { options.values_per_sample = 1; }
+    options.buffer_bytes += (DIRECT_IO_ALIGNMENT - options.buffer_bytes % DIRECT_IO_ALIGNMENT) % DIRECT_IO_ALIGNMENT;
+    if (options.buffer_bytes == 0) { options.buffer_bytes = DIRECT_IO_ALIGNMENT; }
+    if (options.rotate_seconds > 0 && options.samples_per_second == 0) { return UNKNOWN_DATA_RATE; }
+
+    SampleWriter* writer = calloc(1, sizeof(SampleWriter));
+    if (writer == NULL) { return FAILED_MALLOC; }
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->changed, NULL);
+    writer->options = options;
+    writer->options.cpu_list = NULL; // parsed into affinity below
+    writer->fd = -1;
+    if (file_path == NULL || strcmp(file_path, "-") == 0) {
+        // stdout is neither rotated nor closed, and may be a pipe
+        writer->fd = STDOUT_FILENO;
+        writer->options.use_direct_io = 0;
+    } else {
+        writer->file_path = strdup(file_path);
+        if (writer->file_path == NULL) {
+            free_sample_writer(writer);
+            return FAILED_MALLOC;
+        }
+        writer->is_rotating = (options.rotate_bytes > 0 || options.rotate_seconds > 0);
+        if (options.rotate_seconds > 0) {
+            writer->rotate_samples = (unsigned long long)(options.rotate_seconds * options.samples_per_second);
+            if (writer->rotate_samples == 0) { writer->rotate_samples = 1; }
+        }
+    }
+    writer->buffers = calloc(options.num_buffers, sizeof(SinkBuffer));
+    int status = (writer->buffers == NULL) ? FAILED_MALLOC : SUCCESS;
+    if (status == SUCCESS && options.cpu_list != NULL) {
+        status = init_affinity(options.cpu_list, &writer->affinity);
+    }
+    for (unsigned int i = 0; status == SUCCESS && i < options.num_buffers; i++) {
+        if (posix_memalign((void**)&writer->buffers[i].bytes, DIRECT_IO_ALIGNMENT, options.buffer_bytes) != 0) {
+            status = FAILED_MALLOC;
+            break;
+        }
+        bind_to_nodes(writer->buffers[i].bytes, options.buffer_bytes, writer->affinity);
+    }
+    if (status == SUCCESS && pthread_create(&writer->thread, NULL, write_buffers, writer) != 0) {
+        status = FAILURE;
+    }
+    writer->is_started = (status == SUCCESS);
+    if (status != SUCCESS) {
+        free_sample_writer(writer);
+        return status;
+    }
+    *out = writer;
+    return SUCCESS;
+}
+
+SinkMetrics get_writer_metrics(SampleWriter* writer) {
+    pthread_mutex_lock(&writer->lock);
+    SinkMetrics metrics = writer->metrics;
+    pthread_mutex_unlock(&writer->lock);
+    return metrics;
+}
+
+int free_sample_writer(SampleWriter* writer) {
+    if (writer == NULL) { return SUCCESS; }
+    int status = SUCCESS;
+    if (writer->is_started) {
+        // whatever is left is written out, finishing the last file
+        publish_buffer(writer, 1);
+        pthread_mutex_lock(&writer->lock);
+        writer->is_closing = 1;
+        pthread_cond_broadcast(&writer->changed);
+        pthread_mutex_unlock(&writer->lock);
+        pthread_join(writer->thread, NULL);
+        status = writer->status;
+    }
+    if (writer->fd >= 0 && writer->file_path != NULL && close(writer->fd) != 0 && status == SUCCESS) {
+        status = FAILED_TO_WRITE_FILE;
+    }
+    for (unsigned int i = 0; writer->buffers != NULL && i < writer->options.num_buffers; i++) {
+        free(writer->buffers[i].bytes);
+    }
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->changed);
+    free(writer->buffers);
+    free(writer->row);
+    free(writer->file_path);
+    free_affinity(writer->affinity);
+    free(writer);
+    return status;
+}
@@ -0,0 +1,29 @@
+// vdifparse_sink.h - provides a writer for decoded samples that batches them
+// into large writes on a thread of its own, rotating output files by size or
+// by time.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+#ifndef VDIFPARSE_SINK_H
+#define VDIFPARSE_SINK_H
+
+#include "vdifparse_types.h"
+
+int init_sample_writer(const char* file_path, SinkOptions options, SampleWriter** writer);
+int append_samples(SampleWriter* writer, float** samples, unsigned long num_channels, unsigned long num_samples);
+int append_stream_block(void* context, float** samples, unsigned long num_samples, const DecodeMonitor* statistics);
+SinkMetrics get_writer_metrics(SampleWriter* writer);
+int free_sample_writer(SampleWriter* writer);
+
+#endif // VDIFPARSE_SINK_H
@@ -0,0 +1,104 @@
+// vdifparse_stream.h - defines the layout of the data stream, which is kept 
+// private to the library and handed to users only by pointer.
+// Copyright (C) 2022 Mars Buttfield-Addison
+//
+// This program is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VDIFPARSE_STREAM_H
+#define VDIFPARSE_STREAM_H
+
+#include "vdifparse_types.h"
+
+// header fields that stay constant for the whole stream, used to decide 
+// whether some bytes are plausibly a frame header when resynchronising
+typedef struct FrameSignature {
+    unsigned int header_length;
+    unsigned int frame_length;
+    unsigned int key_offset;
+    uint32_t key_word;
+    uint8_t reference_epoch;
+    uint16_t station_id;
+    unsigned int synch_offset;
+    uint32_t synch_pattern; // 0 if the stream has none
+} FrameSignature;
+
+// invalid frames of one thread not buffered (under SkipInvalid) since its 
+// last buffered frame, to be told apart from frames that never arrived
+typedef struct SkippedFrames {
+    unsigned int thread_id;
+    unsigned int num_frames;
+} SkippedFrames;
+
+struct DataStream {
+    DataStreamInput input;
+    enum DataFormat format;
+    unsigned int is_compound_datastream;
+
+    unsigned int data_rate;
+    unsigned int num_channels;
+    unsigned int bits_per_sample;
+    unsigned int num_threads;
+    enum DataType data_type;
+
+    unsigned long num_selected_channels;
+    unsigned int num_selected_threads;
+
+    enum GapPolicy gap_policy;
+
+    FrameSignature signature;
+    unsigned long long num_discarded_bytes;
+    unsigned long num_resyncs;
+    uint8_t* resync_chunk; // scratch for scanning a file, made on first resync
+
+    StreamMetrics metrics;
+    FILE* metrics_file;
+    uint64_t metrics_interval_nanos;
+    uint64_t last_metrics_nanos;
+
+    ThreadSequence* sequences;
+    unsigned int num_sequences;
+    SkippedFrames* skipped_frames; // per thread, since its last buffered frame
+    unsigned int num_skipped_threads;
+    unsigned long max_frame_number; // gives frames per second if data rate is unknown
+    DataFrame gap_frame; // shared invalid frame decoded in place of each lost frame
+    unsigned long num_gap_frames; // still to insert before the pending frame
+    unsigned int is_frame_pending; // next frame was fetched but not decoded yet
+    unsigned long long frame_cursor; // samples of the pending frame already decoded
+    unsigned int num_borrowed_frames; // handed out by next_frame, not yet released
+
+    unsigned int num_processed_frames;
+    unsigned int num_buffered_frames;
+    unsigned int buffer_depth;
+    DataFrame* frames; // buffer_depth of them
+    // with huge pages, frames read from files borrow their data from a pool
+    unsigned int use_huge_pages;
+    uint8_t* frame_pool;
+    size_t frame_pool_bytes;
+    size_t num_pooled_bytes;
+
+    struct CpuAffinity* affinity; // where the stream's threads run, NULL if anywhere
+
+    // CRC32C of the frames read from each file (skipped ones included) and 
+    // of each thread's frames buffered, if asked for
+    unsigned int use_checksums;
+    StreamChecksum* file_checksums;
+    unsigned int num_file_checksums;
+    StreamChecksum* thread_checksums;
+    unsigned int num_thread_checksums;
+    uint32_t* checksum_shift_table; // moves a checksum on past one frame
+    unsigned long checksum_shift_bytes;
+};
+
+
+#endif // VDIFPARSE_STREAM_H
@@ -18,9 +18,13 @@
 #include <string.h>
 #include <libgen.h>
 #include <math.h>
+#include <pthread.h>
 
 #include "vdifparse_types.h"
+#include "vdifparse_capture.h"
 #include "vdifparse_input.h"
+#include "vdifparse_metrics.h"
+#include "vdifparse_stream.h"
 #include "vdifparse_utils.h"
 
 #define FD_DRATE_ARG 0
@@ -30,9 +34,27 @@
 
 #define DWORD_BITS 32
 
-DataStream init_stream(enum InputMode mode) {
+#define SECONDS_PER_DAY 86400
+#define VDIF_NUM_EPOCHS 64   // 6-bit reference epoch field
+#define CODIF_NUM_EPOCHS 256 // 8-bit reference epoch field
+
+// UNIX seconds at each half-year reference epoch, filled once on first use
+static int64_t vdif_epoch_seconds[VDIF_NUM_EPOCHS];
+static int64_t codif_epoch_seconds[CODIF_NUM_EPOCHS];
+static pthread_once_t epoch_tables_once = PTHREAD_ONCE_INIT;
+
+DataStream* init_stream(enum InputMode mode) {
+    DataStream* ds = calloc(1, sizeof(DataStream));
+    if (ds == NULL) { return NULL; }
+    // an input's mode is fixed once made, so it can only be copied in
     DataStreamInput input = init_input(mode);
-    DataStream ds = { .input = input };
+    memcpy(&ds->input, &input, sizeof(DataStreamInput));
+    ds->buffer_depth = BUFFER_FRAMES;
+    ds->frames = calloc(ds->buffer_depth, sizeof(DataFrame));
+    if (ds->frames == NULL) {
+        free(ds);
+        return NULL;
+    }
     return ds;
 }
 
@@ -42,11 +64,27 @@ DataStreamInput init_input(enum InputMode mode) {
         case FileMode: di.file = calloc(1, sizeof(DataStreamInput_File));
             break;
         case StreamMode: di.stream = calloc(1, sizeof(DataStreamInput_Stream));
+            di.stream->socket_fd = -1; // until capture is opened
             break;
     }
     return di;
 }
 
+CaptureOptions init_capture_options() {
+    CaptureOptions options = { 0 };
+    options.receive_timeout_millis = 1000;
+    options.max_packet_bytes = 9000; // jumbo frame
+    return options;
+}
+
+SinkOptions init_sink_options() {
+    SinkOptions options = { 0 };
+    options.buffer_bytes = 8 << 20;
+    options.num_buffers = 4;
+    options.values_per_sample = 1;
+    return options;
+}
+
 DataFrame init_frame(enum DataFormat format) {
     DataFrame df = { .format = format };
     if (format == VDIF || format == VDIF_LEGACY) {
@@ -54,19 +92,83 @@ DataFrame init_frame(enum DataFormat format) {
         VDIFHeader* header = calloc(1, sizeof(VDIFHeader));
         df.vdif->header = header;
         if (format == VDIF) {
-            VDIFExtendedData* data = calloc(1, VDIF_EXTENDED_DATA_BYTES);
+            VDIFExtendedData* data = calloc(1, sizeof(VDIFExtendedData));
+            data->none = calloc(1, VDIF_EXTENDED_DATA_BYTES);
             df.vdif->extended_data = data;
         }
     } else if (format == CODIF) {
         df.codif = calloc(1, sizeof(DataFrame_CODIF));
         CODIFHeader* header = calloc(1, sizeof(CODIFHeader));
         df.codif->header = header;
-        CODIFMetadata* data = calloc(1, CODIF_METADATA_BYTES);
+        CODIFMetadata* data = calloc(1, sizeof(CODIFMetadata));
+        data->none = calloc(1, CODIF_METADATA_BYTES);
         df.codif->metadata = data;
     }
     return df;
 }
 
+void free_frame(DataFrame df) {
+    if (df.format == CODIF) {
+        free(df.codif->metadata->none);
+        free(df.codif->metadata);
+        free(df.codif->header);
+        free(df.codif->data);
+        free(df.codif);
+    } else {
+        if (df.vdif->extended_data != NULL) {
+            free(df.vdif->extended_data->none);
+            free(df.vdif->extended_data);
+        }
+        free(df.vdif->header);
+        free(df.vdif->data);
+        free(df.vdif);
+    }
+}
+
+HeaderBatch init_header_batch(unsigned long capacity) {
+    HeaderBatch hb = { .capacity = capacity };
+    hb.offsets = malloc(capacity * sizeof(uint64_t));
+    hb.file_index = malloc(capacity * sizeof(uint32_t));
+    hb.seconds_from_epoch = malloc(capacity * sizeof(uint32_t));
+    hb.frame_number = malloc(capacity * sizeof(uint32_t));
+    hb.frame_length = malloc(capacity * sizeof(uint32_t));
+    hb.thread_id = malloc(capacity * sizeof(uint16_t));
+    hb.station_id = malloc(capacity * sizeof(uint16_t));
+    hb.reference_epoch = malloc(capacity * sizeof(uint8_t));
+    hb.invalid = malloc(capacity * sizeof(uint8_t));
+    if (hb.offsets == NULL || hb.file_index == NULL || hb.seconds_from_epoch == NULL
+            || hb.frame_number == NULL || hb.frame_length == NULL || hb.thread_id == NULL
+            || hb.station_id == NULL || hb.reference_epoch == NULL || hb.invalid == NULL) {
+        // an empty batch can't be filled, so the failure shows up on first use
+        free_header_batch(&hb);
+    }
+    return hb;
+}
+
+void free_header_batch(HeaderBatch* hb) {
+    free(hb->offsets);
+    free(hb->file_index);
+    free(hb->seconds_from_epoch);
+    free(hb->frame_number);
+    free(hb->frame_length);
+    free(hb->thread_id);
+    free(hb->station_id);
+    free(hb->reference_epoch);
+    free(hb->invalid);
+    *hb = (HeaderBatch){ .format = hb->format };
+}
+
+QualityMap init_quality_map() {
+    // grown as seconds and threads turn up
+    return (QualityMap){ 0 };
+}
+
+void free_quality_map(QualityMap* map) {
+    free(map->seconds);
+    free(map->sequences);
+    *map = (QualityMap){ 0 };
+}
+
 int ingest_format_designator(DataStream* ds, const char* format_designator) {
     // first, let's see if this is a "simple" data stream
     char** combined_streams;
@@ -107,11 +209,8 @@ int ingest_format_designator(DataStream* ds, const char* format_designator) {
 
 static int ingest_aux_info(DataStream* ds, const char* string_value) {
     if (strlen(string_value) < 3) { return FAILURE; }
-    char* code = "xx"; // for first 2 chars
-    memcpy(code, &string_value, 2);
-    int value_length = strlen(string_value) - 2;
-    char* value = malloc(value_length * sizeof(char)); // for the remaining chars
-    memcpy(value, &string_value[2], value_length);
+    char code[3] = { string_value[0], string_value[1], TERM_CHAR }; // for first 2 chars
+    const char* value = &string_value[2]; // for the remaining chars
     if (strcasecmp(code, "st") == 0) {
         // start time
     } else if (strcasecmp(code, "fd") == 0) {
@@ -187,6 +286,14 @@ unsigned int get_data_length(DataFrame df) {
     }
 }
 
+const uint8_t* get_frame_payload(DataFrame df) {
+    if (df.format == CODIF) {
+        return (const uint8_t*)df.codif->data;
+    } else {
+        return (const uint8_t*)df.vdif->data;
+    }
+}
+
 enum DataType get_data_type(DataFrame df) {
     if (df.format == CODIF) {
         return (enum DataType)df.codif->header->data_type;
@@ -203,6 +310,26 @@ unsigned long get_frame_number(DataFrame df) {
     }    
 }
 
+unsigned int is_frame_invalid(DataFrame df) {
+    if (df.format == CODIF) {
+        return df.codif->header->invalid_flag;
+    } else {
+        return df.vdif->header->invalid_flag;
+    }
+}
+
+uint64_t get_invalid_channel_mask(DataFrame df) {
+    // only multiplexed (EDV 0x04) frames say which of their channels are valid
+    if (df.format != VDIF || df.vdif->extended_data == NULL || df.vdif->extended_data->version != Multiplex) {
+        return 0;
+    }
+    VDIFExtendedData_Multiplex* multiplex = df.vdif->extended_data->multiplex;
+    unsigned int mask_length = multiplex->validity_mask_length;
+    // channels past the end of the mask are taken as valid
+    uint64_t covered = (mask_length >= 64) ? ~0ULL : (1ULL << mask_length) - 1;
+    return ~multiplex->validity_mask & covered;
+}
+
 unsigned int get_thread_id(DataFrame df) {
     if (df.format == CODIF) {
         return df.codif->header->thread_id;
@@ -242,10 +369,10 @@ unsigned int get_reference_epoch_year(DataFrame df) {
     uint8_t reference_epoch;
     if (df.format == CODIF) {
         reference_epoch = df.codif->header->reference_epoch;
-        return 2020 + (reference_epoch / 2);
+        return CODIF_EPOCH_YEAR + (reference_epoch / 2);
     } else {
         reference_epoch = df.vdif->header->reference_epoch;
-        return 2000 + (reference_epoch / 2);
+        return VDIF_EPOCH_YEAR + (reference_epoch / 2);
     } 
 }
 
@@ -274,15 +401,33 @@ char* get_station_id(DataFrame df) {
     return numeric_id;
 }
 
+unsigned long get_sample_block_bytes(DataFrame df) {
+    if (df.format == CODIF) {
+        return df.codif->header->sample_block_length * 8;
+    }
+    // VDIF has no sample blocks, so treat the whole payload as one
+    return get_data_length(df);
+}
+
+unsigned long long get_block_samples(DataFrame df) {
+    if (df.format != CODIF) { return get_num_samples(df); }
+    // a block holds as many whole samples of every channel as fit, then padding
+    unsigned long long sample_bits = (unsigned long long)get_bits_per_sample(df) 
+        * ((int)get_data_type(df) + 1) * get_num_channels(df);
+    if (sample_bits == 0) { return 0; }
+    return get_sample_block_bytes(df) * 8 / sample_bits;
+}
+
 unsigned long long get_num_samples(DataFrame df) {
     int multiplier = (int)get_data_type(df) + 1; // real=1*bits, complex=2*bits
     unsigned int bits_per_sample = get_bits_per_sample(df) * multiplier;
     unsigned long num_channels = get_num_channels(df);
-    unsigned long long frame_bytes = get_frame_length(df);
+    unsigned long long frame_bytes = get_data_length(df);
     if (df.format == CODIF) {
         // sample block length (in 64-bit words) already accounts for padding
-        unsigned long sample_bytes = df.codif->header->sample_block_length * 8;
-        return frame_bytes / sample_bytes;
+        unsigned long block_bytes = get_sample_block_bytes(df);
+        if (block_bytes == 0) { return 0; }
+        return (frame_bytes / block_bytes) * get_block_samples(df);
     } else {
         // calculate size of segment (AKA complete sample)
         unsigned long long segment_bits = (bits_per_sample * num_channels);
@@ -311,17 +456,64 @@ unsigned long long get_num_samples(DataFrame df) {
     return 0;
 }
 
+// days between 1970-01-01 and the first day of the given (proleptic 
+// Gregorian) month, so no library call ever has to consult the local timezone
+static int64_t days_from_civil(int64_t year, unsigned int month) {
+    year -= (month <= 2);
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    unsigned int year_of_era = (unsigned int)(year - era * 400);
+    unsigned int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5;
+    unsigned int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + (int64_t)day_of_era - 719468;
+}
+
+static void init_epoch_tables() {
+    for (int i = 0; i < VDIF_NUM_EPOCHS; i++) {
+        int64_t days = days_from_civil(VDIF_EPOCH_YEAR + (i / 2), (i % 2 == 0) ? 1 : 7);
+        vdif_epoch_seconds[i] = days * SECONDS_PER_DAY;
+    }
+    for (int i = 0; i < CODIF_NUM_EPOCHS; i++) {
+        int64_t days = days_from_civil(CODIF_EPOCH_YEAR + (i / 2), (i % 2 == 0) ? 1 : 7);
+        codif_epoch_seconds[i] = days * SECONDS_PER_DAY;
+    }
+}
+
+int64_t get_epoch_seconds(enum DataFormat format, unsigned int reference_epoch) {
+    pthread_once(&epoch_tables_once, init_epoch_tables);
+    if (format == CODIF) {
+        return codif_epoch_seconds[reference_epoch % CODIF_NUM_EPOCHS];
+    } else {
+        return vdif_epoch_seconds[reference_epoch % VDIF_NUM_EPOCHS];
+    }
+}
+
+unsigned int get_epoch_for_time(enum DataFormat format, int64_t unix_seconds) {
+    // latest reference epoch at or before the given time
+    unsigned int num_epochs = (format == CODIF) ? CODIF_NUM_EPOCHS : VDIF_NUM_EPOCHS;
+    unsigned int reference_epoch = 0;
+    while (reference_epoch + 1 < num_epochs && get_epoch_seconds(format, reference_epoch + 1) <= unix_seconds) {
+        reference_epoch++;
+    }
+    return reference_epoch;
+}
+
+int64_t get_reference_epoch_seconds(DataFrame df) {
+    if (df.format == CODIF) {
+        return get_epoch_seconds(df.format, df.codif->header->reference_epoch);
+    } else {
+        return get_epoch_seconds(df.format, df.vdif->header->reference_epoch);
+    }
+}
+
+int64_t get_unix_seconds(DataFrame df) {
+    return get_reference_epoch_seconds(df) + (int64_t)get_seconds_from_epoch(df);
+}
+
 datetime get_start_time(DataFrame df) {
-    unsigned int year = get_reference_epoch_year(df);
-    unsigned int month = get_reference_epoch_month(df);
-    unsigned long seconds = get_seconds_from_epoch(df);
-    char* iso_string = malloc(32 * sizeof(char));
-    sprintf(iso_string, "%02d-%02d-01T00:00:00+0000", year, month);
+    time_t time = (time_t)get_unix_seconds(df);
     datetime dt; // time as struct of components
-    strptime(iso_string, "%Y-%m-%dT%H:%M:%S%z", &dt);
-    time_t time = mktime(&dt); // time as seconds from C epoch
-    time += seconds; // now to add seconds offset
-    return *gmtime(&time); // and turn it back into a datetime struct
+    gmtime_r(&time, &dt);
+    return dt;
 }
 
 FILE* get_file_handle(DataStreamInput di) {
@@ -335,10 +527,19 @@ FILE* get_file_handle(DataStreamInput di) {
 int get_next_buffer_frame(DataStream* ds, DataFrame** frame) {
     // TODO thread lock
     unsigned int next_frame_num = ds->num_processed_frames;
-    int status;
-    if (next_frame_num >= ds->num_buffered_frames && ds->input.mode == FileMode) {
-        // buffer more frames from file
-        status = buffer_frames(ds, BUFFER_FRAMES);
+    int status = SUCCESS;
+    if (next_frame_num >= ds->num_buffered_frames && (ds->input.mode == FileMode
+            || ds->input.stream->packet_pool != NULL)) {
+        // buffer more frames from file or socket, which restarts the frame count
+        METRIC_ADD(ds, num_buffer_stalls, 1);
+        METRIC_START(buffer_start);
+        if (ds->input.mode == FileMode) {
+            status = buffer_frames(ds, ds->buffer_depth);
+        } else {
+            status = buffer_packets(ds, ds->buffer_depth);
+        }
+        METRIC_STOP(ds, buffer_nanos, buffer_start);
+        next_frame_num = ds->num_processed_frames;
     }
     ds->num_processed_frames++;
     // if we succeeded in finding more frames
@@ -354,7 +555,48 @@ int get_next_buffer_frame(DataStream* ds, DataFrame** frame) {
     }
 }
 
-unsigned int should_buffer_frame(DataStream ds, const DataFrame df) {
-    // TODO check if selected thread, if frame is invalid and gap policy is SkipInvalid, etc.
-    return 1;
-}
\ No newline at end of file
+unsigned int should_buffer_frame(const DataStream* ds, const DataFrame df) {
+    // TODO check if selected thread, etc.
+    // invalid frames are only kept when they hold a gap open
+    return !(is_frame_invalid(df) && ds->gap_policy == SkipInvalid);
+}
+
+unsigned long get_frames_per_second(const DataStream* ds, DataFrame df) {
+    return get_stream_frames_per_second(ds, get_data_length(df));
+}
+
+// for when only the length of the frames is to hand, as when scanning headers
+unsigned long get_stream_frames_per_second(const DataStream* ds, unsigned long data_length) {
+    // data rate (Mbps) is for the whole stream, so divide it among threads
+    if (ds->data_rate == 0 || data_length == 0) { return 0; }
+    unsigned int num_threads = (ds->num_threads > 0) ? ds->num_threads : 1;
+    unsigned long long bytes_per_second = (unsigned long long)ds->data_rate * 1000000 / 8;
+    return (unsigned long)(bytes_per_second / num_threads / data_length);
+}
+
+Timestamp get_frame_timestamp(const DataStream* ds, DataFrame df) {
+    Timestamp ts = { get_unix_seconds(df), 0 };
+    unsigned long frames_per_second = get_frames_per_second(ds, df);
+    if (frames_per_second == 0) { return ts; } // data rate unknown
+    uint64_t nanoseconds = (uint64_t)get_frame_number(df) * NANOS_PER_SECOND / frames_per_second;
+    ts.seconds += nanoseconds / NANOS_PER_SECOND;
+    ts.nanoseconds = nanoseconds % NANOS_PER_SECOND;
+    return ts;
+}
+
+Timestamp get_sample_timestamp(const DataStream* ds, DataFrame df, unsigned long long sample) {
+    Timestamp ts = get_frame_timestamp(ds, df);
+    unsigned long frames_per_second = get_frames_per_second(ds, df);
+    unsigned long long frame_samples = get_num_samples(df);
+    if (frames_per_second == 0 || frame_samples == 0) { return ts; }
+    uint64_t samples_per_second = (uint64_t)frames_per_second * frame_samples;
+    uint64_t nanoseconds = ts.nanoseconds + (sample * NANOS_PER_SECOND / samples_per_second);
+    ts.seconds += nanoseconds / NANOS_PER_SECOND;
+    ts.nanoseconds = nanoseconds % NANOS_PER_SECOND;
+    return ts;
+}
+
+int64_t get_nanos_between(Timestamp from, Timestamp to) {
+    return (to.seconds - from.seconds) * (int64_t)NANOS_PER_SECOND
+        + ((int64_t)to.nanoseconds - (int64_t)from.nanoseconds);
+}
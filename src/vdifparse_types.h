@@ -17,11 +17,14 @@
 #ifndef VDIFPARSE_TYPES_H
 #define VDIFPARSE_TYPES_H
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
+#include <pthread.h>
 
-// one arg that may be externally user-defined
+// one arg that may be externally user-defined: the default depth of a 
+// stream's frame buffer (which can also be set per stream at runtime)
 #ifndef BUFFER_FRAMES
 #define BUFFER_FRAMES 20
 #endif
@@ -30,10 +33,17 @@
 
 #define TERM_CHAR '\0'
 
+#define NANOS_PER_SECOND 1000000000ULL
+#define VDIF_EPOCH_YEAR 2000
+#define CODIF_EPOCH_YEAR 2020
+
 #define CODIF_VERSION 0b111
-#define CODIF_METADATA_BYTES 20
+#define CODIF_METADATA_BYTES 24
 #define VDIF_EXTENDED_DATA_BYTES 16
 
+#define VDIF_SYNCH_PATTERN 0xACABFEED
+#define CODIF_SYNCH_PATTERN 0xFEEDCAFE
+
 enum StatusCode {
     SUCCESS = 0,
     FAILURE = -1,
@@ -46,6 +56,14 @@ enum StatusCode {
     BAD_FORMAT_DESIGNATOR = -8,
     BAD_FILE_NAME = -9,
     FAILED_MALLOC = -10,
+    FAILED_TO_OPEN_SOCKET = -11,
+    FRAMES_STILL_BORROWED = -12,
+    UNKNOWN_DATA_RATE = -13,
+    MISMATCHED_SAMPLE_RATES = -14,
+    FAILED_TO_WRITE_FILE = -15,
+    BAD_CPU_LIST = -16,
+    RING_OVERRUN = -17,
+    MIXED_FORMATS = -18,
 }; // NOTE: keep codes < 0 so that result >= 0 indicates success
 
 enum InputMode { FileMode, StreamMode };
@@ -53,14 +71,47 @@ enum DataFormat { VDIF=1, VDIF_LEGACY, CODIF };
 enum DataType { RealData, ComplexData };
 enum GapPolicy  { SkipInvalid, InsertInvalid };
 
+// MARK: Time types
+
+// seconds since the UNIX epoch, plus a sub-second offset
+typedef struct Timestamp {
+    int64_t seconds;
+    uint32_t nanoseconds;
+} Timestamp;
+
 // MARK: Stream input types
 
 typedef struct DataStreamInput_File {
     FILE* file_handle;
+    // a stream may be made up of several files, read one after the other
+    char** file_paths;
+    unsigned int num_files;
+    unsigned int current_file;
+    // the following file is opened and read ahead on a separate thread
+    FILE* next_file_handle;
+    pthread_t prefetch_thread;
+    unsigned int is_prefetching;
 } DataStreamInput_File;
 
+typedef struct CaptureOptions {
+    int receive_buffer_bytes;          // kernel socket buffer (SO_RCVBUF), 0 = system default
+    int busy_poll_micros;              // spin on the device queue (SO_BUSY_POLL), 0 = off
+    unsigned int receive_timeout_millis; // give up waiting for packets after this long
+    unsigned int packet_offset;        // bytes before the frame in each packet, e.g. a sequence number
+    unsigned int max_packet_bytes;
+} CaptureOptions;
+
 typedef struct DataStreamInput_Stream {
     unsigned int buffer_depth;
+    // one frame arrives per datagram, received in batches into pooled slots
+    int socket_fd;
+    unsigned int port;
+    CaptureOptions options;
+    uint8_t* packet_pool;
+    void* packet_batch; // PacketBatch of buffer_depth messages, kept out of this header
+    unsigned long num_received_packets;
+    unsigned long num_rejected_packets;
+    unsigned long num_dropped_packets; // by the kernel, for want of buffer space
 } DataStreamInput_Stream;
 
 typedef struct {
@@ -72,6 +123,7 @@ typedef struct {
 } DataStreamInput;
 
 DataStreamInput init_input(enum InputMode mode);
+CaptureOptions init_capture_options();
 FILE* get_file_handle(DataStreamInput di);
 
 // MARK: Decode monitor (decode statistics) types
@@ -85,9 +137,28 @@ typedef struct DecodeChannelMonitor {
     datetime last_timestep;
 } DecodeChannelMonitor;
 
+// per-stream hot path counters, left at zero when built with VDIFPARSE_NO_METRICS
+typedef struct StreamMetrics {
+    unsigned long long num_bytes_read;
+    unsigned long num_buffered_frames;
+    unsigned long num_skipped_frames;
+    unsigned long num_buffer_stalls; // times a reader ran out of frames and waited on a refill
+    unsigned long num_decoded_frames;
+    uint64_t buffer_nanos;           // time spent refilling the frame buffer (I/O and allocation)
+    uint64_t alloc_nanos;            // the part of buffer_nanos spent allocating frames
+    uint64_t decode_nanos;
+} StreamMetrics;
+
 typedef struct DecodeMonitor {
     unsigned long decoded_channels;
     DecodeChannelMonitor* channels;
+    unsigned long long num_discarded_bytes;
+    unsigned long num_resyncs;
+    unsigned long num_lost_frames;         // missing from the (seconds, frame number) sequence
+    unsigned long num_inserted_frames;     // invalid frames decoded in their place
+    unsigned long num_out_of_order_frames; // late or repeated, so not counted as lost
+    unsigned long num_skipped_frames;      // flagged invalid and skipped (SkipInvalid), so not counted as lost
+    StreamMetrics metrics; // stream metrics as of the end of the last decode
 } DecodeMonitor;
 
 // MARK: VDIF format types
@@ -260,51 +331,227 @@ typedef struct {
         DataFrame_VDIF* vdif;
         DataFrame_CODIF* codif;
     };
+    unsigned int num_skipped_before; // invalid frames of its thread left unbuffered just before it
 } DataFrame;
 
 DataFrame init_frame(enum DataFormat format);
+void free_frame(DataFrame df);
 unsigned int get_frame_length(DataFrame df);
 unsigned int get_header_length(DataFrame df);
 unsigned int get_data_length(DataFrame df);
+const uint8_t* get_frame_payload(DataFrame df);
 enum DataType get_data_type(DataFrame df);
 unsigned long get_frame_number(DataFrame df);
+unsigned int is_frame_invalid(DataFrame df);
+uint64_t get_invalid_channel_mask(DataFrame df);
 unsigned int get_thread_id(DataFrame df);
 unsigned long get_num_channels(DataFrame df);
 unsigned int get_bits_per_sample(DataFrame df);
 unsigned int get_reference_epoch_month(DataFrame df);
 unsigned int get_reference_epoch_year(DataFrame df);
 unsigned long get_seconds_from_epoch(DataFrame df);
+int64_t get_epoch_seconds(enum DataFormat format, unsigned int reference_epoch);
+unsigned int get_epoch_for_time(enum DataFormat format, int64_t unix_seconds);
+int64_t get_reference_epoch_seconds(DataFrame df);
+int64_t get_unix_seconds(DataFrame df);
 char* get_station_id(DataFrame df);
 unsigned long long get_num_samples(DataFrame df);
+unsigned long get_sample_block_bytes(DataFrame df);
+unsigned long long get_block_samples(DataFrame df);
 datetime get_start_time(DataFrame df);
 
-// MARK: Stream types
+// MARK: Header batch types
 
-typedef struct DataStream {
-    const DataStreamInput input;
+// the headers of many frames, decoded into one array per field so that 
+// indexing and summaries only touch the fields they need
+typedef struct HeaderBatch {
     enum DataFormat format;
-    unsigned int is_compound_datastream;
-
-    unsigned int data_rate;
-    unsigned int num_channels;
-    unsigned int bits_per_sample;
-    unsigned int num_threads;
+    unsigned long capacity;
+    unsigned long num_headers;
+    uint64_t* offsets;             // from the start of the frame's file (or buffer)
+    uint32_t* file_index;          // which file of a multi-file stream
+    uint32_t* seconds_from_epoch;
+    uint32_t* frame_number;
+    uint32_t* frame_length;        // in bytes, including the header
+    uint16_t* thread_id;
+    uint16_t* station_id;
+    uint8_t* reference_epoch;
+    uint8_t* invalid;
+} HeaderBatch;
+
+HeaderBatch init_header_batch(unsigned long capacity);
+void free_header_batch(HeaderBatch* hb);
+
+// MARK: Quality map types
+
+// how a frame's payload looks, without decoding it
+enum PayloadPattern { PayloadVaried, PayloadZero, PayloadConstant };
+
+// the frames of one second of a stream (across all its threads), and how
+// many of them are fit to process
+typedef struct SecondQuality {
+    int64_t seconds;                   // since the UNIX epoch
+    unsigned long num_frames;          // present in the stream
+    unsigned long num_missing_frames;  // lost from a thread's frame number sequence
+    unsigned long num_invalid_frames;  // flagged invalid in their headers
+    unsigned long num_zero_frames;     // with payloads of nothing but zero bits
+    unsigned long num_constant_frames; // with payloads of one 64-bit word repeated
+    unsigned long num_valid_frames;    // none of the above
+    float valid_fraction;              // of the frames expected, present and fit to process
+} SecondQuality;
+
+// the last frame seen of one thread, to spot frames that never arrive
+typedef struct ThreadSequence {
+    unsigned int thread_id;
+    int64_t seconds;
+    unsigned long frame_number;
+} ThreadSequence;
+
+// a validity map of a stream, one entry per second that any frame fell in, 
+// in order of time
+typedef struct QualityMap {
+    unsigned long num_seconds;
+    unsigned long capacity;
+    SecondQuality* seconds;
+    unsigned long num_out_of_order_frames;
+    unsigned long max_frame_number;    // stands in for the frame rate while the data rate is unknown
+    unsigned int num_sequences;
+    ThreadSequence* sequences;         // so that continuity carries over between scans
+} QualityMap;
+
+QualityMap init_quality_map();
+void free_quality_map(QualityMap* map);
+
+// MARK: Checksum types
+
+// a CRC32C (Castagnoli) of the frames of one file or thread, headers and 
+// all, in the order they were read; the same as any other CRC32C of those 
+// bytes one after another
+typedef struct StreamChecksum {
+    unsigned int id;               // the file's index in the stream, or the thread's ID
+    uint32_t crc32c;
+    unsigned long long num_bytes;
+    unsigned long num_frames;
+} StreamChecksum;
 
-    unsigned long num_selected_channels;
-    unsigned int num_selected_threads;
-
-    enum GapPolicy gap_policy;
+// MARK: Stream types
 
-    unsigned int num_processed_frames;
-    unsigned int num_buffered_frames;
-    DataFrame frames[BUFFER_FRAMES];
-} DataStream;
+// streams are opaque handles, made by the open_* functions and freed by 
+// close_stream, with their layout kept to the library (vdifparse_stream.h)
+typedef struct DataStream DataStream;
 
-DataStream init_stream(enum InputMode mode);
+DataStream* init_stream(enum InputMode mode);
 int ingest_format_designator(DataStream* ds, const char* format_designator);
 int ingest_structured_filename(DataStream* ds, const char* file_path);
 
 int get_next_buffer_frame(DataStream* ds, DataFrame** out);
-unsigned int should_buffer_frame(DataStream ds, const DataFrame df);
+unsigned int should_buffer_frame(const DataStream* ds, const DataFrame df);
+
+unsigned long get_frames_per_second(const DataStream* ds, DataFrame df);
+unsigned long get_stream_frames_per_second(const DataStream* ds, unsigned long data_length);
+Timestamp get_frame_timestamp(const DataStream* ds, DataFrame df);
+Timestamp get_sample_timestamp(const DataStream* ds, DataFrame df, unsigned long long sample);
+int64_t get_nanos_between(Timestamp from, Timestamp to);
+
+// MARK: Output types
+
+typedef struct DataOutput {
+    FILE* file_handle;
+    enum DataFormat format;
+
+    unsigned int data_rate; // Mbps, to know when frame numbers wrap
+    unsigned long num_channels;
+    unsigned int bits_per_sample;
+    enum DataType data_type;
+    unsigned int payload_bytes;
+    uint16_t station_id;
+    uint16_t thread_id;
+
+    uint8_t reference_epoch;
+    uint32_t seconds_from_epoch;
+    uint32_t frame_number;
+    unsigned long num_written_frames;
+    unsigned int use_checksum;
+    uint32_t checksum; // CRC32C of every frame written so far, if use_checksum
+
+    // one frame of samples in stream order, waiting to be encoded
+    float* staging;
+    unsigned long num_staged_values;
+    // whole frames waiting to be written out in one go
+    uint8_t* buffer;
+    unsigned long buffer_bytes;
+    unsigned long num_buffered_bytes;
+} DataOutput;
+
+// MARK: Batch processing types
+
+// receives each block of samples decoded from a stream, in stream order
+typedef struct StreamSink {
+    int (*write_block)(void* context, float** samples, unsigned long num_samples, const DecodeMonitor* statistics);
+    void* context;
+} StreamSink;
+
+// one block of samples from each of several streams, all covering the same 
+// time span; the samples stay valid until the next block is read
+typedef struct AlignedBlock {
+    unsigned int num_streams;
+    unsigned long num_samples;
+    Timestamp start_time;
+    float*** samples; // [stream][channel][sample]
+    const DecodeMonitor** statistics; // per stream, for this block alone
+} AlignedBlock;
+
+// reads several streams in lockstep from a common start time, decoding each 
+// ahead on its own thread; lost frames are filled in while it reads, and each
+// stream's own gap policy is given back when it is closed
+typedef struct AlignedReader AlignedReader;
+
+// receives each frame of a stream in turn, borrowed only for the duration of 
+// the call; returning anything but SUCCESS stops the iteration
+typedef int (*FrameCallback)(void* context, const DataFrame* df);
+
+// MARK: Sample writer types
+
+typedef struct SinkOptions {
+    unsigned long buffer_bytes;        // per write, rounded up to a whole number of pages
+    unsigned int num_buffers;          // filled ahead of the writer thread
+    unsigned int values_per_sample;    // 2 for complex data, written as (I, Q) pairs
+    unsigned int use_direct_io;        // bypass the page cache (O_DIRECT) where the filesystem allows
+    unsigned int drop_when_full;       // drop blocks rather than wait for the writer to catch up
+    unsigned long long rotate_bytes;   // start a new file after this many bytes, 0 = never
+    double rotate_seconds;             // ... or after this much data time, 0 = never
+    unsigned long samples_per_second;  // needed to rotate by time
+    const char* cpu_list;              // CPUs for the writer thread (and its buffers' node), NULL = any
+} SinkOptions;
+
+SinkOptions init_sink_options();
+
+typedef struct SinkMetrics {
+    unsigned long long num_written_bytes;
+    unsigned int num_files;
+    unsigned long num_writer_stalls;   // times a block waited on the writer for a free buffer
+    unsigned long num_dropped_blocks;  // with drop_when_full, blocks dropped instead
+    uint64_t write_nanos;              // time the writer thread spent in write calls
+} SinkMetrics;
+
+// writes blocks of decoded samples out as rows of float32 values (one row per
+// sample, one value per channel), in large writes made on a thread of its own
+typedef struct SampleWriter SampleWriter;
+
+// MARK: Shared memory ring types
+
+// a block of samples read from a shared memory ring, without copying; the 
+// publisher may overwrite it at any time, so check it with release_ring_block
+typedef struct RingBlock {
+    uint64_t sequence;             // counts the blocks published, from 0
+    unsigned long num_samples;
+    unsigned long num_channels;
+    float** samples;               // [channel][sample], pointing into shared memory
+    unsigned long num_lost_blocks; // overwritten before this reader got to them
+} RingBlock;
+
+// a ring of decoded blocks in POSIX shared memory, published by one process 
+// and read by any number of others, each at its own pace
+typedef struct SharedRing SharedRing;
 
 #endif // VDIFPARSE_TYPES_H
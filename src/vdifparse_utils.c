@@ -20,8 +20,10 @@
 #include <stdio.h>
 #include <math.h>
 #include <ctype.h>
+#include <unistd.h>
 
 #include "vdifparse_utils.h"
+#include "vdifparse_stream.h"
 
 #define _1e9 1000000000
 #define _1e6 1000000
@@ -149,29 +151,44 @@ unsigned int* string_to_numeric(const char* string_value) {
         // cast to numeric failed
         return (unsigned int*)NULL;
     }
-    num_ptr = &num_value;
+    *num_ptr = num_value;
     return num_ptr;
 }
 
 int split_string(const char* string_value, const char* separators, char*** out) {
     char** tokens = NULL;
     int num_tokens = 0;
-    char* token = strtok(strdup(string_value), separators);
+    // skip leading separators, so the first token is the start of the copy
+    char* copy = strdup(&string_value[strspn(string_value, separators)]);
+    char* token = strtok(copy, separators);
     while (token != NULL) {
         num_tokens++;
         tokens = realloc(tokens, num_tokens * sizeof(char*));
         tokens[num_tokens - 1] = token;
         token = strtok(NULL, separators);
     }
+    if (num_tokens == 0) { free(copy); }
     *out = tokens;
     return num_tokens;
 }
 
-void print_stream(DataStream ds) {
+void free_split_string(char** tokens, int num_tokens) {
+    // tokens all point into one copy of the string, which starts at the first
+    if (num_tokens > 0) { free(tokens[0]); }
+    free(tokens);
+}
+
+unsigned int get_num_processors() {
+    long num_processors = sysconf(_SC_NPROCESSORS_ONLN);
+    return (num_processors > 0) ? (unsigned int)num_processors : 1;
+}
+
+void print_stream(const DataStream* ds) {
     fprintf(stdout, "DataStream\n");
-    fprintf(stdout, "_input_mode: %s\n", string_for_input_mode(ds.input.mode));
-    fprintf(stdout, "_gap_policy: %s\n", string_for_gap_policy(ds.gap_policy));
-    fprintf(stdout, "_buffered_frames: %u\n", ds.num_buffered_frames);
+    fprintf(stdout, "_input_mode: %s\n", string_for_input_mode(ds->input.mode));
+    fprintf(stdout, "_gap_policy: %s\n", string_for_gap_policy(ds->gap_policy));
+    fprintf(stdout, "_buffered_frames: %u of %u\n", ds->num_buffered_frames, ds->buffer_depth);
+    fprintf(stdout, "_discarded_bytes: %llu (%lu resyncs)\n", ds->num_discarded_bytes, ds->num_resyncs);
 }
 
 void print_frame(DataFrame df) {
@@ -186,3 +203,18 @@ void print_frame(DataFrame df) {
     fprintf(stdout, "_start_time: %s\n", string_for_datetime(get_start_time(df)));
     // TODO extended data fields
 }
+
+void print_metrics(StreamMetrics metrics, FILE* out) {
+    // rates are per second of time spent in that stage, not of wall time
+    double buffer_seconds = metrics.buffer_nanos / (double)NANOS_PER_SECOND;
+    double decode_seconds = metrics.decode_nanos / (double)NANOS_PER_SECOND;
+    fprintf(out, "StreamMetrics\n");
+    fprintf(out, "_bytes_read: %llu (%.1f MB/s buffering)\n", metrics.num_bytes_read,
+        (buffer_seconds > 0) ? metrics.num_bytes_read / buffer_seconds / 1e6 : 0.0);
+    fprintf(out, "_frames: %lu buffered, %lu skipped, %lu decoded\n", metrics.num_buffered_frames,
+        metrics.num_skipped_frames, metrics.num_decoded_frames);
+    fprintf(out, "_buffer_stalls: %lu\n", metrics.num_buffer_stalls);
+    fprintf(out, "_buffer_time: %.6f s (%.6f s allocating)\n", buffer_seconds,
+        metrics.alloc_nanos / (double)NANOS_PER_SECOND);
+    fprintf(out, "_decode_time: %.6f s\n", decode_seconds);
+}
@@ -36,8 +36,12 @@ char* string_for_ascii(uint64_t sequence);
 
 unsigned int* string_to_numeric(const char* string_value);
 int split_string(const char* string_value, const char* separators, char*** out);
+void free_split_string(char** tokens, int num_tokens);
 
-void print_stream(DataStream ds);
+unsigned int get_num_processors();
+
+void print_stream(const DataStream* ds);
 void print_frame(DataFrame df);
+void print_metrics(StreamMetrics metrics, FILE* out);
 
 #endif // VDIFPARSE_UTILS_H
@@ -1,40 +1,1682 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <zlib.h>
 
+#include "../src/vdifparse_output.h"
 #include "../src/vdifparse_utils.h"
 #include "../vdifparse.h"
 
 
+unsigned int num_failed_tests = 0;
+
 void test(char* description, uint8_t condition) {
     if (condition) {
         fprintf(stdout, "- %s: \033[0;32mTrue\033[0m\n", description);
     } else {
         fprintf(stdout, "- %s: \033[0;31mFalse\033[0m\n", description);
+        num_failed_tests++;
+    }
+}
+
+// fills in, in memory, the header of a frame of 4 channels of 2-bit real
+// samples in a 1000-byte payload (8000 frames per second at 64 Mbps)
+static DataFrame make_timed_frame(uint32_t seconds_from_epoch, uint8_t reference_epoch, uint32_t frame_number) {
+    DataFrame df = init_frame(VDIF);
+    VDIFHeader* header = df.vdif->header;
+    header->seconds_from_epoch = seconds_from_epoch;
+    header->reference_epoch = reference_epoch;
+    header->frame_number = frame_number;
+    header->frame_length = (32 + 1000) / 8;
+    header->log2_num_channels = 2;
+    header->bits_per_sample = 1;
+    return df;
+}
+
+// makes frame 3 of a second in each of three reference epochs, then checks
+// the epoch, calendar date, frame and sample times derived from its header
+int test_timestamps() {
+    struct { int64_t seconds; int64_t epoch_seconds; uint8_t epoch; int year, month, day; } cases[3] = {
+        { 946684800, 946684800, 0, 2000, 1, 1 },          // epoch 0 itself
+        { 1078099200, 1072915200, 8, 2004, 3, 1 },        // epoch 8, past 2004's leap day
+        { 1088640100, 1088640000, 9, 2004, 7, 1 },        // epoch 9, 182 days after epoch 8
+    };
+    DataStream* ds = open_sink();
+    set_format_designator(ds, "VDIF-64-4-2"); // 8000 frames of 1000 samples per second
+    int is_ok = 1;
+    for (unsigned int i = 0; is_ok && i < 3; i++) {
+        DataFrame df = make_timed_frame(cases[i].seconds - cases[i].epoch_seconds, cases[i].epoch, 3);
+        datetime start_time = get_start_time(df);
+        Timestamp frame_time = get_frame_timestamp(ds, df);
+        Timestamp sample_time = get_sample_timestamp(ds, df, 500);
+        // the last sample of the second is 125 ns before the next one starts
+        Timestamp last_time = get_sample_timestamp(ds, df, 8000 * 1000 - 3000 - 1);
+        Timestamp next_time = get_sample_timestamp(ds, df, 8000 * 1000 - 3000);
+        is_ok = get_reference_epoch_seconds(df) == cases[i].epoch_seconds
+            && get_unix_seconds(df) == cases[i].seconds && start_time.tm_year + 1900 == cases[i].year
+            && start_time.tm_mon + 1 == cases[i].month && start_time.tm_mday == cases[i].day
+            && frame_time.seconds == cases[i].seconds && frame_time.nanoseconds == 375000
+            && sample_time.seconds == cases[i].seconds && sample_time.nanoseconds == 375000 + 500 * 125
+            && last_time.seconds == cases[i].seconds && last_time.nanoseconds == NANOS_PER_SECOND - 125
+            && next_time.seconds == cases[i].seconds + 1 && next_time.nanoseconds == 0;
+        free(df.vdif->extended_data);
+        free(df.vdif->header);
+        free(df.vdif);
+    }
+    close_stream(ds);
+    return is_ok;
+}
+
+// writes a VDIF frame of 4 channels of 2-bit real samples in a 1000-byte
+// payload, packed by hand so the test does not depend on any writer.
+// channel c of sample t has code (c + 3t) % 4
+static void write_raw_frame(FILE* file_handle, uint32_t seconds_from_epoch, uint32_t frame_number) {
+    uint32_t header[8] = { 0 };
+    header[0] = seconds_from_epoch;
+    header[1] = frame_number;
+    header[2] = ((32 + 1000) / 8) | (2 << 24); // frame length and log2 channels
+    header[3] = 0x5454 | (1 << 26); // station and bits per sample - 1
+    uint8_t data[1000];
+    for (unsigned long t = 0; t < sizeof(data); t++) {
+        data[t] = 0;
+        for (unsigned int c = 0; c < 4; c++) {
+            data[t] |= ((c + t * 3) % 4) << (2 * c);
+        }
+    }
+    fwrite(header, sizeof(uint32_t), 8, file_handle);
+    fwrite(data, 1, sizeof(data), file_handle);
+}
+
+// puts garbage before the first of ten frames, damages the header of the
+// fifth and slips some stray bytes in before the eighth, then checks the
+// bytes are discarded and the other frames decode as written
+int test_resync() {
+    const float levels[4] = { -3.3359, -1.0, 1.0, 3.3359 };
+    char* file_path = "/tmp/vdifparse_test_resync.vdif";
+    unsigned long frame_bytes = 32 + 1000;
+    uint8_t garbage[1000];
+    memset(garbage, 0x5a, sizeof(garbage));
+    uint8_t damage[8];
+    memset(damage, 0xff, sizeof(damage));
+    FILE* file_handle = fopen(file_path, "wb");
+    fwrite(garbage, 1, sizeof(garbage), file_handle);
+    for (uint32_t i = 0; i < 10; i++) {
+        if (i == 7) {
+            fwrite(garbage, 1, 24, file_handle);
+        }
+        long offset = ftell(file_handle);
+        write_raw_frame(file_handle, 1000, i);
+        if (i == 4) {
+            // frame length, version and station
+            fseek(file_handle, offset + 8, SEEK_SET);
+            fwrite(damage, 1, sizeof(damage), file_handle);
+            fseek(file_handle, 0, SEEK_END);
+        }
+    }
+    fclose(file_handle);
+
+    DataStream* ds = open_file(file_path);
+    int is_ok = get_discarded_bytes(ds) == sizeof(garbage);
+    float** out = NULL;
+    DecodeMonitor statistics = { 0 };
+    unsigned long num_samples = 9 * 1000;
+    is_ok = is_ok && decode_samples(ds, num_samples, &out, &statistics) == SUCCESS
+        && statistics.num_discarded_bytes == frame_bytes + 24 && statistics.num_resyncs == 2
+        && get_discarded_bytes(ds) == sizeof(garbage) + frame_bytes + 24;
+    for (unsigned long i = 0; is_ok && i < 4; i++) {
+        for (unsigned long j = 0; j < num_samples; j++) {
+            // the fifth frame's samples are lost with its header
+            unsigned long sample = (j < 4000) ? j : j + 1000;
+            is_ok = is_ok && out[i][j] == levels[(i + sample * 3) % 4];
+        }
+    }
+    close_stream(ds);
+    for (unsigned long i = 0; out != NULL && i < 4; i++) {
+        free(out[i]);
+    }
+    free(out);
+    free(statistics.channels);
+    remove(file_path);
+    return is_ok;
+}
+
+// counts the blocks and samples a sink is given
+typedef struct BlockTally {
+    unsigned long num_blocks;
+    unsigned long num_samples;
+} BlockTally;
+
+static int tally_block(void* context, float** samples, unsigned long num_samples, const DecodeMonitor* statistics) {
+    BlockTally* tally = (BlockTally*)context;
+    tally->num_blocks++;
+    tally->num_samples += num_samples;
+    return SUCCESS;
+}
+
+// decodes files of different lengths together on fewer threads than streams,
+// and checks each sink is given as many blocks and samples as when its file
+// is decoded alone
+int test_batch_decode() {
+    char* file_paths[3] = { "/tmp/vdifparse_test_batch_a.vdif", "/tmp/vdifparse_test_batch_b.vdif",
+        "/tmp/vdifparse_test_batch_c.vdif" };
+    unsigned long num_frames[3] = { 30, 45, 60 };
+    unsigned long block_samples = 12000;
+    BlockTally expected[3] = { { 0 } };
+    BlockTally counted[3] = { { 0 } };
+    int is_ok = 1;
+    for (unsigned int i = 0; i < 3; i++) {
+        FILE* file_handle = fopen(file_paths[i], "wb");
+        for (uint32_t j = 0; j < num_frames[i]; j++) {
+            write_raw_frame(file_handle, 1000, j);
+        }
+        fclose(file_handle);
+        DataStream* ds = open_file(file_paths[i]);
+        StreamSink sink = { tally_block, &expected[i] };
+        is_ok = is_ok && decode_streams(&ds, &sink, 1, block_samples, 1) == SUCCESS;
+        close_stream(ds);
+    }
+    DataStream* streams[3];
+    StreamSink sinks[3];
+    for (unsigned int i = 0; i < 3; i++) {
+        streams[i] = open_file(file_paths[i]);
+        sinks[i] = (StreamSink){ tally_block, &counted[i] };
+    }
+    is_ok = is_ok && decode_streams(streams, sinks, 3, block_samples, 2) == SUCCESS;
+    for (unsigned int i = 0; i < 3; i++) {
+        is_ok = is_ok && expected[i].num_blocks > 1 && counted[i].num_blocks == expected[i].num_blocks
+            && counted[i].num_samples == expected[i].num_samples;
+        close_stream(streams[i]);
+        remove(file_paths[i]);
+    }
+    return is_ok;
+}
+
+// notes, for one stream of a batch, whether any stream had ended before its
+// first block came
+typedef struct StreamTurn {
+    unsigned long num_samples;
+    unsigned long total_samples;
+    unsigned int* num_finished;
+    int is_first_before_end;
+} StreamTurn;
+
+static int take_turn(void* context, float** samples, unsigned long num_samples, const DecodeMonitor* statistics) {
+    StreamTurn* turn = (StreamTurn*)context;
+    if (turn->num_samples == 0) {
+        turn->is_first_before_end = (*turn->num_finished == 0);
+    }
+    turn->num_samples += num_samples;
+    if (turn->num_samples == turn->total_samples) {
+        (*turn->num_finished)++;
+    }
+    return SUCCESS;
+}
+
+// decodes more streams than there are threads, and checks the streams take 
+// turns, so that every sink gets a block before any stream ends
+int test_batch_turns() {
+    char* file_paths[4] = { "/tmp/vdifparse_test_turn_a.vdif", "/tmp/vdifparse_test_turn_b.vdif",
+        "/tmp/vdifparse_test_turn_c.vdif", "/tmp/vdifparse_test_turn_d.vdif" };
+    unsigned int num_finished = 0;
+    StreamTurn turns[4];
+    DataStream* streams[4];
+    StreamSink sinks[4];
+    for (unsigned int i = 0; i < 4; i++) {
+        FILE* file_handle = fopen(file_paths[i], "wb");
+        for (uint32_t j = 0; j < 20; j++) {
+            write_raw_frame(file_handle, 1000, j);
+        }
+        fclose(file_handle);
+        streams[i] = open_file(file_paths[i]);
+        turns[i] = (StreamTurn){ 0, 20 * 1000, &num_finished, 0 };
+        sinks[i] = (StreamSink){ take_turn, &turns[i] };
+    }
+    // one thread, so the order the streams are decoded in is certain
+    int is_ok = decode_streams(streams, sinks, 4, 3000, 1) == SUCCESS && num_finished == 4;
+    for (unsigned int i = 0; i < 4; i++) {
+        is_ok = is_ok && turns[i].is_first_before_end;
+        close_stream(streams[i]);
+        remove(file_paths[i]);
+    }
+    return is_ok;
+}
+
+// writes frames of known decode levels then reads them back (no test data needed)
+int test_output_round_trip(const char* format_designator, enum DataType type) {
+    char* output_file_path = "/tmp/vdifparse_test_output.vdif";
+    const float levels[4] = { -3.3359, -1.0, 1.0, 3.3359 };
+    DataOutput dout = open_output(output_file_path, VDIF);
+    set_output_format_designator(&dout, format_designator);
+    dout.data_type = type;
+    dout.payload_bytes = 1024;
+    unsigned long num_samples = get_output_frame_samples(&dout) * 3;
+    unsigned long num_values = num_samples * ((type == ComplexData) ? 2 : 1);
+    float** in = malloc(dout.num_channels * sizeof(float*));
+    for (unsigned long i = 0; i < dout.num_channels; i++) {
+        in[i] = malloc(num_values * sizeof(float));
+        for (unsigned long j = 0; j < num_values; j++) {
+            in[i][j] = (dout.bits_per_sample == 2) ? levels[(i + j * 3) % 4] : ((float)((i + j * 7) % 16) - 8.0) / 2.95;
+        }
+    }
+    int status = write_samples(&dout, in, num_samples);
+    status = (status == SUCCESS) ? close_output(&dout) : status;
+
+    DataStream* ds = open_file(output_file_path);
+    float** out = NULL;
+    status = (status == SUCCESS) ? decode_samples(ds, num_samples, &out, NULL) : status;
+    int matching_samples = (status == SUCCESS) && get_selected_channels(ds) == dout.num_channels;
+    for (unsigned long i = 0; matching_samples && i < dout.num_channels; i++) {
+        matching_samples = (memcmp(in[i], out[i], num_values * sizeof(float)) == 0);
+    }
+    close_stream(ds);
+    remove(output_file_path);
+    return matching_samples;
+}
+
+// checks that the hot path counters add up over a file of known frames
+int test_stream_metrics() {
+    char* output_file_path = "/tmp/vdifparse_test_metrics.vdif";
+    DataOutput dout = open_output(output_file_path, VDIF);
+    set_output_format_designator(&dout, "VDIF-64-1-2");
+    dout.payload_bytes = 1024;
+    unsigned long num_samples = get_output_frame_samples(&dout) * 4;
+    float* samples = calloc(num_samples, sizeof(float));
+    write_samples(&dout, &samples, num_samples);
+    close_output(&dout);
+
+    DataStream* ds = open_file(output_file_path);
+    float** out = NULL;
+    decode_samples(ds, num_samples, &out, NULL);
+    StreamMetrics metrics = get_stream_metrics(ds);
+    int matching_metrics = metrics.num_buffered_frames == 4 && metrics.num_decoded_frames == 4
+        && metrics.num_skipped_frames == 0 && metrics.num_bytes_read == 4 * (32 + 1024)
+        && metrics.num_buffer_stalls >= 1;
+    close_stream(ds);
+    remove(output_file_path);
+    free(samples);
+    return matching_metrics;
+}
+
+// sends frames written to file as one datagram each over loopback, then
+// checks they decode the same as the file does
+int test_udp_capture() {
+    char* output_file_path = "/tmp/vdifparse_test_capture.vdif";
+    DataOutput dout = open_output(output_file_path, VDIF);
+    set_output_format_designator(&dout, "VDIF-64-4-2");
+    dout.payload_bytes = 1024;
+    unsigned long num_samples = get_output_frame_samples(&dout) * 3;
+    float* samples[4];
+    for (int i = 0; i < 4; i++) {
+        samples[i] = malloc(num_samples * sizeof(float));
+        for (unsigned long j = 0; j < num_samples; j++) { samples[i][j] = (float)((i + j) % 5) - 2.0; }
+    }
+    write_samples(&dout, samples, num_samples);
+    close_output(&dout);
+
+    FILE* file_handle = fopen(output_file_path, "rb");
+    unsigned int frame_bytes = 32 + 1024;
+    uint8_t* bytes = malloc(frame_bytes * 3);
+    size_t num_bytes = fread(bytes, 1, frame_bytes * 3, file_handle);
+    fclose(file_handle);
+    remove(output_file_path);
+
+    DataStream* ds = open_udp("127.0.0.1", 0, NULL);
+    int sender = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in destination = { .sin_family = AF_INET, .sin_port = htons(get_capture_port(ds)) };
+    inet_pton(AF_INET, "127.0.0.1", &destination.sin_addr);
+    sendto(sender, "not a frame", 11, 0, (struct sockaddr*)&destination, sizeof(destination));
+    for (unsigned int i = 0; i < num_bytes / frame_bytes; i++) {
+        sendto(sender, &bytes[i * frame_bytes], frame_bytes, 0, (struct sockaddr*)&destination, sizeof(destination));
+    }
+    close(sender);
+
+    float** out = NULL;
+    DecodeMonitor statistics = { 0 };
+    int status = decode_samples(ds, num_samples, &out, &statistics);
+    // the datagram that wasn't a frame is discarded
+    int matching_samples = (status == SUCCESS) && statistics.num_discarded_bytes == 11;
+    for (int i = 0; matching_samples && i < 4; i++) {
+        for (unsigned long j = 0; matching_samples && j < num_samples; j++) {
+            matching_samples = (samples[i][j] < 0) == (out[i][j] < 0);
+        }
+    }
+    close_stream(ds);
+    free(bytes);
+    for (int i = 0; i < 4; i++) { free(samples[i]); }
+    return matching_samples;
+}
+
+// decodes a file and a UDP capture together, and checks the capture's stream
+// ends with the frames it was sent once it times out, as the file does at
+// its end
+int test_batch_capture() {
+    char* file_path = "/tmp/vdifparse_test_batch_capture.vdif";
+    unsigned long frame_bytes = 32 + 1000;
+    FILE* file_handle = fopen(file_path, "wb");
+    for (uint32_t i = 0; i < 20; i++) {
+        write_raw_frame(file_handle, 1000, i);
+    }
+    fclose(file_handle);
+    uint8_t* bytes = malloc(10 * frame_bytes);
+    file_handle = fopen(file_path, "rb");
+    size_t num_bytes = fread(bytes, 1, 10 * frame_bytes, file_handle);
+    fclose(file_handle);
+
+    CaptureOptions options = init_capture_options();
+    options.receive_timeout_millis = 200;
+    DataStream* streams[2] = { open_file(file_path), open_udp("127.0.0.1", 0, &options) };
+    int sender = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in destination = { .sin_family = AF_INET, .sin_port = htons(get_capture_port(streams[1])) };
+    inet_pton(AF_INET, "127.0.0.1", &destination.sin_addr);
+    for (unsigned int i = 0; i < num_bytes / frame_bytes; i++) {
+        sendto(sender, &bytes[i * frame_bytes], frame_bytes, 0, (struct sockaddr*)&destination, sizeof(destination));
+    }
+    close(sender);
+
+    BlockTally counted[2] = { { 0 } };
+    StreamSink sinks[2] = { { tally_block, &counted[0] }, { tally_block, &counted[1] } };
+    int is_ok = decode_streams(streams, sinks, 2, 3000, 2) == SUCCESS
+        && counted[0].num_samples == 20 * 1000 && counted[1].num_samples == 10 * 1000;
+    close_stream(streams[0]);
+    close_stream(streams[1]);
+    free(bytes);
+    remove(file_path);
+    return is_ok;
+}
+
+// drops frames from a written file, then checks the gap is seen (and filled
+// with zeros if asked) when decoding
+int test_gap_filling(enum GapPolicy policy) {
+    char* output_file_path = "/tmp/vdifparse_test_gaps.vdif";
+    DataOutput dout = open_output(output_file_path, VDIF);
+    set_output_format_designator(&dout, "VDIF-64-1-2");
+    dout.payload_bytes = 1024;
+    unsigned long frame_samples = get_output_frame_samples(&dout);
+    float* samples = malloc(frame_samples * 6 * sizeof(float));
+    for (unsigned long i = 0; i < frame_samples * 6; i++) { samples[i] = 1.0; }
+    write_samples(&dout, &samples, frame_samples * 6);
+    close_output(&dout);
+
+    // keep frames 0, 1, 4 and 5
+    unsigned int frame_bytes = 32 + 1024;
+    uint8_t* bytes = malloc(frame_bytes * 6);
+    FILE* file_handle = fopen(output_file_path, "rb");
+    size_t num_bytes = fread(bytes, 1, frame_bytes * 6, file_handle);
+    fclose(file_handle);
+    file_handle = fopen(output_file_path, "wb");
+    fwrite(bytes, 1, frame_bytes * 2, file_handle);
+    fwrite(&bytes[frame_bytes * 4], 1, num_bytes - frame_bytes * 4, file_handle);
+    fclose(file_handle);
+
+    DataStream* ds = open_file(output_file_path);
+    set_gap_policy(ds, policy);
+    float** out = NULL;
+    DecodeMonitor statistics = { 0 };
+    unsigned long num_samples = frame_samples * ((policy == InsertInvalid) ? 6 : 4);
+    int status = decode_samples(ds, num_samples, &out, &statistics);
+    int is_gap_handled = (status == SUCCESS) && statistics.num_lost_frames == 2;
+    if (policy == InsertInvalid) {
+        is_gap_handled = is_gap_handled && statistics.num_inserted_frames == 2
+            && out[0][frame_samples * 2] == 0.0 && out[0][frame_samples * 4 - 1] == 0.0
+            && out[0][frame_samples * 4] > 0.0 && statistics.channels[0].num_invalid_frames == 2;
+    } else {
+        is_gap_handled = is_gap_handled && statistics.num_inserted_frames == 0 && out[0][frame_samples * 2] > 0.0;
+    }
+    close_stream(ds);
+    remove(output_file_path);
+    free(bytes);
+    free(samples);
+    return is_gap_handled;
+}
+
+// flags the third of eight written frames invalid and drops the sixth, then
+// checks only the dropped one is counted as lost (and filled, if asked), 
+// while the invalid one is counted as skipped or decoded as zeros
+int test_invalid_in_sequence(enum GapPolicy policy) {
+    char* output_file_path = "/tmp/vdifparse_test_invalid.vdif";
+    DataOutput dout = open_output(output_file_path, VDIF);
+    set_output_format_designator(&dout, "VDIF-64-1-2");
+    dout.payload_bytes = 1024;
+    unsigned long frame_samples = get_output_frame_samples(&dout);
+    float* samples = malloc(frame_samples * 8 * sizeof(float));
+    for (unsigned long i = 0; i < frame_samples * 8; i++) { samples[i] = 1.0; }
+    write_samples(&dout, &samples, frame_samples * 8);
+    close_output(&dout);
+
+    unsigned int frame_bytes = 32 + 1024;
+    uint8_t* bytes = malloc(frame_bytes * 8);
+    FILE* file_handle = fopen(output_file_path, "rb");
+    size_t num_bytes = fread(bytes, 1, frame_bytes * 8, file_handle);
+    fclose(file_handle);
+    bytes[2 * frame_bytes + 3] |= 0x80; // invalid flag, top bit of word 0
+    file_handle = fopen(output_file_path, "wb");
+    fwrite(bytes, 1, frame_bytes * 5, file_handle);
+    fwrite(&bytes[frame_bytes * 6], 1, num_bytes - frame_bytes * 6, file_handle);
+    fclose(file_handle);
+
+    DataStream* ds = open_file(output_file_path);
+    set_gap_policy(ds, policy);
+    float** out = NULL;
+    DecodeMonitor statistics = { 0 };
+    unsigned long num_samples = frame_samples * ((policy == InsertInvalid) ? 8 : 6);
+    int status = decode_samples(ds, num_samples, &out, &statistics);
+    int is_counted = (status == SUCCESS) && statistics.num_lost_frames == 1 
+        && statistics.num_out_of_order_frames == 0;
+    if (policy == InsertInvalid) {
+        is_counted = is_counted && statistics.num_skipped_frames == 0 && statistics.num_inserted_frames == 1
+            && out[0][frame_samples * 2] == 0.0 && out[0][frame_samples * 5] == 0.0
+            && statistics.channels[0].num_invalid_frames == 2;
+    } else {
+        is_counted = is_counted && statistics.num_skipped_frames == 1 && statistics.num_inserted_frames == 0
+            && statistics.channels[0].num_invalid_frames == 0 && out[0][num_samples - 1] > 0.0;
+    }
+    close_stream(ds);
+    remove(output_file_path);
+    free(bytes);
+    free(samples);
+    return is_counted;
+}
+
+// decodes a written file in blocks that don't line up with frames, and 
+// checks every sample comes out once and in order
+int test_sample_cursor(unsigned long block_samples) {
+    char* output_file_path = "/tmp/vdifparse_test_cursor.vdif";
+    DataOutput dout = open_output(output_file_path, VDIF);
+    set_output_format_designator(&dout, "VDIF-64-2-2");
+    dout.payload_bytes = 1024;
+    unsigned long num_samples = get_output_frame_samples(&dout) * 5;
+    const float levels[4] = { -3.3359, -1.0, 1.0, 3.3359 };
+    float* samples[2];
+    for (int i = 0; i < 2; i++) {
+        samples[i] = malloc(num_samples * sizeof(float));
+        for (unsigned long j = 0; j < num_samples; j++) { samples[i][j] = levels[(j * 7 + j / 3 + i) % 4]; }
+    }
+    write_samples(&dout, samples, num_samples);
+    close_output(&dout);
+
+    DataStream* ds = open_file(output_file_path);
+    float** out = NULL;
+    DecodeMonitor statistics = { 0 };
+    unsigned long num_decoded = 0;
+    int matching_samples = 1;
+    int status = SUCCESS;
+    while (status == SUCCESS && matching_samples) {
+        status = decode_samples(ds, block_samples, &out, &statistics);
+        unsigned long num_block = statistics.channels[0].num_decoded_samples - num_decoded;
+        for (int i = 0; i < 2; i++) {
+            matching_samples = matching_samples && memcmp(out[i], &samples[i][num_decoded], num_block * sizeof(float)) == 0;
+        }
+        num_decoded += num_block;
+    }
+    matching_samples = matching_samples && num_decoded == num_samples && statistics.channels[0].num_decoded_frames == 5;
+    close_stream(ds);
+    remove(output_file_path);
+    for (int i = 0; i < 2; i++) { free(samples[i]); }
+    return matching_samples;
+}
+
+int count_frame(void* context, const DataFrame* df) {
+    unsigned long* num_frames = context;
+    if (get_frame_number(*df) != *num_frames) { return FAILURE; }
+    (*num_frames)++;
+    return SUCCESS;
+}
+
+// walks a written file frame by frame without decoding, by pulling borrowed 
+// frames and by having them pushed to a callback
+int test_frame_iteration() {
+    char* output_file_path = "/tmp/vdifparse_test_frames.vdif";
+    DataOutput dout = open_output(output_file_path, VDIF);
+    set_output_format_designator(&dout, "VDIF-64-1-2");
+    dout.payload_bytes = 1024;
+    unsigned long num_samples = get_output_frame_samples(&dout) * 25;
+    float* samples = calloc(num_samples, sizeof(float));
+    write_samples(&dout, &samples, num_samples);
+    close_output(&dout);
+
+    DataStream* ds = open_file(output_file_path);
+    const DataFrame* df;
+    unsigned long num_frames = 0;
+    int is_in_order = 1;
+    while (next_frame(ds, &df) == SUCCESS) {
+        is_in_order = is_in_order && get_frame_number(*df) == num_frames && get_frame_payload(*df) != NULL;
+        release_frame(ds, df);
+        num_frames++;
+    }
+    close_stream(ds);
+    int is_iterated = is_in_order && num_frames == 25;
+
+    // frames kept past the end of the buffer hold up the next refill
+    DataStream* ds_held = open_file(output_file_path);
+    int status;
+    for (num_frames = 0; (status = next_frame(ds_held, &df)) == SUCCESS; num_frames++) { }
+    is_iterated = is_iterated && status == FRAMES_STILL_BORROWED && num_frames == BUFFER_FRAMES;
+    close_stream(ds_held);
+
+    // and the buffer can be made shallower (or deeper) before reading starts
+    DataStream* ds_shallow = open_file(output_file_path);
+    status = set_buffer_depth(ds_shallow, 7);
+    for (num_frames = 0; next_frame(ds_shallow, &df) == SUCCESS; num_frames++) { }
+    is_iterated = is_iterated && status == SUCCESS && num_frames == get_buffer_depth(ds_shallow) && num_frames == 7;
+    close_stream(ds_shallow);
+
+    DataStream* ds_pushed = open_file(output_file_path);
+    num_frames = 0;
+    status = for_each_frame(ds_pushed, count_frame, &num_frames);
+    is_iterated = is_iterated && status == SUCCESS && num_frames == 25;
+    close_stream(ds_pushed);
+    remove(output_file_path);
+    free(samples);
+    return is_iterated;
+}
+
+// checks that headers decoded in batches agree with those read frame by frame
+int test_header_scan(enum DataFormat format) {
+    char* output_file_path = "/tmp/vdifparse_test_headers";
+    DataOutput dout = open_output(output_file_path, format);
+    dout.num_channels = 4;
+    dout.payload_bytes = 1024;
+    dout.station_id = 0x4142;
+    dout.thread_id = 3;
+    dout.frame_number = 970;
+    dout.data_rate = 8; // so that frame numbers wrap at 976
+    // the partial last frame is padded out and flagged invalid
+    unsigned long num_samples = get_output_frame_samples(&dout) * 22 + 5;
+    float** samples = malloc(dout.num_channels * sizeof(float*));
+    for (unsigned long i = 0; i < dout.num_channels; i++) {
+        samples[i] = calloc(num_samples, sizeof(float));
+    }
+    write_samples(&dout, samples, num_samples);
+    close_output(&dout);
+
+    DataStream* ds = open_file(output_file_path);
+    DataStream* ds_frames = open_file(output_file_path);
+    HeaderBatch headers = init_header_batch(10);
+    const DataFrame* df;
+    unsigned long num_frames = 0;
+    int status = SUCCESS;
+    int is_matching = 1;
+    while (status == SUCCESS) {
+        headers.num_headers = 0;
+        status = scan_headers(ds, &headers);
+        for (unsigned long i = 0; i < headers.num_headers; i++, num_frames++) {
+            // invalid frames are skipped when reading frame by frame, but not when scanning
+            if (headers.invalid[i]) { continue; }
+            is_matching = is_matching && next_frame(ds_frames, &df) == SUCCESS
+                && headers.frame_number[i] == get_frame_number(*df)
+                && headers.seconds_from_epoch[i] == get_seconds_from_epoch(*df)
+                && headers.thread_id[i] == get_thread_id(*df) && headers.station_id[i] == 0x4142
+                && headers.invalid[i] == is_frame_invalid(*df)
+                && headers.frame_length[i] == get_frame_length(*df)
+                && headers.offsets[i] == num_frames * get_frame_length(*df);
+            release_frame(ds_frames, df);
+        }
+    }
+    is_matching = is_matching && status == REACHED_END_OF_FILE && num_frames == 23 && headers.invalid[2];
+    free_header_batch(&headers);
+    close_stream(ds);
+    close_stream(ds_frames);
+    for (unsigned long i = 0; i < dout.num_channels; i++) {
+        free(samples[i]);
+    }
+    free(samples);
+    remove(output_file_path);
+    return is_matching;
+}
+
+// checks CODIF samples decode from each representation, through padded sample blocks
+int test_codif_decode(unsigned int representation) {
+    // 3 real channels per sample, leaving padding at the end of each block
+    unsigned int num_channels = 3;
+    unsigned int num_bits = (representation == 2) ? 32 : 8;
+    unsigned int block_words = (representation == 2) ? 2 : 1;
+    unsigned int block_samples = block_words * 64 / (num_bits * num_channels);
+    unsigned int payload_bytes = 256;
+    unsigned int frame_samples = payload_bytes / (block_words * 8) * block_samples;
+    unsigned int num_frames = 3;
+    unsigned int frame_bytes = 64 + payload_bytes;
+    uint8_t* bytes = calloc(num_frames, frame_bytes);
+    float** expected = malloc(num_channels * sizeof(float*));
+    for (unsigned int i = 0; i < num_channels; i++) {
+        expected[i] = malloc(num_frames * frame_samples * sizeof(float));
+    }
+    for (unsigned int frame = 0; frame < num_frames; frame++) {
+        uint8_t* head = &bytes[frame * frame_bytes];
+        CODIFHeader* header = (CODIFHeader*)head;
+        header->frame_number = frame;
+        header->seconds_from_epoch = 1000;
+        header->reference_epoch = 4;
+        header->bits_per_sample = num_bits;
+        header->sample_representation = representation;
+        header->protocol_field = CODIF_VERSION;
+        header->codif_version_number = 1;
+        header->station_id = 0x4142;
+        header->num_channels = num_channels;
+        header->sample_block_length = block_words;
+        header->data_array_length = payload_bytes / 8;
+        uint32_t synch_pattern = CODIF_SYNCH_PATTERN;
+        memcpy(&head[sizeof(CODIFHeader)], &synch_pattern, sizeof(uint32_t));
+        for (unsigned int i = 0; i < frame_samples; i++) {
+            uint8_t* sample = &head[64 + (i / block_samples) * block_words * 8 + (i % block_samples) * num_channels * num_bits / 8];
+            unsigned int sample_index = frame * frame_samples + i;
+            for (unsigned int channel = 0; channel < num_channels; channel++) {
+                int code = (int)((sample_index * 7 + channel * 31) % 256) - 128;
+                if (representation == 2) {
+                    float value = code * 0.25f;
+                    memcpy(&sample[channel * sizeof(float)], &value, sizeof(float));
+                    expected[channel][sample_index] = value;
+                } else {
+                    // offset binary is two's complement with the top bit flipped
+                    sample[channel] = (representation == 1) ? (uint8_t)code : (uint8_t)(code + 128);
+                    expected[channel][sample_index] = (float)(code / 3.3);
+                }
+            }
+        }
+    }
+
+    // decode in blocks that start and end mid-frame and mid-block
+    DataStream* ds = open_memory(bytes, num_frames * frame_bytes);
+    float** out = NULL;
+    int is_matching = 1;
+    for (unsigned int first = 0; first + 7 <= num_frames * frame_samples; first += 7) {
+        int status = decode_samples(ds, 7, &out, NULL);
+        for (unsigned int channel = 0; channel < num_channels; channel++) {
+            is_matching = is_matching && status == SUCCESS
+                && memcmp(out[channel], &expected[channel][first], 7 * sizeof(float)) == 0;
+        }
+    }
+    close_stream(ds);
+    for (unsigned int i = 0; i < num_channels; i++) {
+        free(out[i]);
+        free(expected[i]);
+    }
+    free(out);
+    free(expected);
+    free(bytes);
+    return is_matching;
+}
+
+static void put_field(uint8_t* bytes, unsigned long long bit, unsigned int num_bits, uint32_t code) {
+    for (unsigned int i = 0; i < num_bits; i++, bit++) {
+        bytes[bit / 8] |= ((code >> i) & 0b1) << (bit % 8);
+    }
+}
+
+// checks samples too wide for the lookup tables (or not packing evenly into 
+// bytes) decode to their integer values, word padding and all
+int test_wide_decode(enum DataFormat format, unsigned int num_bits, unsigned int num_channels, 
+        enum DataType type, unsigned int representation) {
+    unsigned int num_components = (type == ComplexData) ? 2 : 1;
+    unsigned int header_bytes = (format == CODIF) ? 64 : 32;
+    unsigned int payload_bytes = 960;
+    unsigned int num_frames = 2;
+    unsigned int frame_bytes = header_bytes + payload_bytes;
+    // fields are packed in groups that never straddle a word (or sample block)
+    unsigned int sample_bits = num_bits * num_components * num_channels;
+    unsigned int word_bits = 32;
+    unsigned int group_fields = num_channels * num_components;
+    if (format == CODIF) {
+        word_bits = (sample_bits + 63) / 64 * 64;
+    } else if (sample_bits > 32) {
+        group_fields = num_components;
+    }
+    unsigned int groups_per_word = word_bits / (group_fields * num_bits);
+    unsigned int frame_samples = payload_bytes * 8 / word_bits * groups_per_word * group_fields / (num_channels * num_components);
+
+    uint8_t* bytes = calloc(num_frames, frame_bytes);
+    float** expected = malloc(num_channels * sizeof(float*));
+    for (unsigned int i = 0; i < num_channels; i++) {
+        expected[i] = malloc(num_frames * frame_samples * num_components * sizeof(float));
+    }
+    for (unsigned int frame = 0; frame < num_frames; frame++) {
+        uint8_t* head = &bytes[frame * frame_bytes];
+        if (format == CODIF) {
+            CODIFHeader* header = (CODIFHeader*)head;
+            header->frame_number = frame;
+            header->seconds_from_epoch = 1000;
+            header->reference_epoch = 4;
+            header->bits_per_sample = num_bits;
+            header->data_type = type;
+            header->sample_representation = representation;
+            header->protocol_field = CODIF_VERSION;
+            header->codif_version_number = 1;
+            header->station_id = 0x4142;
+            header->num_channels = num_channels;
+            header->sample_block_length = word_bits / 64;
+            header->data_array_length = payload_bytes / 8;
+            uint32_t synch_pattern = CODIF_SYNCH_PATTERN;
+            memcpy(&head[sizeof(CODIFHeader)], &synch_pattern, sizeof(uint32_t));
+        } else {
+            VDIFHeader* header = (VDIFHeader*)head;
+            header->seconds_from_epoch = 1000;
+            header->frame_number = frame;
+            header->reference_epoch = 40;
+            header->frame_length = frame_bytes / 8;
+            header->log2_num_channels = __builtin_ctz(num_channels);
+            header->station_id = 0x4142;
+            header->bits_per_sample = num_bits - 1;
+            header->data_type = type;
+        }
+        uint32_t half_range = 1U << (num_bits - 1);
+        for (unsigned int field = 0; field < frame_samples * num_channels * num_components; field++) {
+            unsigned int group = field / group_fields;
+            unsigned long long bit = (unsigned long long)(group / groups_per_word) * word_bits
+                + ((group % groups_per_word) * group_fields + field % group_fields) * num_bits;
+            unsigned int sample_index = frame * frame_samples + field / (num_channels * num_components);
+            unsigned int channel = (field / num_components) % num_channels;
+            unsigned int component = field % num_components;
+            int64_t value = (int64_t)((sample_index * 2654435761U + field * 40503U) % (2ULL * half_range)) - half_range;
+            uint32_t code = (representation == 1) ? (uint32_t)value : (uint32_t)(value + half_range);
+            if (num_bits < 32) { code &= (1U << num_bits) - 1; }
+            put_field(&head[header_bytes], bit, num_bits, code);
+            expected[channel][sample_index * num_components + component] = (float)value;
+        }
+    }
+
+    // decode in blocks that start and end mid-frame and mid-word
+    DataStream* ds = open_memory(bytes, num_frames * frame_bytes);
+    float** out = NULL;
+    int is_matching = 1;
+    for (unsigned int first = 0; first + 5 <= num_frames * frame_samples; first += 5) {
+        int status = decode_samples(ds, 5, &out, NULL);
+        for (unsigned int channel = 0; channel < num_channels; channel++) {
+            is_matching = is_matching && status == SUCCESS && memcmp(out[channel], 
+                &expected[channel][first * num_components], 5 * num_components * sizeof(float)) == 0;
+        }
+    }
+    close_stream(ds);
+    for (unsigned int i = 0; i < num_channels; i++) {
+        free(out[i]);
+        free(expected[i]);
+    }
+    free(out);
+    free(expected);
+    free(bytes);
+    return is_matching;
+}
+
+// checks channels flagged invalid by a multiplexed (EDV 0x04) frame decode as 
+// zeros, and are counted as such, while the rest decode as usual
+int test_validity_mask() {
+    char* output_file_path = "/tmp/vdifparse_test_edv4.vdif";
+    const float levels[4] = { -3.3359, -1.0, 1.0, 3.3359 };
+    const uint64_t validity_masks[4] = { 0b1111, 0b1011, 0b0110, 0b1111 };
+    DataOutput dout = open_output(output_file_path, VDIF);
+    set_output_format_designator(&dout, "VDIF-64-4-2");
+    dout.payload_bytes = 1024;
+    unsigned long frame_samples = get_output_frame_samples(&dout);
+    unsigned long num_samples = frame_samples * 4;
+    float* in[4];
+    for (unsigned long i = 0; i < 4; i++) {
+        in[i] = malloc(num_samples * sizeof(float));
+        for (unsigned long j = 0; j < num_samples; j++) {
+            in[i][j] = levels[(i + j * 3) % 4];
+        }
+    }
+    write_samples(&dout, in, num_samples);
+    close_output(&dout);
+
+    // mark the frames as multiplexed, each with its own validity mask
+    FILE* file_handle = fopen(output_file_path, "rb");
+    unsigned long frame_bytes = 32 + dout.payload_bytes;
+    uint8_t* bytes = malloc(4 * frame_bytes);
+    int is_read = fread(bytes, 1, 4 * frame_bytes, file_handle) == 4 * frame_bytes;
+    fclose(file_handle);
+    remove(output_file_path);
+    for (unsigned int frame = 0; frame < 4; frame++) {
+        uint8_t* head = &bytes[frame * frame_bytes];
+        uint32_t synch_pattern = VDIF_SYNCH_PATTERN;
+        head[18] = 4; // mask length, in channels
+        head[19] = Multiplex;
+        memcpy(&head[20], &synch_pattern, sizeof(uint32_t));
+        memcpy(&head[24], &validity_masks[frame], sizeof(uint64_t));
+    }
+
+    DataStream* ds = open_memory(bytes, 4 * frame_bytes);
+    float** out = NULL;
+    DecodeMonitor statistics = { 0 };
+    int status = decode_samples(ds, num_samples, &out, &statistics);
+    int is_masked = is_read && status == SUCCESS;
+    for (unsigned long i = 0; is_masked && i < 4; i++) {
+        unsigned long num_invalid_samples = 0;
+        for (unsigned int frame = 0; frame < 4; frame++) {
+            int is_valid = (validity_masks[frame] >> i) & 0b1;
+            for (unsigned long j = frame * frame_samples; j < (frame + 1) * frame_samples; j++) {
+                is_masked = is_masked && out[i][j] == (is_valid ? in[i][j] : 0.0f);
+            }
+            num_invalid_samples += is_valid ? 0 : frame_samples;
+        }
+        is_masked = is_masked && statistics.channels[i].num_invalid_samples == num_invalid_samples
+            && statistics.channels[i].num_decoded_samples == num_samples;
+    }
+    close_stream(ds);
+    for (unsigned long i = 0; i < 4; i++) {
+        free(in[i]);
+        free(out[i]);
+    }
+    free(out);
+    free(statistics.channels);
+    free(bytes);
+    return is_masked;
+}
+
+// writes one station's frames from a given frame after the start second, with
+// levels that follow the sample's time rather than its place in the file
+static void write_station(const char* file_path, Timestamp start, unsigned long first_frame, unsigned long num_frames) {
+    const float levels[4] = { -3.3359, -1.0, 1.0, 3.3359 };
+    DataOutput dout = open_output(file_path, VDIF);
+    set_output_format_designator(&dout, "VDIF-64-4-2");
+    dout.payload_bytes = 1000; // 8000 frames per second
+    unsigned long frame_samples = get_output_frame_samples(&dout);
+    start.nanoseconds = first_frame * NANOS_PER_SECOND / 8000;
+    set_output_start_time(&dout, start);
+    unsigned long num_samples = frame_samples * num_frames;
+    float* in[4];
+    for (unsigned long i = 0; i < 4; i++) {
+        in[i] = malloc(num_samples * sizeof(float));
+        for (unsigned long j = 0; j < num_samples; j++) {
+            in[i][j] = levels[(i + (first_frame * frame_samples + j) * 3) % 4];
+        }
+    }
+    write_samples(&dout, in, num_samples);
+    close_output(&dout);
+    for (unsigned long i = 0; i < 4; i++) {
+        free(in[i]);
+    }
+}
+
+// checks that opening a directory ends the program with a failure
+static int is_open_directory_refused(const char* directory_path) {
+    fflush(stdout); // or the child's exit prints what is buffered again
+    pid_t child = fork();
+    if (child == 0) {
+        freopen("/dev/null", "w", stderr);
+        open_directory(directory_path);
+        _exit(EXIT_SUCCESS);
+    }
+    int child_status;
+    return child > 0 && waitpid(child, &child_status, 0) == child 
+        && WIFEXITED(child_status) && WEXITSTATUS(child_status) == EXIT_FAILURE;
+}
+
+// splits frames written to one file across three, named so that neither 
+// their names nor the order they are given in is the order they were taken,
+// then checks they read back as the one file does
+int test_multi_file() {
+    char* file_path = "/tmp/vdifparse_test_whole.vdif";
+    char* directory_path = "/tmp/vdifparse_test_scans";
+    // scan9_z then scan9_a by start time, then scan10
+    char* file_paths[3] = { "/tmp/vdifparse_test_scans/tst_st_scan10_a.vdif", 
+        "/tmp/vdifparse_test_scans/tst_st_scan9_a.vdif", "/tmp/vdifparse_test_scans/tst_st_scan9_z.vdif" };
+    unsigned long first_frames[3] = { 20, 10, 0 };
+    Timestamp start = { 1660000000, 0 };
+    mkdir(directory_path, 0755);
+    write_station(file_path, start, 0, 30);
+    for (unsigned int i = 0; i < 3; i++) {
+        write_station(file_paths[i], start, first_frames[i], 10);
+    }
+    FILE* file_handle = fopen("/tmp/vdifparse_test_scans/notes.txt", "w");
+    fclose(file_handle);
+
+    // frames carry on across files, and number as many as in the one file
+    DataStream* ds = open_files((const char**)file_paths, 3);
+    const DataFrame* df;
+    unsigned long num_frames = 0;
+    int is_ok = 1;
+    while (next_frame(ds, &df) == SUCCESS) {
+        is_ok = is_ok && get_frame_number(*df) == num_frames;
+        release_frame(ds, df);
+        num_frames++;
+    }
+    is_ok = is_ok && num_frames == 30 && get_discarded_bytes(ds) == 0;
+    close_stream(ds);
+
+    DataStream* streams[2] = { open_file(file_path), open_directory(directory_path) };
+    unsigned long num_samples = 30 * 1000;
+    float** out[2] = { NULL, NULL };
+    for (unsigned int i = 0; i < 2; i++) {
+        is_ok = is_ok && decode_samples(streams[i], num_samples, &out[i], NULL) == SUCCESS;
+    }
+    for (unsigned long i = 0; is_ok && i < 4; i++) {
+        is_ok = memcmp(out[0][i], out[1][i], num_samples * sizeof(float)) == 0;
+    }
+    for (unsigned int i = 0; i < 2; i++) {
+        close_stream(streams[i]);
+        for (unsigned long j = 0; out[i] != NULL && j < 4; j++) {
+            free(out[i][j]);
+        }
+        free(out[i]);
+    }
+
+    // a directory with a CODIF file among the VDIF ones can't be one stream,
+    // and nor can one with nothing in it to read
+    DataOutput dout = open_output("/tmp/vdifparse_test_scans/tst_st_scan11_a.codif", CODIF);
+    dout.num_channels = 4;
+    dout.payload_bytes = 1024;
+    float* in[4];
+    for (unsigned long c = 0; c < 4; c++) {
+        in[c] = calloc(get_output_frame_samples(&dout), sizeof(float));
+    }
+    write_samples(&dout, in, get_output_frame_samples(&dout));
+    close_output(&dout);
+    for (unsigned long c = 0; c < 4; c++) {
+        free(in[c]);
+    }
+    is_ok = is_ok && is_open_directory_refused(directory_path);
+    remove("/tmp/vdifparse_test_scans/tst_st_scan11_a.codif");
+    for (unsigned int i = 0; i < 3; i++) {
+        remove(file_paths[i]);
+    }
+    is_ok = is_ok && is_open_directory_refused(directory_path);
+    remove("/tmp/vdifparse_test_scans/notes.txt");
+    rmdir(directory_path);
+    remove(file_path);
+    return is_ok;
+}
+
+int test_aligned_read() {
+    const float levels[4] = { -3.3359, -1.0, 1.0, 3.3359 };
+    char* file_paths[2] = { "/tmp/vdifparse_test_station_a.vdif", "/tmp/vdifparse_test_station_b.vdif" };
+    Timestamp start = { 1660000000, 0 };
+    // station b starts 10 frames later than station a, and both end together
+    write_station(file_paths[0], start, 0, 40);
+    write_station(file_paths[1], start, 10, 30);
+    DataStream* streams[2];
+    for (unsigned int i = 0; i < 2; i++) {
+        streams[i] = open_file(file_paths[i]);
+        set_format_designator(streams[i], "VDIF-64-4-2");
+    }
+
+    // a lone seek lands on the first sample at or after the time asked for
+    Timestamp mid_frame = { start.seconds, 437500 }; // 3.5 frames in
+    float** out = NULL;
+    DecodeMonitor statistics = { 0 };
+    int is_aligned = seek_to_timestamp(streams[0], mid_frame) == SUCCESS
+        && decode_samples(streams[0], 1, &out, &statistics) == SUCCESS && out[1][0] == levels[(1 + 3500 * 3) % 4];
+    for (unsigned long i = 0; i < 4; i++) {
+        free(out[i]);
+    }
+    free(out);
+    free(statistics.channels);
+
+    AlignedReader* reader = NULL;
+    unsigned long block_samples = 1500;
+    is_aligned = is_aligned && align_streams(streams, 2, block_samples, &reader) == SUCCESS;
+    Timestamp common_start = get_aligned_start(reader);
+    is_aligned = is_aligned && common_start.seconds == start.seconds && common_start.nanoseconds == 1250000;
+    AlignedBlock block;
+    unsigned long num_blocks = 0;
+    int status;
+    while (is_aligned && (status = read_aligned(reader, &block)) == SUCCESS) {
+        uint64_t nanos = 1250000 + num_blocks * block_samples * NANOS_PER_SECOND / 8000000;
+        is_aligned = block.num_streams == 2 && block.start_time.nanoseconds == nanos;
+        for (unsigned long i = 0; is_aligned && i < 4; i++) {
+            for (unsigned long j = 0; j < block_samples; j++) {
+                float expected = levels[(i + (10000 + num_blocks * block_samples + j) * 3) % 4];
+                is_aligned = is_aligned && block.samples[0][i][j] == expected && block.samples[1][i][j] == expected;
+            }
+        }
+        num_blocks++;
+    }
+    // the 30 frames both stations have make 20 whole blocks
+    is_aligned = is_aligned && status == REACHED_END_OF_FILE && num_blocks == 20;
+    close_aligned(reader);
+    // the reader fills gaps only while it reads, leaving the streams as it found them
+    is_aligned = is_aligned && get_gap_policy(streams[0]) == SkipInvalid && get_gap_policy(streams[1]) == SkipInvalid;
+    for (unsigned int i = 0; i < 2; i++) {
+        close_stream(streams[i]);
+        remove(file_paths[i]);
+    }
+    return is_aligned;
+}
+
+// compresses a file as one gzip member, or as BGZF-style members that each 
+// give their own length, as bgzip writes them
+static int compress_file(const char* file_path, const char* compressed_path, int is_blocked) {
+    FILE* file_handle = fopen(file_path, "rb");
+    FILE* compressed_handle = fopen(compressed_path, "wb");
+    if (file_handle == NULL || compressed_handle == NULL) { return 0; }
+    unsigned long block_bytes = is_blocked ? 60000 : (1 << 20);
+    uint8_t* in = malloc(block_bytes);
+    uint8_t* out = malloc(2 * block_bytes + 64);
+    z_stream deflater = { 0 };
+    deflateInit2(&deflater, 1, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    uint8_t extra[6] = { 'B', 'C', 2, 0, 0, 0 };
+    gz_header header = { 0 };
+    header.extra = extra;
+    header.extra_len = sizeof(extra);
+    size_t num_bytes;
+    while ((num_bytes = fread(in, 1, block_bytes, file_handle)) > 0 || !is_blocked) {
+        if (is_blocked) { deflateSetHeader(&deflater, &header); }
+        deflater.next_in = in;
+        deflater.avail_in = num_bytes;
+        deflater.next_out = out;
+        deflater.avail_out = 2 * block_bytes + 64;
+        int is_last = !is_blocked && num_bytes < block_bytes;
+        deflate(&deflater, (is_blocked || is_last) ? Z_FINISH : Z_NO_FLUSH);
+        unsigned long out_bytes = 2 * block_bytes + 64 - deflater.avail_out;
+        if (is_blocked) {
+            // now that the member's length is known, fill in its BSIZE field
+            out[16] = (out_bytes - 1) & 0xff;
+            out[17] = (out_bytes - 1) >> 8;
+            deflateReset(&deflater);
+        }
+        fwrite(out, 1, out_bytes, compressed_handle);
+        if (is_last) { break; }
+    }
+    deflateEnd(&deflater);
+    fclose(file_handle);
+    fclose(compressed_handle);
+    free(in);
+    free(out);
+    return 1;
+}
+
+int test_compressed_read(int is_blocked) {
+    char* file_path = "/tmp/vdifparse_test_archive.vdif";
+    char* compressed_path = "/tmp/vdifparse_test_archive.vdif.gz";
+    Timestamp start = { 1660000000, 0 };
+    // enough frames to span several decompressed chunks
+    unsigned long num_frames = 6000;
+    write_station(file_path, start, 0, num_frames);
+    int is_compressed = compress_file(file_path, compressed_path, is_blocked);
+
+    DataStream* streams[2] = { open_file(file_path), open_file(compressed_path) };
+    unsigned long num_samples = num_frames * 1000;
+    float** out[2] = { NULL, NULL };
+    DecodeMonitor statistics[2] = { { 0 }, { 0 } };
+    int is_same = is_compressed;
+    for (unsigned int i = 0; i < 2; i++) {
+        is_same = is_same && decode_samples(streams[i], num_samples, &out[i], &statistics[i]) == SUCCESS;
+    }
+    for (unsigned long i = 0; is_same && i < 4; i++) {
+        is_same = memcmp(out[0][i], out[1][i], num_samples * sizeof(float)) == 0;
+    }
+    is_same = is_same && get_discarded_bytes(streams[1]) == 0;
+    for (unsigned int i = 0; i < 2; i++) {
+        close_stream(streams[i]);
+        for (unsigned long j = 0; out[i] != NULL && j < 4; j++) {
+            free(out[i][j]);
+        }
+        free(out[i]);
+        free(statistics[i].channels);
+    }
+    remove(file_path);
+    remove(compressed_path);
+    return is_same;
+}
+
+// writes blocks of samples with files rotated partway through rows and blocks,
+// then checks the rows read back are in order and split where expected
+int test_sample_writer(int is_complex) {
+    unsigned long num_channels = is_complex ? 2 : 3;
+    unsigned int values_per_sample = is_complex ? 2 : 1;
+    unsigned long num_samples = 5000, block_samples = 700;
+    SinkOptions options = init_sink_options();
+    options.buffer_bytes = 4096; // so rows straddle buffers
+    options.num_buffers = 2;
+    options.values_per_sample = values_per_sample;
+    if (is_complex) {
+        options.rotate_seconds = 0.5;
+        options.samples_per_second = 1000;
+    } else {
+        options.rotate_bytes = 10000;
+    }
+    unsigned long file_rows = is_complex ? 500 : 10000 / (num_channels * sizeof(float));
+    float* in[3];
+    for (unsigned long c = 0; c < num_channels; c++) {
+        in[c] = malloc(num_samples * values_per_sample * sizeof(float));
+        for (unsigned long i = 0; i < num_samples * values_per_sample; i++) {
+            in[c][i] = c * 100000.0f + i;
+        }
+    }
+    SampleWriter* writer = open_sample_writer("/tmp/vdifparse_test_samples.f32", &options);
+    int is_ok = 1;
+    for (unsigned long i = 0; i < num_samples; i += block_samples) {
+        float* block[3];
+        for (unsigned long c = 0; c < num_channels; c++) {
+            block[c] = &in[c][i * values_per_sample];
+        }
+        unsigned long n = (num_samples - i < block_samples) ? num_samples - i : block_samples;
+        is_ok = is_ok && write_sample_block(writer, block, num_channels, n) == SUCCESS;
+    }
+    SinkMetrics metrics = get_sink_metrics(writer);
+    is_ok = is_ok && close_sample_writer(writer) == SUCCESS;
+    unsigned long num_files = (num_samples + file_rows - 1) / file_rows;
+    is_ok = is_ok && metrics.num_dropped_blocks == 0;
+
+    // each file holds whole rows, and all of them together hold every sample
+    unsigned long row_values = num_channels * values_per_sample;
+    float* row = malloc(row_values * sizeof(float));
+    unsigned long sample = 0;
+    for (unsigned long f = 0; f <= num_files; f++) {
+        char file_path[64];
+        snprintf(file_path, sizeof(file_path), "/tmp/vdifparse_test_samples_%04lu.f32", f);
+        FILE* file_handle = fopen(file_path, "rb");
+        is_ok = is_ok && ((f < num_files) == (file_handle != NULL));
+        if (file_handle == NULL) { continue; }
+        unsigned long num_rows = 0;
+        while (fread(row, sizeof(float), row_values, file_handle) == row_values) {
+            for (unsigned long c = 0; c < num_channels; c++) {
+                for (unsigned int v = 0; v < values_per_sample; v++) {
+                    is_ok = is_ok && row[c * values_per_sample + v] == in[c][sample * values_per_sample + v];
+                }
+            }
+            num_rows++;
+            sample++;
+        }
+        is_ok = is_ok && (num_rows == file_rows || (f == num_files - 1 && num_rows == num_samples % file_rows));
+        fclose(file_handle);
+        remove(file_path);
+    }
+    is_ok = is_ok && sample == num_samples;
+    free(row);
+    for (unsigned long c = 0; c < num_channels; c++) {
+        free(in[c]);
+    }
+    return is_ok;
+}
+
+// counts the samples of channel 0 decoded by a batch, and checks they are all as written
+static int count_block(void* context, float** samples, unsigned long num_samples, const DecodeMonitor* statistics) {
+    const float levels[4] = { -3.3359, -1.0, 1.0, 3.3359 };
+    unsigned long* num_counted = (unsigned long*)context;
+    for (unsigned long i = 0; i < num_samples; i++) {
+        if (samples[0][i] != levels[((*num_counted + i) * 3) % 4]) { return FAILURE; }
+    }
+    *num_counted += num_samples;
+    return SUCCESS;
+}
+
+// rejects CPU lists that can't be used, then decodes with the workers pinned
+int test_thread_affinity() {
+    char* file_path = "/tmp/vdifparse_test_affinity.vdif";
+    Timestamp start = { 1660000000, 0 };
+    write_station(file_path, start, 0, 40);
+    DataStream* ds = open_file(file_path);
+    int is_ok = set_thread_affinity(ds, "0-") == BAD_CPU_LIST && set_thread_affinity(ds, "0,x") == BAD_CPU_LIST
+        && set_thread_affinity(ds, "1-0") == BAD_CPU_LIST && set_thread_affinity(ds, "100000") == BAD_CPU_LIST
+        && set_thread_affinity(ds, "0") == SUCCESS;
+    unsigned long num_counted = 0;
+    StreamSink sink = { count_block, &num_counted };
+    int status = decode_streams(&ds, &sink, 1, 3000, 0);
+    is_ok = is_ok && (status == SUCCESS || status == REACHED_END_OF_FILE) && num_counted == 40 * 1000;
+    close_stream(ds);
+    remove(file_path);
+    return is_ok;
+}
+
+// decodes the same file with frames pooled in huge pages and without, across
+// several refills of the buffer, and checks the samples match
+int test_huge_pages() {
+    char* file_path = "/tmp/vdifparse_test_huge_pages.vdif";
+    Timestamp start = { 1660000000, 0 };
+    unsigned long num_frames = 300;
+    write_station(file_path, start, 0, num_frames);
+    DataStream* streams[2] = { open_file(file_path), open_file(file_path) };
+    int is_same = set_huge_pages(streams[1], 1) == SUCCESS && set_buffer_depth(streams[1], 64) == SUCCESS;
+    unsigned long num_samples = num_frames * 1000;
+    float** out[2] = { NULL, NULL };
+    for (unsigned int i = 0; i < 2; i++) {
+        is_same = is_same && decode_samples(streams[i], num_samples, &out[i], NULL) == SUCCESS;
+    }
+    for (unsigned long i = 0; is_same && i < 4; i++) {
+        is_same = memcmp(out[0][i], out[1][i], num_samples * sizeof(float)) == 0;
+    }
+    for (unsigned int i = 0; i < 2; i++) {
+        close_stream(streams[i]);
+        for (unsigned long j = 0; out[i] != NULL && j < 4; j++) {
+            free(out[i][j]);
+        }
+        free(out[i]);
+    }
+    remove(file_path);
+    return is_same;
+}
+
+// fills a block of two channels with values telling which block, channel and sample each is
+static void fill_ring_block(float** samples, unsigned long block, unsigned long num_samples) {
+    for (unsigned long c = 0; c < 2; c++) {
+        for (unsigned long i = 0; i < num_samples; i++) {
+            samples[c][i] = block * 1000 + c * 100 + (i % 100);
+        }
+    }
+}
+
+static int is_ring_block(const RingBlock* block, unsigned long sequence, unsigned long num_samples, 
+        unsigned long num_lost_blocks, float value_block) {
+    int is_ok = block->sequence == sequence && block->num_samples == num_samples && block->num_channels == 2
+        && block->num_lost_blocks == num_lost_blocks;
+    for (unsigned long c = 0; is_ok && c < 2; c++) {
+        for (unsigned long i = 0; is_ok && i < num_samples; i++) {
+            is_ok = block->samples[c][i] == value_block * 1000 + c * 100 + i;
+        }
+    }
+    return is_ok;
+}
+
+// reads a ring with two readers, one of which falls behind and has a block
+// overwritten while holding it
+int test_shared_ring() {
+    SharedRing* ring = create_shared_ring("vdifparse_test_ring", 4, 2, 100, RealData);
+    SharedRing* readers[2] = { attach_shared_ring("/vdifparse_test_ring"), attach_shared_ring("vdifparse_test_ring") };
+    if (ring == NULL || readers[0] == NULL || readers[1] == NULL) { return 0; }
+    float* channels[2] = { malloc(250 * sizeof(float)), malloc(250 * sizeof(float)) };
+    RingBlock block, held;
+    int is_ok = 1;
+    for (unsigned long b = 0; b < 3; b++) {
+        fill_ring_block(channels, b, 100);
+        is_ok = is_ok && publish_ring_block(ring, channels, 100) == SUCCESS;
+    }
+    for (unsigned long r = 0; r < 2; r++) {
+        for (unsigned long b = 0; b < 3; b++) {
+            is_ok = is_ok && read_ring_block(readers[r], &block, 10) == SUCCESS && is_ring_block(&block, b, 100, 0, b)
+                && release_ring_block(readers[r], &block) == SUCCESS;
+        }
+        is_ok = is_ok && read_ring_block(readers[r], &block, 10) == REACHED_END_OF_BUFFER;
+    }
+    // longer than a slot, so split over blocks 3, 4 and 5
+    fill_ring_block(channels, 3, 250);
+    is_ok = is_ok && publish_ring_block(ring, channels, 250) == SUCCESS;
+    is_ok = is_ok && read_ring_block(readers[0], &held, 10) == SUCCESS && is_ring_block(&held, 3, 100, 0, 3);
+    is_ok = is_ok && read_ring_block(readers[1], &block, 10) == SUCCESS
+        && read_ring_block(readers[1], &block, 10) == SUCCESS
+        && read_ring_block(readers[1], &block, 10) == SUCCESS && is_ring_block(&block, 5, 50, 0, 3);
+    for (unsigned long b = 6; b < 11; b++) {
+        fill_ring_block(channels, b, 100);
+        is_ok = is_ok && publish_ring_block(ring, channels, 100) == SUCCESS;
+    }
+    is_ok = is_ok && release_ring_block(readers[0], &held) == RING_OVERRUN;
+    // both skip to the oldest of the last 4 blocks
+    is_ok = is_ok && read_ring_block(readers[0], &block, 10) == SUCCESS && is_ring_block(&block, 7, 100, 3, 7);
+    is_ok = is_ok && read_ring_block(readers[1], &block, 10) == SUCCESS && is_ring_block(&block, 7, 100, 1, 7);
+    // and once the publisher has gone, drain what is left
+    close_shared_ring(ring);
+    for (unsigned long b = 8; b < 11; b++) {
+        is_ok = is_ok && read_ring_block(readers[0], &block, 10) == SUCCESS && is_ring_block(&block, b, 100, 0, b);
+    }
+    is_ok = is_ok && read_ring_block(readers[0], &block, 10) == REACHED_END_OF_FILE;
+    close_shared_ring(readers[0]);
+    close_shared_ring(readers[1]);
+    free(channels[0]);
+    free(channels[1]);
+    return is_ok;
+}
+
+// builds three seconds of frames from the header of one written by
+// write_station (whose samples repeat too regularly to pass for real data),
+// with some flagged invalid, some payloads zeroed or made constant, and some
+// left out, then checks the map made of them by a quality scan
+int test_quality_map() {
+    char* file_path = "/tmp/vdifparse_test_quality.vdif";
+    Timestamp start = { 1660000000, 0 };
+    write_station(file_path, start, 0, 1);
+    uint8_t frame[1032];
+    FILE* file_handle = fopen(file_path, "rb");
+    int is_ok = fread(frame, 1, sizeof(frame), file_handle) == sizeof(frame);
+    fclose(file_handle);
+    uint32_t words[2];
+    memcpy(words, frame, sizeof(words));
+    uint8_t payload[1000];
+    uint32_t state = 1;
+    for (unsigned long i = 0; i < sizeof(payload); i++) {
+        state = state * 1664525 + 1013904223;
+        payload[i] = state >> 24;
+    }
+    file_handle = fopen(file_path, "wb");
+    for (uint32_t f = 0; f < 3 * 8000; f++) {
+        if (f >= 16500 && f < 16600) { continue; }
+        uint32_t header[2] = { words[0] + f / 8000, (words[1] & 0xff000000) | (f % 8000) };
+        if (f >= 10 && f < 20) { header[0] |= 0x80000000; }
+        memcpy(frame, header, sizeof(header));
+        memcpy(&frame[32], payload, sizeof(payload));
+        if (f >= 8100 && f < 8150) { memset(&frame[32], 0, sizeof(payload)); }
+        if (f >= 8200 && f < 8210) { memset(&frame[32], 0x55, sizeof(payload)); }
+        fwrite(frame, 1, sizeof(frame), file_handle);
+    }
+    fclose(file_handle);
+
+    DataStream* ds = open_file(file_path);
+    set_format_designator(ds, "VDIF-64-4-2");
+    QualityMap map = init_quality_map();
+    is_ok = is_ok && scan_quality(ds, &map) == SUCCESS && map.num_seconds == 3;
+    for (unsigned long i = 0; is_ok && i < 3; i++) {
+        const SecondQuality* second = &map.seconds[i];
+        unsigned long num_bad[3][4] = { { 0, 10, 0, 0 }, { 0, 0, 50, 10 }, { 100, 0, 0, 0 } };
+        is_ok = second->seconds == start.seconds + (int64_t)i && second->num_frames == 8000 - num_bad[i][0]
+            && second->num_missing_frames == num_bad[i][0] && second->num_invalid_frames == num_bad[i][1]
+            && second->num_zero_frames == num_bad[i][2] && second->num_constant_frames == num_bad[i][3];
+    }
+    is_ok = is_ok && map.seconds[0].num_valid_frames == 7990 && map.seconds[1].num_valid_frames == 7940
+        && map.seconds[2].valid_fraction == 7900.0f / 8000;
+    free_quality_map(&map);
+    close_stream(ds);
+    remove(file_path);
+    return is_ok;
+}
+
+// checksums two interleaved threads (one frame of which is flagged invalid,
+// so skipped) as they are read, and a file as it is written, against CRC32C
+// computed over the same bytes in one go
+int test_checksums() {
+    char* file_path = "/tmp/vdifparse_test_checksums.vdif";
+    int is_ok = get_crc32c(0, "123456789", 9) == 0xe3069283
+        && get_crc32c(get_crc32c(0, "1234", 4), "56789", 5) == 0xe3069283;
+
+    // the writer's checksum is of the whole file
+    Timestamp start = { 1660000000, 0 };
+    write_station(file_path, start, 0, 1);
+    DataOutput dout = open_output(file_path, VDIF);
+    set_output_format_designator(&dout, "VDIF-64-4-2");
+    dout.payload_bytes = 1000;
+    set_output_checksum(&dout, 1);
+    float* in[4];
+    for (unsigned long c = 0; c < 4; c++) {
+        in[c] = calloc(2500, sizeof(float));
+    }
+    write_samples(&dout, in, 2500);
+    close_output(&dout);
+    uint8_t* bytes = malloc(1 << 20);
+    FILE* file_handle = fopen(file_path, "rb");
+    size_t num_bytes = fread(bytes, 1, 1 << 20, file_handle);
+    fclose(file_handle);
+    is_ok = is_ok && num_bytes > 0 && get_output_checksum(&dout) == get_crc32c(0, bytes, num_bytes);
+    for (unsigned long c = 0; c < 4; c++) {
+        free(in[c]);
+    }
+
+    // and the reader's of the whole file, and of each thread's frames in turn
+    unsigned long frame_length = dout.payload_bytes + 32;
+    uint32_t state = 1;
+    uint32_t expected[2] = { 0, 0 };
+    file_handle = fopen(file_path, "wb");
+    for (uint32_t f = 0; f < 200; f++) {
+        uint8_t* frame = &bytes[f * frame_length];
+        if (f > 0) { memcpy(frame, bytes, 32); }
+        uint32_t words[4];
+        memcpy(words, frame, sizeof(words));
+        words[1] = (words[1] & 0xff000000) | (f / 2);
+        words[3] = (words[3] & 0xfc00ffff) | ((f % 2) << 16);
+        if (f == 7) { words[0] |= 0x80000000; }
+        memcpy(frame, words, sizeof(words));
+        for (unsigned long i = 32; i < frame_length; i++) {
+            state = state * 1664525 + 1013904223;
+            frame[i] = state >> 24;
+        }
+        if (f != 7) { expected[f % 2] = get_crc32c(expected[f % 2], frame, frame_length); }
+    }
+    fwrite(bytes, 1, 200 * frame_length, file_handle);
+    fclose(file_handle);
+    DataStream* ds = open_file(file_path);
+    is_ok = is_ok && set_checksums(ds, 1) == SUCCESS;
+    const DataFrame* df;
+    while (next_frame(ds, &df) == SUCCESS) {
+        release_frame(ds, df);
+    }
+    const StreamChecksum* checksums;
+    is_ok = is_ok && get_file_checksums(ds, &checksums) == 1 && checksums[0].num_frames == 200
+        && checksums[0].crc32c == get_crc32c(0, bytes, 200 * frame_length);
+    is_ok = is_ok && get_thread_checksums(ds, &checksums) == 2;
+    for (unsigned int i = 0; is_ok && i < 2; i++) {
+        is_ok = checksums[i].crc32c == expected[checksums[i].id] && checksums[i].num_frames == 100 - checksums[i].id;
+    }
+    close_stream(ds);
+    free(bytes);
+    remove(file_path);
+    return is_ok;
+}
+
+static uint8_t* read_whole_file(const char* file_path, size_t* num_bytes) {
+    *num_bytes = 0;
+    FILE* file_handle = fopen(file_path, "rb");
+    if (file_handle == NULL) { return NULL; }
+    uint8_t* bytes = malloc(1 << 20);
+    *num_bytes = fread(bytes, 1, 1 << 20, file_handle);
+    fclose(file_handle);
+    return bytes;
+}
+
+// runs the vdifparse tool's summary, index and split commands on 8 frames 
+// written as 4 of each of 2 threads, interleaved
+int test_command_line() {
+    char* file_path = "/tmp/vdifparse_test_command.vdif";
+    char* index_path = "/tmp/vdifparse_test_command.csv";
+    char* split_prefix = "/tmp/vdifparse_test_command_split";
+    char command[512], split_paths[2][256];
+    const unsigned long frame_length = 1032;
+    Timestamp start = { 1660000000, 0 };
+    write_station(file_path, start, 0, 8);
+    size_t num_bytes;
+    uint8_t* bytes = read_whole_file(file_path, &num_bytes);
+    int is_ok = num_bytes == 8 * frame_length;
+    for (uint32_t f = 0; is_ok && f < 8; f++) {
+        uint32_t words[4];
+        memcpy(words, &bytes[f * frame_length], sizeof(words));
+        words[1] = (words[1] & 0xff000000) | (f / 2);
+        words[3] = (words[3] & 0xfc00ffff) | ((f % 2) << 16);
+        memcpy(&bytes[f * frame_length], words, sizeof(words));
+    }
+    FILE* file_handle = fopen(file_path, "wb");
+    fwrite(bytes, 1, num_bytes, file_handle);
+    fclose(file_handle);
+
+    // summary takes the sample layout from the first header, with no -f
+    snprintf(command, sizeof(command), "./vdifparse summary %s 2>/dev/null", file_path);
+    FILE* pipe = popen(command, "r");
+    char summary[4096] = { 0 };
+    size_t summary_bytes = (pipe != NULL) ? fread(summary, 1, sizeof(summary) - 1, pipe) : 0;
+    is_ok = is_ok && pipe != NULL && pclose(pipe) == 0 && summary_bytes > 0
+        && strstr(summary, "frame length:      1032 bytes\n") != NULL
+        && strstr(summary, "frames:            8 (0 invalid, 0 lost)\n") != NULL
+        && strstr(summary, "channels:          4 x 2-bit real\n") != NULL
+        && strstr(summary, "threads:           2 (0: 4 frames, 1: 4 frames)\n") != NULL;
+
+    // index has a row of header fields for each frame
+    snprintf(command, sizeof(command), "./vdifparse index -o %s %s 2>/dev/null", index_path, file_path);
+    is_ok = is_ok && system(command) == 0;
+    file_handle = fopen(index_path, "r");
+    char line[256];
+    unsigned int num_rows = 0;
+    if (file_handle != NULL && fgets(line, sizeof(line), file_handle) != NULL) {
+        is_ok = is_ok && strcmp(line, "file,offset,seconds,frame_number,thread_id,station_id,frame_length,invalid\n") == 0;
+        unsigned int file_index, frame_number, thread_id, station_id, length, invalid;
+        unsigned long long offset;
+        long long seconds;
+        while (fgets(line, sizeof(line), file_handle) != NULL) {
+            is_ok = is_ok && sscanf(line, "%u,%llu,%lld,%u,%u,%u,%u,%u", &file_index, &offset, &seconds, 
+                &frame_number, &thread_id, &station_id, &length, &invalid) == 8
+                && file_index == 0 && offset == num_rows * frame_length && seconds == start.seconds
+                && frame_number == num_rows / 2 && thread_id == num_rows % 2 && length == frame_length && invalid == 0;
+            num_rows++;
+        }
+    }
+    if (file_handle != NULL) { fclose(file_handle); }
+    is_ok = is_ok && num_rows == 8;
+
+    // split writes each thread's frames, unchanged, to a file of its own
+    snprintf(command, sizeof(command), "./vdifparse split -o %s %s 2>/dev/null", split_prefix, file_path);
+    is_ok = is_ok && system(command) == 0;
+    for (unsigned int t = 0; t < 2; t++) {
+        snprintf(split_paths[t], sizeof(split_paths[t]), "%s_%u.vdif", split_prefix, t);
+        size_t split_bytes;
+        uint8_t* split = read_whole_file(split_paths[t], &split_bytes);
+        is_ok = is_ok && split != NULL && split_bytes == 4 * frame_length;
+        for (unsigned int f = 0; is_ok && f < 4; f++) {
+            is_ok = memcmp(&split[f * frame_length], &bytes[(2 * f + t) * frame_length], frame_length) == 0;
+        }
+        free(split);
+        remove(split_paths[t]);
+    }
+
+    // and reading from stdin is refused rather than taken as a file
+    is_ok = is_ok && system("./vdifparse summary - >/dev/null 2>&1") != 0;
+    free(bytes);
+    remove(file_path);
+    remove(index_path);
+    return is_ok;
+}
+
+// writes a stand-in for the start of scan 264 of m0921 at Mp: one second of
+// 2-channel 2-bit frames of 8000 bytes, starting 7100400 seconds into epoch 43
+static void write_recording(const char* file_path) {
+    const float levels[4] = { -3.3359, -1.0, 1.0, 3.3359 };
+    const unsigned int first_codes[2][4] = { { 0, 1, 2, 2 }, { 0, 0, 3, 3 } };
+    DataOutput dout = open_output(file_path, VDIF);
+    set_output_format_designator(&dout, "VDIF-1024-2-2");
+    dout.payload_bytes = 8000;
+    Timestamp start = { 1625097600 + 7100400, 0 };
+    set_output_start_time(&dout, start);
+    unsigned long num_samples = get_output_frame_samples(&dout) * 4;
+    float* in[2];
+    for (unsigned long i = 0; i < 2; i++) {
+        in[i] = malloc(num_samples * sizeof(float));
+        for (unsigned long j = 0; j < num_samples; j++) {
+            in[i][j] = levels[(j < 4) ? first_codes[i][j] : (i + j * 3) % 4];
+        }
+    }
+    write_samples(&dout, in, num_samples);
+    close_output(&dout);
+    for (unsigned long i = 0; i < 2; i++) {
+        free(in[i]);
     }
 }
 
 int main(int argc, char** argv) {
-    char* test_file_path = "/Users/mars/test_data/m0921_Mp_264_042000.vdif";
+    printf("==TIMESTAMP TESTS\n");
+
+    test("Timed frames and samples from epoch 0 and across a leap year", test_timestamps());
+
+    printf("==RESYNC TESTS\n");
+
+    test("Discarded garbage, a damaged header and stray bytes between frames", test_resync());
+
+    printf("==BATCH TESTS\n");
+
+    test("Decoded files of different lengths on a shared pool", test_batch_decode());
+    test("Every stream given a block before any ended, with more streams than threads", test_batch_turns());
+
+    printf("==OUTPUT TESTS\n");
+
+    // Test quantise and frame samples, then decode them again
+    test("Round trip of 2-bit real samples", test_output_round_trip("VDIF-64-4-2", RealData));
+    test("Round trip of 4-bit complex samples", test_output_round_trip("VDIF-64-2-4", ComplexData));
+
+    printf("==METRICS TESTS\n");
+
+    test("Counted bytes and frames through the hot path", test_stream_metrics());
+
+    printf("==CAPTURE TESTS\n");
+
+    test("Decoded frames captured over loopback UDP", test_udp_capture());
+    test("Ended a capture that timed out in a batch", test_batch_capture());
+
+    printf("==GAP TESTS\n");
+
+    test("Lost frames counted and skipped", test_gap_filling(SkipInvalid));
+    test("Lost frames counted and filled with invalid frames", test_gap_filling(InsertInvalid));
+    test("Skipped invalid frame not counted as lost", test_invalid_in_sequence(SkipInvalid));
+    test("Kept invalid frame not counted as lost", test_invalid_in_sequence(InsertInvalid));
+
+    printf("==CURSOR TESTS\n");
+
+    test("Resumed mid-frame with blocks smaller than a frame", test_sample_cursor(1000));
+    test("Resumed mid-frame with blocks larger than a frame", test_sample_cursor(3000));
+
+    printf("==ITERATOR TESTS\n");
+
+    test("Iterated over borrowed frames without decoding", test_frame_iteration());
+
+    printf("==HEADER TESTS\n");
+
+    test("Batched VDIF headers match frame by frame", test_header_scan(VDIF));
+    test("Batched CODIF headers match frame by frame", test_header_scan(CODIF));
+
+    printf("==CODIF TESTS\n");
+
+    test("Decoded offset binary CODIF samples", test_codif_decode(0));
+    test("Decoded two's complement CODIF samples", test_codif_decode(1));
+    test("Copied float CODIF samples", test_codif_decode(2));
+
+    printf("==WIDE SAMPLE TESTS\n");
+
+    test("Decoded 16-bit real VDIF samples", test_wide_decode(VDIF, 16, 4, RealData, 0));
+    test("Decoded 32-bit two's complement CODIF samples", test_wide_decode(CODIF, 32, 3, RealData, 1));
+    test("Decoded 3-bit VDIF samples with word padding", test_wide_decode(VDIF, 3, 4, RealData, 0));
+    test("Decoded 12-bit complex VDIF samples by channel", test_wide_decode(VDIF, 12, 2, ComplexData, 0));
+
+    printf("==MULTI-FILE TESTS\n");
+
+    test("Read files in scan and time order as one stream", test_multi_file());
+
+    printf("==VALIDITY TESTS\n");
+
+    test("Blanked channels flagged invalid in multiplexed frames", test_validity_mask());
+
+    printf("==ALIGNMENT TESTS\n");
+
+    test("Read two stations in lockstep from a common start", test_aligned_read());
+
+    printf("==COMPRESSION TESTS\n");
+
+    test("Decoded a gzip compressed file as a stream", test_compressed_read(0));
+    test("Decoded BGZF blocks in parallel", test_compressed_read(1));
+
+    printf("==SINK TESTS\n");
+
+    test("Wrote real samples across files rotated by size", test_sample_writer(0));
+    test("Wrote complex samples across files rotated by time", test_sample_writer(1));
+
+    printf("==AFFINITY TESTS\n");
+
+    test("Decoded on threads pinned to a CPU list", test_thread_affinity());
+
+    printf("==HUGE PAGE TESTS\n");
+
+    test("Decoded the same from frames pooled in huge pages", test_huge_pages());
+
+    printf("==SHARED RING TESTS\n");
+
+    test("Read blocks through a shared memory ring", test_shared_ring());
+
+    printf("==QUALITY TESTS\n");
+
+    test("Mapped missing, invalid, zero and constant frames by second", test_quality_map());
+
+    printf("==CHECKSUM TESTS\n");
+
+    test("Checksummed frames by file and thread as read and written", test_checksums());
+
+    printf("==COMMAND LINE TESTS\n");
+
+    test("Summarised, indexed and split a recording with the vdifparse tool", test_command_line());
+
+    char* test_file_path = "/tmp/m0921_Mp_264_042000.vdif";
+    write_recording(test_file_path);
 
-    DataStream ds = open_file(test_file_path); 
+    DataStream* ds = open_file(test_file_path); 
 
     printf("==DATA STREAM TESTS\n");
 
     // Test first init filemode stream with peek format
-    test("Correct format", ds.format == VDIF);
-    test("Correct default gap policy", ds.gap_policy == SkipInvalid);
+    test("Correct format", get_stream_format(ds) == VDIF);
+    test("Correct default gap policy", get_gap_policy(ds) == SkipInvalid);
+    test("Found first frame at start of file", get_discarded_bytes(ds) == 0);
 
     // Test set stream attributes
-    set_gap_policy(&ds, InsertInvalid);
-    test("Successfully set gap policy", ds.gap_policy == InsertInvalid);
+    set_gap_policy(ds, InsertInvalid);
+    test("Successfully set gap policy", get_gap_policy(ds) == InsertInvalid);
 
-    ds.num_selected_channels = 2; // TODO remove
+    set_selected_channels(ds, 2);
 
     float** out = NULL;
     DecodeMonitor* statistics = NULL;
     unsigned int num_samples = 4;
-    decode_samples(&ds, num_samples, &out, statistics);
+    decode_samples(ds, num_samples, &out, statistics);
     double samples[4][2] = { { -3.335900, -3.335900 }, 
         { -1.000000, -3.335900 },
         { 1.000000, 3.335900 }, 
@@ -54,16 +1696,16 @@ int main(int argc, char** argv) {
     printf("==FORMAT DESIGNATOR TESTS\n");
 
     // Test use of format designator to provide information
-    int status = set_format_designator(&ds, "VDIF-1024-16-2-4");
+    int status = set_format_designator(ds, "VDIF-1024-16-2-4");
     test("Could parse format designator", status == SUCCESS);
     if (status == SUCCESS) {
-        test("Correct data rate", ds.data_rate == 1024);
-        test("Correct num channels", ds.num_channels == 16);
-        test("Correct bits per sample", ds.bits_per_sample == 2);
-        test("Correct num threads", ds.num_threads == 4);
+        test("Correct data rate", get_stream_data_rate(ds) == 1024);
+        test("Correct num channels", get_stream_num_channels(ds) == 16);
+        test("Correct bits per sample", get_stream_bits_per_sample(ds) == 2);
+        test("Correct num threads", get_stream_num_threads(ds) == 4);
     }
     
-    DataFrame df = ds.frames[0];
+    DataFrame df = *get_buffered_frame(ds, 0);
 
     printf("==DATA FRAME TESTS\n");
 
@@ -83,7 +1725,8 @@ int main(int argc, char** argv) {
     print_stream(ds);
     print_frame(df);
 
-    close(&ds);
+    close_stream(ds);
+    remove(test_file_path);
 
-    // char* test_file_path2 = "/Users/mars/University/Coursework/data/m1010_yg_no0003.vdif";
+    return (num_failed_tests == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -1,23 +1,684 @@
-// vdifio.c - minimal main() functionality for decoding a single file
+// vdifparse.c - command-line tool to summarise, index, quality check, split,
+// extract and decode VDIF or CODIF recordings
 // Copyright (C) 2022 Mars Buttfield-Addison
 //
 // This program is free software: you can redistribute it and/or modify it under
 // the terms of the GNU General Public License as published by the Free Software
-// Foundation, either version 3 of the License, or (at your option) any later 
+// Foundation, either version 3 of the License, or (at your option) any later
 // version.
 //
-// This program is distributed in the hope that it will be useful, but WITHOUT 
+// This program is distributed in the hope that it will be useful, but WITHOUT
 // ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
-// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more 
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
 // details.
 //
 // You should have received a copy of the GNU General Public License along with
 // this program. If not, see <http://www.gnu.org/licenses/>.
 
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "src/vdifparse_utils.h"
 #include "vdifparse.h"
 
+#define OUTPUT_BUFFER_BYTES (8 << 20)
+#define HEADER_BATCH_FRAMES 4096
+#define DEFAULT_BLOCK_SAMPLES (1 << 16)
+#define PIPELINE_BLOCKS 4
+#define MAX_SPLIT_THREADS 1024
+
+typedef struct Options {
+    const char* command;
+    const char** file_paths;
+    unsigned int num_files;
+    const char* output_path; // NULL or "-" for stdout
+    const char* format_designator;
+    unsigned long num_channels;
+    unsigned long block_samples;
+    double start_offset;
+    double duration; // < 0 for to the end
+    double rotate_megabytes;
+    double rotate_seconds;
+    unsigned int use_direct_io;
+    unsigned int use_checksums; // CRC32C of the frames read and written
+    const char* cpu_list; // for the library's threads, the decoder and the writer
+} Options;
+
+typedef struct Throughput {
+    unsigned long long num_bytes_in;
+    unsigned long long num_bytes_out;
+    unsigned long long num_samples;
+    unsigned long long num_frames;
+    double start_seconds;
+} Throughput;
+
+// MARK: helpers
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static DataStream* open_input(const Options* options) {
+    DataStream* ds = (options->num_files == 1) ? open_file(options->file_paths[0]) :
+        open_files(options->file_paths, options->num_files);
+    if (options->format_designator != NULL) {
+        int status = set_format_designator(ds, options->format_designator);
+        if (status != SUCCESS) { raise_exception("%s", get_error_message(status)); }
+    }
+    if (options->num_channels > 0) { set_selected_channels(ds, options->num_channels); }
+    if (options->use_checksums) { set_checksums(ds, 1); }
+    if (options->cpu_list != NULL) {
+        int status = set_thread_affinity(ds, options->cpu_list);
+        if (status != SUCCESS) { raise_exception("%s", get_error_message(status)); }
+    }
+    return ds;
+}
+
+// opens a file (or stdout) for large buffered writes
+static FILE* open_output_file(const char* file_path) {
+    FILE* file_handle = (file_path == NULL || strcmp(file_path, "-") == 0) ? stdout : fopen(file_path, "wb");
+    if (file_handle == NULL) { raise_exception("file %s could not be opened for writing.", file_path); }
+    setvbuf(file_handle, NULL, _IOFBF, OUTPUT_BUFFER_BYTES);
+    return file_handle;
+}
+
+static void close_output_file(FILE* file_handle) {
+    if (fflush(file_handle) != 0) { raise_exception("output could not be written."); }
+    if (file_handle != stdout) { fclose(file_handle); }
+}
+
+static size_t write_frame(FILE* file_handle, const DataFrame* df, uint32_t* checksum) {
+    // headers are held as their fixed part and their extended data (or
+    // metadata), so write them back out in that order, then the payload
+    const void* parts[3] = { NULL, NULL, get_frame_payload(*df) };
+    size_t part_bytes[3] = { 0, 0, get_data_length(*df) };
+    if (df->format == CODIF) {
+        parts[0] = df->codif->header;
+        part_bytes[0] = sizeof(CODIFHeader);
+        parts[1] = df->codif->metadata->none;
+        part_bytes[1] = CODIF_METADATA_BYTES;
+    } else {
+        parts[0] = df->vdif->header;
+        part_bytes[0] = sizeof(VDIFHeader);
+        if (df->vdif->extended_data != NULL) {
+            parts[1] = df->vdif->extended_data->none;
+            part_bytes[1] = VDIF_EXTENDED_DATA_BYTES;
+        }
+    }
+    size_t num_bytes = 0;
+    for (int i = 0; i < 3; i++) {
+        if (part_bytes[i] == 0) { continue; }
+        num_bytes += fwrite(parts[i], 1, part_bytes[i], file_handle);
+        if (checksum != NULL) { *checksum = get_crc32c(*checksum, parts[i], part_bytes[i]); }
+    }
+    return num_bytes;
+}
+
+static void format_time(Timestamp ts, char* out, size_t out_bytes) {
+    time_t seconds = (time_t)ts.seconds;
+    struct tm utc;
+    gmtime_r(&seconds, &utc);
+    size_t length = strftime(out, out_bytes, "%Y-%m-%dT%H:%M:%S", &utc);
+    snprintf(&out[length], out_bytes - length, ".%09uZ", ts.nanoseconds);
+}
+
+static void format_station(uint16_t station_id, char* out, size_t out_bytes) {
+    // two printable characters, or otherwise a number
+    char first = station_id >> 8, second = station_id & 0xff;
+    if (first >= 0x20 && first < 0x7f && second >= 0x20 && second < 0x7f) {
+        snprintf(out, out_bytes, "%c%c", first, second);
+    } else {
+        snprintf(out, out_bytes, "%u", station_id);
+    }
+}
+
+static void report_throughput(const char* command, Throughput throughput) {
+    fflush(stdout);
+    double seconds = now_seconds() - throughput.start_seconds;
+    if (seconds <= 0) { seconds = 1e-9; }
+    fprintf(stderr, "%s: %llu frames, %.1f MB in, %.1f MB out", command, throughput.num_frames,
+        throughput.num_bytes_in / 1e6, throughput.num_bytes_out / 1e6);
+    if (throughput.num_samples > 0) { fprintf(stderr, ", %llu samples", throughput.num_samples); }
+    fprintf(stderr, " in %.3f s (%.1f MB/s in", seconds, throughput.num_bytes_in / seconds / 1e6);
+    if (throughput.num_samples > 0) { fprintf(stderr, ", %.1f Msamples/s", throughput.num_samples / seconds / 1e6); }
+    fprintf(stderr, ")\n");
+}
+
+// prints the checksums of what was read, to compare with those of what was
+// written, or of the same recording elsewhere
+static void report_checksums(const char* command, const DataStream* ds) {
+    const StreamChecksum* checksums;
+    unsigned int num_checksums = get_file_checksums(ds, &checksums);
+    for (unsigned int i = 0; i < num_checksums; i++) {
+        fprintf(stderr, "%s: crc32c %08x of file %u in (%lu frames, %llu bytes)\n", command, checksums[i].crc32c,
+            checksums[i].id, checksums[i].num_frames, checksums[i].num_bytes);
+    }
+    num_checksums = get_thread_checksums(ds, &checksums);
+    for (unsigned int i = 0; i < num_checksums; i++) {
+        fprintf(stderr, "%s: crc32c %08x of thread %u in (%lu frames, %llu bytes)\n", command, checksums[i].crc32c,
+            checksums[i].id, checksums[i].num_frames, checksums[i].num_bytes);
+    }
+}
+
+// MARK: summary
+
+static Timestamp get_frame_start(int64_t seconds, uint64_t frame_number, uint64_t frames_per_second) {
+    uint64_t nanoseconds = frame_number * NANOS_PER_SECOND / frames_per_second;
+    return (Timestamp){ seconds + (int64_t)(nanoseconds / NANOS_PER_SECOND), nanoseconds % NANOS_PER_SECOND };
+}
+
+typedef struct ThreadSummary {
+    uint16_t thread_id;
+    unsigned long long num_frames;
+    int64_t first_seconds;
+    uint32_t first_frame_number;
+    int64_t last_seconds;
+    uint32_t last_frame_number;
+} ThreadSummary;
+
+// the stream only knows its sample layout when given a format designator,
+// so otherwise it is read from the first frame's header
+static void format_samples(const Options* options, const DataStream* ds, char* out, size_t out_bytes) {
+    if (get_stream_num_channels(ds) > 0 && get_stream_bits_per_sample(ds) > 0) {
+        snprintf(out, out_bytes, "%u x %u-bit %s", get_stream_num_channels(ds), get_stream_bits_per_sample(ds),
+            string_for_data_type(get_stream_data_type(ds)));
+        return;
+    }
+    snprintf(out, out_bytes, "unknown");
+    DataStream* first_ds = open_input(options);
+    const DataFrame* df;
+    if (next_frame(first_ds, &df) == SUCCESS) {
+        snprintf(out, out_bytes, "%lu x %u-bit %s", get_num_channels(*df), get_bits_per_sample(*df),
+            string_for_data_type(get_data_type(*df)));
+        release_frame(first_ds, df);
+    }
+    close_stream(first_ds);
+}
+
+static int run_summary(const Options* options) {
+    Throughput throughput = { .start_seconds = now_seconds() };
+    DataStream* ds = open_input(options);
+    HeaderBatch headers = init_header_batch(HEADER_BATCH_FRAMES);
+    ThreadSummary* threads = NULL;
+    unsigned int num_threads = 0;
+    uint16_t* stations = NULL;
+    unsigned int num_stations = 0;
+    unsigned long long num_invalid = 0;
+    uint32_t max_frame_number = 0;
+    uint32_t frame_length = 0;
+    int status = SUCCESS;
+    while (status == SUCCESS) {
+        headers.num_headers = 0;
+        status = scan_headers(ds, &headers);
+        for (unsigned long i = 0; i < headers.num_headers; i++) {
+            int64_t seconds = get_epoch_seconds(headers.format, headers.reference_epoch[i]) + headers.seconds_from_epoch[i];
+            ThreadSummary* thread = NULL;
+            for (unsigned int j = 0; j < num_threads && thread == NULL; j++) {
+                if (threads[j].thread_id == headers.thread_id[i]) { thread = &threads[j]; }
+            }
+            if (thread == NULL) {
+                ThreadSummary* grown = realloc(threads, (num_threads + 1) * sizeof(ThreadSummary));
+                if (grown == NULL) { raise_exception("%s", get_error_message(FAILED_MALLOC)); }
+                threads = grown;
+                thread = &threads[num_threads++];
+                *thread = (ThreadSummary){ headers.thread_id[i], 0, seconds, headers.frame_number[i] };
+            }
+            thread->num_frames++;
+            thread->last_seconds = seconds;
+            thread->last_frame_number = headers.frame_number[i];
+            int is_known_station = 0;
+            for (unsigned int j = 0; j < num_stations; j++) {
+                is_known_station = is_known_station || stations[j] == headers.station_id[i];
+            }
+            if (!is_known_station) {
+                uint16_t* grown = realloc(stations, (num_stations + 1) * sizeof(uint16_t));
+                if (grown == NULL) { raise_exception("%s", get_error_message(FAILED_MALLOC)); }
+                stations = grown;
+                stations[num_stations++] = headers.station_id[i];
+            }
+            if (headers.frame_number[i] > max_frame_number) { max_frame_number = headers.frame_number[i]; }
+            num_invalid += headers.invalid[i];
+            frame_length = headers.frame_length[i];
+            throughput.num_bytes_in += headers.frame_length[i];
+            throughput.num_frames++;
+        }
+    }
+    if (status != REACHED_END_OF_FILE) {
+        raise_exception("could not read headers. %s", get_error_message(status));
+    }
+
+    // frames per second come from the data rate if known, or else from how
+    // high frame numbers go
+    unsigned long long frames_per_second = 0;
+    const char* rate_source = "inferred from frame numbers";
+    if (frame_length > get_stream_header_length(ds)) {
+        frames_per_second = get_stream_frames_per_second(ds, frame_length - get_stream_header_length(ds));
+    }
+    if (frames_per_second > 0) {
+        rate_source = "from the data rate";
+    } else {
+        frames_per_second = (unsigned long long)max_frame_number + 1;
+    }
+    unsigned long long num_lost = 0;
+    Timestamp first = { 0 }, last = { 0 };
+    for (unsigned int i = 0; i < num_threads; i++) {
+        ThreadSummary* thread = &threads[i];
+        long long first_position = thread->first_seconds * (long long)frames_per_second + thread->first_frame_number;
+        long long last_position = thread->last_seconds * (long long)frames_per_second + thread->last_frame_number;
+        long long num_expected = last_position - first_position + 1;
+        if (num_expected > (long long)thread->num_frames) { num_lost += num_expected - thread->num_frames; }
+        Timestamp thread_first = get_frame_start(thread->first_seconds, thread->first_frame_number, frames_per_second);
+        Timestamp thread_last = get_frame_start(thread->last_seconds, thread->last_frame_number + 1ULL, frames_per_second);
+        if (i == 0 || get_nanos_between(thread_first, first) > 0) { first = thread_first; }
+        if (i == 0 || get_nanos_between(last, thread_last) > 0) { last = thread_last; }
+    }
+
+    char first_string[48], last_string[48], station_string[8], samples_string[64];
+    format_samples(options, ds, samples_string, sizeof(samples_string));
+    fprintf(stdout, "files:             %u\n", options->num_files);
+    fprintf(stdout, "format:            %s\n", string_for_data_format(get_stream_format(ds)));
+    fprintf(stdout, "frame length:      %u bytes\n", frame_length);
+    fprintf(stdout, "frames:            %llu (%llu invalid, %llu lost)\n", throughput.num_frames, num_invalid, num_lost);
+    fprintf(stdout, "channels:          %s\n", samples_string);
+    fprintf(stdout, "threads:           %u (", num_threads);
+    for (unsigned int i = 0; i < num_threads; i++) {
+        fprintf(stdout, "%s%u: %llu frames", (i > 0) ? ", " : "", threads[i].thread_id, threads[i].num_frames);
+    }
+    fprintf(stdout, ")\nstations:          ");
+    for (unsigned int i = 0; i < num_stations; i++) {
+        format_station(stations[i], station_string, sizeof(station_string));
+        fprintf(stdout, "%s%s", (i > 0) ? ", " : "", station_string);
+    }
+    fprintf(stdout, "\nframes per second: %llu per thread (%s)\n", frames_per_second, rate_source);
+    if (num_threads > 0) {
+        format_time(first, first_string, sizeof(first_string));
+        format_time(last, last_string, sizeof(last_string));
+        fprintf(stdout, "start:             %s\n", first_string);
+        fprintf(stdout, "end:               %s\n", last_string);
+        fprintf(stdout, "duration:          %.6f s\n", get_nanos_between(first, last) / 1e9);
+    }
+    fprintf(stdout, "discarded bytes:   %llu\n", get_discarded_bytes(ds));
+    free(threads);
+    free(stations);
+    free_header_batch(&headers);
+    close_stream(ds);
+    report_throughput(options->command, throughput);
+    return SUCCESS;
+}
+
+// MARK: index
+
+static int run_index(const Options* options) {
+    Throughput throughput = { .start_seconds = now_seconds() };
+    DataStream* ds = open_input(options);
+    FILE* out = open_output_file(options->output_path);
+    HeaderBatch headers = init_header_batch(HEADER_BATCH_FRAMES);
+    fprintf(out, "file,offset,seconds,frame_number,thread_id,station_id,frame_length,invalid\n");
+    int status = SUCCESS;
+    while (status == SUCCESS) {
+        headers.num_headers = 0;
+        status = scan_headers(ds, &headers);
+        for (unsigned long i = 0; i < headers.num_headers; i++) {
+            int64_t seconds = get_epoch_seconds(headers.format, headers.reference_epoch[i]) + headers.seconds_from_epoch[i];
+            int num_bytes = fprintf(out, "%u,%llu,%lld,%u,%u,%u,%u,%u\n", headers.file_index[i],
+                (unsigned long long)headers.offsets[i], (long long)seconds, headers.frame_number[i],
+                headers.thread_id[i], headers.station_id[i], headers.frame_length[i], headers.invalid[i]);
+            throughput.num_bytes_out += (num_bytes > 0) ? num_bytes : 0;
+            throughput.num_bytes_in += headers.frame_length[i];
+            throughput.num_frames++;
+        }
+    }
+    free_header_batch(&headers);
+    close_output_file(out);
+    close_stream(ds);
+    if (status != REACHED_END_OF_FILE) {
+        raise_exception("could not read headers. %s", get_error_message(status));
+    }
+    report_throughput(options->command, throughput);
+    return SUCCESS;
+}
+
+// MARK: quality
+
+static int run_quality(const Options* options) {
+    Throughput throughput = { .start_seconds = now_seconds() };
+    DataStream* ds = open_input(options);
+    QualityMap map = init_quality_map();
+    int status = scan_quality(ds, &map);
+    if (status != SUCCESS) {
+        raise_exception("could not scan for quality. %s", get_error_message(status));
+    }
+    FILE* out = open_output_file(options->output_path);
+    fprintf(out, "time,frames,missing,invalid,zero,constant,valid_fraction\n");
+    for (unsigned long i = 0; i < map.num_seconds; i++) {
+        const SecondQuality* second = &map.seconds[i];
+        char time[64];
+        format_time((Timestamp){ second->seconds, 0 }, time, sizeof(time));
+        int num_bytes = fprintf(out, "%s,%lu,%lu,%lu,%lu,%lu,%.6f\n", time, second->num_frames,
+            second->num_missing_frames, second->num_invalid_frames, second->num_zero_frames,
+            second->num_constant_frames, second->valid_fraction);
+        throughput.num_bytes_out += (num_bytes > 0) ? num_bytes : 0;
+        throughput.num_frames += second->num_frames;
+    }
+    throughput.num_bytes_in = get_stream_metrics(ds).num_bytes_read;
+    free_quality_map(&map);
+    close_output_file(out);
+    close_stream(ds);
+    report_throughput(options->command, throughput);
+    return SUCCESS;
+}
+
+// MARK: split
+
+static int run_split(const Options* options) {
+    Throughput throughput = { .start_seconds = now_seconds() };
+    DataStream* ds = open_input(options);
+    const char* prefix = (options->output_path != NULL) ? options->output_path : "thread";
+    const char* extension = (get_stream_format(ds) == CODIF) ? "codif" : "vdif";
+    FILE** outputs = calloc(MAX_SPLIT_THREADS, sizeof(FILE*));
+    uint32_t* checksums = calloc(MAX_SPLIT_THREADS, sizeof(uint32_t));
+    const DataFrame* df;
+    int status;
+    while ((status = next_frame(ds, &df)) == SUCCESS) {
+        unsigned int thread_id = get_thread_id(*df);
+        if (thread_id >= MAX_SPLIT_THREADS) {
+            raise_exception("thread id %u is beyond the %u threads that can be split.", thread_id, MAX_SPLIT_THREADS);
+        }
+        if (outputs[thread_id] == NULL) {
+            char file_path[1024];
+            snprintf(file_path, sizeof(file_path), "%s_%u.%s", prefix, thread_id, extension);
+            outputs[thread_id] = open_output_file(file_path);
+        }
+        throughput.num_bytes_out += write_frame(outputs[thread_id], df,
+            options->use_checksums ? &checksums[thread_id] : NULL);
+        throughput.num_bytes_in += get_frame_length(*df);
+        throughput.num_frames++;
+        release_frame(ds, df);
+    }
+    for (unsigned int i = 0; i < MAX_SPLIT_THREADS; i++) {
+        if (outputs[i] == NULL) { continue; }
+        close_output_file(outputs[i]);
+        if (options->use_checksums) {
+            fprintf(stderr, "%s: crc32c %08x of %s_%u.%s out\n", options->command, checksums[i], prefix, i, extension);
+        }
+    }
+    if (options->use_checksums) { report_checksums(options->command, ds); }
+    free(outputs);
+    free(checksums);
+    close_stream(ds);
+    if (status != REACHED_END_OF_FILE && status != REACHED_END_OF_BUFFER) {
+        raise_exception("could not read frames. %s", get_error_message(status));
+    }
+    report_throughput(options->command, throughput);
+    return SUCCESS;
+}
+
+// MARK: extract
+
+static int run_extract(const Options* options) {
+    Throughput throughput = { .start_seconds = now_seconds() };
+    // find when the recording starts, then open it again to seek from there
+    DataStream* ds = open_input(options);
+    const DataFrame* df;
+    int status = next_frame(ds, &df);
+    if (status != SUCCESS) { raise_exception("could not read a first frame. %s", get_error_message(status)); }
+    Timestamp first = get_frame_timestamp(ds, *df);
+    release_frame(ds, df);
+    close_stream(ds);
+
+    int64_t start_nanos = (int64_t)(options->start_offset * NANOS_PER_SECOND) + first.nanoseconds;
+    Timestamp start = { first.seconds + start_nanos / (int64_t)NANOS_PER_SECOND, start_nanos % NANOS_PER_SECOND };
+    int64_t duration_nanos = (int64_t)(options->duration * NANOS_PER_SECOND);
+    ds = open_input(options);
+    status = seek_to_timestamp(ds, start);
+    if (status != SUCCESS) { raise_exception("could not seek to the start. %s", get_error_message(status)); }
+    FILE* out = open_output_file(options->output_path);
+    uint32_t checksum = 0;
+    while ((status = next_frame(ds, &df)) == SUCCESS) {
+        // frames are copied whole, from the one holding the start time
+        if (options->duration >= 0 && get_nanos_between(start, get_frame_timestamp(ds, *df)) >= duration_nanos) {
+            release_frame(ds, df);
+            break;
+        }
+        throughput.num_bytes_out += write_frame(out, df, options->use_checksums ? &checksum : NULL);
+        throughput.num_bytes_in += get_frame_length(*df);
+        throughput.num_frames++;
+        release_frame(ds, df);
+    }
+    close_output_file(out);
+    if (options->use_checksums) {
+        report_checksums(options->command, ds);
+        fprintf(stderr, "%s: crc32c %08x out\n", options->command, checksum);
+    }
+    close_stream(ds);
+    report_throughput(options->command, throughput);
+    return SUCCESS;
+}
+
+// MARK: decode
+
+// Decoding runs on a thread of its own, a few blocks ahead of this thread,
+// which interleaves each block's channels into rows of float32 values (one row
+// per sample, with complex samples as I, Q pairs) in the sample writer's
+// buffers, which are written out on a thread of their own. Input files are
+// read ahead on their own threads as well.
+
+typedef struct DecodePipeline {
+    DataStream* ds;
+    unsigned long block_samples;
+    float** samples[PIPELINE_BLOCKS];
+    unsigned long num_samples[PIPELINE_BLOCKS];
+    unsigned long num_channels[PIPELINE_BLOCKS];
+    unsigned long num_decoded_blocks;
+    unsigned long num_written_blocks;
+    int is_done;
+    int status;
+    DecodeMonitor statistics;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} DecodePipeline;
+
+static void* decode_blocks(void* arg) {
+    DecodePipeline* pipeline = (DecodePipeline*)arg;
+    pin_to_stream_cpus(pipeline->ds);
+    while (1) {
+        pthread_mutex_lock(&pipeline->lock);
+        while (pipeline->num_decoded_blocks - pipeline->num_written_blocks == PIPELINE_BLOCKS) {
+            pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+        }
+        unsigned int slot = pipeline->num_decoded_blocks % PIPELINE_BLOCKS;
+        pthread_mutex_unlock(&pipeline->lock);
+
+        unsigned long decoded_before = (pipeline->statistics.channels != NULL) ?
+            pipeline->statistics.channels[0].num_decoded_samples : 0;
+        int status = decode_samples(pipeline->ds, pipeline->block_samples, &pipeline->samples[slot], &pipeline->statistics);
+        unsigned long num_samples = (pipeline->statistics.channels != NULL) ?
+            pipeline->statistics.channels[0].num_decoded_samples - decoded_before : 0;
+
+        pthread_mutex_lock(&pipeline->lock);
+        pipeline->num_samples[slot] = num_samples;
+        pipeline->num_channels[slot] = pipeline->statistics.decoded_channels;
+        if (num_samples > 0) { pipeline->num_decoded_blocks++; }
+        if (status != SUCCESS) {
+            pipeline->is_done = 1;
+            pipeline->status = status;
+        }
+        pthread_cond_broadcast(&pipeline->changed);
+        pthread_mutex_unlock(&pipeline->lock);
+        if (status != SUCCESS) { break; }
+    }
+    return NULL;
+}
+
+static int run_decode(const Options* options) {
+    Throughput throughput = { .start_seconds = now_seconds() };
+    DataStream* ds = open_input(options);
+    SinkOptions sink_options = init_sink_options();
+    sink_options.values_per_sample = (get_stream_data_type(ds) == ComplexData) ? 2 : 1;
+    sink_options.use_direct_io = options->use_direct_io;
+    sink_options.rotate_bytes = (unsigned long long)(options->rotate_megabytes * 1e6);
+    sink_options.rotate_seconds = options->rotate_seconds;
+    sink_options.cpu_list = options->cpu_list;
+    if (options->rotate_seconds > 0) {
+        // samples per second per channel, from the data rate
+        unsigned long long sample_bits = (unsigned long long)get_stream_bits_per_sample(ds)
+            * get_stream_num_channels(ds) * sink_options.values_per_sample;
+        if (get_stream_data_rate(ds) == 0 || sample_bits == 0) {
+            raise_exception("%s", get_error_message(UNKNOWN_DATA_RATE));
+        }
+        sink_options.samples_per_second = (unsigned long long)get_stream_data_rate(ds) * 1000000 / sample_bits;
+    }
+    SampleWriter* writer = open_sample_writer(options->output_path, &sink_options);
+    DecodePipeline pipeline = { ds, options->block_samples };
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.changed, NULL);
+    pthread_t decoder;
+    if (pthread_create(&decoder, NULL, decode_blocks, &pipeline) != 0) {
+        raise_exception("could not start the decoding thread.");
+    }
+
+    while (1) {
+        pthread_mutex_lock(&pipeline.lock);
+        while (pipeline.num_written_blocks == pipeline.num_decoded_blocks && !pipeline.is_done) {
+            pthread_cond_wait(&pipeline.changed, &pipeline.lock);
+        }
+        int has_block = (pipeline.num_written_blocks < pipeline.num_decoded_blocks);
+        unsigned int slot = pipeline.num_written_blocks % PIPELINE_BLOCKS;
+        // the decoder goes on to the next block meanwhile, so this one's
+        // counts are copied while it can't change them
+        unsigned long num_channels = pipeline.num_channels[slot];
+        unsigned long num_samples = pipeline.num_samples[slot];
+        pthread_mutex_unlock(&pipeline.lock);
+        if (!has_block) { break; }
+
+        int status = write_sample_block(writer, pipeline.samples[slot], num_channels, num_samples);
+        if (status != SUCCESS) { raise_exception("output could not be written. %s", get_error_message(status)); }
+        throughput.num_samples += num_samples * num_channels;
+        throughput.num_bytes_out += num_samples * num_channels * sink_options.values_per_sample * sizeof(float);
+
+        pthread_mutex_lock(&pipeline.lock);
+        pipeline.num_written_blocks++;
+        pthread_cond_broadcast(&pipeline.changed);
+        pthread_mutex_unlock(&pipeline.lock);
+    }
+    pthread_join(decoder, NULL);
+    SinkMetrics sink_metrics = get_sink_metrics(writer);
+    int status = close_sample_writer(writer);
+    if (status != SUCCESS) { raise_exception("output could not be written. %s", get_error_message(status)); }
+
+    if (pipeline.status != REACHED_END_OF_FILE && pipeline.status != REACHED_END_OF_BUFFER) {
+        raise_exception("could not decode samples. %s", get_error_message(pipeline.status));
+    }
+    throughput.num_bytes_in = get_stream_metrics(ds).num_bytes_read;
+    throughput.num_frames = get_stream_metrics(ds).num_decoded_frames;
+    fprintf(stderr, "decode: %lu frames lost, %lu inserted, %lu invalid skipped, %llu bytes discarded, "
+        "%lu waits on the writer\n", pipeline.statistics.num_lost_frames, pipeline.statistics.num_inserted_frames,
+        pipeline.statistics.num_skipped_frames, pipeline.statistics.num_discarded_bytes, sink_metrics.num_writer_stalls);
+    for (unsigned int i = 0; i < PIPELINE_BLOCKS; i++) {
+        for (unsigned long c = 0; pipeline.samples[i] != NULL && c < get_selected_channels(ds); c++) {
+            free(pipeline.samples[i][c]);
+        }
+        free(pipeline.samples[i]);
+    }
+    free(pipeline.statistics.channels);
+    pthread_mutex_destroy(&pipeline.lock);
+    pthread_cond_destroy(&pipeline.changed);
+    if (options->use_checksums) { report_checksums(options->command, ds); }
+    close_stream(ds);
+    report_throughput(options->command, throughput);
+    return SUCCESS;
+}
+
+// MARK: command line
+
+typedef struct Command {
+    const char* name;
+    int (*run)(const Options* options);
+    const char* description;
+} Command;
+
+static const Command commands[] = {
+    { "summary", run_summary, "print the format, threads, stations, time span and losses of a recording" },
+    { "index", run_index, "write the header fields of every frame as CSV" },
+    { "quality", run_quality, "write, as CSV, how many frames of each second are missing, flagged invalid,\n"
+        "           or all zero or constant, and the fraction fit to process" },
+    { "split", run_split, "write each thread's frames to <prefix>_<thread>.vdif (prefix from -o)" },
+    { "extract", run_extract, "copy the frames from -s seconds in, for -d seconds" },
+    { "decode", run_decode, "write decoded samples as rows of float32 values, one per channel, to files\n"
+        "           rotated every -r MB or -t seconds (numbered as out_0000.f32), with -D for direct I/O" },
+};
+static const unsigned int num_commands = sizeof(commands) / sizeof(Command);
+
+static void usage(const char* name) {
+    fprintf(stderr, "%s %s (%s)\n", program, version, verdate);
+    fprintf(stderr, "usage: %s <command> [-o output] [-f format designator] [-c channels] "
+        "[-b block samples] [-s start seconds] [-d duration seconds] [-r rotate MB] [-t rotate seconds] [-D] [-k] [-a CPU list] file...\n", name);
+    for (unsigned int i = 0; i < num_commands; i++) {
+        fprintf(stderr, "  %-8s %s\n", commands[i].name, commands[i].description);
+    }
+    fprintf(stderr, "output goes to stdout if -o is not given (or is -), and input files (not stdin) may be gzip compressed\n");
+    fprintf(stderr, "threads (and their buffers) are kept to the CPUs given by -a, as in -a 0-7,16-23\n");
+    fprintf(stderr, "-k prints CRC32C checksums of the frames read, by file and by thread, and of those written\n");
+    exit(EXIT_FAILURE);
+}
+
 int main(int argc, char** argv) {
-    // TODO get file input
-    // TODO flags for decode/read
-    // TODO stream file output
-}
\ No newline at end of file
+    if (argc < 3) { usage(argv[0]); }
+    Options options = { argv[1] };
+    options.block_samples = DEFAULT_BLOCK_SAMPLES;
+    options.duration = -1;
+    options.file_paths = calloc(argc, sizeof(char*));
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-") == 0) {
+            fprintf(stderr, "%s: recordings can't be read from stdin, so give their file paths\n", argv[0]);
+            usage(argv[0]);
+        }
+        if (argv[i][0] != '-') {
+            options.file_paths[options.num_files++] = argv[i];
+            continue;
+        }
+        if (strcmp(argv[i], "-D") == 0) {
+            options.use_direct_io = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "-k") == 0) {
+            options.use_checksums = 1;
+            continue;
+        }
+        if (i + 1 >= argc) { usage(argv[0]); }
+        if (strcmp(argv[i], "-o") == 0) {
+            options.output_path = argv[++i];
+        } else if (strcmp(argv[i], "-f") == 0) {
+            options.format_designator = argv[++i];
+        } else if (strcmp(argv[i], "-c") == 0) {
+            options.num_channels = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-b") == 0) {
+            options.block_samples = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-s") == 0) {
+            options.start_offset = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "-d") == 0) {
+            options.duration = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "-a") == 0) {
+            options.cpu_list = argv[++i];
+        } else if (strcmp(argv[i], "-r") == 0) {
+            options.rotate_megabytes = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "-t") == 0) {
+            options.rotate_seconds = strtod(argv[++i], NULL);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (options.num_files == 0 || options.block_samples == 0) { usage(argv[0]); }
+    for (unsigned int i = 0; i < num_commands; i++) {
+        if (strcmp(options.command, commands[i].name) == 0) {
+            int status = commands[i].run(&options);
+            free(options.file_paths);
+            return (status == SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    usage(argv[0]);
+}